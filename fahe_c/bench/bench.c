@@ -0,0 +1,556 @@
+/**
+ * @file bench.c
+ * @brief Standalone latency benchmark for FAHE1 and FAHE2, run by
+ * `make bench`.
+ *
+ * For every point of a lambda x m_max x alpha sweep the harness generates
+ * keys, warms up, and then times single encryptions and decryptions with
+ * the wall clock (CLOCK_MONOTONIC). Keygen is timed separately and is never
+ * part of the encryption or decryption samples.
+ *
+ * The output starts with the columns of
+ * fahe_py/analysis_tests/fahe*_alpha_performance_*.csv (means in ms, four
+ * decimals), so C and Python results can be compared directly, followed by
+ * percentiles and throughput.
+ *
+ * Usage: bench [-s 1|2|12] [-l LAMBDAS] [-m M_MAXES] [-a ALPHAS] [-r REPS]
+ *              [-w WARMUP] [-k KEYGEN_REPS] [-f csv|json] [-o FILE] [-L] [-A]
+ *              [-P]
+ *
+ * A list is either comma separated ("128,256") or a range "start:end:step"
+ * ("5:50:5"). -L times the original BIGNUM API (fahe1_encrypt, ...) instead
+ * of the encryption and decryption contexts. -A adds the heap allocations
+ * and bytes per timed encryption and decryption and the peak RSS; libc
+ * allocations are only counted in a -DFAHE_ALLOC_TRACK build. -P adds
+ * cycles, instructions, LLC misses and branch misses per encryption and
+ * decryption and per ciphertext limb, read from perf_event_open counters.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ * - alloc_track.h
+ * - bench_perf.h
+ * - bench_util.h
+ * - fahe1.h
+ * - fahe2.h
+ * - helper.h
+ * - logger.h
+ */
+
+#include <openssl/bn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc_track.h"
+#include "bench_perf.h"
+#include "bench_util.h"
+#include "fahe1.h"
+#include "fahe2.h"
+#include "helper.h"
+#include "logger.h"
+
+#define BENCH_MESSAGES 64
+
+typedef struct {
+  int schemes;  // bit 0: FAHE1, bit 1: FAHE2
+  bench_list lambdas;
+  bench_list m_maxes;
+  bench_list alphas;
+  int reps;
+  int warmup;
+  int keygen_reps;
+  int json;
+  int legacy;
+  int allocs;
+  const bench_perf *perf;  // NULL unless -P
+  const char *output;
+} bench_options;
+
+// A key of either scheme and the contexts built from it
+typedef struct {
+  int scheme;
+  fahe1_key k1;
+  fahe2_key k2;
+  void *enc_ctx;
+  void *dec_ctx;
+  BN_CTX *bn_ctx;
+} bench_key;
+
+typedef struct {
+  int scheme;
+  int lambda;
+  int m_max;
+  int alpha;
+  int rho;
+  int eta;
+  int gamma;
+  int reps;
+  double clength;
+  bench_summary keygen;
+  bench_summary encrypt;
+  bench_summary decrypt;
+  fahe_alloc_stats encrypt_allocs;
+  fahe_alloc_stats decrypt_allocs;
+  uint64_t encrypt_perf[BENCH_PERF_COUNT];
+  uint64_t decrypt_perf[BENCH_PERF_COUNT];
+} bench_result;
+
+static void bench_usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [-s 1|2|12] [-l LAMBDAS] [-m M_MAXES] [-a ALPHAS]\n"
+          "          [-r REPS] [-w WARMUP] [-k KEYGEN_REPS] [-f csv|json]\n"
+          "          [-o FILE] [-L] [-A] [-P]\n"
+          "Lists are \"128,256\" or \"start:end:step\". Defaults: -s 12 -l "
+          "128 -m 32 -a 5:50:5 -r 100 -w 10 -k 10 -f csv\n",
+          name);
+}
+
+static void bench_keygen(bench_key *bk, int scheme, int lambda, int m_max,
+                         int alpha) {
+  memset(bk, 0, sizeof(*bk));
+  bk->scheme = scheme;
+  if (scheme == 1) {
+    bk->k1 = fahe1_keygen(lambda, m_max, alpha);
+  } else {
+    bk->k2 = fahe2_keygen(lambda, m_max, alpha);
+  }
+}
+
+static void bench_key_free(bench_key *bk) {
+  if (bk->scheme == 1) {
+    fahe1_enc_ctx_free(bk->enc_ctx);
+    fahe1_dec_ctx_free(bk->dec_ctx);
+    BN_free(bk->k1.p);
+    BN_free(bk->k1.X);
+  } else {
+    fahe2_enc_ctx_free(bk->enc_ctx);
+    fahe2_dec_ctx_free(bk->dec_ctx);
+    BN_free(bk->k2.p);
+    BN_free(bk->k2.X);
+  }
+  BN_CTX_free(bk->bn_ctx);
+}
+
+static void bench_prepare(bench_key *bk, int legacy) {
+  if (legacy) {
+    bk->bn_ctx = BN_CTX_new();
+    if (!bk->bn_ctx) {
+      log_message(LOG_FATAL, "Memory allocation for BN_CTX failed\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (bk->scheme == 1) {
+    bk->enc_ctx = fahe1_enc_ctx_new(&bk->k1);
+    bk->dec_ctx = fahe1_dec_ctx_new(&bk->k1);
+  } else {
+    bk->enc_ctx = fahe2_enc_ctx_new(&bk->k2);
+    bk->dec_ctx = fahe2_dec_ctx_new(&bk->k2);
+  }
+}
+
+// Encrypts into *c. The legacy API allocates a fresh ciphertext, which is
+// part of its cost, so the previous one is freed outside the timed region.
+static void bench_encrypt(bench_key *bk, BIGNUM *m, BIGNUM **c, int legacy) {
+  if (!legacy) {
+    if (bk->scheme == 1) {
+      fahe1_encrypt_ctx(bk->enc_ctx, m, *c);
+    } else {
+      fahe2_encrypt_ctx(bk->enc_ctx, m, *c);
+    }
+  } else if (bk->scheme == 1) {
+    *c = fahe1_encrypt(bk->k1.p, bk->k1.X, bk->k1.rho, bk->k1.alpha, m);
+  } else {
+    *c = fahe2_encrypt(bk->k2, m, bk->bn_ctx);
+  }
+}
+
+static void bench_decrypt(bench_key *bk, BIGNUM *c, BIGNUM **m, int legacy) {
+  if (!legacy) {
+    if (bk->scheme == 1) {
+      fahe1_decrypt_ctx(bk->dec_ctx, c, *m);
+    } else {
+      fahe2_decrypt_ctx(bk->dec_ctx, c, *m);
+    }
+  } else if (bk->scheme == 1) {
+    *m = fahe1_decrypt(bk->k1.p, bk->k1.m_max, bk->k1.rho, bk->k1.alpha, c);
+  } else {
+    *m = fahe2_decrypt(bk->k2, c, bk->bn_ctx);
+  }
+}
+
+// Adds the allocations made since *mark to *total and moves the mark
+static void bench_track_allocs(fahe_alloc_stats *total, fahe_alloc_stats *mark,
+                               int counted) {
+  fahe_alloc_stats now, diff;
+  fahe_alloc_snapshot(&now);
+  fahe_alloc_diff(&diff, mark, &now);
+  if (counted) {
+    for (int s = 0; s < FAHE_ALLOC_SOURCE_COUNT; s++) {
+      total->sources[s].allocs += diff.sources[s].allocs;
+      total->sources[s].frees += diff.sources[s].frees;
+      total->sources[s].bytes += diff.sources[s].bytes;
+      total->sources[s].freed_bytes += diff.sources[s].freed_bytes;
+    }
+  }
+  total->peak_rss_kib = now.peak_rss_kib;
+  *mark = now;
+}
+
+static void bench_point(const bench_options *opt, int scheme, int lambda,
+                        int m_max, int alpha, bench_result *res) {
+  int n = opt->reps;
+  double *keygen = malloc(opt->keygen_reps * sizeof(double));
+  double *encrypt = malloc(n * sizeof(double));
+  double *decrypt = malloc(n * sizeof(double));
+  if (!keygen || !encrypt || !decrypt) {
+    log_message(LOG_FATAL, "Memory allocation for samples failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Keygen is timed on its own; the last key is used for the rest
+  bench_key bk;
+  for (int i = 0; i < opt->keygen_reps; i++) {
+    if (i > 0) {
+      bench_key_free(&bk);
+    }
+    uint64_t t0 = bench_now();
+    bench_keygen(&bk, scheme, lambda, m_max, alpha);
+    keygen[i] = (double)(bench_now() - t0);
+  }
+  bench_prepare(&bk, opt->legacy);
+
+  BIGNUM *messages[BENCH_MESSAGES];
+  for (int i = 0; i < BENCH_MESSAGES; i++) {
+    messages[i] = generate_big_message(m_max);
+  }
+  BIGNUM *c = BN_new();
+  BIGNUM *m = BN_new();
+  if (!c || !m) {
+    log_message(LOG_FATAL, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  double clength = 0;
+  fahe_alloc_stats mark;
+  memset(&res->encrypt_allocs, 0, sizeof(res->encrypt_allocs));
+  memset(&res->decrypt_allocs, 0, sizeof(res->decrypt_allocs));
+  memset(res->encrypt_perf, 0, sizeof(res->encrypt_perf));
+  memset(res->decrypt_perf, 0, sizeof(res->decrypt_perf));
+  uint64_t perf0[BENCH_PERF_COUNT], perf1[BENCH_PERF_COUNT];
+  for (int i = -opt->warmup; i < n; i++) {
+    BIGNUM *message = messages[(i + opt->warmup) % BENCH_MESSAGES];
+    if (opt->legacy) {
+      BN_free(c);
+      BN_free(m);
+    }
+
+    // Snapshots and counter reads are taken outside the timed regions
+    if (opt->allocs) {
+      fahe_alloc_snapshot(&mark);
+    }
+    if (opt->perf) {
+      bench_perf_read(opt->perf, perf0);
+    }
+    uint64_t t0 = bench_now();
+    bench_encrypt(&bk, message, &c, opt->legacy);
+    uint64_t t1 = bench_now();
+    if (opt->perf) {
+      bench_perf_read(opt->perf, perf1);
+      if (i >= 0) {
+        bench_perf_accumulate(res->encrypt_perf, perf0, perf1);
+      }
+    }
+    if (opt->allocs) {
+      bench_track_allocs(&res->encrypt_allocs, &mark, i >= 0);
+    }
+    if (opt->perf) {
+      bench_perf_read(opt->perf, perf0);
+    }
+    uint64_t t2 = bench_now();
+    bench_decrypt(&bk, c, &m, opt->legacy);
+    uint64_t t3 = bench_now();
+    if (opt->perf) {
+      bench_perf_read(opt->perf, perf1);
+      if (i >= 0) {
+        bench_perf_accumulate(res->decrypt_perf, perf0, perf1);
+      }
+    }
+    if (opt->allocs) {
+      bench_track_allocs(&res->decrypt_allocs, &mark, i >= 0);
+    }
+
+    if (BN_cmp(m, message) != 0) {
+      log_message(LOG_FATAL, "FAHE%d decryption failed at lambda %d, m_max "
+                  "%d, alpha %d\n", scheme, lambda, m_max, alpha);
+      exit(EXIT_FAILURE);
+    }
+    if (i >= 0) {
+      encrypt[i] = (double)(t1 - t0);
+      decrypt[i] = (double)(t3 - t2);
+      clength += BN_num_bits(c);
+    }
+  }
+
+  // gamma as in keygen, recovered from X = 2**gamma / p
+  const BIGNUM *p = scheme == 1 ? bk.k1.p : bk.k2.p;
+  const BIGNUM *X = scheme == 1 ? bk.k1.X : bk.k2.X;
+  res->scheme = scheme;
+  res->lambda = lambda;
+  res->m_max = m_max;
+  res->alpha = alpha;
+  res->rho = scheme == 1 ? bk.k1.rho : bk.k2.rho;
+  res->eta = BN_num_bits(p);
+  res->gamma = BN_num_bits(X) + res->eta - 1;
+  res->reps = n;
+  res->clength = n > 0 ? clength / n : 0;
+  res->keygen = bench_summarize(keygen, opt->keygen_reps);
+  res->encrypt = bench_summarize(encrypt, n);
+  res->decrypt = bench_summarize(decrypt, n);
+
+  for (int i = 0; i < BENCH_MESSAGES; i++) {
+    BN_free(messages[i]);
+  }
+  BN_free(c);
+  BN_free(m);
+  bench_key_free(&bk);
+  free(keygen);
+  free(encrypt);
+  free(decrypt);
+}
+
+static const char *bench_ops[] = {"keygen", "encryption", "decryption"};
+
+// Allocations (or bytes, if bytes is set) of all sources per operation
+static double bench_per_op(const fahe_alloc_stats *stats, int bytes, int reps) {
+  uint64_t total = 0;
+  for (int s = 0; s < FAHE_ALLOC_SOURCE_COUNT; s++) {
+    total += bytes ? stats->sources[s].bytes : stats->sources[s].allocs;
+  }
+  return reps > 0 ? (double)total / reps : 0;
+}
+
+// Counters per operation and per limb of the mean ciphertext length
+static void bench_write_perf(FILE *out, const bench_result *r,
+                             const bench_options *opt, int json) {
+  if (!opt->perf) {
+    return;
+  }
+  double limbs = r->clength / 64;
+  bench_perf_write(out, opt->perf, bench_ops[1], r->encrypt_perf, r->reps,
+                   limbs, json);
+  bench_perf_write(out, opt->perf, bench_ops[2], r->decrypt_perf, r->reps,
+                   limbs, json);
+}
+
+static void bench_write_csv_header(FILE *out, const bench_options *opt) {
+  fprintf(out, "alpha,rho,eta,gamma,keygen time/ms,encryption time/ms,"
+               "decryption time/ms,total time/ms,ciphertext length in bits,"
+               "lambda,m_max,scheme");
+  for (int i = 0; i < 3; i++) {
+    fprintf(out, ",%s p50/ms,%s p90/ms,%s p99/ms,%s max/ms,%s ops/s",
+            bench_ops[i], bench_ops[i], bench_ops[i], bench_ops[i],
+            bench_ops[i]);
+  }
+  if (opt->allocs) {
+    fprintf(out, ",encryption allocs/op,encryption bytes/op,"
+                 "decryption allocs/op,decryption bytes/op,peak RSS/KiB");
+  }
+  if (opt->perf) {
+    bench_perf_write_header(out, bench_ops[1]);
+    bench_perf_write_header(out, bench_ops[2]);
+  }
+  fprintf(out, "\n");
+}
+
+static void bench_write_csv(FILE *out, const bench_result *r,
+                            const bench_options *opt) {
+  const bench_summary *s[3] = {&r->keygen, &r->encrypt, &r->decrypt};
+  fprintf(out, "%d,%d,%d,%d,%.4f,%.4f,%.4f,%.4f,%.0f,%d,%d,%d", r->alpha,
+          r->rho, r->eta, r->gamma, s[0]->mean / 1e6, s[1]->mean / 1e6,
+          s[2]->mean / 1e6, (s[0]->mean + s[1]->mean + s[2]->mean) / 1e6,
+          r->clength, r->lambda, r->m_max, r->scheme);
+  for (int i = 0; i < 3; i++) {
+    fprintf(out, ",%.4f,%.4f,%.4f,%.4f,%.1f", s[i]->p50 / 1e6,
+            s[i]->p90 / 1e6, s[i]->p99 / 1e6, s[i]->max / 1e6,
+            s[i]->ops_per_sec);
+  }
+  if (opt->allocs) {
+    fprintf(out, ",%.2f,%.1f,%.2f,%.1f,%ld",
+            bench_per_op(&r->encrypt_allocs, 0, r->reps),
+            bench_per_op(&r->encrypt_allocs, 1, r->reps),
+            bench_per_op(&r->decrypt_allocs, 0, r->reps),
+            bench_per_op(&r->decrypt_allocs, 1, r->reps),
+            r->decrypt_allocs.peak_rss_kib);
+  }
+  bench_write_perf(out, r, opt, 0);
+  fprintf(out, "\n");
+}
+
+static void bench_write_json(FILE *out, const bench_result *r, int first,
+                             const bench_options *opt) {
+  const bench_summary *s[3] = {&r->keygen, &r->encrypt, &r->decrypt};
+  fprintf(out,
+          "%s  {\"alpha\": %d, \"rho\": %d, \"eta\": %d, \"gamma\": %d, "
+          "\"keygen time/ms\": %.4f, \"encryption time/ms\": %.4f, "
+          "\"decryption time/ms\": %.4f, \"total time/ms\": %.4f, "
+          "\"ciphertext length in bits\": %.0f, \"lambda\": %d, "
+          "\"m_max\": %d, \"scheme\": %d",
+          first ? "" : ",\n", r->alpha, r->rho, r->eta, r->gamma,
+          s[0]->mean / 1e6, s[1]->mean / 1e6, s[2]->mean / 1e6,
+          (s[0]->mean + s[1]->mean + s[2]->mean) / 1e6, r->clength, r->lambda,
+          r->m_max, r->scheme);
+  for (int i = 0; i < 3; i++) {
+    fprintf(out,
+            ", \"%s p50/ms\": %.4f, \"%s p90/ms\": %.4f, "
+            "\"%s p99/ms\": %.4f, \"%s max/ms\": %.4f, \"%s ops/s\": %.1f",
+            bench_ops[i], s[i]->p50 / 1e6, bench_ops[i], s[i]->p90 / 1e6,
+            bench_ops[i], s[i]->p99 / 1e6, bench_ops[i], s[i]->max / 1e6,
+            bench_ops[i], s[i]->ops_per_sec);
+  }
+  if (opt->allocs) {
+    fprintf(out,
+            ", \"encryption allocs/op\": %.2f, \"encryption bytes/op\": %.1f, "
+            "\"decryption allocs/op\": %.2f, \"decryption bytes/op\": %.1f, "
+            "\"peak RSS/KiB\": %ld",
+            bench_per_op(&r->encrypt_allocs, 0, r->reps),
+            bench_per_op(&r->encrypt_allocs, 1, r->reps),
+            bench_per_op(&r->decrypt_allocs, 0, r->reps),
+            bench_per_op(&r->decrypt_allocs, 1, r->reps),
+            r->decrypt_allocs.peak_rss_kib);
+  }
+  bench_write_perf(out, r, opt, 1);
+  fprintf(out, "}");
+}
+
+int main(int argc, char **argv) {
+  bench_options opt = {0};
+  opt.schemes = 3;
+  bench_parse_list("128", &opt.lambdas);
+  bench_parse_list("32", &opt.m_maxes);
+  bench_parse_list("5:50:5", &opt.alphas);
+  opt.reps = 100;
+  opt.warmup = 10;
+  opt.keygen_reps = 10;
+
+  bench_perf perf;
+  int use_perf = 0;
+  int c;
+  while ((c = getopt(argc, argv, "s:l:m:a:r:w:k:f:o:LAPh")) != -1) {
+    int ok = 1;
+    switch (c) {
+      case 's':
+        opt.schemes = (strchr(optarg, '1') ? 1 : 0) |
+                      (strchr(optarg, '2') ? 2 : 0);
+        ok = opt.schemes != 0;
+        break;
+      case 'l':
+        ok = bench_parse_list(optarg, &opt.lambdas);
+        break;
+      case 'm':
+        ok = bench_parse_list(optarg, &opt.m_maxes);
+        break;
+      case 'a':
+        ok = bench_parse_list(optarg, &opt.alphas);
+        break;
+      case 'r':
+        opt.reps = atoi(optarg);
+        ok = opt.reps > 0;
+        break;
+      case 'w':
+        opt.warmup = atoi(optarg);
+        ok = opt.warmup >= 0;
+        break;
+      case 'k':
+        opt.keygen_reps = atoi(optarg);
+        ok = opt.keygen_reps > 0;
+        break;
+      case 'f':
+        opt.json = strcmp(optarg, "json") == 0;
+        ok = opt.json || strcmp(optarg, "csv") == 0;
+        break;
+      case 'o':
+        opt.output = optarg;
+        break;
+      case 'L':
+        opt.legacy = 1;
+        break;
+      case 'A':
+        opt.allocs = 1;
+        break;
+      case 'P':
+        use_perf = 1;
+        break;
+      default:
+        ok = 0;
+        break;
+    }
+    if (!ok) {
+      bench_usage(argv[0]);
+      return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  // Nothing has called OpenSSL yet, so its allocator can still be replaced
+  if (opt.allocs && !fahe_alloc_track_install()) {
+    log_message(LOG_ERROR, "OpenSSL allocations cannot be counted\n");
+  }
+
+  // Columns stay in place, empty, when no counter can be opened
+  if (use_perf) {
+    bench_perf_open(&perf);
+    opt.perf = &perf;
+  }
+
+  FILE *out = stdout;
+  if (opt.output) {
+    out = fopen(opt.output, "w");
+    if (!out) {
+      log_message(LOG_FATAL, "Opening %s failed\n", opt.output);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (opt.json) {
+    fprintf(out, "[\n");
+  } else {
+    bench_write_csv_header(out, &opt);
+  }
+  int first = 1;
+  for (int scheme = 1; scheme <= 2; scheme++) {
+    if (!(opt.schemes & scheme)) {
+      continue;
+    }
+    for (int l = 0; l < opt.lambdas.count; l++) {
+      for (int mm = 0; mm < opt.m_maxes.count; mm++) {
+        for (int a = 0; a < opt.alphas.count; a++) {
+          bench_result res;
+          fprintf(stderr, "FAHE%d lambda = %d, m_max = %d, alpha = %d\n",
+                  scheme, opt.lambdas.values[l], opt.m_maxes.values[mm],
+                  opt.alphas.values[a]);
+          bench_point(&opt, scheme, opt.lambdas.values[l],
+                      opt.m_maxes.values[mm], opt.alphas.values[a], &res);
+          if (opt.json) {
+            bench_write_json(out, &res, first, &opt);
+          } else {
+            bench_write_csv(out, &res, &opt);
+          }
+          first = 0;
+          fflush(out);
+        }
+      }
+    }
+  }
+  if (opt.json) {
+    fprintf(out, "\n]\n");
+  }
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  if (opt.perf) {
+    bench_perf_close(&perf);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file bench_perf.c
+ * @brief Implementation of the benchmark hardware counters.
+ *
+ * Dependencies:
+ * - linux/perf_event.h
+ *
+ * Failures are reported on stderr, next to the progress of the harness,
+ * rather than through the library log, which is quiet by default.
+ *
+ * @see bench_perf.h for the documentation of the functions implemented here.
+ */
+
+#include "bench_perf.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const char *perf_names[BENCH_PERF_COUNT] = {
+    "cycles", "instructions", "LLC misses", "branch misses"};
+
+static const uint64_t perf_configs[BENCH_PERF_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+static int perf_event_open(struct perf_event_attr *attr, int group_fd) {
+  return (int)syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+int bench_perf_open(bench_perf *perf) {
+  perf->leader = -1;
+  perf->opened = 0;
+  int first_errno = 0;
+  for (int e = 0; e < BENCH_PERF_COUNT; e++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = perf_configs[e];
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.disabled = perf->leader < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    perf->fds[e] = perf_event_open(&attr, perf->leader);
+    if (perf->fds[e] < 0) {
+      if (!first_errno) {
+        first_errno = errno;
+      }
+      continue;
+    }
+    if (perf->leader < 0) {
+      perf->leader = perf->fds[e];
+    }
+    perf->opened++;
+  }
+
+  if (perf->opened == 0) {
+    fprintf(stderr, "perf_event_open failed: %s\n", strerror(first_errno));
+    return 0;
+  }
+  for (int e = 0; e < BENCH_PERF_COUNT; e++) {
+    if (perf->fds[e] < 0) {
+      fprintf(stderr, "Counter %s is not available\n", perf_names[e]);
+    }
+  }
+  ioctl(perf->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(perf->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return perf->opened;
+}
+
+void bench_perf_close(bench_perf *perf) {
+  for (int e = 0; e < BENCH_PERF_COUNT; e++) {
+    if (perf->fds[e] >= 0) {
+      close(perf->fds[e]);
+      perf->fds[e] = -1;
+    }
+  }
+  perf->leader = -1;
+  perf->opened = 0;
+}
+
+int bench_perf_read(const bench_perf *perf,
+                    uint64_t values[BENCH_PERF_COUNT]) {
+  memset(values, 0, BENCH_PERF_COUNT * sizeof(uint64_t));
+  if (perf->opened == 0) {
+    return 0;
+  }
+
+  // PERF_FORMAT_GROUP: the number of events, then their values in the
+  // order they joined the group
+  uint64_t buf[1 + BENCH_PERF_COUNT];
+  ssize_t want = (ssize_t)((1 + perf->opened) * sizeof(uint64_t));
+  if (read(perf->leader, buf, sizeof(buf)) < want) {
+    return 0;
+  }
+  int i = 1;
+  for (int e = 0; e < BENCH_PERF_COUNT; e++) {
+    if (perf->fds[e] >= 0) {
+      values[e] = buf[i++];
+    }
+  }
+  return 1;
+}
+
+void bench_perf_accumulate(uint64_t totals[BENCH_PERF_COUNT],
+                           const uint64_t before[BENCH_PERF_COUNT],
+                           const uint64_t after[BENCH_PERF_COUNT]) {
+  for (int e = 0; e < BENCH_PERF_COUNT; e++) {
+    totals[e] += after[e] - before[e];
+  }
+}
+
+void bench_perf_write_header(FILE *out, const char *label) {
+  const char *sep = label[0] ? " " : "";
+  for (int e = 0; e < BENCH_PERF_COUNT; e++) {
+    fprintf(out, ",%s%s%s/op", label, sep, perf_names[e]);
+  }
+  for (int e = 0; e < BENCH_PERF_COUNT; e++) {
+    fprintf(out, ",%s%s%s/limb", label, sep, perf_names[e]);
+  }
+}
+
+void bench_perf_write(FILE *out, const bench_perf *perf, const char *label,
+                      const uint64_t totals[BENCH_PERF_COUNT], int ops,
+                      double limbs, int json) {
+  for (int per_limb = 0; per_limb <= 1; per_limb++) {
+    for (int e = 0; e < BENCH_PERF_COUNT; e++) {
+      double value = ops > 0 ? (double)totals[e] / ops : 0;
+      if (per_limb) {
+        value = limbs > 0 ? value / limbs : 0;
+      }
+      const char *unit = per_limb ? "limb" : "op";
+      if (json) {
+        fprintf(out, ", \"%s%s%s/%s\": ", label, label[0] ? " " : "",
+                perf_names[e], unit);
+      } else {
+        fprintf(out, ",");
+      }
+      if (perf->fds[e] >= 0) {
+        fprintf(out, "%.2f", value);
+      } else if (json) {
+        fprintf(out, "null");
+      }
+    }
+  }
+}
@@ -0,0 +1,101 @@
+/**
+ * @file bench_perf.h
+ * @brief Header file for bench_perf.c, hardware performance counters for the
+ * benchmark harnesses.
+ *
+ * The counters are opened once with perf_event_open as a single group on
+ * the calling thread, counting user space only, and stay enabled. A
+ * harness reads the group before and after each measured operation and
+ * adds the difference to a running total. Counters the CPU or the kernel
+ * does not offer (in many VMs, or with perf_event_paranoid > 2) are left
+ * out and reported as empty columns.
+ *
+ * This file contains the following structs: bench_perf
+ *                and the following methods: bench_perf_open,
+ * bench_perf_close, bench_perf_read, bench_perf_accumulate,
+ * bench_perf_write_header, bench_perf_write
+ */
+
+#ifndef BENCH_PERF_H
+#define BENCH_PERF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Counted events: cycles, instructions, last-level cache misses and
+ * branch misses.
+ */
+typedef enum {
+  BENCH_PERF_CYCLES,
+  BENCH_PERF_INSTRUCTIONS,
+  BENCH_PERF_LLC_MISSES,
+  BENCH_PERF_BRANCH_MISSES,
+  BENCH_PERF_COUNT
+} bench_perf_event;
+
+/**
+ * @typedef bench_perf
+ * @brief An open counter group.
+ *
+ * fds holds one descriptor per event, -1 for events that could not be
+ * opened. The first open descriptor leads the group.
+ */
+typedef struct {
+  int fds[BENCH_PERF_COUNT];
+  int leader;
+  int opened;
+} bench_perf;
+
+/**
+ * @brief Opens and enables the counters on the calling thread.
+ *
+ * @return The number of events opened. 0 leaves every fd at -1.
+ */
+int bench_perf_open(bench_perf *perf);
+
+/**
+ * @brief Closes the counters. Safe on a group that opened nothing.
+ */
+void bench_perf_close(bench_perf *perf);
+
+/**
+ * @brief Reads the current value of every event with one read call.
+ *
+ * @param[out] values Event values, 0 for events that are not open.
+ *
+ * @return 1 on success, 0 if nothing is open or the read failed.
+ */
+int bench_perf_read(const bench_perf *perf, uint64_t values[BENCH_PERF_COUNT]);
+
+/**
+ * @brief Adds after - before to totals.
+ */
+void bench_perf_accumulate(uint64_t totals[BENCH_PERF_COUNT],
+                           const uint64_t before[BENCH_PERF_COUNT],
+                           const uint64_t after[BENCH_PERF_COUNT]);
+
+/**
+ * @brief Writes the CSV header of the counter columns of an operation: each
+ * event per operation, then each event per limb, all prefixed by label.
+ * An empty label writes the bare event names.
+ */
+void bench_perf_write_header(FILE *out, const char *label);
+
+/**
+ * @brief Writes the counter columns of an operation, each preceded by a
+ * comma. Events that are not open are written as empty CSV fields or JSON
+ * nulls.
+ *
+ * @param[in] label Operation name used for the JSON keys.
+ * @param[in] totals Event totals over ops operations.
+ * @param[in] ops Number of operations.
+ * @param[in] limbs Limbs of the operand per operation, for the per-limb
+ *                  columns.
+ * @param[in] json 1 to write JSON members, 0 for CSV fields.
+ */
+void bench_perf_write(FILE *out, const bench_perf *perf, const char *label,
+                      const uint64_t totals[BENCH_PERF_COUNT], int ops,
+                      double limbs, int json);
+
+#endif  // BENCH_PERF_H
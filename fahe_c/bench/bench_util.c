@@ -0,0 +1,77 @@
+/**
+ * @file bench_util.c
+ * @brief Implementation of the benchmark timing and statistics helpers.
+ *
+ * @see bench_util.h for the documentation of the functions implemented here.
+ */
+
+#include "bench_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+uint64_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int bench_parse_list(const char *text, bench_list *list) {
+  int start, end, step;
+  list->count = 0;
+  if (sscanf(text, "%d:%d:%d", &start, &end, &step) == 3) {
+    if (step <= 0 || end < start) {
+      return 0;
+    }
+    for (int v = start; v <= end && list->count < BENCH_MAX_LIST; v += step) {
+      list->values[list->count++] = v;
+    }
+    return list->count > 0;
+  }
+
+  const char *p = text;
+  while (*p && list->count < BENCH_MAX_LIST) {
+    char *next;
+    long v = strtol(p, &next, 10);
+    if (next == p || v <= 0) {
+      return 0;
+    }
+    list->values[list->count++] = (int)v;
+    p = *next == ',' ? next + 1 : next;
+  }
+  return list->count > 0 && *p == '\0';
+}
+
+static int bench_compare(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples
+static double bench_percentile(const double *sorted, int n, double p) {
+  int rank = (int)(p * n + 0.999999);
+  if (rank < 1) {
+    rank = 1;
+  }
+  return sorted[(rank > n ? n : rank) - 1];
+}
+
+bench_summary bench_summarize(double *samples, int n) {
+  bench_summary s = {0};
+  if (n == 0) {
+    return s;
+  }
+  qsort(samples, n, sizeof(double), bench_compare);
+  double total = 0;
+  for (int i = 0; i < n; i++) {
+    total += samples[i];
+  }
+  s.mean = total / n;
+  s.p50 = bench_percentile(samples, n, 0.50);
+  s.p90 = bench_percentile(samples, n, 0.90);
+  s.p99 = bench_percentile(samples, n, 0.99);
+  s.max = samples[n - 1];
+  s.ops_per_sec = total > 0 ? n * 1e9 / total : 0;
+  return s;
+}
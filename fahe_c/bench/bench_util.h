@@ -0,0 +1,62 @@
+/**
+ * @file bench_util.h
+ * @brief Header file for bench_util.c, timing and statistics shared by the
+ * benchmark harnesses.
+ *
+ * This file contains the following structs: bench_list, bench_summary
+ *                and the following methods: bench_now, bench_parse_list,
+ * bench_summarize
+ */
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdint.h>
+
+/**
+ * @brief Most values a bench_list holds.
+ */
+#define BENCH_MAX_LIST 64
+
+/**
+ * @typedef bench_list
+ * @brief A list of sweep values, e.g. the alphas to run.
+ */
+typedef struct {
+  int values[BENCH_MAX_LIST];
+  int count;
+} bench_list;
+
+/**
+ * @typedef bench_summary
+ * @brief Mean, percentiles, maximum and throughput of a set of samples, in
+ * the unit of the samples (ns for bench_now differences).
+ */
+typedef struct {
+  double mean;
+  double p50;
+  double p90;
+  double p99;
+  double max;
+  double ops_per_sec;
+} bench_summary;
+
+/**
+ * @brief Returns the CLOCK_MONOTONIC wall time in ns.
+ */
+uint64_t bench_now(void);
+
+/**
+ * @brief Parses "a,b,c" or "start:end:step" into a list of positive values.
+ *
+ * @return 1 on success, 0 on malformed input.
+ */
+int bench_parse_list(const char *text, bench_list *list);
+
+/**
+ * @brief Sorts samples in ns and summarizes them. Percentiles use the
+ * nearest-rank method.
+ */
+bench_summary bench_summarize(double *samples, int n);
+
+#endif  // BENCH_UTIL_H
@@ -0,0 +1,379 @@
+/**
+ * @file micro.c
+ * @brief Microbenchmarks of the big-integer kernels behind encryption and
+ * decryption, run by `make bench_micro`.
+ *
+ * Every kernel runs on operands of the sizes our parameter sets produce: a
+ * gamma-bit ciphertext, an eta-bit prime p and q < 2**gamma / p. The output
+ * is one CSV row per kernel and size with the median cost per 64-bit limb of
+ * the gamma-bit operand. A kernel whose ns/limb grows with gamma scales
+ * superlinearly; comparing rows across OpenSSL versions catches regressions.
+ *
+ * The OpenSSL kernels are listed next to the replacements this library uses
+ * for them (fahe_rng_limbs_below, limbs_mul_small_add, fahe_reduce,
+ * fahe_bn2dec, fahe_dec2bn), and the limb conversions that the limb paths
+ * add are timed on their own.
+ *
+ * Usage: micro [-g GAMMAS] [-e ETA] [-r MAX_REPS] [-t BUDGET_MS] [-k KERNELS]
+ *              [-P]
+ *
+ * GAMMAS is a list as in bench.c (default 32768:327680:32768). Each kernel
+ * runs until BUDGET_MS (default 20) has passed or MAX_REPS (default 200)
+ * samples are taken, with at least 3 samples. KERNELS is a comma-separated
+ * list of names to run, e.g. "BN_mul,BN_mod". -P adds cycles, instructions,
+ * LLC misses and branch misses per call and per limb, which separates the
+ * memory-bound kernels (BN_add, reduction) from the compute-bound ones.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ * - openssl/crypto.h
+ * - bench_perf.h
+ * - bench_util.h
+ * - limb.h
+ * - logger.h
+ * - radix.h
+ * - reduce.h
+ * - rng.h
+ */
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_perf.h"
+#include "bench_util.h"
+#include "limb.h"
+#include "logger.h"
+#include "radix.h"
+#include "reduce.h"
+#include "rng.h"
+
+#define MICRO_MIN_REPS 3
+#define MICRO_SHIFT 137
+
+// Operands for one gamma
+typedef struct {
+  BN_CTX *ctx;
+  BIGNUM *p;
+  BIGNUM *bound;  // X + 1, the exclusive bound of q
+  BIGNUM *q;
+  BIGNUM *n;
+  BIGNUM *M;
+  BIGNUM *c;
+  BIGNUM *r;
+  char *dec;
+  fahe_rng *rng;
+  fahe_reducer *reducer;
+  size_t p_limbs;
+  size_t q_limbs;
+  size_t c_limbs;
+  uint64_t *p_buf;
+  uint64_t *bound_buf;
+  uint64_t *q_buf;
+  uint64_t *M_buf;
+  uint64_t *c_buf;
+  uint64_t *out_buf;
+  size_t m_limbs;
+} micro_operands;
+
+typedef int (*micro_kernel_fn)(micro_operands *ops);
+
+typedef struct {
+  const char *name;
+  micro_kernel_fn fn;
+} micro_kernel;
+
+static int micro_bn_rand_range(micro_operands *o) {
+  return BN_rand_range(o->q, o->bound);
+}
+
+static int micro_rng_limbs_below(micro_operands *o) {
+  return fahe_rng_limbs_below(o->rng, o->q_buf, o->bound_buf, o->q_limbs);
+}
+
+static int micro_bn_mul(micro_operands *o) {
+  return BN_mul(o->n, o->p, o->q, o->ctx);
+}
+
+static int micro_limbs_mul_small_add(micro_operands *o) {
+  return limbs_mul_small_add(o->out_buf, o->q_buf, o->q_limbs, o->p_buf,
+                             o->p_limbs, o->M_buf, o->m_limbs) > 0;
+}
+
+static int micro_bn_add(micro_operands *o) {
+  return BN_add(o->r, o->n, o->M);
+}
+
+static int micro_bn_mod(micro_operands *o) {
+  return BN_mod(o->r, o->c, o->p, o->ctx);
+}
+
+static int micro_fahe_reduce(micro_operands *o) {
+  return fahe_reduce(o->reducer, o->r, o->c);
+}
+
+static int micro_bn_lshift(micro_operands *o) {
+  return BN_lshift(o->r, o->c, MICRO_SHIFT);
+}
+
+static int micro_bn_bn2dec(micro_operands *o) {
+  OPENSSL_free(o->dec);
+  o->dec = BN_bn2dec(o->c);
+  return o->dec != NULL;
+}
+
+static int micro_bn_dec2bn(micro_operands *o) {
+  return BN_dec2bn(&o->r, o->dec) > 0;
+}
+
+static int micro_fahe_bn2dec(micro_operands *o) {
+  OPENSSL_free(o->dec);
+  o->dec = fahe_bn2dec(o->c);
+  return o->dec != NULL;
+}
+
+static int micro_fahe_dec2bn(micro_operands *o) {
+  return fahe_dec2bn(o->r, o->dec, strlen(o->dec));
+}
+
+static int micro_limbs_to_bn(micro_operands *o) {
+  return limbs_to_bn(o->c_buf, o->c_limbs, o->r);
+}
+
+static int micro_limbs_from_bn(micro_operands *o) {
+  return limbs_from_bn(o->c, o->out_buf, o->c_limbs);
+}
+
+static const micro_kernel micro_kernels[] = {
+    {"BN_rand_range", micro_bn_rand_range},
+    {"fahe_rng_limbs_below", micro_rng_limbs_below},
+    {"BN_mul", micro_bn_mul},
+    {"limbs_mul_small_add", micro_limbs_mul_small_add},
+    {"BN_add", micro_bn_add},
+    {"BN_mod", micro_bn_mod},
+    {"fahe_reduce", micro_fahe_reduce},
+    {"BN_lshift", micro_bn_lshift},
+    {"BN_bn2dec", micro_bn_bn2dec},
+    {"fahe_bn2dec", micro_fahe_bn2dec},
+    {"BN_dec2bn", micro_bn_dec2bn},
+    {"fahe_dec2bn", micro_fahe_dec2bn},
+    {"limbs_to_bn", micro_limbs_to_bn},
+    {"limbs_from_bn", micro_limbs_from_bn},
+};
+
+static uint64_t *micro_limbs(const BIGNUM *bn, size_t num_limbs) {
+  uint64_t *limbs = calloc(num_limbs + 1, sizeof(uint64_t));
+  if (!limbs || !limbs_from_bn(bn, limbs, num_limbs)) {
+    log_message(LOG_FATAL, "Exporting limbs failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return limbs;
+}
+
+// Builds p, X + 1, q, M and c = p * q + M as encryption would for gamma
+static void micro_setup(micro_operands *o, int gamma, int eta) {
+  memset(o, 0, sizeof(*o));
+  o->ctx = BN_CTX_new();
+  o->p = BN_new();
+  o->bound = BN_new();
+  o->q = BN_new();
+  o->n = BN_new();
+  o->M = BN_new();
+  o->c = BN_new();
+  o->r = BN_new();
+  o->rng = fahe_rng_new(FAHE_RNG_DEFAULT);
+  BIGNUM *pow = BN_new();
+  if (!o->ctx || !o->p || !o->bound || !o->q || !o->n || !o->M || !o->c ||
+      !o->r || !o->rng || !pow) {
+    log_message(LOG_FATAL, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!BN_generate_prime_ex(o->p, eta, 0, NULL, NULL, NULL) ||
+      !BN_set_bit(pow, gamma) || !BN_div(o->bound, NULL, pow, o->p, o->ctx) ||
+      !BN_add_word(o->bound, 1) || !BN_rand_range(o->q, o->bound) ||
+      !BN_rand(o->M, eta - 1, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY) ||
+      !BN_mul(o->n, o->p, o->q, o->ctx) || !BN_add(o->c, o->n, o->M)) {
+    log_message(LOG_FATAL, "Building the operands failed\n");
+    exit(EXIT_FAILURE);
+  }
+  BN_free(pow);
+
+  o->p_limbs = FAHE_LIMBS(BN_num_bits(o->p));
+  o->q_limbs = FAHE_LIMBS(BN_num_bits(o->bound));
+  o->m_limbs = FAHE_LIMBS(BN_num_bits(o->M));
+  o->c_limbs = FAHE_LIMBS(gamma + 1);
+  o->p_buf = micro_limbs(o->p, o->p_limbs);
+  o->bound_buf = micro_limbs(o->bound, o->q_limbs);
+  o->q_buf = micro_limbs(o->q, o->q_limbs);
+  o->M_buf = micro_limbs(o->M, o->m_limbs);
+  o->c_buf = micro_limbs(o->c, o->c_limbs);
+  o->out_buf = calloc(o->c_limbs + 2, sizeof(uint64_t));
+  o->reducer = fahe_reducer_new(o->p, gamma + 1);
+  o->dec = BN_bn2dec(o->c);
+  if (!o->out_buf || !o->dec) {
+    log_message(LOG_FATAL, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void micro_teardown(micro_operands *o) {
+  BN_CTX_free(o->ctx);
+  BN_free(o->p);
+  BN_free(o->bound);
+  BN_free(o->q);
+  BN_free(o->n);
+  BN_free(o->M);
+  BN_free(o->c);
+  BN_free(o->r);
+  OPENSSL_free(o->dec);
+  fahe_rng_free(o->rng);
+  fahe_reducer_free(o->reducer);
+  free(o->p_buf);
+  free(o->bound_buf);
+  free(o->q_buf);
+  free(o->M_buf);
+  free(o->c_buf);
+  free(o->out_buf);
+}
+
+// Whether name is one of the comma-separated names in filter
+static int micro_selected(const char *filter, const char *name) {
+  if (!filter) {
+    return 1;
+  }
+  size_t len = strlen(name);
+  for (const char *p = filter; (p = strstr(p, name)) != NULL; p += len) {
+    if ((p == filter || p[-1] == ',') && (p[len] == ',' || p[len] == '\0')) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  bench_list gammas;
+  bench_parse_list("32768:327680:32768", &gammas);
+  int eta = 200;
+  int max_reps = 200;
+  double budget_ns = 20e6;
+  const char *filter = NULL;
+  int use_perf = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "g:e:r:t:k:Ph")) != -1) {
+    int ok = 1;
+    switch (opt) {
+      case 'g':
+        ok = bench_parse_list(optarg, &gammas);
+        break;
+      case 'e':
+        eta = atoi(optarg);
+        ok = eta > 1;
+        break;
+      case 'r':
+        max_reps = atoi(optarg);
+        ok = max_reps >= MICRO_MIN_REPS;
+        break;
+      case 't':
+        budget_ns = atof(optarg) * 1e6;
+        ok = budget_ns > 0;
+        break;
+      case 'k':
+        filter = optarg;
+        break;
+      case 'P':
+        use_perf = 1;
+        break;
+      default:
+        ok = 0;
+        break;
+    }
+    if (!ok) {
+      fprintf(stderr,
+              "Usage: %s [-g GAMMAS] [-e ETA] [-r MAX_REPS] [-t BUDGET_MS] "
+              "[-k KERNELS] [-P]\n",
+              argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  double *samples = malloc(max_reps * sizeof(double));
+  if (!samples) {
+    log_message(LOG_FATAL, "Memory allocation for samples failed\n");
+    return EXIT_FAILURE;
+  }
+
+  bench_perf perf;
+  if (use_perf) {
+    bench_perf_open(&perf);
+  }
+  uint64_t perf0[BENCH_PERF_COUNT], perf1[BENCH_PERF_COUNT];
+  uint64_t perf_totals[BENCH_PERF_COUNT];
+
+  printf("kernel,gamma bits,limbs,reps,mean/ns,p50/ns,p99/ns,ns per limb");
+  if (use_perf) {
+    bench_perf_write_header(stdout, "");
+  }
+  printf("\n");
+  size_t num_kernels = sizeof(micro_kernels) / sizeof(micro_kernels[0]);
+  for (int g = 0; g < gammas.count; g++) {
+    int gamma = gammas.values[g];
+    if (gamma <= 2 * eta) {
+      log_message(LOG_ERROR, "gamma %d must exceed 2 * eta\n", gamma);
+      continue;
+    }
+    micro_operands ops;
+    micro_setup(&ops, gamma, eta);
+
+    for (size_t k = 0; k < num_kernels; k++) {
+      if (!micro_selected(filter, micro_kernels[k].name)) {
+        continue;
+      }
+      // One untimed call warms caches and any lazily built tables
+      micro_kernels[k].fn(&ops);
+
+      int n = 0;
+      double spent = 0;
+      memset(perf_totals, 0, sizeof(perf_totals));
+      while (n < max_reps && (n < MICRO_MIN_REPS || spent < budget_ns)) {
+        if (use_perf) {
+          bench_perf_read(&perf, perf0);
+        }
+        uint64_t t0 = bench_now();
+        int ok = micro_kernels[k].fn(&ops);
+        samples[n] = (double)(bench_now() - t0);
+        if (use_perf) {
+          bench_perf_read(&perf, perf1);
+          bench_perf_accumulate(perf_totals, perf0, perf1);
+        }
+        if (!ok) {
+          log_message(LOG_FATAL, "%s failed\n", micro_kernels[k].name);
+          return EXIT_FAILURE;
+        }
+        spent += samples[n++];
+      }
+
+      bench_summary s = bench_summarize(samples, n);
+      printf("%s,%d,%zu,%d,%.1f,%.1f,%.1f,%.3f", micro_kernels[k].name, gamma,
+             ops.c_limbs, n, s.mean, s.p50, s.p99, s.p50 / ops.c_limbs);
+      if (use_perf) {
+        bench_perf_write(stdout, &perf, "", perf_totals, n,
+                         (double)ops.c_limbs, 0);
+      }
+      printf("\n");
+      fflush(stdout);
+    }
+    micro_teardown(&ops);
+  }
+
+  free(samples);
+  if (use_perf) {
+    bench_perf_close(&perf);
+  }
+  return EXIT_SUCCESS;
+}
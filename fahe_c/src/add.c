@@ -0,0 +1,313 @@
+/**
+ * @file add.c
+ * @brief Implementation of homomorphic addition of ciphertexts.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ * - helper.h
+ * - limb.h
+ * - logger.h
+ * - metrics.h
+ * - thread_pool.h
+ *
+ * @see add.h for the documentation of the functions implemented here.
+ */
+
+#include "add.h"
+
+#include <openssl/bn.h>
+#include <stdlib.h>
+
+#include "helper.h"
+#include "limb.h"
+#include "logger.h"
+#include "metrics.h"
+#include "thread_pool.h"
+
+// ceil(log2(n)) for n >= 1
+static int ceil_log2(uint64_t n) {
+  return n <= 1 ? 0 : 64 - __builtin_clzll(n - 1);
+}
+
+fahe_acc *fahe_acc_new(int gamma_bits, const BIGNUM *num_additions) {
+  if (!num_additions || BN_is_zero(num_additions) ||
+      BN_is_negative(num_additions)) {
+    log_message(LOG_FATAL, "num_additions must be positive\n");
+    exit(EXIT_FAILURE);
+  }
+
+  fahe_acc *acc = (fahe_acc *)malloc(sizeof(fahe_acc));
+  if (!acc) {
+    log_message(LOG_FATAL, "Memory allocation for fahe_acc failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  BN_ULONG max_additions = BN_get_word(num_additions);
+  acc->max_additions = BN_num_bits(num_additions) > 64
+                           ? UINT64_MAX
+                           : (uint64_t)max_additions;
+  acc->count = 0;
+  acc->reserve_bits = gamma_bits + ceil_log2(acc->max_additions);
+  acc->sum = BN_new();
+  if (!acc->sum || !bn_reserve_bits(acc->sum, acc->reserve_bits)) {
+    log_message(LOG_FATAL, "Memory allocation for the sum failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return acc;
+}
+
+void fahe_acc_free(fahe_acc *acc) {
+  if (!acc) {
+    return;
+  }
+  BN_free(acc->sum);
+  free(acc);
+}
+
+void fahe_acc_reset(fahe_acc *acc) {
+  BN_zero(acc->sum);
+  acc->count = 0;
+}
+
+int fahe_add_inplace(fahe_acc *acc, const BIGNUM *ciphertext) {
+  uint64_t t_metrics = fahe_metrics_start();
+  if (acc->count >= acc->max_additions) {
+    log_message(LOG_ERROR, "Accumulator already holds %llu ciphertexts\n",
+                (unsigned long long)acc->count);
+    fahe_metrics_fail(FAHE_OP_ADD, 0);
+    return 0;
+  }
+  if (!BN_add(acc->sum, acc->sum, ciphertext)) {
+    log_message(LOG_ERROR, "BN_add failed\n");
+    fahe_metrics_fail(FAHE_OP_ADD, 0);
+    return 0;
+  }
+  acc->count++;
+  fahe_metrics_record(FAHE_OP_ADD, 0, t_metrics, 1, BN_num_bytes(ciphertext));
+  return 1;
+}
+
+BIGNUM *fahe_add(BIGNUM *r, const BIGNUM *a, const BIGNUM *b) {
+  uint64_t t_metrics = fahe_metrics_start();
+  BIGNUM *sum = r;
+  if (!sum) {
+    int bits = BN_num_bits(a) > BN_num_bits(b) ? BN_num_bits(a)
+                                                : BN_num_bits(b);
+    sum = BN_new();
+    if (!sum || !bn_reserve_bits(sum, bits + 1)) {
+      log_message(LOG_FATAL, "Memory allocation for the sum failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (!BN_add(sum, a, b)) {
+    log_message(LOG_FATAL, "BN_add failed\n");
+    exit(EXIT_FAILURE);
+  }
+  fahe_metrics_record(FAHE_OP_ADD, 0, t_metrics, 2,
+                      BN_num_bytes(a) + BN_num_bytes(b));
+  return sum;
+}
+
+BIGNUM *fahe_sum(BIGNUM **list, size_t n) {
+  uint64_t t_metrics = fahe_metrics_start();
+  int max_bits = 0;
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (BN_num_bits(list[i]) > max_bits) {
+      max_bits = BN_num_bits(list[i]);
+    }
+    bytes += BN_num_bytes(list[i]);
+  }
+
+  BIGNUM *sum = BN_new();
+  if (!sum || !bn_reserve_bits(sum, max_bits + ceil_log2(n))) {
+    log_message(LOG_FATAL, "Memory allocation for the sum failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    if (!BN_add(sum, sum, list[i])) {
+      log_message(LOG_FATAL, "BN_add failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  fahe_metrics_record(FAHE_OP_ADD, 0, t_metrics, n, bytes);
+  return sum;
+}
+
+// Clamps a requested block count to [1, n]; <= 0 means one per thread of
+// the shared pool
+static int sum_num_threads(int num_threads, size_t n) {
+  if (num_threads <= 0) {
+    num_threads = fahe_thread_pool_shared()->num_threads;
+  }
+  if ((size_t)num_threads > n) {
+    num_threads = n > 0 ? (int)n : 1;
+  }
+  return num_threads;
+}
+
+typedef struct {
+  BIGNUM **list;
+  size_t begin;
+  size_t end;
+  BIGNUM *sum;
+} sum_bn_job;
+
+static void sum_bn_task(void *arg, size_t begin, size_t end,
+                        fahe_worker *worker) {
+  (void)worker;
+  sum_bn_job *jobs = (sum_bn_job *)arg;
+  for (size_t i = begin; i < end; i++) {
+    jobs[i].sum = fahe_sum(jobs[i].list + jobs[i].begin,
+                           jobs[i].end - jobs[i].begin);
+  }
+}
+
+BIGNUM *fahe_sum_parallel(BIGNUM **list, size_t n, int num_threads) {
+  int t = sum_num_threads(num_threads, n);
+  if (t == 1) {
+    return fahe_sum(list, n);
+  }
+
+  sum_bn_job *jobs = malloc(t * sizeof(sum_bn_job));
+  if (!jobs) {
+    log_message(LOG_FATAL, "Memory allocation for sum jobs failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // One contiguous block per job, summed on the shared pool
+  for (int i = 0; i < t; i++) {
+    jobs[i].list = list;
+    jobs[i].begin = n * i / t;
+    jobs[i].end = n * (i + 1) / t;
+  }
+  fahe_thread_pool_run(fahe_thread_pool_shared(), t, 1, sum_bn_task, jobs);
+
+  // Pairwise combine: after the pass with step s, jobs[i] for i % 2s == 0
+  // holds the sum of blocks i .. i + 2s - 1
+  for (int step = 1; step < t; step *= 2) {
+    for (int i = 0; i + step < t; i += 2 * step) {
+      if (!BN_add(jobs[i].sum, jobs[i].sum, jobs[i + step].sum)) {
+        log_message(LOG_FATAL, "BN_add failed\n");
+        exit(EXIT_FAILURE);
+      }
+      BN_free(jobs[i + step].sum);
+    }
+  }
+
+  BIGNUM *sum = jobs[0].sum;
+  free(jobs);
+  return sum;
+}
+
+typedef struct {
+  const uint64_t *rows;
+  size_t begin;
+  size_t end;
+  size_t row_limbs;
+  size_t row_stride;
+  uint64_t *lo;
+  uint64_t *hi;
+} sum_limbs_job;
+
+static void sum_limbs_block(sum_limbs_job *job) {
+  uint64_t *lo = job->lo;
+  uint64_t *hi = job->hi;
+
+  // Column j accumulates hi[j] * 2**64 + lo[j] across all rows of the block
+  for (size_t c0 = 0; c0 < job->row_limbs; c0 += FAHE_SUM_BLOCK_LIMBS) {
+    size_t c1 = c0 + FAHE_SUM_BLOCK_LIMBS < job->row_limbs
+                    ? c0 + FAHE_SUM_BLOCK_LIMBS
+                    : job->row_limbs;
+    for (size_t i = job->begin; i < job->end; i++) {
+      const uint64_t *row = job->rows + i * job->row_stride;
+      for (size_t j = c0; j < c1; j++) {
+        uint64_t s = lo[j] + row[j];
+        hi[j] += s < row[j];
+        lo[j] = s;
+      }
+    }
+  }
+}
+
+static void sum_limbs_task(void *arg, size_t begin, size_t end,
+                           fahe_worker *worker) {
+  (void)worker;
+  sum_limbs_job *jobs = (sum_limbs_job *)arg;
+  for (size_t i = begin; i < end; i++) {
+    sum_limbs_block(&jobs[i]);
+  }
+}
+
+int fahe_sum_limbs_parallel(const uint64_t *rows, size_t num_rows,
+                            size_t row_limbs, size_t row_stride, uint64_t *out,
+                            size_t out_limbs, int num_threads) {
+  uint64_t t_metrics = fahe_metrics_start();
+  if (row_stride < row_limbs || out_limbs < row_limbs + 2) {
+    log_message(LOG_ERROR, "Invalid row layout or output size for the sum\n");
+    fahe_metrics_fail(FAHE_OP_ADD, 0);
+    return 0;
+  }
+
+  int t = sum_num_threads(num_threads, num_rows);
+  sum_limbs_job *jobs = malloc(t * sizeof(sum_limbs_job));
+  uint64_t *columns = calloc(2 * (size_t)t * row_limbs + 1, sizeof(uint64_t));
+  if (!jobs || !columns) {
+    free(jobs);
+    free(columns);
+    log_message(LOG_ERROR, "Memory allocation for sum jobs failed\n");
+    fahe_metrics_fail(FAHE_OP_ADD, 0);
+    return 0;
+  }
+
+  for (int i = 0; i < t; i++) {
+    jobs[i].rows = rows;
+    jobs[i].begin = num_rows * i / t;
+    jobs[i].end = num_rows * (i + 1) / t;
+    jobs[i].row_limbs = row_limbs;
+    jobs[i].row_stride = row_stride;
+    jobs[i].lo = columns + 2 * i * row_limbs;
+    jobs[i].hi = jobs[i].lo + row_limbs;
+  }
+  fahe_thread_pool_run(fahe_thread_pool_shared(), t, 1, sum_limbs_task,
+                       jobs);
+
+  // Pairwise combine of the 128-bit columns
+  for (int step = 1; step < t; step *= 2) {
+    for (int i = 0; i + step < t; i += 2 * step) {
+      sum_limbs_job *dst = &jobs[i], *src = &jobs[i + step];
+      for (size_t j = 0; j < row_limbs; j++) {
+        uint64_t s = dst->lo[j] + src->lo[j];
+        dst->hi[j] += src->hi[j] + (s < src->lo[j]);
+        dst->lo[j] = s;
+      }
+    }
+  }
+
+  // out = sum_j (lo[j] + hi[j] * 2**64) * 2**(64 * j)
+  unsigned __int128 carry = 0;
+  for (size_t j = 0; j < out_limbs; j++) {
+    if (j < row_limbs) {
+      carry += jobs[0].lo[j];
+    }
+    if (j >= 1 && j - 1 < row_limbs) {
+      carry += jobs[0].hi[j - 1];
+    }
+    out[j] = (uint64_t)carry;
+    carry >>= 64;
+  }
+
+  free(columns);
+  free(jobs);
+  if (fahe_metrics_enabled()) {
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < num_rows; i++) {
+      bytes += (limbs_num_bits(rows + i * row_stride, row_limbs) + 7) / 8;
+    }
+    fahe_metrics_record(FAHE_OP_ADD, 0, t_metrics, num_rows, bytes);
+  }
+  return 1;
+}
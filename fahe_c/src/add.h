@@ -0,0 +1,166 @@
+/**
+ * @file add.h
+ * @brief Header file for add.c, homomorphic addition of FAHE1 and FAHE2
+ * ciphertexts.
+ *
+ * Both schemes are additive over the integers: the sum of ciphertexts
+ * decrypts to the sum of the messages as long as at most num_additions
+ * ciphertexts are added. This file contains the following structs: fahe_acc
+ *                and the following methods: fahe_acc_new, fahe_acc_free,
+ * fahe_acc_reset, fahe_add_inplace, fahe_add, fahe_sum, fahe_sum_parallel,
+ * fahe_sum_limbs_parallel
+ */
+
+#ifndef ADD_H
+#define ADD_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Column strip, in limbs, that fahe_sum_limbs_parallel sums over all
+ * of a thread's rows before moving on. Its 128-bit column accumulators take
+ * 16 KiB and stay in L1 while the rows stream past.
+ */
+#define FAHE_SUM_BLOCK_LIMBS 1024
+
+/**
+ * @typedef fahe_acc
+ * @brief A running sum of ciphertexts.
+ *
+ * The sum of n gamma-bit ciphertexts needs gamma + ceil(log2(n)) bits. The
+ * accumulator reserves that much for n = num_additions when it is created,
+ * so adding never reallocates. It also counts the ciphertexts added and
+ * refuses to go past num_additions, where the message bits of the sum would
+ * overflow into the noise and decryption would no longer be correct.
+ */
+
+/**
+ * @struct fahe_acc
+ *
+ * @var fahe_acc: sum (BIGNUM*)
+ * The running sum of the ciphertexts added.
+ *
+ * @var fahe_acc: count (uint64_t)
+ * Number of ciphertexts in sum.
+ *
+ * @var fahe_acc: max_additions (uint64_t)
+ * num_additions of the key, capped to UINT64_MAX.
+ *
+ * @var fahe_acc: reserve_bits (int)
+ * gamma + ceil(log2(num_additions)), the size sum is reserved for.
+ */
+typedef struct {
+  BIGNUM *sum;
+  uint64_t count;
+  uint64_t max_additions;
+  int reserve_bits;
+} fahe_acc;
+
+/**
+ * @brief Creates an empty accumulator.
+ *
+ * @param[in] gamma_bits Bit length bound of a single ciphertext, e.g. the
+ *                       gamma_bits of an encryption context.
+ * @param[in] num_additions The key's num_additions. Must be >= 1.
+ *
+ * @return The initialized accumulator, holding 0. Free with fahe_acc_free.
+ */
+fahe_acc *fahe_acc_new(int gamma_bits, const BIGNUM *num_additions);
+
+/**
+ * @brief Frees an accumulator created by fahe_acc_new.
+ *
+ * @param[in] acc The accumulator to free. NULL is ignored.
+ */
+void fahe_acc_free(fahe_acc *acc);
+
+/**
+ * @brief Resets an accumulator to 0 additions, keeping its storage.
+ *
+ * @param[in] acc The accumulator to reset.
+ */
+void fahe_acc_reset(fahe_acc *acc);
+
+/**
+ * @brief Adds a ciphertext to an accumulator in place.
+ *
+ * @param[in,out] acc The accumulator. @see fahe_acc struct
+ * @param[in] ciphertext The FAHE1 or FAHE2 ciphertext to add.
+ *
+ * @return 1 on success. 0, with acc unchanged, on failure or when acc
+ *         already holds num_additions ciphertexts.
+ */
+int fahe_add_inplace(fahe_acc *acc, const BIGNUM *ciphertext);
+
+/**
+ * @brief Adds two ciphertexts, r = a + b.
+ *
+ * @param[out] r Where to store the result. May alias a or b. If NULL, a new
+ *               BIGNUM reserved for the result is allocated.
+ * @param[in] a The first ciphertext.
+ * @param[in] b The second ciphertext.
+ *
+ * @return r, or the newly allocated BIGNUM if r was NULL.
+ */
+BIGNUM *fahe_add(BIGNUM *r, const BIGNUM *a, const BIGNUM *b);
+
+/**
+ * @brief Sums a list of ciphertexts.
+ *
+ * The result is reserved for max_bits + ceil(log2(n)) bits before the first
+ * addition, where max_bits is the length of the longest input, so the sum
+ * never reallocates.
+ *
+ * @param[in] list The ciphertexts to add.
+ * @param[in] n Number of ciphertexts in list.
+ *
+ * @return A new BIGNUM holding the sum, 0 if n is 0.
+ */
+BIGNUM *fahe_sum(BIGNUM **list, size_t n);
+
+/**
+ * @brief Sums a list of ciphertexts on several threads.
+ *
+ * The list is split into num_threads contiguous blocks, which the shared
+ * thread pool sums with fahe_sum. The partial sums are combined pairwise.
+ * Integer addition is exact, so the result does not depend on num_threads.
+ *
+ * @param[in] list The ciphertexts to add, e.g. from fahe1_encrypt_list.
+ * @param[in] n Number of ciphertexts in list.
+ * @param[in] num_threads Blocks to split the work into. <= 0 uses one per
+ *                        thread of fahe_thread_pool_shared.
+ *
+ * @return A new BIGNUM holding the sum.
+ */
+BIGNUM *fahe_sum_parallel(BIGNUM **list, size_t n, int num_threads);
+
+/**
+ * @brief Sums ciphertexts stored as contiguous limb rows on several threads.
+ *
+ * Row i starts at rows + i * row_stride and holds row_limbs little-endian
+ * limbs. The rows are split into num_threads blocks that run on the shared
+ * thread pool. Each block of rows is added into its own 128-bit column
+ * accumulators, FAHE_SUM_BLOCK_LIMBS columns at a time, so there is no carry
+ * chain in the inner loop. The per-block columns are merged pairwise and
+ * carried into out once at the end. The result does not depend on
+ * num_threads.
+ *
+ * @param[in] rows The first row.
+ * @param[in] num_rows Number of rows.
+ * @param[in] row_limbs Limbs per row.
+ * @param[in] row_stride Distance between rows in limbs. Must be >=
+ *                       row_limbs.
+ * @param[out] out The sum. Limbs above the sum are cleared.
+ * @param[in] out_limbs Size of out. Must be >= row_limbs + 2.
+ * @param[in] num_threads Blocks to split the work into. <= 0 uses one per
+ *                        thread of fahe_thread_pool_shared.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_sum_limbs_parallel(const uint64_t *rows, size_t num_rows,
+                            size_t row_limbs, size_t row_stride, uint64_t *out,
+                            size_t out_limbs, int num_threads);
+
+#endif  // ADD_H
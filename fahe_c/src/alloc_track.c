@@ -0,0 +1,224 @@
+/**
+ * @file alloc_track.c
+ * @brief Implementation of the allocation counters.
+ *
+ * Counters live in initial-exec thread-local storage, so updating them
+ * never calls back into malloc. With -DFAHE_ALLOC_TRACK, this file also
+ * defines malloc and friends on top of the __libc_* entry points of glibc,
+ * which every other definition in the program then resolves to.
+ *
+ * Dependencies:
+ * - errno.h
+ * - malloc.h
+ * - openssl/crypto.h
+ * - sys/resource.h
+ *
+ * @see alloc_track.h for the documentation of the functions implemented here.
+ */
+
+#include "alloc_track.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <openssl/crypto.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#if defined(FAHE_ALLOC_TRACK) && !defined(__GLIBC__)
+#error "FAHE_ALLOC_TRACK requires glibc"
+#endif
+
+static __thread fahe_alloc_counters track_counters[FAHE_ALLOC_SOURCE_COUNT]
+    __attribute__((tls_model("initial-exec")));
+static int openssl_tracked = 0;
+
+static const char *source_names[FAHE_ALLOC_SOURCE_COUNT] = {"openssl",
+                                                            "libc"};
+
+#ifdef FAHE_ALLOC_TRACK
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+#define REAL_MALLOC __libc_malloc
+#define REAL_REALLOC __libc_realloc
+#define REAL_FREE __libc_free
+#else
+#define REAL_MALLOC malloc
+#define REAL_REALLOC realloc
+#define REAL_FREE free
+#endif
+
+static inline void track_alloc(fahe_alloc_source source, void *ptr) {
+  if (ptr) {
+    track_counters[source].allocs++;
+    track_counters[source].bytes += malloc_usable_size(ptr);
+  }
+}
+
+static inline void track_free(fahe_alloc_source source, void *ptr) {
+  if (ptr) {
+    track_counters[source].frees++;
+    track_counters[source].freed_bytes += malloc_usable_size(ptr);
+  }
+}
+
+static void *track_realloc(fahe_alloc_source source, void *ptr, size_t size) {
+  track_free(source, ptr);
+  void *moved = REAL_REALLOC(ptr, size);
+  if (!moved && ptr && size) {
+    // The old block is still live
+    track_counters[source].frees--;
+    track_counters[source].freed_bytes -= malloc_usable_size(ptr);
+  }
+  track_alloc(source, moved);
+  return moved;
+}
+
+static void *openssl_malloc(size_t num, const char *file, int line) {
+  (void)file;
+  (void)line;
+  void *ptr = REAL_MALLOC(num);
+  track_alloc(FAHE_ALLOC_OPENSSL, ptr);
+  return ptr;
+}
+
+static void *openssl_realloc(void *addr, size_t num, const char *file,
+                             int line) {
+  (void)file;
+  (void)line;
+  return track_realloc(FAHE_ALLOC_OPENSSL, addr, num);
+}
+
+static void openssl_free(void *addr, const char *file, int line) {
+  (void)file;
+  (void)line;
+  track_free(FAHE_ALLOC_OPENSSL, addr);
+  REAL_FREE(addr);
+}
+
+int fahe_alloc_track_install(void) {
+  if (__atomic_load_n(&openssl_tracked, __ATOMIC_ACQUIRE)) {
+    return 1;
+  }
+  if (!CRYPTO_set_mem_functions(openssl_malloc, openssl_realloc,
+                                openssl_free)) {
+    return 0;
+  }
+  __atomic_store_n(&openssl_tracked, 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+int fahe_alloc_track_active(fahe_alloc_source source) {
+  switch (source) {
+    case FAHE_ALLOC_OPENSSL:
+      return __atomic_load_n(&openssl_tracked, __ATOMIC_ACQUIRE);
+    case FAHE_ALLOC_LIBC:
+      return FAHE_ALLOC_TRACK_ENABLED;
+    default:
+      return 0;
+  }
+}
+
+void fahe_alloc_snapshot(fahe_alloc_stats *stats) {
+  memcpy(stats->sources, track_counters, sizeof(track_counters));
+  struct rusage usage;
+  stats->peak_rss_kib = getrusage(RUSAGE_SELF, &usage) == 0
+                            ? usage.ru_maxrss
+                            : 0;
+}
+
+void fahe_alloc_diff(fahe_alloc_stats *diff, const fahe_alloc_stats *before,
+                     const fahe_alloc_stats *after) {
+  for (int s = 0; s < FAHE_ALLOC_SOURCE_COUNT; s++) {
+    const fahe_alloc_counters *b = &before->sources[s];
+    const fahe_alloc_counters *a = &after->sources[s];
+    diff->sources[s].allocs = a->allocs - b->allocs;
+    diff->sources[s].frees = a->frees - b->frees;
+    diff->sources[s].bytes = a->bytes - b->bytes;
+    diff->sources[s].freed_bytes = a->freed_bytes - b->freed_bytes;
+  }
+  diff->peak_rss_kib = after->peak_rss_kib;
+}
+
+uint64_t fahe_alloc_count(const fahe_alloc_stats *stats) {
+  uint64_t allocs = 0;
+  for (int s = 0; s < FAHE_ALLOC_SOURCE_COUNT; s++) {
+    allocs += stats->sources[s].allocs;
+  }
+  return allocs;
+}
+
+void fahe_alloc_print(const char *label, const fahe_alloc_stats *stats,
+                      uint64_t ops, FILE *stream) {
+  if (ops == 0) {
+    ops = 1;
+  }
+  for (int s = 0; s < FAHE_ALLOC_SOURCE_COUNT; s++) {
+    const fahe_alloc_counters *c = &stats->sources[s];
+    if (!fahe_alloc_track_active((fahe_alloc_source)s)) {
+      fprintf(stream, "%-10s %-8s %12s\n", label, source_names[s],
+              "untracked");
+      continue;
+    }
+    fprintf(stream,
+            "%-10s %-8s %12.2f allocs/op %12.1f bytes/op %12.2f frees/op\n",
+            label, source_names[s], (double)c->allocs / ops,
+            (double)c->bytes / ops, (double)c->frees / ops);
+  }
+  fprintf(stream, "%-10s peak RSS %ld KiB\n", label, stats->peak_rss_kib);
+}
+
+#ifdef FAHE_ALLOC_TRACK
+// Installs the OpenSSL allocator before main, ahead of any OpenSSL call
+__attribute__((constructor)) static void alloc_track_init(void) {
+  fahe_alloc_track_install();
+}
+
+void *malloc(size_t size) {
+  void *ptr = __libc_malloc(size);
+  track_alloc(FAHE_ALLOC_LIBC, ptr);
+  return ptr;
+}
+
+void *calloc(size_t n, size_t size) {
+  void *ptr = __libc_calloc(n, size);
+  track_alloc(FAHE_ALLOC_LIBC, ptr);
+  return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+  return track_realloc(FAHE_ALLOC_LIBC, ptr, size);
+}
+
+void free(void *ptr) {
+  track_free(FAHE_ALLOC_LIBC, ptr);
+  __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  void *ptr = __libc_memalign(alignment, size);
+  track_alloc(FAHE_ALLOC_LIBC, ptr);
+  return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+  if (alignment % sizeof(void *) != 0 ||
+      (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  void *ptr = memalign(alignment, size);
+  if (!ptr) {
+    return ENOMEM;
+  }
+  *out = ptr;
+  return 0;
+}
+#endif
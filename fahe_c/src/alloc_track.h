@@ -0,0 +1,156 @@
+/**
+ * @file alloc_track.h
+ * @brief Header file for alloc_track.c, counting of the heap allocations
+ * made by encryption, decryption and addition.
+ *
+ * The tracker counts allocations, frees and bytes per thread, split by
+ * where they come from: OpenSSL (BIGNUMs, BN_CTX, strings from BN_bn2dec)
+ * or plain libc malloc (limb buffers, lists, contexts). A caller takes a
+ * snapshot before and after a run of operations on the same thread and
+ * divides the difference by the number of operations.
+ *
+ * OpenSSL allocations are counted once fahe_alloc_track_install has
+ * replaced the OpenSSL allocator with CRYPTO_set_mem_functions. OpenSSL
+ * only accepts that before its first allocation, so the call belongs at the
+ * top of main or of a freshly forked test.
+ *
+ * libc allocations are counted when the library is built with
+ * -DFAHE_ALLOC_TRACK, e.g. make OPTFLAGS="-O2 -DFAHE_ALLOC_TRACK". This
+ * replaces malloc, calloc, realloc, free and the aligned allocators of the
+ * whole program with counting wrappers around the glibc ones, and installs
+ * the OpenSSL allocator before main. It is meant for tests and benchmarks,
+ * not for production builds, and requires glibc.
+ *
+ * This file contains the following structs: fahe_alloc_counters,
+ * fahe_alloc_stats
+ *                and the following methods: fahe_alloc_track_install,
+ * fahe_alloc_track_active, fahe_alloc_snapshot, fahe_alloc_diff,
+ * fahe_alloc_count, fahe_alloc_print
+ */
+
+#ifndef ALLOC_TRACK_H
+#define ALLOC_TRACK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief 1 if the library was built with -DFAHE_ALLOC_TRACK, 0 otherwise.
+ */
+#ifdef FAHE_ALLOC_TRACK
+#define FAHE_ALLOC_TRACK_ENABLED 1
+#else
+#define FAHE_ALLOC_TRACK_ENABLED 0
+#endif
+
+/**
+ * @brief Where a counted allocation was made.
+ */
+typedef enum {
+  FAHE_ALLOC_OPENSSL,
+  FAHE_ALLOC_LIBC,
+  FAHE_ALLOC_SOURCE_COUNT
+} fahe_alloc_source;
+
+/**
+ * @struct fahe_alloc_counters
+ * @brief Allocation counters of one source.
+ *
+ * A realloc counts as an allocation of the new block and, when it was given
+ * a block, a free of the old one. Bytes are usable sizes as reported by
+ * malloc_usable_size, so they include allocator rounding.
+ *
+ * @var fahe_alloc_counters::allocs
+ * Member 'allocs' (uint64_t) is the number of blocks handed out.
+ *
+ * @var fahe_alloc_counters::frees
+ * Member 'frees' (uint64_t) is the number of blocks returned.
+ *
+ * @var fahe_alloc_counters::bytes
+ * Member 'bytes' (uint64_t) is the total size of the blocks handed out.
+ *
+ * @var fahe_alloc_counters::freed_bytes
+ * Member 'freed_bytes' (uint64_t) is the total size of the blocks returned.
+ */
+typedef struct {
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t bytes;
+  uint64_t freed_bytes;
+} fahe_alloc_counters;
+
+/**
+ * @struct fahe_alloc_stats
+ * @brief A snapshot of the calling thread's allocation counters.
+ *
+ * @var fahe_alloc_stats::sources
+ * Member 'sources' (fahe_alloc_counters[]) holds the counters of each
+ * fahe_alloc_source.
+ *
+ * @var fahe_alloc_stats::peak_rss_kib
+ * Member 'peak_rss_kib' (long) is the peak resident set size of the
+ * process in KiB. fahe_alloc_diff keeps the later value.
+ */
+typedef struct {
+  fahe_alloc_counters sources[FAHE_ALLOC_SOURCE_COUNT];
+  long peak_rss_kib;
+} fahe_alloc_stats;
+
+/**
+ * @brief Replaces the OpenSSL allocator with the counting one.
+ *
+ * @return 1 if OpenSSL allocations are counted, now or already. 0 if
+ *         OpenSSL has allocated before and refused the new allocator.
+ */
+int fahe_alloc_track_install(void);
+
+/**
+ * @brief Reports whether allocations of a source are being counted.
+ *
+ * @param[in] source @see fahe_alloc_source
+ *
+ * @return 1 if allocations of source are counted, 0 otherwise.
+ */
+int fahe_alloc_track_active(fahe_alloc_source source);
+
+/**
+ * @brief Reads the allocation counters of the calling thread.
+ *
+ * Allocations made by other threads, such as the workers of a thread pool
+ * or the writer of the async log, are not included.
+ *
+ * @param[out] stats The counters and the current peak RSS.
+ */
+void fahe_alloc_snapshot(fahe_alloc_stats *stats);
+
+/**
+ * @brief Computes the counters accumulated between two snapshots.
+ *
+ * @param[out] diff after - before. May alias either input.
+ * @param[in] before The earlier snapshot.
+ * @param[in] after The later snapshot.
+ */
+void fahe_alloc_diff(fahe_alloc_stats *diff, const fahe_alloc_stats *before,
+                     const fahe_alloc_stats *after);
+
+/**
+ * @brief Returns the number of allocations of all sources in a snapshot.
+ *
+ * @param[in] stats A snapshot or a difference of snapshots.
+ *
+ * @return The sum of allocs over all sources.
+ */
+uint64_t fahe_alloc_count(const fahe_alloc_stats *stats);
+
+/**
+ * @brief Prints allocations and bytes per operation, one row per source.
+ *
+ * @param[in] label Name of the operation, e.g. "encrypt".
+ * @param[in] stats A difference of snapshots taken around ops operations.
+ * @param[in] ops Number of operations. 0 is treated as 1.
+ * @param[in] stream The stream to print to.
+ */
+void fahe_alloc_print(const char *label, const fahe_alloc_stats *stats,
+                      uint64_t ops, FILE *stream);
+
+#endif  // ALLOC_TRACK_H
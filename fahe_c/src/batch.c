@@ -0,0 +1,219 @@
+/**
+ * @file batch.c
+ * @brief Implementation of the contiguous ciphertext batch.
+ *
+ * Like the rest of the limb code, the rows are written to and read from
+ * streams as host limbs, which assumes a little-endian host. The stream
+ * format itself lives in fahefile.c.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ * - openssl/crypto.h
+ * - sys/mman.h
+ * - add.h
+ * - fahefile.h
+ * - limb.h
+ * - logger.h
+ *
+ * @see batch.h for the documentation of the functions implemented here.
+ */
+
+#define _GNU_SOURCE
+
+#include "batch.h"
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "add.h"
+#include "fahefile.h"
+#include "limb.h"
+#include "logger.h"
+
+#define BATCH_HUGEPAGE_BYTES ((size_t)2 << 20)
+
+// Maps bytes of zeroed memory on huge pages, or on regular pages advised
+// for transparent huge pages. Returns NULL if both fail.
+static void *batch_map_hugepages(size_t *bytes) {
+  size_t size =
+      (*bytes + BATCH_HUGEPAGE_BYTES - 1) & ~(BATCH_HUGEPAGE_BYTES - 1);
+  void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+  if (mem == MAP_FAILED) {
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+    if (mem == MAP_FAILED) {
+      return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(mem, size, MADV_HUGEPAGE);
+#endif
+  }
+  *bytes = size;
+  return mem;
+}
+
+// Allocates a batch as fahe_ct_batch_new does. Returns NULL if the rows do
+// not fit in a size_t or cannot be allocated.
+static fahe_ct_batch *batch_alloc(size_t row_limbs, size_t capacity,
+                                  int flags) {
+  size_t align_limbs = FAHE_CT_BATCH_ALIGN / sizeof(uint64_t);
+  size_t max_limbs = SIZE_MAX / sizeof(uint64_t);
+  if (row_limbs > max_limbs - align_limbs) {
+    log_message(LOG_ERROR, "Batch rows of %zu limbs are too large\n",
+                row_limbs);
+    return NULL;
+  }
+  size_t row_stride = (row_limbs + align_limbs - 1) / align_limbs * align_limbs;
+  if (capacity > max_limbs / row_stride) {
+    log_message(LOG_ERROR, "Batch of %zu rows of %zu limbs is too large\n",
+                capacity, row_limbs);
+    return NULL;
+  }
+
+  fahe_ct_batch *batch = (fahe_ct_batch *)malloc(sizeof(fahe_ct_batch));
+  if (!batch) {
+    log_message(LOG_ERROR, "Memory allocation for fahe_ct_batch failed\n");
+    return NULL;
+  }
+  batch->count = 0;
+  batch->capacity = capacity;
+  batch->row_limbs = row_limbs;
+  batch->row_stride = row_stride;
+  batch->alloc_bytes = capacity * row_stride * sizeof(uint64_t);
+  if (batch->alloc_bytes == 0) {
+    batch->alloc_bytes = FAHE_CT_BATCH_ALIGN;
+  }
+  batch->limbs = NULL;
+  batch->mapped = 0;
+
+  if (flags & FAHE_CT_BATCH_HUGEPAGES) {
+    batch->limbs = batch_map_hugepages(&batch->alloc_bytes);
+    batch->mapped = batch->limbs != NULL;
+  }
+  if (!batch->limbs) {
+    void *mem = NULL;
+    if (posix_memalign(&mem, FAHE_CT_BATCH_ALIGN, batch->alloc_bytes) != 0) {
+      log_message(LOG_ERROR, "Memory allocation for batch rows failed\n");
+      free(batch);
+      return NULL;
+    }
+    memset(mem, 0, batch->alloc_bytes);
+    batch->limbs = mem;
+  }
+  return batch;
+}
+
+fahe_ct_batch *fahe_ct_batch_new(size_t row_limbs, size_t capacity,
+                                 int flags) {
+  if (row_limbs == 0) {
+    log_message(LOG_FATAL, "Batch rows need at least one limb\n");
+    exit(EXIT_FAILURE);
+  }
+  fahe_ct_batch *batch = batch_alloc(row_limbs, capacity, flags);
+  if (!batch) {
+    log_message(LOG_FATAL, "Batch allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return batch;
+}
+
+void fahe_ct_batch_free(fahe_ct_batch *batch) {
+  if (!batch) {
+    return;
+  }
+  OPENSSL_cleanse(batch->limbs, batch->alloc_bytes);
+  if (batch->mapped) {
+    munmap(batch->limbs, batch->alloc_bytes);
+  } else {
+    free(batch->limbs);
+  }
+  free(batch);
+}
+
+int fahe_ct_batch_get(const fahe_ct_batch *batch, size_t i,
+                      BIGNUM *ciphertext) {
+  if (i >= batch->count) {
+    log_message(LOG_ERROR, "Batch row %zu is past count %zu\n", i,
+                batch->count);
+    return 0;
+  }
+  return limbs_to_bn(fahe_ct_batch_row(batch, i), batch->row_limbs,
+                     ciphertext);
+}
+
+int fahe_ct_batch_set(fahe_ct_batch *batch, size_t i,
+                      const BIGNUM *ciphertext) {
+  if (i >= batch->capacity) {
+    log_message(LOG_ERROR, "Batch row %zu is past capacity %zu\n", i,
+                batch->capacity);
+    return 0;
+  }
+  if (!limbs_from_bn(ciphertext, fahe_ct_batch_row(batch, i),
+                     batch->row_limbs)) {
+    log_message(LOG_ERROR, "Ciphertext does not fit in %zu limbs\n",
+                batch->row_limbs);
+    return 0;
+  }
+  if (i >= batch->count) {
+    batch->count = i + 1;
+  }
+  return 1;
+}
+
+BIGNUM *fahe_ct_batch_sum(const fahe_ct_batch *batch, int num_threads) {
+  size_t out_limbs = batch->row_limbs + 2;
+  uint64_t *out = malloc(out_limbs * sizeof(uint64_t));
+  BIGNUM *sum = BN_new();
+  if (!out || !sum) {
+    log_message(LOG_FATAL, "Memory allocation for the sum failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!fahe_sum_limbs_parallel(batch->limbs, batch->count, batch->row_limbs,
+                               batch->row_stride, out, out_limbs,
+                               num_threads) ||
+      !limbs_to_bn(out, out_limbs, sum)) {
+    log_message(LOG_FATAL, "Summing the batch failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  free(out);
+  return sum;
+}
+
+int fahe_ct_batch_write(const fahe_ct_batch *batch, FILE *stream) {
+  return fahe_file_write_batch(NULL, batch, stream);
+}
+
+fahe_ct_batch *fahe_ct_batch_read(FILE *stream, int flags) {
+  fahe_file_header header;
+  if (!fahe_file_header_read(stream, &header)) {
+    log_message(LOG_ERROR, "Not a ciphertext batch stream\n");
+    return NULL;
+  }
+
+  // fahe_file_header_read has checked the records against a seekable
+  // stream; on a pipe an impossible count fails here, not the process
+  fahe_ct_batch *batch = batch_alloc(header.row_limbs, header.count, flags);
+  if (!batch) {
+    return NULL;
+  }
+  for (size_t i = 0; i < header.count; i++) {
+    if (fread(fahe_ct_batch_row(batch, i), sizeof(uint64_t),
+              batch->row_limbs, stream) != batch->row_limbs) {
+      log_message(LOG_ERROR, "Batch stream ends at row %zu of %llu\n", i,
+                  (unsigned long long)header.count);
+      fahe_ct_batch_free(batch);
+      return NULL;
+    }
+  }
+  batch->count = header.count;
+  return batch;
+}
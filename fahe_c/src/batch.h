@@ -0,0 +1,183 @@
+/**
+ * @file batch.h
+ * @brief Header file for batch.c, a contiguous container of ciphertexts.
+ *
+ * This file contains the following structs: fahe_ct_batch
+ *                and the following methods: fahe_ct_batch_new,
+ * fahe_ct_batch_free, fahe_ct_batch_row, fahe_ct_batch_get,
+ * fahe_ct_batch_set, fahe_ct_batch_sum, fahe_ct_batch_write,
+ * fahe_ct_batch_read
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Alignment of the batch storage and of every row, in bytes.
+ */
+#define FAHE_CT_BATCH_ALIGN 64
+
+/**
+ * @brief Flag for fahe_ct_batch_new: back the rows with huge pages.
+ *
+ * Explicit huge pages (MAP_HUGETLB) are tried first. If none are reserved,
+ * the rows fall back to regular pages marked MADV_HUGEPAGE, which
+ * transparent huge pages may promote.
+ */
+#define FAHE_CT_BATCH_HUGEPAGES 1
+
+/**
+ * @typedef fahe_ct_batch
+ * @brief N ciphertexts stored as fixed-width limb rows in one allocation.
+ *
+ * A list of BIGNUM* costs two heap objects per ciphertext and a pointer
+ * chase per access. A batch instead keeps row i at
+ * limbs + i * row_stride as row_limbs little-endian limbs. row_stride is
+ * row_limbs rounded up to a multiple of FAHE_CT_BATCH_ALIGN bytes, so every
+ * row starts on a cache line. The padding limbs are always zero.
+ *
+ * Encryption, decryption and summation read and write the rows directly.
+ * @see fahe1_encrypt_batch @see fahe1_decrypt_batch @see fahe_ct_batch_sum
+ */
+
+/**
+ * @struct fahe_ct_batch
+ *
+ * @var fahe_ct_batch: count (size_t)
+ * Rows holding a ciphertext.
+ *
+ * @var fahe_ct_batch: capacity (size_t)
+ * Rows allocated.
+ *
+ * @var fahe_ct_batch: row_limbs, row_stride (size_t)
+ * Limbs per ciphertext and the distance between rows, in limbs.
+ *
+ * @var fahe_ct_batch: limbs (uint64_t*)
+ * capacity * row_stride limbs, FAHE_CT_BATCH_ALIGN-aligned.
+ *
+ * @var fahe_ct_batch: alloc_bytes (size_t)
+ * Size of the allocation behind limbs.
+ *
+ * @var fahe_ct_batch: mapped (int)
+ * 1 if limbs was mapped with mmap, 0 if it came from posix_memalign.
+ */
+typedef struct {
+  size_t count;
+  size_t capacity;
+  size_t row_limbs;
+  size_t row_stride;
+  uint64_t *limbs;
+  size_t alloc_bytes;
+  int mapped;
+} fahe_ct_batch;
+
+/**
+ * @brief Creates an empty batch with zeroed rows.
+ *
+ * @param[in] row_limbs Limbs per ciphertext, e.g. the c_limbs of an
+ *                      encryption context. Must be >= 1.
+ * @param[in] capacity Number of rows to allocate.
+ * @param[in] flags 0 or FAHE_CT_BATCH_HUGEPAGES.
+ *
+ * @return The initialized batch with count 0. Free with fahe_ct_batch_free.
+ *         Exits if the rows do not fit in memory.
+ */
+fahe_ct_batch *fahe_ct_batch_new(size_t row_limbs, size_t capacity,
+                                 int flags);
+
+/**
+ * @brief Frees a batch. The rows are cleansed first.
+ *
+ * @param[in] batch The batch to free. NULL is ignored.
+ */
+void fahe_ct_batch_free(fahe_ct_batch *batch);
+
+/**
+ * @brief Returns the limbs of row i.
+ *
+ * @param[in] batch The batch.
+ * @param[in] i The row. Must be < capacity.
+ *
+ * @return A pointer to row_limbs limbs.
+ */
+static inline uint64_t *fahe_ct_batch_row(const fahe_ct_batch *batch,
+                                          size_t i) {
+  return batch->limbs + i * batch->row_stride;
+}
+
+/**
+ * @brief Copies row i into a BIGNUM.
+ *
+ * @param[in] batch The batch.
+ * @param[in] i The row. Must be < count.
+ * @param[out] ciphertext Where to store the row.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_ct_batch_get(const fahe_ct_batch *batch, size_t i,
+                      BIGNUM *ciphertext);
+
+/**
+ * @brief Stores a BIGNUM in row i. Rows up to i count as used afterwards.
+ *
+ * @param[in,out] batch The batch.
+ * @param[in] i The row. Must be < capacity.
+ * @param[in] ciphertext The value to store. Must fit in row_limbs limbs.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_ct_batch_set(fahe_ct_batch *batch, size_t i,
+                      const BIGNUM *ciphertext);
+
+/**
+ * @brief Sums the ciphertexts of a batch.
+ *
+ * @see fahe_sum_limbs_parallel, which does the work on the shared thread
+ * pool.
+ *
+ * @param[in] batch The batch to sum.
+ * @param[in] num_threads Blocks to split the rows into. <= 0 uses one per
+ *                        thread of fahe_thread_pool_shared.
+ *
+ * @return A new BIGNUM holding the sum of rows [0, count).
+ */
+BIGNUM *fahe_ct_batch_sum(const fahe_ct_batch *batch, int num_threads);
+
+/**
+ * @brief Writes the used rows of a batch to a stream.
+ *
+ * The stream is a FAHE file of ciphertexts that is not tied to a key,
+ * @see fahefile.h. fahe_file_write_batch writes one with the key fields.
+ *
+ * @param[in] batch The batch to write.
+ * @param[in] stream An open binary stream.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_ct_batch_write(const fahe_ct_batch *batch, FILE *stream);
+
+/**
+ * @brief Reads the records of a FAHE file into a new batch.
+ *
+ * Reads files of any kind and version fahe_file_header_read accepts,
+ * including the FAHECTB1 streams earlier versions of fahe_ct_batch_write
+ * produced. To check the header first, or to use the records without
+ * copying them, @see fahe_file_open.
+ *
+ * @param[in] stream An open binary stream.
+ * @param[in] flags Passed to fahe_ct_batch_new.
+ *
+ * The header is not trusted: a seekable stream must hold all of its
+ * records, and rows that cannot be allocated fail the read rather than
+ * the process.
+ *
+ * @return A new batch with capacity == count, or NULL on failure.
+ */
+fahe_ct_batch *fahe_ct_batch_read(FILE *stream, int flags);
+
+#endif  // BATCH_H
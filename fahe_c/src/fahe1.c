@@ -29,10 +29,19 @@
  * fahe1_free(fahe);
  *
  * Dependencies:
- * - math.h
  * - openssl/bn.h
+ * - batch.h
+ * - fahefile.h
  * - helper.h
+ * - keygen.h
+ * - limb.h
  * - logger.h
+ * - metrics.h
+ * - pool.h
+ * - rng.h
+ * - stats.h
+ * - stream.h
+ * - thread_pool.h
  *
  * @see fahe1.h for the documetation of the functions implemented in this file.
  * @see helper.h for additional helper functions such as random primes
@@ -43,11 +52,21 @@
 
 #include "fahe1.h"
 
-#include <math.h>
 #include <openssl/bn.h>
 
+#include "batch.h"
+#include "fahefile.h"
 #include "helper.h"
+#include "keygen.h"
+#include "limb.h"
 #include "logger.h"
+#include "metrics.h"
+#include "pool.h"
+#include "probes.h"
+#include "rng.h"
+#include "stats.h"
+#include "stream.h"
+#include "thread_pool.h"
 
 fahe1 *fahe1_init(const fahe_params *params) {
   log_message(LOG_INFO, "Fahe1 init start...\n");
@@ -97,9 +116,21 @@ void fahe1_free(fahe1 *fahe1_instance) {
   }
   BN_free(fahe1_instance->num_additions);
   free(fahe1_instance);
+  log_flush();
 }
 
 fahe1_key fahe1_keygen(int lambda, int m_max, int alpha) {
+  return fahe1_keygen_ex(lambda, m_max, alpha, NULL);
+}
+
+fahe1_key fahe1_keygen_ex(int lambda, int m_max, int alpha,
+                           const fahe_keygen_opts *opts) {
+  FAHE_PROBE4(keygen_entry, 1, lambda, m_max, alpha);
+  uint64_t t_metrics = fahe_metrics_start();
+  fahe_keygen_opts defaults = FAHE_KEYGEN_OPTS_DEFAULT;
+  if (!opts) {
+    opts = &defaults;
+  }
   // Assign key's int attributes
   fahe1_key key;
 
@@ -111,7 +142,7 @@ fahe1_key fahe1_keygen(int lambda, int m_max, int alpha) {
   int rho = lambda;
   key.rho = rho;
   double eta = rho + (2 * alpha) + m_max;
-  int gamma = (int)(rho / log2(rho) * ((eta - rho) * (eta - rho)));
+  int gamma = fahe_keygen_gamma(rho, (int)eta);
   log_message(LOG_DEBUG, "GAMMA: %d\n", gamma);
 
   // Generate a large prime p
@@ -120,50 +151,20 @@ fahe1_key fahe1_keygen(int lambda, int m_max, int alpha) {
     log_message(LOG_FATAL, "BN_new failed\n");
     exit(EXIT_FAILURE);
   }
-  if (!BN_generate_prime_ex(key.p, (int)eta, 1, NULL, NULL, NULL)) {
-    log_message(LOG_FATAL, "BN_generate_prime_ex failed\n");
+  if (!fahe_prime_generate(key.p, (int)eta, opts->safe_prime, opts->pool)) {
+    log_message(LOG_FATAL, "Prime generation failed\n");
     BN_free(key.p);
     exit(EXIT_FAILURE);
   }
-  log_message(LOG_DEBUG, "p decimal: %s\n", BN_bn2dec(key.p));
+  log_bignum(LOG_DEBUG, "p decimal: %s\n", key.p);
 
   // Calculating X = (2^gamma) / p...
   BIGNUM *X = BN_new();
-  BIGNUM *base = BN_new();
-  BIGNUM *gamma_bn = BN_new();
   BN_CTX *ctx = BN_CTX_new();
-
-  if (!X || !base || !gamma_bn || !ctx) {
-    log_message(LOG_FATAL, "BN_new or BN_CTX_new failed\n");
-    BN_free(key.p);
-    BN_free(X);
-    BN_free(base);
-    BN_free(gamma_bn);
-    BN_CTX_free(ctx);
-    exit(EXIT_FAILURE);
-  }
-
-  BN_set_word(base, 2);
-  BN_set_word(gamma_bn, gamma);
-
-  // Calculate 2^gamma
-  if (!BN_exp(X, base, gamma_bn, ctx)) {
-    log_message(LOG_FATAL, "BN_exp failed\n");
-    BN_free(key.p);
-    BN_free(X);
-    BN_free(base);
-    BN_free(gamma_bn);
-    BN_CTX_free(ctx);
-    exit(EXIT_FAILURE);
-  }
-
-  // Calculate (2^gamma)/p
-  if (!BN_div(X, NULL, X, key.p, ctx)) {
-    log_message(LOG_FATAL, "BN_div failed\n");
+  if (!X || !ctx || !fahe_pow2_div(X, gamma, key.p, ctx)) {
+    log_message(LOG_FATAL, "Computing X failed\n");
     BN_free(key.p);
     BN_free(X);
-    BN_free(base);
-    BN_free(gamma_bn);
     BN_CTX_free(ctx);
     exit(EXIT_FAILURE);
   }
@@ -172,11 +173,11 @@ fahe1_key fahe1_keygen(int lambda, int m_max, int alpha) {
   key.X = X;
 
   // Clean up
-  BN_free(base);
-  BN_free(gamma_bn);
   BN_CTX_free(ctx);
 
   log_message(LOG_INFO, "FAHE1 Key successfully generated.\n");
+  fahe_metrics_record(FAHE_OP_KEYGEN, 1, t_metrics, 1, 0);
+  FAHE_PROBE4(keygen_return, 1, lambda, (int)eta, gamma);
 
   return key;
 }
@@ -184,9 +185,14 @@ fahe1_key fahe1_keygen(int lambda, int m_max, int alpha) {
 BIGNUM *fahe1_encrypt(BIGNUM *p, BIGNUM *X, int rho, int alpha,
                       BIGNUM *message) {
   log_message(LOG_DEBUG, "Initializing encryption...");
+  FAHE_STATS_START(t_encrypt);
+  FAHE_PROBE3(encrypt_entry, 1, alpha,
+              X && p ? BN_num_bits(X) + BN_num_bits(p) : 0);
+  uint64_t t_metrics = fahe_metrics_start();
   // Initialize BIGNUM values
   BIGNUM *q = NULL;
   BIGNUM *noise = NULL;
+  FAHE_STATS_START(t_alloc);
   BIGNUM *M = BN_new();
   BIGNUM *n = BN_new();
   BIGNUM *c = BN_new();
@@ -198,6 +204,7 @@ BIGNUM *fahe1_encrypt(BIGNUM *p, BIGNUM *X, int rho, int alpha,
     log_message(LOG_FATAL, "Memory allocation failed\n");
     exit(EXIT_FAILURE);
   }
+  FAHE_STATS_STOP(FAHE_STAGE_ALLOC, t_alloc);
 
   log_message(LOG_DEBUG,
               "Debug: Successfully initialized encryption BIGNUM variables\n");
@@ -216,7 +223,7 @@ BIGNUM *fahe1_encrypt(BIGNUM *p, BIGNUM *X, int rho, int alpha,
   }
   log_message(LOG_DEBUG, "Debug: Input BIGNUM X is not NULL\n");
 
-  log_message(LOG_DEBUG, "Debug: X = %s\n", BN_bn2dec(X));
+  log_bignum(LOG_DEBUG, "Debug: X = %s\n", X);
 
   if (!BN_copy(X_plus_one, X)) {
     log_message(LOG_FATAL, "BN_copy failed\n");
@@ -230,58 +237,68 @@ BIGNUM *fahe1_encrypt(BIGNUM *p, BIGNUM *X, int rho, int alpha,
   }
   log_message(LOG_DEBUG, "Debug: BN_add_word succeeded\n");
 
-  log_message(LOG_DEBUG, "Debug: X+1 = %s\n", BN_bn2dec(X_plus_one));
+  log_bignum(LOG_DEBUG, "Debug: X+1 = %s\n", X_plus_one);
 
+  FAHE_STATS_START(t_rng_q);
   q = rand_bignum_below(X_plus_one);
+  FAHE_STATS_STOP(FAHE_STAGE_RNG, t_rng_q);
   if (!q) {
     log_message(LOG_FATAL, "rand_bignum_below failed\n");
     exit(EXIT_FAILURE);
   }
-  log_message(LOG_DEBUG, "Debug: q = %s\n", BN_bn2dec(q));
+  log_bignum(LOG_DEBUG, "Debug: q = %s\n", q);
   BN_free(X_plus_one);
 
   // Generate random noise of bit length rho
+  FAHE_STATS_START(t_rng_noise);
   noise = rand_bits_below(rho);
+  FAHE_STATS_STOP(FAHE_STAGE_RNG, t_rng_noise);
   if (!noise) {
     log_message(LOG_FATAL, "rand_bits_below failed\n");
     exit(EXIT_FAILURE);
   }
 
-  log_message(LOG_DEBUG, "Debug: noise = %s\n", BN_bn2dec(noise));
+  log_bignum(LOG_DEBUG, "Debug: noise = %s\n", noise);
 
   // M = (message << (rho + alpha)) + noise
+  FAHE_STATS_START(t_encode);
   if (!BN_set_word(rho_alpha, rho + alpha)) {
     log_message(LOG_FATAL, "BN_set_word failed\n");
     exit(EXIT_FAILURE);
   }
-  log_message(LOG_DEBUG, "Debug: rho+alpha = %s\n", BN_bn2dec(rho_alpha));
+  log_bignum(LOG_DEBUG, "Debug: rho+alpha = %s\n", rho_alpha);
 
   if (!BN_lshift(rho_alpha_shift, message, rho + alpha)) {
     log_message(LOG_FATAL, "BN_lshift failed\n");
     exit(EXIT_FAILURE);
   }
-  log_message(LOG_DEBUG, "Debug: message << (rho + alpha) = %s\n",
-              BN_bn2dec(rho_alpha_shift));
+  log_bignum(LOG_DEBUG, "Debug: message << (rho + alpha) = %s\n",
+             rho_alpha_shift);
 
   if (!BN_add(M, rho_alpha_shift, noise)) {
     log_message(LOG_FATAL, "BN_add for M failed\n");
     exit(EXIT_FAILURE);
   }
-  log_message(LOG_DEBUG, "Debug: M = %s\n", BN_bn2dec(M));
+  FAHE_STATS_STOP(FAHE_STAGE_ENCODE, t_encode);
+  log_bignum(LOG_DEBUG, "Debug: M = %s\n", M);
 
   // n = p * q
+  FAHE_STATS_START(t_mul);
   if (!BN_mul(n, p, q, ctx)) {
     log_message(LOG_FATAL, "BN_mul failed\n");
     exit(EXIT_FAILURE);
   }
-  log_message(LOG_DEBUG, "Debug: n = %s\n", BN_bn2dec(n));
+  FAHE_STATS_STOP(FAHE_STAGE_MUL, t_mul);
+  log_bignum(LOG_DEBUG, "Debug: n = %s\n", n);
 
   // c = n + M
+  FAHE_STATS_START(t_add);
   if (!BN_add(c, n, M)) {
     log_message(LOG_FATAL, "BN_add for c failed\n");
     exit(EXIT_FAILURE);
   }
-  log_message(LOG_DEBUG, "Debug: c = %s\n", BN_bn2dec(c));
+  FAHE_STATS_STOP(FAHE_STAGE_ADD, t_add);
+  log_bignum(LOG_DEBUG, "Debug: c = %s\n", c);
 
   // Free temporary BIGNUMs and context
   BN_free(q);
@@ -291,104 +308,324 @@ BIGNUM *fahe1_encrypt(BIGNUM *p, BIGNUM *X, int rho, int alpha,
   BN_free(rho_alpha_shift);
   BN_free(rho_alpha);
   BN_CTX_free(ctx);
+  FAHE_STATS_STOP(FAHE_STAGE_ENCRYPT, t_encrypt);
+  int c_bits = BN_num_bits(c);
+  fahe_metrics_record(FAHE_OP_ENCRYPT, 1, t_metrics, 1, (c_bits + 7) / 8);
+  FAHE_PROBE3(encrypt_return, 1, alpha, c_bits);
 
   return c;
 }
-BIGNUM **fahe1_encrypt_list(BIGNUM *p, BIGNUM *X, int rho, int alpha,
-                            BIGNUM **message_list, BIGNUM *list_size) {
-  log_message(LOG_INFO, "Initializing List Encryption");
+// Creates an encryption context that draws from rng, or from an engine of
+// its own if rng is NULL
+static fahe1_enc_ctx *fahe1_enc_ctx_create(const fahe1_key *key,
+                                        fahe_rng *rng) {
+  if (!key || !key->p || !key->X) {
+    log_message(LOG_FATAL, "Input key is NULL or incomplete\n");
+    exit(EXIT_FAILURE);
+  }
 
-  // Initialize BIGNUM values
-  BIGNUM *q = NULL;
-  BIGNUM *noise = NULL;
-  BIGNUM *M = BN_new();
-  BIGNUM *n = BN_new();
-  BIGNUM *c = BN_new();
-  BIGNUM *rho_alpha_shift = BN_new();
-  BIGNUM *rho_alpha = BN_new();
-  BN_CTX *ctx = BN_CTX_new();
+  fahe1_enc_ctx *enc_ctx = (fahe1_enc_ctx *)malloc(sizeof(fahe1_enc_ctx));
+  if (!enc_ctx) {
+    log_message(LOG_FATAL, "Memory allocation for fahe1_enc_ctx failed\n");
+    exit(EXIT_FAILURE);
+  }
 
-  BIGNUM **ciphertext_list = malloc(BN_get_word(list_size) * sizeof(BIGNUM *));
-  if (!ciphertext_list || !M || !n || !c || !rho_alpha_shift || !rho_alpha ||
-      !ctx) {
+  enc_ctx->p = key->p;
+  enc_ctx->rho = key->rho;
+  enc_ctx->rho_alpha = key->rho + key->alpha;
+  // c = p * q + M with q <= X, so c fits in bits(X) + bits(p) + 1 bits
+  enc_ctx->gamma_bits = BN_num_bits(key->X) + BN_num_bits(key->p) + 1;
+
+  enc_ctx->owns_rng = rng == NULL;
+  enc_ctx->rng = rng ? rng : fahe_rng_new(FAHE_RNG_DEFAULT);
+  enc_ctx->noise = BN_new();
+  enc_ctx->M = BN_new();
+  BIGNUM *X_plus_one = BN_dup(key->X);
+  if (!enc_ctx->noise || !enc_ctx->M || !X_plus_one) {
     log_message(LOG_FATAL, "Memory allocation failed\n");
     exit(EXIT_FAILURE);
   }
 
-  // q < X + 1
-  BIGNUM *X_plus_one = BN_new();
-  if (!X_plus_one) {
-    log_message(LOG_FATAL, "BN_new for X_plus_one failed\n");
+  // Calculating q < X + 1 bound once for the lifetime of the context
+  if (!BN_add_word(X_plus_one, 1)) {
+    log_message(LOG_FATAL, "BN_add_word failed\n");
     exit(EXIT_FAILURE);
   }
 
-  if (!BN_copy(X_plus_one, X) || !BN_add_word(X_plus_one, 1)) {
-    log_message(LOG_FATAL, "Initialization of X_plus_one failed\n");
+  enc_ctx->p_limbs = FAHE_LIMBS(BN_num_bits(key->p));
+  enc_ctx->q_limbs = FAHE_LIMBS(BN_num_bits(X_plus_one));
+  enc_ctx->c_limbs = enc_ctx->p_limbs + enc_ctx->q_limbs + 1;
+  enc_ctx->p_buf = malloc(enc_ctx->p_limbs * sizeof(uint64_t));
+  enc_ctx->bound_buf = malloc(enc_ctx->q_limbs * sizeof(uint64_t));
+  enc_ctx->q_buf = malloc(enc_ctx->q_limbs * sizeof(uint64_t));
+  enc_ctx->M_buf = malloc(enc_ctx->c_limbs * sizeof(uint64_t));
+  enc_ctx->c_buf = malloc(enc_ctx->c_limbs * sizeof(uint64_t));
+  if (!enc_ctx->p_buf || !enc_ctx->bound_buf || !enc_ctx->q_buf ||
+      !enc_ctx->M_buf || !enc_ctx->c_buf) {
+    log_message(LOG_FATAL, "Memory allocation for limb buffers failed\n");
     exit(EXIT_FAILURE);
   }
 
-  // Pre-compute rho + alpha
-  if (!BN_set_word(rho_alpha, rho + alpha)) {
-    log_message(LOG_FATAL, "BN_set_word failed\n");
+  if (!limbs_from_bn(key->p, enc_ctx->p_buf, enc_ctx->p_limbs) ||
+      !limbs_from_bn(X_plus_one, enc_ctx->bound_buf, enc_ctx->q_limbs)) {
+    log_message(LOG_FATAL, "Exporting key limbs failed\n");
     exit(EXIT_FAILURE);
   }
+  BN_free(X_plus_one);
 
-  // Loop through each message and perform calculations
-  for (int i = 0; i < BN_get_word(list_size); i++) {
-    q = rand_bignum_below(X_plus_one);
-    noise = rand_bits_below(rho);
+  // Reserve scratch storage up front so encryption never grows a buffer
+  if (!bn_reserve_bits(enc_ctx->noise, enc_ctx->rho) ||
+      !bn_reserve_bits(enc_ctx->M, enc_ctx->gamma_bits)) {
+    log_message(LOG_FATAL, "bn_reserve_bits failed\n");
+    exit(EXIT_FAILURE);
+  }
 
-    if (!q || !noise) {
-      log_message(LOG_FATAL, "Random number generation failed\n");
-      exit(EXIT_FAILURE);
-    }
+  log_message(LOG_DEBUG, "fahe1_enc_ctx initialized for %d-bit ciphertexts\n",
+              enc_ctx->gamma_bits);
+  return enc_ctx;
+}
 
-    // Calculate message << (rho + alpha)
-    if (!BN_lshift(rho_alpha_shift, message_list[i], rho + alpha)) {
-      log_message(LOG_FATAL, "BN_lshift failed\n");
-      exit(EXIT_FAILURE);
-    }
+fahe1_enc_ctx *fahe1_enc_ctx_new(const fahe1_key *key) {
+  return fahe1_enc_ctx_create(key, NULL);
+}
 
-    // M = (message << (rho + alpha)) + noise
-    if (!BN_add(M, rho_alpha_shift, noise)) {
-      log_message(LOG_FATAL, "BN_add for M failed\n");
-      exit(EXIT_FAILURE);
-    }
+void fahe1_enc_ctx_free(fahe1_enc_ctx *enc_ctx) {
+  if (!enc_ctx) {
+    return;
+  }
+  if (enc_ctx->owns_rng) {
+    fahe_rng_free(enc_ctx->rng);
+  }
+  BN_free(enc_ctx->noise);
+  BN_free(enc_ctx->M);
+  free(enc_ctx->p_buf);
+  free(enc_ctx->bound_buf);
+  free(enc_ctx->q_buf);
+  free(enc_ctx->M_buf);
+  free(enc_ctx->c_buf);
+  free(enc_ctx);
+}
 
-    // n = p * q
-    if (!BN_mul(n, p, q, ctx)) {
-      log_message(LOG_FATAL, "BN_mul failed\n");
-      exit(EXIT_FAILURE);
+// Draws the noise and writes the limbs of M = (message << (rho + alpha)) +
+// noise to enc_ctx->M_buf.
+static int fahe1_encode_M(fahe1_enc_ctx *enc_ctx, const BIGNUM *message,
+                          size_t *m_limbs) {
+  // Generate random noise of bit length rho
+  FAHE_STATS_START(t_rng);
+  if (!fahe_rng_bn_bits(enc_ctx->rng, enc_ctx->noise, enc_ctx->rho)) {
+    log_message(LOG_ERROR, "fahe_rng_bn_bits failed\n");
+    return 0;
+  }
+  FAHE_STATS_STOP(FAHE_STAGE_RNG, t_rng);
+
+  // M = (message << (rho + alpha)) + noise
+  FAHE_STATS_START(t_encode);
+  if (!BN_lshift(enc_ctx->M, message, enc_ctx->rho_alpha) ||
+      !BN_add(enc_ctx->M, enc_ctx->M, enc_ctx->noise)) {
+    log_message(LOG_ERROR, "Computing M failed\n");
+    return 0;
+  }
+  *m_limbs = FAHE_LIMBS(BN_num_bits(enc_ctx->M));
+  if (*m_limbs >= enc_ctx->c_limbs ||
+      !limbs_from_bn(enc_ctx->M, enc_ctx->M_buf, *m_limbs)) {
+    log_message(LOG_ERROR, "Message is too large to encrypt\n");
+    return 0;
+  }
+  FAHE_STATS_STOP(FAHE_STAGE_ENCODE, t_encode);
+  return 1;
+}
+
+// Draws q < X + 1 and writes c = p * q + M to out.
+static size_t fahe1_mul_add_M(fahe1_enc_ctx *enc_ctx, uint64_t *out,
+                              size_t m_limbs) {
+  // q < X + 1
+  FAHE_STATS_START(t_rng);
+  if (!fahe_rng_limbs_below(enc_ctx->rng, enc_ctx->q_buf, enc_ctx->bound_buf,
+                            enc_ctx->q_limbs)) {
+    log_message(LOG_ERROR, "fahe_rng_limbs_below failed\n");
+    return 0;
+  }
+  FAHE_STATS_STOP(FAHE_STAGE_RNG, t_rng);
+
+  // c = p * q + M
+  FAHE_STATS_START(t_mul);
+  size_t n = limbs_mul_small_add(out, enc_ctx->q_buf, enc_ctx->q_limbs,
+                                 enc_ctx->p_buf, enc_ctx->p_limbs,
+                                 enc_ctx->M_buf, m_limbs);
+  FAHE_STATS_STOP(FAHE_STAGE_MUL, t_mul);
+  return n;
+}
+
+size_t fahe1_encrypt_ctx_limbs(fahe1_enc_ctx *enc_ctx, const BIGNUM *message,
+                               uint64_t *out, size_t out_limbs) {
+  if (out_limbs < enc_ctx->c_limbs) {
+    log_message(LOG_ERROR, "Ciphertext buffer holds %zu limbs, need %zu\n",
+                out_limbs, enc_ctx->c_limbs);
+    fahe_metrics_fail(FAHE_OP_ENCRYPT, 1);
+    return 0;
+  }
+
+  FAHE_STATS_START(t_encrypt);
+  FAHE_PROBE3(encrypt_entry, 1, enc_ctx->rho_alpha - enc_ctx->rho,
+              enc_ctx->gamma_bits);
+  uint64_t t_metrics = fahe_metrics_start();
+  size_t m_limbs;
+  if (!fahe1_encode_M(enc_ctx, message, &m_limbs)) {
+    fahe_metrics_fail(FAHE_OP_ENCRYPT, 1);
+    return 0;
+  }
+  size_t n = fahe1_mul_add_M(enc_ctx, out, m_limbs);
+  if (n == 0) {
+    fahe_metrics_fail(FAHE_OP_ENCRYPT, 1);
+    return 0;
+  }
+  FAHE_STATS_STOP(FAHE_STAGE_ENCRYPT, t_encrypt);
+  int c_bits = limbs_num_bits(out, n);
+  fahe_metrics_record(FAHE_OP_ENCRYPT, 1, t_metrics, 1, (c_bits + 7) / 8);
+  FAHE_PROBE3(encrypt_return, 1, enc_ctx->rho_alpha - enc_ctx->rho, c_bits);
+  return n;
+}
+
+size_t fahe1_encrypt_pooled_limbs(fahe1_enc_ctx *enc_ctx, fahe_pool *pool,
+                                  const BIGNUM *message, uint64_t *out,
+                                  size_t out_limbs) {
+  if (out_limbs < enc_ctx->c_limbs) {
+    log_message(LOG_ERROR, "Ciphertext buffer holds %zu limbs, need %zu\n",
+                out_limbs, enc_ctx->c_limbs);
+    fahe_metrics_fail(FAHE_OP_ENCRYPT, 1);
+    return 0;
+  }
+  if (pool->n_limbs != enc_ctx->c_limbs) {
+    log_message(LOG_ERROR, "Pool and encryption context keys differ\n");
+    fahe_metrics_fail(FAHE_OP_ENCRYPT, 1);
+    return 0;
+  }
+
+  FAHE_STATS_START(t_encrypt);
+  FAHE_PROBE3(encrypt_entry, 1, enc_ctx->rho_alpha - enc_ctx->rho,
+              enc_ctx->gamma_bits);
+  uint64_t t_metrics = fahe_metrics_start();
+  size_t m_limbs;
+  if (!fahe1_encode_M(enc_ctx, message, &m_limbs)) {
+    fahe_metrics_fail(FAHE_OP_ENCRYPT, 1);
+    return 0;
+  }
+
+  // Pool miss: compute p * q on this thread instead
+  if (!fahe_pool_take(pool, out, out_limbs)) {
+    size_t n = fahe1_mul_add_M(enc_ctx, out, m_limbs);
+    if (n == 0) {
+      fahe_metrics_fail(FAHE_OP_ENCRYPT, 1);
+      return 0;
     }
+    FAHE_STATS_STOP(FAHE_STAGE_ENCRYPT, t_encrypt);
+    int c_bits = limbs_num_bits(out, n);
+    fahe_metrics_record(FAHE_OP_ENCRYPT, 1, t_metrics, 1, (c_bits + 7) / 8);
+    FAHE_PROBE3(encrypt_return, 1, enc_ctx->rho_alpha - enc_ctx->rho, c_bits);
+    return n;
+  }
 
-    // c = n + M
-    if (!BN_add(c, n, M)) {
-      log_message(LOG_FATAL, "BN_add for c failed\n");
+  // c = p * q + M. p * q < 2**gamma leaves the top limb free for the carry.
+  FAHE_STATS_START(t_add);
+  limbs_add(out, enc_ctx->c_limbs, enc_ctx->M_buf, m_limbs);
+  FAHE_STATS_STOP(FAHE_STAGE_ADD, t_add);
+  FAHE_STATS_STOP(FAHE_STAGE_ENCRYPT, t_encrypt);
+  int c_bits = limbs_num_bits(out, enc_ctx->c_limbs);
+  fahe_metrics_record(FAHE_OP_ENCRYPT, 1, t_metrics, 1, (c_bits + 7) / 8);
+  FAHE_PROBE3(encrypt_return, 1, enc_ctx->rho_alpha - enc_ctx->rho, c_bits);
+  return enc_ctx->c_limbs;
+}
+
+BIGNUM *fahe1_encrypt_ctx(fahe1_enc_ctx *enc_ctx, const BIGNUM *message,
+                          BIGNUM *ciphertext) {
+  BIGNUM *c = ciphertext;
+  if (!c) {
+    FAHE_STATS_START(t_alloc);
+    c = BN_new();
+    if (!c || !bn_reserve_bits(c, enc_ctx->gamma_bits)) {
+      log_message(LOG_FATAL, "Memory allocation for ciphertext failed\n");
       exit(EXIT_FAILURE);
     }
+    FAHE_STATS_STOP(FAHE_STAGE_ALLOC, t_alloc);
+  }
 
-    ciphertext_list[i] = BN_dup(c);
-    if (!ciphertext_list[i]) {
-      log_message(LOG_FATAL, "BN_dup failed\n");
+  size_t n = fahe1_encrypt_ctx_limbs(enc_ctx, message, enc_ctx->c_buf,
+                                     enc_ctx->c_limbs);
+  FAHE_STATS_START(t_convert);
+  if (n == 0 || !limbs_to_bn(enc_ctx->c_buf, n, c)) {
+    log_message(LOG_FATAL, "Encryption failed\n");
+    exit(EXIT_FAILURE);
+  }
+  FAHE_STATS_STOP(FAHE_STAGE_CONVERT, t_convert);
+
+  return c;
+}
+
+BIGNUM *fahe1_encrypt_pooled(fahe1_enc_ctx *enc_ctx, fahe_pool *pool,
+                             const BIGNUM *message, BIGNUM *ciphertext) {
+  BIGNUM *c = ciphertext;
+  if (!c) {
+    FAHE_STATS_START(t_alloc);
+    c = BN_new();
+    if (!c || !bn_reserve_bits(c, enc_ctx->gamma_bits)) {
+      log_message(LOG_FATAL, "Memory allocation for ciphertext failed\n");
       exit(EXIT_FAILURE);
     }
+    FAHE_STATS_STOP(FAHE_STAGE_ALLOC, t_alloc);
   }
 
-  // Free temporary BIGNUMs and context
-  BN_free(q);
-  BN_free(noise);
-  BN_free(X_plus_one);
-  BN_free(M);
-  BN_free(n);
-  BN_free(c);
-  BN_free(rho_alpha_shift);
-  BN_free(rho_alpha);
-  BN_CTX_free(ctx);
+  size_t n = fahe1_encrypt_pooled_limbs(enc_ctx, pool, message,
+                                        enc_ctx->c_buf, enc_ctx->c_limbs);
+  FAHE_STATS_START(t_convert);
+  if (n == 0 || !limbs_to_bn(enc_ctx->c_buf, n, c)) {
+    log_message(LOG_FATAL, "Encryption failed\n");
+    exit(EXIT_FAILURE);
+  }
+  FAHE_STATS_STOP(FAHE_STAGE_CONVERT, t_convert);
+
+  return c;
+}
+
+BIGNUM **fahe1_encrypt_list(BIGNUM *p, BIGNUM *X, int rho, int alpha,
+                            BIGNUM **message_list, BIGNUM *list_size) {
+  log_message(LOG_INFO, "Initializing List Encryption");
+  size_t count = BN_get_word(list_size);
+
+  BIGNUM **ciphertext_list = malloc(count * sizeof(BIGNUM *));
+  if (!ciphertext_list) {
+    log_message(LOG_FATAL, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // X + 1, the BN_CTX and the scratch values are computed only once and
+  // reused for every message of the list
+  fahe1_key key = {0};
+  key.rho = rho;
+  key.alpha = alpha;
+  key.X = X;
+  key.p = p;
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(&key);
+
+  // Encrypt each message directly into its own ciphertext
+  FAHE_STATS_START(t_list);
+  FAHE_PROBE3(encrypt_list_entry, 1, count, 1);
+  for (size_t i = 0; i < count; i++) {
+    ciphertext_list[i] = fahe1_encrypt_ctx(enc_ctx, message_list[i], NULL);
+  }
+  FAHE_STATS_STOP(FAHE_STAGE_ENCRYPT_LIST, t_list);
+  FAHE_PROBE3(encrypt_list_return, 1, count, 1);
+
+  fahe1_enc_ctx_free(enc_ctx);
 
   return ciphertext_list;
 }
 BIGNUM *fahe1_decrypt(BIGNUM *p, int m_max, int rho, int alpha,
                       BIGNUM *ciphertext) {
+  FAHE_STATS_START(t_decrypt);
+  int c_bits = BN_num_bits(ciphertext);
+  FAHE_PROBE3(decrypt_entry, 1, m_max, c_bits);
+  uint64_t t_metrics = fahe_metrics_start();
+  FAHE_STATS_START(t_alloc);
   BIGNUM *m_full = BN_new();
   BIGNUM *m_shifted = BN_new();
   BIGNUM *m_masked = BN_new();
@@ -398,148 +635,462 @@ BIGNUM *fahe1_decrypt(BIGNUM *p, int m_max, int rho, int alpha,
     log_message(LOG_FATAL, "Memory allocation failed\n");
     exit(EXIT_FAILURE);
   }
+  FAHE_STATS_STOP(FAHE_STAGE_ALLOC, t_alloc);
 
   // m_full = ciphertext % p
+  FAHE_STATS_START(t_reduce);
   if (!BN_mod(m_full, ciphertext, p, ctx)) {
     log_message(LOG_FATAL, "BN_mod failed\n");
     exit(EXIT_FAILURE);
   }
-  log_message(LOG_DEBUG, "Debug: m_full = %s\n", BN_bn2dec(m_full));
+  FAHE_STATS_STOP(FAHE_STAGE_REDUCE, t_reduce);
+  log_bignum(LOG_DEBUG, "Debug: m_full = %s\n", m_full);
 
   // m_shifted = m_full >> (rho + alpha)
+  FAHE_STATS_START(t_decode);
   if (!BN_rshift(m_shifted, m_full, rho + alpha)) {
     log_message(LOG_FATAL, "BN_rshift failed\n");
     exit(EXIT_FAILURE);
   }
-  log_message(LOG_DEBUG, "Debug: m_shifted before masking = %s\n",
-              BN_bn2dec(m_shifted));
+  log_bignum(LOG_DEBUG, "Debug: m_shifted before masking = %s\n", m_shifted);
 
   // Mask the bits to the size of m_max
   if (!BN_mask_bits(m_shifted, m_max)) {
     log_message(LOG_FATAL, "BN_mask_bits failed\n");
     exit(EXIT_FAILURE);
   }
-  log_message(LOG_DEBUG, "Debug:  m_shifted after masking = %s\n",
-              BN_bn2dec(m_masked));
+  log_bignum(LOG_DEBUG, "Debug:  m_shifted after masking = %s\n", m_shifted);
 
   // Assign the masked value to m_masked
   if (!BN_copy(m_masked, m_shifted)) {
     log_message(LOG_FATAL, "BN_copy failed\n");
     exit(EXIT_FAILURE);
   }
-  log_message(LOG_DEBUG, "Debug: m_masked after copying = %s\n",
-              BN_bn2dec(m_masked));
+  FAHE_STATS_STOP(FAHE_STAGE_DECODE, t_decode);
+  log_bignum(LOG_DEBUG, "Debug: m_masked after copying = %s\n", m_masked);
 
   // Free allocated memory
   BN_free(m_full);
   BN_free(m_shifted);
   BN_CTX_free(ctx);
+  FAHE_STATS_STOP(FAHE_STAGE_DECRYPT, t_decrypt);
+  fahe_metrics_record(FAHE_OP_DECRYPT, 1, t_metrics, 1, (c_bits + 7) / 8);
+  FAHE_PROBE3(decrypt_return, 1, m_max, c_bits);
 
   return m_masked;
 }
 
 BIGNUM **fahe1_decrypt_list(BIGNUM *p, int m_max, int rho, int alpha,
                             BIGNUM **ciphertext_list, BIGNUM *list_size) {
+  size_t count = BN_get_word(list_size);
   log_message(LOG_DEBUG, "Decrypting ciphertext list...");
 
-  // Initialize BIGNUM values
-  BIGNUM *m_full = BN_new();
-  BIGNUM *m_shifted = BN_new();
-  BN_CTX *ctx = BN_CTX_new();
+  // Allocate memory for the list of decrypted messages
+  BIGNUM **decrypted_list = malloc(count * sizeof(BIGNUM *));
+  if (decrypted_list == NULL) {
+    log_message(LOG_FATAL, "Memory allocation for decrypted_list failed\n");
+    return NULL;
+  }
+
+  // The reduction data for p is computed only once for the whole list
+  fahe1_key key = {0};
+  key.m_max = m_max;
+  key.rho = rho;
+  key.alpha = alpha;
+  key.p = p;
+  fahe1_dec_ctx *dec_ctx = fahe1_dec_ctx_new(&key);
+
+  // Decrypt each ciphertext directly into its own message
+  FAHE_STATS_START(t_list);
+  FAHE_PROBE3(decrypt_list_entry, 1, count, 1);
+  for (size_t i = 0; i < count; i++) {
+    decrypted_list[i] = fahe1_decrypt_ctx(dec_ctx, ciphertext_list[i], NULL);
+  }
+  FAHE_STATS_STOP(FAHE_STAGE_DECRYPT_LIST, t_list);
+  FAHE_PROBE3(decrypt_list_return, 1, count, 1);
+
+  fahe1_dec_ctx_free(dec_ctx);
 
-  if (!m_full || !m_shifted || !ctx) {
+  return decrypted_list;
+}
+
+// Creates a decryption context whose reducer uses bn_ctx, or a BN_CTX of
+// its own if bn_ctx is NULL
+static fahe1_dec_ctx *fahe1_dec_ctx_create(const fahe1_key *key,
+                                        BN_CTX *bn_ctx) {
+  if (!key || !key->p) {
+    log_message(LOG_FATAL, "Input key is NULL or incomplete\n");
+    exit(EXIT_FAILURE);
+  }
+
+  fahe1_dec_ctx *dec_ctx = (fahe1_dec_ctx *)malloc(sizeof(fahe1_dec_ctx));
+  if (!dec_ctx) {
+    log_message(LOG_FATAL, "Memory allocation for fahe1_dec_ctx failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Sums of up to 2^alpha ciphertexts grow by at most alpha bits
+  int reserve_bits =
+      key->X ? BN_num_bits(key->X) + BN_num_bits(key->p) + 1 + key->alpha
+             : 0;
+
+  dec_ctx->reducer = fahe_reducer_new_ctx(key->p, reserve_bits, bn_ctx);
+  dec_ctx->rho_alpha = key->rho + key->alpha;
+  dec_ctx->m_max = key->m_max;
+  dec_ctx->m_full = BN_new();
+  if (!dec_ctx->m_full ||
+      !bn_reserve_bits(dec_ctx->m_full, BN_num_bits(key->p))) {
     log_message(LOG_FATAL, "Memory allocation failed\n");
     exit(EXIT_FAILURE);
   }
 
-  // Allocate memory for the list of decrypted messages
-  BIGNUM **decrypted_list = malloc(BN_get_word(list_size) * sizeof(BIGNUM *));
-  if (decrypted_list == NULL) {
-    log_message(LOG_FATAL, "Memory allocation for decrypted_list failed\n");
-    BN_free(m_full);
-    BN_free(m_shifted);
-    BN_CTX_free(ctx);
-    return NULL;
+  return dec_ctx;
+}
+
+fahe1_dec_ctx *fahe1_dec_ctx_new(const fahe1_key *key) {
+  return fahe1_dec_ctx_create(key, NULL);
+}
+
+void fahe1_dec_ctx_free(fahe1_dec_ctx *dec_ctx) {
+  if (!dec_ctx) {
+    return;
   }
+  fahe_reducer_free(dec_ctx->reducer);
+  BN_free(dec_ctx->m_full);
+  free(dec_ctx);
+}
 
-  // Decrypt each ciphertext
-  for (size_t i = 0; i < BN_get_word(list_size); i++) {
-    // Allocate memory for each decrypted message
-    decrypted_list[i] = BN_new();
-    if (!decrypted_list[i]) {
-      log_message(LOG_FATAL, "BN_new failed for index %zu\n", i);
-      //  Free already allocated BIGNUMs
-      for (size_t j = 0; j < i; j++) {
-        BN_free(decrypted_list[j]);
-      }
-      free(decrypted_list);
-      BN_free(m_full);
-      BN_free(m_shifted);
-      BN_CTX_free(ctx);
-      return NULL;
+// Turns dec_ctx->m_full into the message, allocating it if m is NULL
+static BIGNUM *fahe1_decode_m(fahe1_dec_ctx *dec_ctx, BIGNUM *message) {
+  BIGNUM *m = message;
+  if (!m) {
+    FAHE_STATS_START(t_alloc);
+    m = BN_new();
+    if (!m) {
+      log_message(LOG_FATAL, "Memory allocation for message failed\n");
+      exit(EXIT_FAILURE);
     }
+    FAHE_STATS_STOP(FAHE_STAGE_ALLOC, t_alloc);
+  }
+
+  // m = m_full >> (rho + alpha)
+  FAHE_STATS_START(t_decode);
+  if (!BN_rshift(m, dec_ctx->m_full, dec_ctx->rho_alpha)) {
+    log_message(LOG_FATAL, "BN_rshift failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Mask the bits to the size of m_max. BN_mask_bits rejects values that
+  // are already narrower than m_max, which need no masking.
+  if (BN_num_bits(m) > dec_ctx->m_max && !BN_mask_bits(m, dec_ctx->m_max)) {
+    log_message(LOG_FATAL, "BN_mask_bits failed\n");
+    exit(EXIT_FAILURE);
+  }
+  FAHE_STATS_STOP(FAHE_STAGE_DECODE, t_decode);
 
-    // m_full = ciphertext % p
-    if (!BN_mod(m_full, ciphertext_list[i], p, ctx)) {
-      log_message(LOG_FATAL, "BN_mod failed for index %zu\n", i);
-      BN_free(decrypted_list[i]);
-      for (size_t j = 0; j < i; j++) {
-        BN_free(decrypted_list[j]);
-      }
-      free(decrypted_list);
-      BN_free(m_full);
-      BN_free(m_shifted);
-      BN_CTX_free(ctx);
-      return NULL;
+  return m;
+}
+
+BIGNUM *fahe1_decrypt_ctx(fahe1_dec_ctx *dec_ctx, const BIGNUM *ciphertext,
+                          BIGNUM *message) {
+  // m_full = ciphertext % p
+  FAHE_STATS_START(t_decrypt);
+  int c_bits = BN_num_bits(ciphertext);
+  FAHE_PROBE3(decrypt_entry, 1, dec_ctx->m_max, c_bits);
+  uint64_t t_metrics = fahe_metrics_start();
+  FAHE_STATS_START(t_reduce);
+  if (!fahe_reduce(dec_ctx->reducer, dec_ctx->m_full, ciphertext)) {
+    log_message(LOG_FATAL, "fahe_reduce failed\n");
+    exit(EXIT_FAILURE);
+  }
+  FAHE_STATS_STOP(FAHE_STAGE_REDUCE, t_reduce);
+  BIGNUM *m = fahe1_decode_m(dec_ctx, message);
+  FAHE_STATS_STOP(FAHE_STAGE_DECRYPT, t_decrypt);
+  fahe_metrics_record(FAHE_OP_DECRYPT, 1, t_metrics, 1, (c_bits + 7) / 8);
+  FAHE_PROBE3(decrypt_return, 1, dec_ctx->m_max, c_bits);
+  return m;
+}
+
+BIGNUM *fahe1_decrypt_ctx_limbs(fahe1_dec_ctx *dec_ctx,
+                                 const uint64_t *ciphertext, size_t num_limbs,
+                                 BIGNUM *message) {
+  // m_full = ciphertext % p, straight from the limbs
+  FAHE_STATS_START(t_decrypt);
+  int c_bits = limbs_num_bits(ciphertext, num_limbs);
+  FAHE_PROBE3(decrypt_entry, 1, dec_ctx->m_max, c_bits);
+  uint64_t t_metrics = fahe_metrics_start();
+  FAHE_STATS_START(t_reduce);
+  if (!fahe_reduce_limbs(dec_ctx->reducer, dec_ctx->m_full, ciphertext,
+                         num_limbs)) {
+    log_message(LOG_FATAL, "fahe_reduce_limbs failed\n");
+    exit(EXIT_FAILURE);
+  }
+  FAHE_STATS_STOP(FAHE_STAGE_REDUCE, t_reduce);
+  BIGNUM *m = fahe1_decode_m(dec_ctx, message);
+  FAHE_STATS_STOP(FAHE_STAGE_DECRYPT, t_decrypt);
+  fahe_metrics_record(FAHE_OP_DECRYPT, 1, t_metrics, 1, (c_bits + 7) / 8);
+  FAHE_PROBE3(decrypt_return, 1, dec_ctx->m_max, c_bits);
+  return m;
+}
+
+// Shared by the encrypt and decrypt tasks of a parallel list operation;
+// ctxs holds one encryption or decryption context per pool thread, built on
+// the RNG or the BN_CTX of its worker
+typedef struct {
+  const fahe1_key *key;
+  int encrypt;
+  BIGNUM **in;
+  BIGNUM **out;
+  void **ctxs;
+} fahe1_list_job;
+
+static void fahe1_list_task(void *arg, size_t begin, size_t end,
+                            fahe_worker *worker) {
+  fahe1_list_job *job = (fahe1_list_job *)arg;
+  void **ctx = &job->ctxs[worker->index];
+  if (job->encrypt) {
+    if (!*ctx) {
+      *ctx = fahe1_enc_ctx_create(job->key, worker->rng);
+    }
+    for (size_t i = begin; i < end; i++) {
+      job->out[i] = fahe1_encrypt_ctx(*ctx, job->in[i], NULL);
+    }
+  } else {
+    if (!*ctx) {
+      *ctx = fahe1_dec_ctx_create(job->key, worker->bn_ctx);
+    }
+    for (size_t i = begin; i < end; i++) {
+      job->out[i] = fahe1_decrypt_ctx(*ctx, job->in[i], NULL);
     }
+  }
+}
+
+// Encrypts or decrypts the list with one context slot per thread of pool
+static BIGNUM **fahe1_run_list(const fahe1_key *key, BIGNUM **in,
+                                size_t list_size, fahe_thread_pool *pool,
+                                int encrypt) {
+  if (!pool) {
+    pool = fahe_thread_pool_shared();
+  }
+  fahe1_list_job job;
+  job.key = key;
+  job.encrypt = encrypt;
+  job.in = in;
+  job.out = malloc((list_size > 0 ? list_size : 1) * sizeof(BIGNUM *));
+  job.ctxs = calloc(pool->num_threads, sizeof(void *));
+  if (!job.out || !job.ctxs) {
+    log_message(LOG_FATAL, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
 
-    // m_shifted = m_full >> (rho + alpha)
-    if (!BN_rshift(m_shifted, m_full, rho + alpha)) {
-      log_message(LOG_FATAL, "BN_rshift failed for index %zu\n", i);
-      BN_free(decrypted_list[i]);
-      for (size_t j = 0; j < i; j++) {
-        BN_free(decrypted_list[j]);
-      }
-      free(decrypted_list);
-      BN_free(m_full);
-      BN_free(m_shifted);
-      BN_CTX_free(ctx);
-      return NULL;
+  FAHE_STATS_START(t_list);
+  if (encrypt) {
+    FAHE_PROBE3(encrypt_list_entry, 1, list_size, pool->num_threads);
+  } else {
+    FAHE_PROBE3(decrypt_list_entry, 1, list_size, pool->num_threads);
+  }
+  fahe_thread_pool_run(pool, list_size, 0, fahe1_list_task, &job);
+  FAHE_STATS_STOP(encrypt ? FAHE_STAGE_ENCRYPT_LIST : FAHE_STAGE_DECRYPT_LIST,
+                  t_list);
+  if (encrypt) {
+    FAHE_PROBE3(encrypt_list_return, 1, list_size, pool->num_threads);
+  } else {
+    FAHE_PROBE3(decrypt_list_return, 1, list_size, pool->num_threads);
+  }
+
+  for (int i = 0; i < pool->num_threads; i++) {
+    if (encrypt) {
+      fahe1_enc_ctx_free(job.ctxs[i]);
+    } else {
+      fahe1_dec_ctx_free(job.ctxs[i]);
     }
+  }
+  free(job.ctxs);
+  return job.out;
+}
+
+BIGNUM **fahe1_encrypt_list_parallel(const fahe1_key *key,
+                                      BIGNUM **message_list, size_t list_size,
+                                      fahe_thread_pool *pool) {
+  log_message(LOG_INFO, "Initializing Parallel List Encryption");
+  return fahe1_run_list(key, message_list, list_size, pool, 1);
+}
+
+BIGNUM **fahe1_decrypt_list_parallel(const fahe1_key *key,
+                                      BIGNUM **ciphertext_list,
+                                      size_t list_size,
+                                      fahe_thread_pool *pool) {
+  log_message(LOG_INFO, "Decrypting ciphertext list in parallel...");
+  return fahe1_run_list(key, ciphertext_list, list_size, pool, 0);
+}
 
-    // Mask the bits to the size of m_max
-    if (!BN_mask_bits(m_shifted, m_max)) {
-      log_message(LOG_FATAL, "BN_mask_bits failed for index %zu\n", i);
-      BN_free(decrypted_list[i]);
-      for (size_t j = 0; j < i; j++) {
-        BN_free(decrypted_list[j]);
-      }
-      free(decrypted_list);
-      BN_free(m_full);
-      BN_free(m_shifted);
-      BN_CTX_free(ctx);
-      return NULL;
+// State of a batch encryption or decryption; ctxs as in fahe1_list_job
+typedef struct {
+  const fahe1_key *key;
+  BIGNUM **messages;
+  fahe_ct_batch *batch;
+  void **ctxs;
+  int failed;
+} fahe1_batch_job;
+
+static void fahe1_encrypt_batch_task(void *arg, size_t begin, size_t end,
+                                      fahe_worker *worker) {
+  fahe1_batch_job *job = (fahe1_batch_job *)arg;
+  if (!job->ctxs[worker->index]) {
+    job->ctxs[worker->index] = fahe1_enc_ctx_create(job->key, worker->rng);
+  }
+  fahe1_enc_ctx *enc_ctx = job->ctxs[worker->index];
+  for (size_t i = begin; i < end; i++) {
+    uint64_t *row = fahe_ct_batch_row(job->batch, i);
+    size_t n = fahe1_encrypt_ctx_limbs(enc_ctx, job->messages[i], row,
+                                       job->batch->row_limbs);
+    if (n == 0) {
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+      return;
     }
+    // Clear what a previous, wider ciphertext may have left in the row
+    for (size_t j = n; j < job->batch->row_limbs; j++) {
+      row[j] = 0;
+    }
+  }
+}
 
-    // Copy the masked value to the decrypted message
-    if (!BN_copy(decrypted_list[i], m_shifted)) {
-      log_message(LOG_FATAL, "BN_copy failed for index %zu\n", i);
-      BN_free(decrypted_list[i]);
-      for (size_t j = 0; j < i; j++) {
-        BN_free(decrypted_list[j]);
-      }
-      free(decrypted_list);
-      BN_free(m_full);
-      BN_free(m_shifted);
-      BN_CTX_free(ctx);
-      return NULL;
+static void fahe1_decrypt_batch_task(void *arg, size_t begin, size_t end,
+                                      fahe_worker *worker) {
+  fahe1_batch_job *job = (fahe1_batch_job *)arg;
+  if (!job->ctxs[worker->index]) {
+    job->ctxs[worker->index] = fahe1_dec_ctx_create(job->key, worker->bn_ctx);
+  }
+  fahe1_dec_ctx *dec_ctx = job->ctxs[worker->index];
+  for (size_t i = begin; i < end; i++) {
+    job->messages[i] =
+        fahe1_decrypt_ctx_limbs(dec_ctx, fahe_ct_batch_row(job->batch, i),
+                                 job->batch->row_limbs, NULL);
+  }
+}
+
+int fahe1_encrypt_batch(const fahe1_key *key, BIGNUM **message_list,
+                         size_t list_size, fahe_ct_batch *batch,
+                         fahe_thread_pool *pool) {
+  if (list_size > batch->capacity) {
+    log_message(LOG_ERROR, "Batch holds %zu rows, need %zu\n",
+                batch->capacity, list_size);
+    fahe_metrics_fail(FAHE_OP_ENCRYPT, 1);
+    return 0;
+  }
+  if (!pool) {
+    pool = fahe_thread_pool_shared();
+  }
+
+  fahe1_batch_job job;
+  job.key = key;
+  job.messages = message_list;
+  job.batch = batch;
+  job.ctxs = calloc(pool->num_threads, sizeof(void *));
+  job.failed = 0;
+  if (!job.ctxs) {
+    log_message(LOG_FATAL, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  FAHE_STATS_START(t_list);
+  FAHE_PROBE3(encrypt_list_entry, 1, list_size, pool->num_threads);
+  fahe_thread_pool_run(pool, list_size, 0, fahe1_encrypt_batch_task, &job);
+  FAHE_STATS_STOP(FAHE_STAGE_ENCRYPT_LIST, t_list);
+  FAHE_PROBE3(encrypt_list_return, 1, list_size, pool->num_threads);
+
+  for (int i = 0; i < pool->num_threads; i++) {
+    fahe1_enc_ctx_free(job.ctxs[i]);
+  }
+  free(job.ctxs);
+  if (job.failed) {
+    return 0;
+  }
+  batch->count = list_size;
+  return 1;
+}
+
+BIGNUM **fahe1_decrypt_batch(const fahe1_key *key,
+                              const fahe_ct_batch *batch,
+                              fahe_thread_pool *pool) {
+  if (!pool) {
+    pool = fahe_thread_pool_shared();
+  }
+
+  fahe1_batch_job job;
+  job.key = key;
+  job.batch = (fahe_ct_batch *)batch;
+  job.messages = malloc((batch->count > 0 ? batch->count : 1) *
+                        sizeof(BIGNUM *));
+  job.ctxs = calloc(pool->num_threads, sizeof(void *));
+  job.failed = 0;
+  if (!job.messages || !job.ctxs) {
+    log_message(LOG_FATAL, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  FAHE_STATS_START(t_list);
+  FAHE_PROBE3(decrypt_list_entry, 1, batch->count, pool->num_threads);
+  fahe_thread_pool_run(pool, batch->count, 0, fahe1_decrypt_batch_task,
+                       &job);
+  FAHE_STATS_STOP(FAHE_STAGE_DECRYPT_LIST, t_list);
+  FAHE_PROBE3(decrypt_list_return, 1, batch->count, pool->num_threads);
+
+  for (int i = 0; i < pool->num_threads; i++) {
+    fahe1_dec_ctx_free(job.ctxs[i]);
+  }
+  free(job.ctxs);
+  return job.messages;
+}
+
+int fahe1_file_header(const fahe1_key *key, uint32_t kind,
+                       fahe_file_header *header) {
+  fahe_file_header_init(header, kind);
+  header->scheme = 1;
+  header->lambda = key->lambda;
+  header->m_max = key->m_max;
+  header->alpha = key->alpha;
+  int eta = key->rho + (2 * key->alpha) + key->m_max;
+  header->gamma = (uint64_t)fahe_keygen_gamma(key->rho, eta);
+
+  if (kind == FAHE_FILE_MESSAGES) {
+    header->row_limbs = FAHE_LIMBS(key->m_max);
+  } else {
+    // The c_limbs of fahe1_enc_ctx_new
+    BIGNUM *X_plus_one = BN_dup(key->X);
+    if (!X_plus_one || !BN_add_word(X_plus_one, 1)) {
+      log_message(LOG_ERROR, "BN_add_word failed\n");
+      BN_free(X_plus_one);
+      return 0;
     }
+    header->row_limbs = FAHE_LIMBS(BN_num_bits(key->p)) +
+                        FAHE_LIMBS(BN_num_bits(X_plus_one)) + 1;
+    BN_free(X_plus_one);
   }
 
-  // Free temporary BIGNUMs and context
-  BN_free(m_full);
-  BN_free(m_shifted);
-  BN_CTX_free(ctx);
+  return fahe_file_fingerprint(header, key->p, key->X, 0);
+}
 
-  return decrypted_list;
-}
\ No newline at end of file
+fahe_decrypt_stream *fahe1_decrypt_stream_new(const fahe1_key *key,
+                                              fahe_stream_order order) {
+  if (!key || !key->p) {
+    log_message(LOG_FATAL, "Input key is NULL or incomplete\n");
+    exit(EXIT_FAILURE);
+  }
+  return fahe_decrypt_stream_new(key->p, key->rho + key->alpha, key->m_max,
+                                 order);
+}
+
+fahe_encrypt_stream *fahe1_encrypt_stream_new(
+    const fahe1_enc_ctx *enc_ctx) {
+  return fahe_encrypt_stream_new(enc_ctx->p_buf, enc_ctx->p_limbs,
+                                 enc_ctx->bound_buf, enc_ctx->q_limbs);
+}
+
+int fahe1_encrypt_stream_begin(fahe1_enc_ctx *enc_ctx,
+                               fahe_encrypt_stream *stream,
+                               const BIGNUM *message) {
+  size_t m_limbs;
+  return fahe1_encode_M(enc_ctx, message, &m_limbs) &&
+         fahe_encrypt_stream_begin(stream, enc_ctx->M_buf, m_limbs);
+}
@@ -3,9 +3,16 @@
  * @brief Header file for fahe2.c, the main file for Fast Additive Homomorphic
  * Encryption 2 operations such as encryption, decryption, and key generation.
  *
- * This file contains the following structs: fahe_params, fahe1_key, fahe1
- *                and the following methods: fahe1_init, fahe1_free
- * fahe1_keygen, fahe1_encrypt, fahe1_encrypt_list, fahe1_decrypt
+ * This file contains the following structs: fahe_params, fahe1_key, fahe1,
+ *                fahe2_enc_ctx, fahe2_dec_ctx and the following methods:
+ * fahe1_init, fahe1_free fahe1_keygen, fahe1_encrypt, fahe1_encrypt_list,
+ * fahe1_decrypt, fahe2_enc_ctx_new, fahe2_enc_ctx_free,
+ * fahe2_encrypt_ctx_limbs, fahe2_encrypt_ctx, fahe2_encrypt_pooled_limbs,
+ * fahe2_encrypt_pooled, fahe2_dec_ctx_new, fahe2_dec_ctx_free, fahe2_decrypt_ctx,
+ * fahe2_decrypt_ctx_limbs, fahe2_encrypt_list_parallel,
+ * fahe2_decrypt_list_parallel, fahe2_encrypt_batch, fahe2_decrypt_batch,
+ * fahe2_keygen_ex, fahe2_file_header, fahe2_decrypt_stream_new,
+ * fahe2_encrypt_stream_new, fahe2_encrypt_stream_begin
  *
  * @author Oscar Chen
  * @date 2024-07-23
@@ -16,7 +23,15 @@
 
 #include <openssl/bn.h>
 
+#include "batch.h"
+#include "fahefile.h"
 #include "fahe1.h"  //for the fahe_params struct
+#include "keygen.h"
+#include "pool.h"
+#include "reduce.h"
+#include "rng.h"
+#include "stream.h"
+#include "thread_pool.h"
 
 /**
  * @struct fahe2_key
@@ -136,13 +151,27 @@ void fahe2_free(fahe2 *fahe2_instance);
  *                   - eta (double): eta = rho + (2 * alpha) + m_max;
  *                   - gamma (int): gamma =
  *                    (int)(rho / log2(rho) * ((eta - rho) * (eta - rho)));
- *                   - p (BIGINT): p =
- *                    BN_generate_prime_ex(key.p, (int)eta, 1, NULL, NULL,NULL)
+ *                   - p (BIGINT): a random safe prime of eta bits, from
+ *                    fahe_prime_generate on the shared thread pool.
+ *                   - X (BIGINT): X = floor(2**gamma / p).
  *
  * @param[in] params An instance of the fahe2 struct @see fahe2 struct:
  */
 fahe2_key fahe2_keygen(int lambda, int m_max, int alpha);
 
+/**
+ * @brief Creates fahe2_key with keygen options.
+ *
+ * Same as fahe2_keygen, which uses FAHE_KEYGEN_OPTS_DEFAULT. Setting
+ * opts->safe_prime to 0 draws p among all primes of eta bits, which the
+ * scheme permits and which is several times faster; opts->pool picks the
+ * threads that search for p. @see keygen.h
+ *
+ * @param[in] opts The options. NULL uses FAHE_KEYGEN_OPTS_DEFAULT.
+ */
+fahe2_key fahe2_keygen_ex(int lambda, int m_max, int alpha,
+                           const fahe_keygen_opts *opts);
+
 /**
  * @brief Encrypts a plaintext message into ciphertext.
  *
@@ -211,6 +240,7 @@ BIGNUM **fahe2_encrypt_list(fahe2_key key, BIGNUM **message_list,
  *                   - rho (int): @see fahe1 struct
  *                   - alpha (int): @see fahe1_key struct
  *                   - ciphertext (BIGNUM): The ciphertext to decrypt.
+ *                   - ctx (BN_CTX): Caller-owned context. It is not freed.
  *
  * @return The decrypted message masked to m_max bits.
  */
@@ -234,10 +264,425 @@ BIGNUM *fahe2_decrypt(fahe2_key key, BIGNUM *ciphertext, BN_CTX *ctx);
  *                   - alpha (int): @see fahe1_key struct
  *                   - ciphertext_list (BIGNUM*): The ciphertext to decrypt.
  *                   - list_size (BIGNUM): The size of ciphertext_list.
+ *                   - ctx (BN_CTX): Caller-owned context. It is not freed.
  *
  * @return A list of decrypted, masked messages
  */
 BIGNUM **fahe2_decrypt_list(fahe2_key key, BIGNUM **ciphertext_list,
                             BIGNUM *list_size, BN_CTX *ctx);
 
+/**
+ * @typedef fahe2_enc_ctx
+ * @brief Reusable encryption state for a single fahe2_key.
+ *
+ * fahe2_encrypt rebuilds X + 1 (a full copy of the gamma-bit X) and every
+ * temporary BIGNUM on each call. An encryption context performs that work
+ * once per key so that fahe2_encrypt_ctx only draws randomness and does
+ * arithmetic on storage that is already sized for gamma bits.
+ *
+ * q is drawn directly as limbs from the context's fahe_rng and p * q + M is
+ * formed by the fused limbs_mul_small_add kernel, so the gamma-bit product
+ * never exists as a separate BIGNUM. @see limb.h @see rng.h
+ *
+ * @note A context is not thread-safe. Use one context per thread.
+ * @note The context borrows key.p; the key must outlive the context.
+ */
+
+/**
+ * @struct fahe2_enc_ctx
+ *
+ * @var fahe2_enc_ctx: p (BIGNUM*)
+ * Borrowed from the key. @see fahe2_key struct
+ *
+ * @var fahe2_enc_ctx: pos (int)
+ * @see fahe2_key struct. Also the bit length of noise1.
+ *
+ * @var fahe2_enc_ctx: noise2_bits (int)
+ * Bit length of noise2, lambda - pos.
+ *
+ * @var fahe2_enc_ctx: pos_alpha (int)
+ * Message shift constant pos + alpha.
+ *
+ * @var fahe2_enc_ctx: pos_max_alpha (int)
+ * noise2 shift constant pos + m_max + alpha.
+ *
+ * @var fahe2_enc_ctx: gamma_bits (int)
+ * Ciphertext size in bits that the scratch values are reserved for.
+ *
+ * @var fahe2_enc_ctx: rng (fahe_rng*)
+ * FAHE_RNG_DEFAULT engine for q and the noise. Use fahe_rng_set_engine
+ * to select another generator. @see fahe_rng struct
+ *
+ * @var fahe2_enc_ctx: owns_rng (int)
+ * 1 if rng is freed with the context; 0 inside the parallel list and batch
+ * functions, whose contexts draw from the RNG of their pool worker.
+ *
+ * @var fahe2_enc_ctx: noise1, noise2, M (BIGNUM*)
+ * Scratch values, @see fahe2_encrypt for their meaning.
+ *
+ * @var fahe2_enc_ctx: shifted (BIGNUM*)
+ * Scratch value for message << (pos + alpha).
+ *
+ * @var fahe2_enc_ctx: p_limbs, q_limbs (size_t)
+ * Limb counts of p and of the bound X + 1.
+ *
+ * @var fahe2_enc_ctx: c_limbs (size_t)
+ * Limbs written per ciphertext by fahe2_encrypt_ctx_limbs,
+ * p_limbs + q_limbs + 1.
+ *
+ * @var fahe2_enc_ctx: p_buf, bound_buf (uint64_t*)
+ * Limbs of p and of the exclusive upper bound X + 1 for q.
+ *
+ * @var fahe2_enc_ctx: q_buf, M_buf, c_buf (uint64_t*)
+ * Scratch limbs for q, M and the ciphertext.
+ */
+typedef struct {
+  BIGNUM *p;
+  int pos;
+  int noise2_bits;
+  int pos_alpha;
+  int pos_max_alpha;
+  int gamma_bits;
+  fahe_rng *rng;
+  int owns_rng;
+  BIGNUM *noise1;
+  BIGNUM *noise2;
+  BIGNUM *M;
+  BIGNUM *shifted;
+  size_t p_limbs;
+  size_t q_limbs;
+  size_t c_limbs;
+  uint64_t *p_buf;
+  uint64_t *bound_buf;
+  uint64_t *q_buf;
+  uint64_t *M_buf;
+  uint64_t *c_buf;
+} fahe2_enc_ctx;
+
+/**
+ * @brief Creates a reusable encryption context for a fahe2_key.
+ *
+ * This function computes X + 1 and the pos/alpha shift constants, exports p
+ * and X + 1 to limbs and allocates every scratch buffer for the ciphertext
+ * size (bits(X) + bits(p) + 1), so that steady-state encryption does not
+ * grow any buffer.
+ *
+ * @param[in] key The key to encrypt with. @see fahe2_key struct
+ *
+ * @return The initialized encryption context. Free with fahe2_enc_ctx_free.
+ */
+fahe2_enc_ctx *fahe2_enc_ctx_new(const fahe2_key *key);
+
+/**
+ * @brief Frees an encryption context created by fahe2_enc_ctx_new.
+ *
+ * @param[in] enc_ctx The context to free. NULL is ignored.
+ */
+void fahe2_enc_ctx_free(fahe2_enc_ctx *enc_ctx);
+
+/**
+ * @brief Encrypts a plaintext message into a caller-owned limb array.
+ *
+ * This function computes the same ciphertext as fahe2_encrypt,
+ * c = p * q + (noise2 << (pos + m_max + alpha)) + (message << (pos + alpha))
+ *     + noise1,
+ * entirely on native limbs: q is drawn below X + 1 with fahe_rng_limbs_below
+ * and c is produced by one pass of limbs_mul_small_add.
+ *
+ * @param[in] enc_ctx - An encryption context. @see fahe2_enc_ctx struct
+ * @param[in] message - A plaintext message to encrypt. Must be <= m_max.
+ * @param[out] out - Little-endian limbs of the ciphertext.
+ * @param[in] out_limbs - Size of out. Must be >= enc_ctx->c_limbs.
+ *
+ * @return The number of limbs written (enc_ctx->c_limbs), or 0 on failure.
+ */
+size_t fahe2_encrypt_ctx_limbs(fahe2_enc_ctx *enc_ctx, const BIGNUM *message,
+                               uint64_t *out, size_t out_limbs);
+
+/**
+ * @brief Encrypts a plaintext message using a reusable encryption context.
+ *
+ * This function computes the ciphertext with fahe2_encrypt_ctx_limbs into
+ * the context's limb buffer and imports it into a BIGNUM.
+ *
+ * @param[in] enc_ctx - An encryption context. @see fahe2_enc_ctx struct
+ * @param[in] message - A plaintext message to encrypt. Must be <= m_max.
+ * @param[out] ciphertext - Where to store the result. If NULL, a new BIGNUM
+ *                          reserved for gamma bits is allocated. Passing the
+ *                          same BIGNUM on every call avoids all allocation.
+ *
+ * @return ciphertext, or the newly allocated BIGNUM if ciphertext was NULL.
+ */
+BIGNUM *fahe2_encrypt_ctx(fahe2_enc_ctx *enc_ctx, const BIGNUM *message,
+                          BIGNUM *ciphertext);
+
+/**
+ * @brief Encrypts a message with a p * q value taken from a pool.
+ *
+ * This function is the online half of offline/online encryption: it draws
+ * the noise, builds M and adds it to a pooled p * q, so the gamma-bit random
+ * draw and multiplication stay off the caller's thread. When the pool is
+ * empty, it falls back to fahe2_encrypt_ctx_limbs. Both paths produce the
+ * same distribution of ciphertexts.
+ *
+ * @param[in] enc_ctx - An encryption context. @see fahe2_enc_ctx struct
+ * @param[in] pool - A pool created from the same key. @see fahe_pool struct
+ * @param[in] message - A plaintext message to encrypt. Must be <= m_max.
+ * @param[out] out - Little-endian limbs of the ciphertext.
+ * @param[in] out_limbs - Size of out. Must be >= enc_ctx->c_limbs.
+ *
+ * @return The number of limbs written (enc_ctx->c_limbs), or 0 on failure.
+ */
+size_t fahe2_encrypt_pooled_limbs(fahe2_enc_ctx *enc_ctx, fahe_pool *pool,
+                                  const BIGNUM *message, uint64_t *out,
+                                  size_t out_limbs);
+
+/**
+ * @brief Encrypts a message with a pooled p * q into a BIGNUM.
+ *
+ * @see fahe2_encrypt_pooled_limbs. The result is imported into ciphertext.
+ *
+ * @param[in] enc_ctx - An encryption context. @see fahe2_enc_ctx struct
+ * @param[in] pool - A pool created from the same key. @see fahe_pool struct
+ * @param[in] message - A plaintext message to encrypt. Must be <= m_max.
+ * @param[out] ciphertext - Where to store the result. If NULL, a new BIGNUM
+ *                          is allocated.
+ *
+ * @return ciphertext, or the newly allocated BIGNUM if ciphertext was NULL.
+ */
+BIGNUM *fahe2_encrypt_pooled(fahe2_enc_ctx *enc_ctx, fahe_pool *pool,
+                             const BIGNUM *message, BIGNUM *ciphertext);
+
+/**
+ * @typedef fahe2_dec_ctx
+ * @brief Reusable decryption state for a single fahe2_key.
+ *
+ * fahe2_decrypt runs a generic BN_mod on every call, although p is fixed for
+ * the key's lifetime. A decryption context holds a fahe_reducer with the
+ * reduction data for p precomputed, so that fahe2_decrypt_ctx is only
+ * reduce, shift and mask on reserved storage.
+ *
+ * @note A context is not thread-safe. Use one context per thread.
+ * @note The context borrows key.p; the key must outlive the context.
+ */
+
+/**
+ * @struct fahe2_dec_ctx
+ *
+ * @var fahe2_dec_ctx: reducer (fahe_reducer*)
+ * Precomputed reduction modulo p. @see fahe_reducer struct
+ *
+ * @var fahe2_dec_ctx: pos_alpha (int)
+ * Noise shift constant pos + alpha.
+ *
+ * @var fahe2_dec_ctx: m_max (int)
+ * @see fahe2_key struct
+ *
+ * @var fahe2_dec_ctx: m_full (BIGNUM*)
+ * Scratch value for ciphertext % p.
+ */
+typedef struct {
+  fahe_reducer *reducer;
+  int pos_alpha;
+  int m_max;
+  BIGNUM *m_full;
+} fahe2_dec_ctx;
+
+/**
+ * @brief Creates a reusable decryption context for a fahe2_key.
+ *
+ * This function precomputes the reduction data for p and reserves the
+ * scratch BIGNUMs for the ciphertext size (bits(X) + bits(p) + 1) plus alpha
+ * bits of headroom for sums of ciphertexts. key.X may be NULL, in which case
+ * scratch storage grows on first use instead.
+ *
+ * @param[in] key The key to decrypt with. @see fahe2_key struct
+ *
+ * @return The initialized decryption context. Free with fahe2_dec_ctx_free.
+ */
+fahe2_dec_ctx *fahe2_dec_ctx_new(const fahe2_key *key);
+
+/**
+ * @brief Frees a decryption context created by fahe2_dec_ctx_new.
+ *
+ * @param[in] dec_ctx The context to free. NULL is ignored.
+ */
+void fahe2_dec_ctx_free(fahe2_dec_ctx *dec_ctx);
+
+/**
+ * @brief Decrypts a ciphertext using a reusable decryption context.
+ *
+ * This function computes the same message as fahe2_decrypt,
+ * ((ciphertext % p) >> (pos + alpha)) masked to m_max bits, using the
+ * precomputed reduction held by dec_ctx.
+ *
+ * @param[in] dec_ctx - A decryption context. @see fahe2_dec_ctx struct
+ * @param[in] ciphertext - The ciphertext to decrypt.
+ * @param[out] message - Where to store the result. If NULL, a new BIGNUM is
+ *                       allocated. Passing the same BIGNUM on every call
+ *                       avoids all allocation.
+ *
+ * @return message, or the newly allocated BIGNUM if message was NULL.
+ */
+BIGNUM *fahe2_decrypt_ctx(fahe2_dec_ctx *dec_ctx, const BIGNUM *ciphertext,
+                          BIGNUM *message);
+
+/**
+ * @brief Decrypts a ciphertext given as limbs using a decryption context.
+ *
+ * @see fahe2_decrypt_ctx. The ciphertext is reduced with
+ * fahe_reduce_limbs, so no BIGNUM of ciphertext size is built.
+ *
+ * @param[in] dec_ctx - A decryption context. @see fahe2_dec_ctx struct
+ * @param[in] ciphertext - Little-endian limbs of the ciphertext.
+ * @param[in] num_limbs - The number of limbs in ciphertext.
+ * @param[out] message - Where to store the result. If NULL, a new BIGNUM is
+ *                       allocated.
+ *
+ * @return message, or the newly allocated BIGNUM if message was NULL.
+ */
+BIGNUM *fahe2_decrypt_ctx_limbs(fahe2_dec_ctx *dec_ctx,
+                                 const uint64_t *ciphertext, size_t num_limbs,
+                                 BIGNUM *message);
+
+/**
+ * @brief Encrypts a list of messages on a thread pool.
+ *
+ * The list is split into chunks that the pool's threads claim dynamically.
+ * Each thread encrypts with its own fahe2_enc_ctx, created on its first
+ * chunk, so the ciphertexts are the same as from fahe2_encrypt_ctx.
+ *
+ * @param[in] key The key to encrypt with. @see fahe2_key struct
+ * @param[in] message_list The messages to encrypt.
+ * @param[in] list_size Number of messages.
+ * @param[in] pool The pool to run on, e.g. fahe_thread_pool_new(num_threads).
+ *                 NULL uses fahe_thread_pool_shared.
+ *
+ * @return A new list of list_size ciphertexts, in the order of message_list.
+ */
+BIGNUM **fahe2_encrypt_list_parallel(const fahe2_key *key,
+                                      BIGNUM **message_list, size_t list_size,
+                                      fahe_thread_pool *pool);
+
+/**
+ * @brief Decrypts a list of ciphertexts on a thread pool.
+ *
+ * @see fahe2_encrypt_list_parallel. Each thread decrypts with its own
+ * fahe2_dec_ctx.
+ *
+ * @param[in] key The key to decrypt with. @see fahe2_key struct
+ * @param[in] ciphertext_list The ciphertexts to decrypt.
+ * @param[in] list_size Number of ciphertexts.
+ * @param[in] pool The pool to run on. NULL uses fahe_thread_pool_shared.
+ *
+ * @return A new list of list_size messages masked to m_max bits, in the
+ *         order of ciphertext_list.
+ */
+BIGNUM **fahe2_decrypt_list_parallel(const fahe2_key *key,
+                                      BIGNUM **ciphertext_list,
+                                      size_t list_size,
+                                      fahe_thread_pool *pool);
+
+/**
+ * @brief Encrypts a list of messages into the rows of a batch.
+ *
+ * Row i receives the encryption of message_list[i], written in place by
+ * fahe2_encrypt_ctx_limbs on the threads of pool. No BIGNUM is allocated
+ * per ciphertext.
+ *
+ * @param[in] key The key to encrypt with. @see fahe2_key struct
+ * @param[in] message_list The messages to encrypt.
+ * @param[in] list_size Number of messages. Must be <= batch->capacity.
+ * @param[out] batch The destination. Its row_limbs must be at least the
+ *                   c_limbs of an encryption context for key. On success,
+ *                   batch->count is list_size.
+ * @param[in] pool The pool to run on. NULL uses fahe_thread_pool_shared.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe2_encrypt_batch(const fahe2_key *key, BIGNUM **message_list,
+                         size_t list_size, fahe_ct_batch *batch,
+                         fahe_thread_pool *pool);
+
+/**
+ * @brief Decrypts every row of a batch.
+ *
+ * Each row is reduced straight from its limbs with
+ * fahe2_decrypt_ctx_limbs on the threads of pool.
+ *
+ * @param[in] key The key to decrypt with. @see fahe2_key struct
+ * @param[in] batch The ciphertexts, e.g. from fahe2_encrypt_batch.
+ * @param[in] pool The pool to run on. NULL uses fahe_thread_pool_shared.
+ *
+ * @return A new list of batch->count messages masked to m_max bits.
+ */
+BIGNUM **fahe2_decrypt_batch(const fahe2_key *key,
+                              const fahe_ct_batch *batch,
+                              fahe_thread_pool *pool);
+
+/**
+ * @brief Fills the header of a FAHE file for the ciphertexts or messages
+ * of a key. @see fahefile.h
+ *
+ * The header gets the scheme, the parameters and gamma of the key and its
+ * fingerprint, which covers pos. row_limbs is the c_limbs of an encryption
+ * context for a file of ciphertexts, and FAHE_LIMBS(m_max) for a file of
+ * messages.
+ *
+ * @param[in] key The key. @see fahe2_key struct
+ * @param[in] kind FAHE_FILE_CIPHERTEXTS or FAHE_FILE_MESSAGES.
+ * @param[out] header The header, for fahe_file_write_batch or
+ *                    fahe_file_write_list.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe2_file_header(const fahe2_key *key, uint32_t kind,
+                       fahe_file_header *header);
+
+/**
+ * @brief Creates a stream that decrypts ciphertexts of a key as their bytes
+ * arrive. @see stream.h
+ *
+ * The messages are those of fahe2_decrypt, with the shift pos + alpha and
+ * the mask to m_max bits of the key.
+ *
+ * @param[in] key The key to decrypt with. @see fahe2_key struct
+ * @param[in] order Byte order of the ciphertexts.
+ *
+ * @return The stream. Free with fahe_decrypt_stream_free.
+ */
+fahe_decrypt_stream *fahe2_decrypt_stream_new(const fahe2_key *key,
+                                              fahe_stream_order order);
+
+/**
+ * @brief Creates a stream that produces ciphertexts limb by limb, with
+ * working memory of a few times eta bits. @see stream.h
+ *
+ * @param[in] enc_ctx The encryption context whose limbs of p and X + 1 the
+ *                    stream borrows. It must outlive the stream, but is not
+ *                    used by it otherwise, so streams may run on other
+ *                    threads.
+ *
+ * @return The stream. Free with fahe_encrypt_stream_free.
+ */
+fahe_encrypt_stream *fahe2_encrypt_stream_new(const fahe2_enc_ctx *enc_ctx);
+
+/**
+ * @brief Encodes a message and starts its ciphertext on a stream.
+ *
+ * The noise is drawn and M encoded on enc_ctx, as in
+ * fahe2_encrypt_ctx_limbs; q is drawn by the stream as it is read. The
+ * bytes read from the stream are those of the c_limbs limbs that
+ * fahe2_encrypt_ctx_limbs writes, for the same M and q.
+ *
+ * @param[in] enc_ctx An encryption context for the key.
+ * @param[in] stream A stream of fahe2_encrypt_stream_new.
+ * @param[in] message The message to encrypt.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe2_encrypt_stream_begin(fahe2_enc_ctx *enc_ctx,
+                               fahe_encrypt_stream *stream,
+                               const BIGNUM *message);
+
 #endif  // FAHE2
\ No newline at end of file
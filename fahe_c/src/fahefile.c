@@ -0,0 +1,408 @@
+/**
+ * @file fahefile.c
+ * @brief Implementation of the binary file format and its mmap reader.
+ *
+ * Header fields are encoded byte by byte, so headers are portable. Records
+ * are written from and mapped as host limbs, which like the rest of the
+ * limb code assumes a little-endian host.
+ *
+ * Dependencies:
+ * - fcntl.h
+ * - openssl/bn.h
+ * - openssl/crypto.h
+ * - openssl/evp.h
+ * - sys/mman.h
+ * - sys/stat.h
+ * - unistd.h
+ * - batch.h
+ * - limb.h
+ * - logger.h
+ *
+ * @see fahefile.h for the documentation of the functions implemented here.
+ */
+
+#include "fahefile.h"
+
+#include <fcntl.h>
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "limb.h"
+#include "logger.h"
+
+#define FILE_MAGIC "FAHEFILE"
+#define FILE_LEGACY_MAGIC "FAHECTB1"
+#define FILE_LEGACY_HEADER_BYTES 24
+#define FILE_FINGERPRINT_LABEL "FAHE key fingerprint 1"
+
+static void store_le32(unsigned char *buf, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    buf[i] = (unsigned char)(v >> (8 * i));
+  }
+}
+
+static void store_le64(unsigned char *buf, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    buf[i] = (unsigned char)(v >> (8 * i));
+  }
+}
+
+static uint32_t load_le32(const unsigned char *buf) {
+  uint32_t v = 0;
+  for (int i = 3; i >= 0; i--) {
+    v = (v << 8) | buf[i];
+  }
+  return v;
+}
+
+static uint64_t load_le64(const unsigned char *buf) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) {
+    v = (v << 8) | buf[i];
+  }
+  return v;
+}
+
+// Bytes of header a file starting with magic needs, 0 for an unknown magic
+static size_t header_known_bytes(const unsigned char *magic) {
+  if (memcmp(magic, FILE_MAGIC, 8) == 0) {
+    return FAHE_FILE_HEADER_BYTES;
+  }
+  if (memcmp(magic, FILE_LEGACY_MAGIC, 8) == 0) {
+    return FILE_LEGACY_HEADER_BYTES;
+  }
+  return 0;
+}
+
+// Decodes the header_known_bytes(buf) bytes at buf
+static int header_decode(const unsigned char *buf, fahe_file_header *header) {
+  memset(header, 0, sizeof(fahe_file_header));
+  header->kind = FAHE_FILE_CIPHERTEXTS;
+
+  if (memcmp(buf, FILE_LEGACY_MAGIC, 8) == 0) {
+    header->header_bytes = FILE_LEGACY_HEADER_BYTES;
+    header->row_limbs = load_le64(buf + 8);
+    header->count = load_le64(buf + 16);
+  } else {
+    header->version = load_le32(buf + 8);
+    header->header_bytes = load_le32(buf + 12);
+    header->kind = load_le32(buf + 16);
+    header->scheme = (int)load_le32(buf + 20);
+    header->lambda = (int)load_le32(buf + 24);
+    header->m_max = (int)load_le32(buf + 28);
+    header->alpha = (int)load_le32(buf + 32);
+    header->gamma = load_le64(buf + 40);
+    header->count = load_le64(buf + 48);
+    header->row_limbs = load_le64(buf + 56);
+    memcpy(header->fingerprint, buf + 64, FAHE_FILE_FINGERPRINT_BYTES);
+
+    if (header->version < 1 || header->version > FAHE_FILE_VERSION) {
+      log_message(LOG_ERROR, "Unsupported file version %u\n",
+                  header->version);
+      return 0;
+    }
+    if (header->header_bytes < FAHE_FILE_HEADER_BYTES ||
+        header->header_bytes % sizeof(uint64_t) != 0) {
+      log_message(LOG_ERROR, "Invalid header size %u\n", header->header_bytes);
+      return 0;
+    }
+    if (header->kind > FAHE_FILE_MESSAGES) {
+      log_message(LOG_ERROR, "Unknown record kind %u\n", header->kind);
+      return 0;
+    }
+  }
+
+  if (header->row_limbs == 0) {
+    log_message(LOG_ERROR, "Records need at least one limb\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Checks that avail bytes hold the records of header. avail is
+// SIZE_MAX when the length is unknown, which still refuses records whose
+// size does not fit in a size_t.
+static int header_check_records(const fahe_file_header *header,
+                                size_t avail) {
+  if (header->count > avail / sizeof(uint64_t) / header->row_limbs) {
+    log_message(LOG_ERROR, "File is shorter than its %llu records\n",
+                (unsigned long long)header->count);
+    return 0;
+  }
+  return 1;
+}
+
+void fahe_file_header_init(fahe_file_header *header, uint32_t kind) {
+  memset(header, 0, sizeof(fahe_file_header));
+  header->version = FAHE_FILE_VERSION;
+  header->header_bytes = FAHE_FILE_HEADER_BYTES;
+  header->kind = kind;
+}
+
+// Hashes a BIGNUM as a 32-bit length followed by its big-endian bytes
+static int fingerprint_bn(EVP_MD_CTX *md, const BIGNUM *bn) {
+  int len = BN_num_bytes(bn);
+  unsigned char prefix[4];
+  store_le32(prefix, (uint32_t)len);
+  unsigned char *bytes = malloc(len > 0 ? (size_t)len : 1);
+  if (!bytes) {
+    return 0;
+  }
+  BN_bn2bin(bn, bytes);
+  int ok = EVP_DigestUpdate(md, prefix, sizeof(prefix)) &&
+           EVP_DigestUpdate(md, bytes, (size_t)len);
+  OPENSSL_cleanse(bytes, (size_t)len);
+  free(bytes);
+  return ok;
+}
+
+int fahe_file_fingerprint(fahe_file_header *header, const BIGNUM *p,
+                          const BIGNUM *X, uint64_t extra) {
+  if (!p || !X) {
+    log_message(LOG_ERROR, "Fingerprint needs p and X\n");
+    return 0;
+  }
+
+  unsigned char fields[32];
+  store_le32(fields, (uint32_t)header->scheme);
+  store_le32(fields + 4, (uint32_t)header->lambda);
+  store_le32(fields + 8, (uint32_t)header->m_max);
+  store_le32(fields + 12, (uint32_t)header->alpha);
+  store_le64(fields + 16, header->gamma);
+  store_le64(fields + 24, extra);
+
+  EVP_MD_CTX *md = EVP_MD_CTX_new();
+  unsigned int len = 0;
+  int ok = md && EVP_DigestInit_ex(md, EVP_sha256(), NULL) &&
+           EVP_DigestUpdate(md, FILE_FINGERPRINT_LABEL,
+                            sizeof(FILE_FINGERPRINT_LABEL)) &&
+           EVP_DigestUpdate(md, fields, sizeof(fields)) &&
+           fingerprint_bn(md, p) && fingerprint_bn(md, X) &&
+           EVP_DigestFinal_ex(md, header->fingerprint, &len) &&
+           len == FAHE_FILE_FINGERPRINT_BYTES;
+  EVP_MD_CTX_free(md);
+  if (!ok) {
+    log_message(LOG_ERROR, "Computing the key fingerprint failed\n");
+    return 0;
+  }
+  return 1;
+}
+
+int fahe_file_header_write(const fahe_file_header *header, FILE *stream) {
+  unsigned char buf[FAHE_FILE_HEADER_BYTES];
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, FILE_MAGIC, 8);
+  store_le32(buf + 8, FAHE_FILE_VERSION);
+  store_le32(buf + 12, FAHE_FILE_HEADER_BYTES);
+  store_le32(buf + 16, header->kind);
+  store_le32(buf + 20, (uint32_t)header->scheme);
+  store_le32(buf + 24, (uint32_t)header->lambda);
+  store_le32(buf + 28, (uint32_t)header->m_max);
+  store_le32(buf + 32, (uint32_t)header->alpha);
+  store_le64(buf + 40, header->gamma);
+  store_le64(buf + 48, header->count);
+  store_le64(buf + 56, header->row_limbs);
+  memcpy(buf + 64, header->fingerprint, FAHE_FILE_FINGERPRINT_BYTES);
+
+  if (fwrite(buf, 1, sizeof(buf), stream) != sizeof(buf)) {
+    log_message(LOG_ERROR, "Writing the file header failed\n");
+    return 0;
+  }
+  return 1;
+}
+
+int fahe_file_header_read(FILE *stream, fahe_file_header *header) {
+  unsigned char buf[FAHE_FILE_HEADER_BYTES];
+  size_t known = 0;
+  if (fread(buf, 1, 8, stream) != 8 ||
+      (known = header_known_bytes(buf)) == 0 ||
+      fread(buf + 8, 1, known - 8, stream) != known - 8) {
+    log_message(LOG_ERROR, "Not a FAHE file\n");
+    return 0;
+  }
+  if (!header_decode(buf, header)) {
+    return 0;
+  }
+
+  // Skip the fields a later revision appended to the header
+  for (size_t skip = header->header_bytes - known; skip > 0;) {
+    size_t n = skip < sizeof(buf) ? skip : sizeof(buf);
+    if (fread(buf, 1, n, stream) != n) {
+      log_message(LOG_ERROR, "File ends inside its header\n");
+      return 0;
+    }
+    skip -= n;
+  }
+
+  // A seekable stream must hold all the records
+  size_t avail = SIZE_MAX;
+  off_t here = ftello(stream);
+  if (here >= 0 && fseeko(stream, 0, SEEK_END) == 0) {
+    off_t end = ftello(stream);
+    if (fseeko(stream, here, SEEK_SET) != 0) {
+      log_message(LOG_ERROR, "Could not seek back to the first record\n");
+      return 0;
+    }
+    avail = end > here ? (size_t)(end - here) : 0;
+  }
+  return header_check_records(header, avail);
+}
+
+int fahe_file_write_batch(const fahe_file_header *header,
+                          const fahe_ct_batch *batch, FILE *stream) {
+  fahe_file_header out;
+  if (header) {
+    out = *header;
+  } else {
+    fahe_file_header_init(&out, FAHE_FILE_CIPHERTEXTS);
+  }
+  out.count = batch->count;
+  out.row_limbs = batch->row_limbs;
+  if (!fahe_file_header_write(&out, stream)) {
+    return 0;
+  }
+
+  // Without padding the rows are one block; with it, write row by row
+  if (batch->row_stride == batch->row_limbs) {
+    size_t n = batch->count * batch->row_limbs;
+    if (fwrite(batch->limbs, sizeof(uint64_t), n, stream) != n) {
+      log_message(LOG_ERROR, "Writing the batch rows failed\n");
+      return 0;
+    }
+    return 1;
+  }
+  for (size_t i = 0; i < batch->count; i++) {
+    if (fwrite(fahe_ct_batch_row(batch, i), sizeof(uint64_t),
+               batch->row_limbs, stream) != batch->row_limbs) {
+      log_message(LOG_ERROR, "Writing batch row %zu failed\n", i);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int fahe_file_write_list(const fahe_file_header *header, BIGNUM **list,
+                         size_t n, FILE *stream) {
+  fahe_file_header out = *header;
+  out.count = n;
+  if (out.row_limbs == 0) {
+    out.row_limbs = 1;
+    for (size_t i = 0; i < n; i++) {
+      size_t limbs = FAHE_LIMBS(BN_num_bits(list[i]));
+      if (limbs > out.row_limbs) {
+        out.row_limbs = limbs;
+      }
+    }
+  }
+  if (!fahe_file_header_write(&out, stream)) {
+    return 0;
+  }
+
+  uint64_t *row = malloc(out.row_limbs * sizeof(uint64_t));
+  if (!row) {
+    log_message(LOG_FATAL, "Memory allocation for a record failed\n");
+    exit(EXIT_FAILURE);
+  }
+  int ok = 1;
+  for (size_t i = 0; i < n && ok; i++) {
+    if (BN_is_negative(list[i]) ||
+        !limbs_from_bn(list[i], row, out.row_limbs)) {
+      log_message(LOG_ERROR, "Value %zu does not fit in %llu limbs\n", i,
+                  (unsigned long long)out.row_limbs);
+      ok = 0;
+    } else if (fwrite(row, sizeof(uint64_t), out.row_limbs, stream) !=
+               out.row_limbs) {
+      log_message(LOG_ERROR, "Writing record %zu failed\n", i);
+      ok = 0;
+    }
+  }
+  OPENSSL_cleanse(row, out.row_limbs * sizeof(uint64_t));
+  free(row);
+  return ok;
+}
+
+fahe_file *fahe_file_open(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    log_message(LOG_ERROR, "Could not open %s\n", path);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 8) {
+    log_message(LOG_ERROR, "%s is not a FAHE file\n", path);
+    close(fd);
+    return NULL;
+  }
+  size_t map_bytes = (size_t)st.st_size;
+  void *map = mmap(NULL, map_bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    log_message(LOG_ERROR, "Could not map %s\n", path);
+    return NULL;
+  }
+
+  fahe_file_header header;
+  size_t known = header_known_bytes(map);
+  if (known == 0 || map_bytes < known || !header_decode(map, &header)) {
+    log_message(LOG_ERROR, "%s is not a FAHE file\n", path);
+    munmap(map, map_bytes);
+    return NULL;
+  }
+  if (map_bytes < header.header_bytes ||
+      !header_check_records(&header, map_bytes - header.header_bytes)) {
+    log_message(LOG_ERROR, "%s is shorter than its header says\n", path);
+    munmap(map, map_bytes);
+    return NULL;
+  }
+
+  fahe_file *file = (fahe_file *)malloc(sizeof(fahe_file));
+  if (!file) {
+    log_message(LOG_FATAL, "Memory allocation for fahe_file failed\n");
+    exit(EXIT_FAILURE);
+  }
+  file->header = header;
+  file->rows = (const uint64_t *)((const unsigned char *)map +
+                                  header.header_bytes);
+  file->map = map;
+  file->map_bytes = map_bytes;
+
+  // Start paging the records in before the first of them is touched
+  madvise(map, map_bytes, MADV_WILLNEED);
+
+  file->batch.count = header.count;
+  file->batch.capacity = header.count;
+  file->batch.row_limbs = header.row_limbs;
+  file->batch.row_stride = header.row_limbs;
+  file->batch.limbs = (uint64_t *)file->rows;
+  file->batch.alloc_bytes = 0;
+  file->batch.mapped = 0;
+  return file;
+}
+
+int fahe_file_get(const fahe_file *file, size_t i, BIGNUM *value) {
+  if (i >= file->header.count) {
+    log_message(LOG_ERROR, "Record %zu is past count %llu\n", i,
+                (unsigned long long)file->header.count);
+    return 0;
+  }
+  return limbs_to_bn(fahe_file_row(file, i), file->header.row_limbs, value);
+}
+
+const fahe_ct_batch *fahe_file_batch(const fahe_file *file) {
+  return &file->batch;
+}
+
+void fahe_file_close(fahe_file *file) {
+  if (!file) {
+    return;
+  }
+  munmap(file->map, file->map_bytes);
+  free(file);
+}
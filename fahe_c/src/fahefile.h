@@ -0,0 +1,291 @@
+/**
+ * @file fahefile.h
+ * @brief Header file for fahefile.c, the versioned binary file format for
+ * ciphertexts and messages and its mmap reader.
+ *
+ * A file is a FAHE_FILE_HEADER_BYTES header followed by count records of
+ * row_limbs little-endian 64-bit limbs each, least significant limb first
+ * and without padding. All header fields are little-endian:
+ *
+ *   offset  size  field
+ *        0     8  magic "FAHEFILE"
+ *        8     4  version, FAHE_FILE_VERSION
+ *       12     4  header_bytes, the offset of the first record
+ *       16     4  kind, FAHE_FILE_CIPHERTEXTS or FAHE_FILE_MESSAGES
+ *       20     4  scheme, 1 or 2, 0 if the file is not tied to a key
+ *       24     4  lambda
+ *       28     4  m_max
+ *       32     4  alpha
+ *       36     4  reserved, zero
+ *       40     8  gamma
+ *       48     8  count
+ *       56     8  row_limbs
+ *       64    32  fingerprint, SHA-256 of the key, zero if not tied to one
+ *       96    32  reserved, zero
+ *
+ * Readers skip to header_bytes, so a later revision may append fields to
+ * the header without changing the version; the version only changes when
+ * the meaning of the existing fields or of the records does.
+ *
+ * Records are fixed width, so record i starts at
+ * header_bytes + 8 * row_limbs * i and a reader can seek to it, or map the
+ * file and use it in place: fahe_file_open hands out the rows of the
+ * mapping, and a fahe_ct_batch over them that decryption and summation
+ * accept as is.
+ *
+ * The fingerprint lets a reader check that a file was written under the
+ * key it holds before decrypting garbage. @see fahe1_file_header
+ * @see fahe2_file_header
+ *
+ * fahe_ct_batch_write writes this format with a header that is not tied to
+ * a key; fahe_ct_batch_read and fahe_file_open still accept the FAHECTB1
+ * streams that fahe_ct_batch_write produced before, which they report as
+ * version 0.
+ *
+ * This file contains the following structs: fahe_file_header, fahe_file
+ *                and the following methods: fahe_file_header_init,
+ * fahe_file_fingerprint, fahe_file_header_write, fahe_file_header_read,
+ * fahe_file_write_batch, fahe_file_write_list, fahe_file_open,
+ * fahe_file_row, fahe_file_get, fahe_file_batch, fahe_file_close
+ */
+
+#ifndef FAHEFILE_H
+#define FAHEFILE_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "batch.h"
+
+/**
+ * @brief Version written by this code and the newest one it reads.
+ */
+#define FAHE_FILE_VERSION 1
+
+/**
+ * @brief Size of the version 1 header, a multiple of 64 so that records
+ * start on a cache line of a mapping.
+ */
+#define FAHE_FILE_HEADER_BYTES 128
+
+/**
+ * @brief Size of the key fingerprint, a SHA-256 digest.
+ */
+#define FAHE_FILE_FINGERPRINT_BYTES 32
+
+/**
+ * @brief What the records of a file hold.
+ */
+typedef enum {
+  FAHE_FILE_CIPHERTEXTS = 0,
+  FAHE_FILE_MESSAGES = 1
+} fahe_file_kind;
+
+/**
+ * @typedef fahe_file_header
+ * @brief The decoded header of a file. @see fahefile.h for the layout.
+ */
+
+/**
+ * @struct fahe_file_header
+ *
+ * @var fahe_file_header: version, header_bytes (uint32_t)
+ * Format version and offset of the first record. Version 0 is a FAHECTB1
+ * stream, whose header is 24 bytes and carries no key.
+ *
+ * @var fahe_file_header: kind (uint32_t)
+ * A fahe_file_kind.
+ *
+ * @var fahe_file_header: scheme, lambda, m_max, alpha (int)
+ * Scheme and parameters of the key, all 0 if the file is not tied to one.
+ *
+ * @var fahe_file_header: gamma (uint64_t)
+ * The gamma the key was generated with, 0 if not tied to a key.
+ *
+ * @var fahe_file_header: count, row_limbs (uint64_t)
+ * Number of records and limbs per record.
+ *
+ * @var fahe_file_header: fingerprint (unsigned char[32])
+ * @see fahe_file_fingerprint. Zero if not tied to a key.
+ */
+typedef struct {
+  uint32_t version;
+  uint32_t header_bytes;
+  uint32_t kind;
+  int scheme;
+  int lambda;
+  int m_max;
+  int alpha;
+  uint64_t gamma;
+  uint64_t count;
+  uint64_t row_limbs;
+  unsigned char fingerprint[FAHE_FILE_FINGERPRINT_BYTES];
+} fahe_file_header;
+
+/**
+ * @typedef fahe_file
+ * @brief A file mapped read-only by fahe_file_open.
+ */
+
+/**
+ * @struct fahe_file
+ *
+ * @var fahe_file: header (fahe_file_header)
+ * The decoded header.
+ *
+ * @var fahe_file: rows (const uint64_t*)
+ * count * row_limbs limbs inside the mapping.
+ *
+ * @var fahe_file: batch (fahe_ct_batch)
+ * A batch whose rows are the records. @see fahe_file_batch
+ *
+ * @var fahe_file: map, map_bytes (void*, size_t)
+ * The mapping of the whole file.
+ */
+typedef struct {
+  fahe_file_header header;
+  const uint64_t *rows;
+  fahe_ct_batch batch;
+  void *map;
+  size_t map_bytes;
+} fahe_file;
+
+/**
+ * @brief Fills a header that is not tied to a key: the current version,
+ * FAHE_FILE_HEADER_BYTES, the kind and zeroes everywhere else.
+ *
+ * @param[out] header The header.
+ * @param[in] kind A fahe_file_kind.
+ */
+void fahe_file_header_init(fahe_file_header *header, uint32_t kind);
+
+/**
+ * @brief Sets header->fingerprint to the fingerprint of a key.
+ *
+ * The fingerprint is the SHA-256 of a fixed label, scheme, lambda, m_max,
+ * alpha and gamma as taken from the header, extra, and p and X as
+ * length-prefixed big-endian bytes. It is one-way, but as it is computed
+ * over the secret p, files should still be stored as the key would be.
+ *
+ * @param[in,out] header Header with the key fields already set.
+ * @param[in] p The secret prime of the key.
+ * @param[in] X The X of the key.
+ * @param[in] extra Further key material, e.g. the pos of a fahe2_key.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_file_fingerprint(fahe_file_header *header, const BIGNUM *p,
+                          const BIGNUM *X, uint64_t extra);
+
+/**
+ * @brief Writes a version 1 header to a stream.
+ *
+ * header->version and header->header_bytes are ignored: the header is
+ * always written as FAHE_FILE_VERSION and FAHE_FILE_HEADER_BYTES.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_file_header_write(const fahe_file_header *header, FILE *stream);
+
+/**
+ * @brief Reads a header and leaves the stream at the first record.
+ *
+ * Accepts versions 0 (FAHECTB1) to FAHE_FILE_VERSION and skips whatever
+ * lies between the known fields and header_bytes. count * row_limbs is
+ * checked as fahe_file_open does: a seekable stream must hold all the
+ * records, and on any stream their size must fit in a size_t.
+ *
+ * @param[in] stream An open binary stream.
+ * @param[out] header The decoded header.
+ *
+ * @return 1 on success, 0 if the stream is not a file of a known version
+ *         or cannot hold its records.
+ */
+int fahe_file_header_read(FILE *stream, fahe_file_header *header);
+
+/**
+ * @brief Writes the used rows of a batch as a file.
+ *
+ * @param[in] header Kind and key fields of the file, or NULL for a file of
+ *                   ciphertexts that is not tied to a key. count and
+ *                   row_limbs are taken from the batch.
+ * @param[in] batch The rows to write.
+ * @param[in] stream An open binary stream.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_file_write_batch(const fahe_file_header *header,
+                          const fahe_ct_batch *batch, FILE *stream);
+
+/**
+ * @brief Writes a list of BIGNUMs as a file, e.g. the ciphertexts of
+ * fahe1_encrypt_list or the messages they encrypt.
+ *
+ * @param[in] header Kind and key fields of the file. If row_limbs is 0 the
+ *                   records are as wide as the largest value. count is
+ *                   taken from n.
+ * @param[in] list The values, none negative or wider than row_limbs.
+ * @param[in] n Length of the list.
+ * @param[in] stream An open binary stream.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_file_write_list(const fahe_file_header *header, BIGNUM **list,
+                         size_t n, FILE *stream);
+
+/**
+ * @brief Maps a file read-only and checks its header.
+ *
+ * Nothing is copied: the records are read from the page cache as they are
+ * touched. The file must not be truncated while it is open.
+ *
+ * @param[in] path The file to open.
+ *
+ * @return The open file, or NULL if it cannot be mapped, is not a file of
+ *         a known version or is shorter than its header says. Close with
+ *         fahe_file_close.
+ */
+fahe_file *fahe_file_open(const char *path);
+
+/**
+ * @brief Returns the limbs of record i, inside the mapping.
+ *
+ * @param[in] file The open file.
+ * @param[in] i The record. Must be < header.count.
+ *
+ * @return A pointer to header.row_limbs limbs, valid until the file is
+ *         closed.
+ */
+static inline const uint64_t *fahe_file_row(const fahe_file *file,
+                                            size_t i) {
+  return file->rows + i * file->header.row_limbs;
+}
+
+/**
+ * @brief Copies record i into a BIGNUM.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_file_get(const fahe_file *file, size_t i, BIGNUM *value);
+
+/**
+ * @brief Returns a batch over the records of the file, for
+ * fahe1_decrypt_batch, fahe2_decrypt_batch and fahe_ct_batch_sum.
+ *
+ * The batch belongs to the file: its rows are read-only and it must not be
+ * passed to fahe_ct_batch_free, fahe_ct_batch_set or an encryption.
+ *
+ * @return The batch, valid until the file is closed.
+ */
+const fahe_ct_batch *fahe_file_batch(const fahe_file *file);
+
+/**
+ * @brief Unmaps and frees a file.
+ *
+ * @param[in] file The file to close. NULL is ignored.
+ */
+void fahe_file_close(fahe_file *file);
+
+#endif  // FAHEFILE_H
@@ -8,6 +8,9 @@
 #include "fahe1.h"
 #include "fahe2.h"
 #include "logger.h"
+#include "radix.h"
+#include "rng.h"
+#include "textio.h"
 
 BIGNUM *rand_bignum_below(const BIGNUM *upper_bound) {
   BIGNUM *rand_bn = BN_new();
@@ -16,8 +19,8 @@ BIGNUM *rand_bignum_below(const BIGNUM *upper_bound) {
     exit(EXIT_FAILURE);
   }
 
-  if (!BN_rand_range(rand_bn, upper_bound)) {
-    log_message(LOG_FATAL, "BN_rand_range failed\n");
+  if (!fahe_rng_bn_below(fahe_rng_thread(), rand_bn, upper_bound)) {
+    log_message(LOG_FATAL, "fahe_rng_bn_below failed\n");
     BN_free(rand_bn);
     exit(EXIT_FAILURE);
   }
@@ -39,8 +42,8 @@ BIGNUM *rand_bits_below(unsigned int bitlength) {
     exit(EXIT_FAILURE);
   }
 
-  if (!BN_rand(rand_bn, bitlength, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY)) {
-    log_message(LOG_FATAL, "BN_rand failed\n");
+  if (!fahe_rng_bn_bits(fahe_rng_thread(), rand_bn, (int)bitlength)) {
+    log_message(LOG_FATAL, "fahe_rng_bn_bits failed\n");
     BN_free(rand_bn);
     exit(EXIT_FAILURE);
   }
@@ -48,6 +51,22 @@ BIGNUM *rand_bits_below(unsigned int bitlength) {
   return rand_bn;
 }
 
+// Grows bn's storage to hold `bits` bits so later operations writing into it
+// do not reallocate. The value of bn is reset to zero. One limb more than
+// needed is reserved because BN_add expands its output to one limb past the
+// longer input before adding.
+int bn_reserve_bits(BIGNUM *bn, int bits) {
+  if (bits <= 0) {
+    BN_zero(bn);
+    return 1;
+  }
+  if (!BN_set_bit(bn, bits + 63)) {
+    return 0;
+  }
+  BN_zero(bn);
+  return 1;
+}
+
 BIGNUM *generate_big_message(unsigned int message_size) {
   BIGNUM *BN_message = BN_new();
   if (!BN_message) {
@@ -120,7 +139,7 @@ void debug_fahe1_init(fahe1 *fahe1_instance) {
   printf("msg_size: %u\n", fahe1_instance->msg_size);
 
   // Print num_additions
-  char *num_additions_str = BN_bn2dec(fahe1_instance->num_additions);
+  char *num_additions_str = fahe_bn2dec(fahe1_instance->num_additions);
   if (num_additions_str) {
     printf("num_additions: %s\n", num_additions_str);
     OPENSSL_free(num_additions_str);
@@ -141,7 +160,7 @@ void debug_fahe2_init(fahe2 *fahe2_instance) {
   printf("msg_size: %u\n", fahe2_instance->msg_size);
 
   // Print num_additions
-  char *num_additions_str = BN_bn2dec(fahe2_instance->num_additions);
+  char *num_additions_str = fahe_bn2dec(fahe2_instance->num_additions);
   if (num_additions_str) {
     printf("num_additions: %s\n", num_additions_str);
     OPENSSL_free(num_additions_str);
@@ -152,7 +171,7 @@ void debug_fahe2_init(fahe2 *fahe2_instance) {
 
 // Helper function to print a BIGNUM
 void print_bn(const char *label, BIGNUM *bn) {
-  char *bn_str = BN_bn2dec(bn);
+  char *bn_str = fahe_bn2dec(bn);
   if (bn_str) {
     fprintf(stdout, "%s: %s\n", label, bn_str);
     OPENSSL_free(bn_str);  // Free the allocated string
@@ -163,7 +182,7 @@ void print_bn(const char *label, BIGNUM *bn) {
 
 void print_bn_list(const char *label, BIGNUM **bn_list, unsigned int len) {
   for (unsigned int i = 0; i < len; i++) {
-    char *bn_str = BN_bn2dec(bn_list[i]);
+    char *bn_str = fahe_bn2dec(bn_list[i]);
     if (bn_str) {
       fprintf(stdout, "%s[%u]: %s\n", label, i, bn_str);
       OPENSSL_free(bn_str);
@@ -183,7 +202,7 @@ void write_messages_to_file(BIGNUM **message_list, unsigned int num_msgs,
   }
 
   for (unsigned int i = 0; i < num_msgs; i++) {
-    char *msg_str = BN_bn2dec(message_list[i]);
+    char *msg_str = fahe_bn2dec_parallel(message_list[i], NULL);
     if (msg_str) {
       fprintf(file, "%s", msg_str);
       if (i < num_msgs - 1) {
@@ -200,79 +219,50 @@ void write_messages_to_file(BIGNUM **message_list, unsigned int num_msgs,
   fclose(file);
 }
 
-BIGNUM **read_bignum_list_from_file(const char *filename, int *num_elements) {
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-    fprintf(stderr, "Failed to open file %s for reading\n", filename);
-    return NULL;
-  }
-
-  // Read the file content into a string
-  fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  char *file_content = (char *)malloc(file_size + 1);
-  if (!file_content) {
-    fprintf(stderr, "Memory allocation failed\n");
-    fclose(file);
-    return NULL;
-  }
-
-  fread(file_content, 1, file_size, file);
-  file_content[file_size] = '\0';
-  fclose(file);
-
-  // Count the number of elements
-  *num_elements = 1;  // There's at least one number
-  for (char *p = file_content; *p; p++) {
-    if (*p == ',') {
-      (*num_elements)++;
+typedef struct {
+  BIGNUM **list;
+  size_t num;
+  size_t cap;
+} bignum_list_builder;
+
+static int append_bignum(void *arg, size_t index, const BIGNUM *value) {
+  (void)index;
+  bignum_list_builder *builder = (bignum_list_builder *)arg;
+  if (builder->num == builder->cap) {
+    size_t cap = 2 * builder->cap;
+    BIGNUM **list = realloc(builder->list, cap * sizeof(BIGNUM *));
+    if (!list) {
+      return 0;
     }
+    builder->list = list;
+    builder->cap = cap;
   }
+  builder->list[builder->num] = BN_dup(value);
+  return builder->list[builder->num++] != NULL;
+}
 
-  // Allocate memory for the BIGNUM list
-  BIGNUM **bignum_list = (BIGNUM **)malloc(*num_elements * sizeof(BIGNUM *));
-  if (!bignum_list) {
-    fprintf(stderr, "Memory allocation failed\n");
-    free(file_content);
+BIGNUM **read_bignum_list_from_file(const char *filename, int *num_elements) {
+  bignum_list_builder builder;
+  builder.num = 0;
+  builder.cap = 16;
+  builder.list = (BIGNUM **)malloc(builder.cap * sizeof(BIGNUM *));
+  if (!builder.list) {
+    log_message(LOG_ERROR, "Memory allocation failed\n");
     return NULL;
   }
 
-  // Split the file content by commas and convert to BIGNUMs
-  char *token = strtok(file_content, ",");
-  int index = 0;
-  while (token) {
-    bignum_list[index] = BN_new();
-    if (!bignum_list[index]) {
-      fprintf(stderr, "BN_new failed\n");
-      // Free previously allocated BIGNUMs
-      for (int j = 0; j < index; j++) {
-        BN_free(bignum_list[j]);
-      }
-      free(bignum_list);
-      free(file_content);
-      return NULL;
+  // Parsed a window at a time, so the file is never held in memory whole
+  if (!fahe_text_read_file(filename, NULL, append_bignum, &builder, NULL)) {
+    log_message(LOG_ERROR, "Failed to read %s\n", filename);
+    for (size_t i = 0; i < builder.num; i++) {
+      BN_free(builder.list[i]);
     }
-
-    if (!BN_dec2bn(&bignum_list[index], token)) {
-      fprintf(stderr, "BN_dec2bn failed for token %s\n", token);
-      // Free previously allocated BIGNUMs
-      for (int j = 0; j < index; j++) {
-        BN_free(bignum_list[j]);
-      }
-      BN_free(bignum_list[index]);
-      free(bignum_list);
-      free(file_content);
-      return NULL;
-    }
-
-    token = strtok(NULL, ",");
-    index++;
+    free(builder.list);
+    return NULL;
   }
 
-  free(file_content);
-  return bignum_list;
+  *num_elements = (int)builder.num;
+  return builder.list;
 }
 
 void print_test_table(char *test_name, fahe_params params, int num_trials,
@@ -4,6 +4,7 @@
 BIGNUM *rand_bignum_below(const BIGNUM *upper_bound);
 int rand_int_below(int x);
 BIGNUM *rand_bits_below(unsigned int bitlength);
+int bn_reserve_bits(BIGNUM *bn, int bits);
 BIGNUM *generate_big_message(unsigned int message_size);
 BIGNUM **generate_message_list(unsigned int message_size, BIGNUM *num_messages);
 void free_message_list(BIGNUM **message_list, int list_size);
@@ -0,0 +1,223 @@
+/**
+ * @file keygen.c
+ * @brief Implementation of the parallel prime search and of X = 2**gamma / p.
+ *
+ * Candidates of a window are start + step * i for i < FAHE_PRIME_WINDOW,
+ * with start odd and step 2. For a safe prime, start = 3 mod 4 and step 4,
+ * so that q = (p - 1) / 2 is odd; the sieve then also strikes out the
+ * candidates whose q has a small factor, i.e. p = 1 mod s.
+ *
+ * Dependencies:
+ * - math.h
+ * - openssl/bn.h
+ * - pthread.h
+ * - logger.h
+ * - thread_pool.h
+ *
+ * @see keygen.h for the documentation of the functions implemented here.
+ */
+
+#include "keygen.h"
+
+#include <math.h>
+#include <openssl/bn.h>
+#include <openssl/opensslv.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "logger.h"
+#include "thread_pool.h"
+
+static uint16_t sieve_primes[FAHE_PRIME_SIEVE_PRIMES];
+static pthread_once_t sieve_once = PTHREAD_ONCE_INIT;
+
+typedef struct {
+  BIGNUM *p;
+  int bits;
+  int safe;
+  int found;
+  int failed;
+} prime_job;
+
+// Sieve of Eratosthenes for the first FAHE_PRIME_SIEVE_PRIMES odd primes
+static void sieve_init(void) {
+  enum { LIMIT = 18000 };
+  static unsigned char composite[LIMIT];
+  int n = 0;
+  for (int i = 3; i < LIMIT && n < FAHE_PRIME_SIEVE_PRIMES; i += 2) {
+    if (composite[i]) {
+      continue;
+    }
+    sieve_primes[n++] = (uint16_t)i;
+    for (int j = i * i; j < LIMIT; j += 2 * i) {
+      composite[j] = 1;
+    }
+  }
+}
+
+// Lets Miller-Rabin give up once another thread has found p
+static int prime_cancel(int a, int b, BN_GENCB *cb) {
+  (void)a;
+  (void)b;
+  prime_job *job = (prime_job *)BN_GENCB_get_arg(cb);
+  return !__atomic_load_n(&job->found, __ATOMIC_ACQUIRE);
+}
+
+static int prime_check(const BIGNUM *c, BN_CTX *ctx, BN_GENCB *cb) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  return BN_check_prime(c, ctx, cb);
+#else
+  return BN_is_prime_fasttest_ex(c, BN_prime_checks, ctx, 0, cb);
+#endif
+}
+
+// Fermat test to base 2. It costs one Miller-Rabin round and lets the
+// safe-prime search reject a composite q before running all the rounds of
+// BN_check_prime on p.
+static int prime_fermat(const BIGNUM *c, BIGNUM *scratch, BN_CTX *ctx) {
+  if (!BN_copy(scratch, c) || !BN_sub_word(scratch, 1) ||
+      !BN_mod_exp_mont_word(scratch, 2, scratch, c, ctx, NULL)) {
+    return -1;
+  }
+  return BN_is_one(scratch);
+}
+
+// Marks the candidates of the window at start that have a small factor, or
+// whose (p - 1) / 2 does for a safe prime
+static int prime_sieve(unsigned char *sieve, const BIGNUM *start, int safe) {
+  memset(sieve, 0, FAHE_PRIME_WINDOW);
+  for (int k = 0; k < FAHE_PRIME_SIEVE_PRIMES; k++) {
+    uint64_t s = sieve_primes[k];
+    BN_ULONG r = BN_mod_word(start, (BN_ULONG)s);
+    if (r == (BN_ULONG)-1) {
+      return 0;
+    }
+    // start + step * i = v mod s  <=>  i = (v - r) / step mod s
+    uint64_t inv = (s + 1) / 2;
+    if (safe) {
+      inv = inv * inv % s;
+    }
+    for (uint64_t v = 0; v <= (uint64_t)(safe != 0); v++) {
+      uint64_t i = (v + s - r) % s * inv % s;
+      for (; i < FAHE_PRIME_WINDOW; i += s) {
+        sieve[i] = 1;
+      }
+    }
+  }
+  return 1;
+}
+
+static void prime_task(void *arg, size_t begin, size_t end,
+                       fahe_worker *worker) {
+  (void)begin;
+  (void)end;
+  prime_job *job = (prime_job *)arg;
+  unsigned char sieve[FAHE_PRIME_WINDOW];
+  BN_ULONG step = job->safe ? 4 : 2;
+
+  BN_CTX *ctx = worker->bn_ctx;
+  BN_CTX_start(ctx);
+  BIGNUM *start = BN_CTX_get(ctx);
+  BIGNUM *c = BN_CTX_get(ctx);
+  BIGNUM *q = BN_CTX_get(ctx);
+  BIGNUM *scratch = BN_CTX_get(ctx);
+  BN_GENCB *cb = BN_GENCB_new();
+  if (!scratch || !cb) {
+    __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->found, 1, __ATOMIC_RELEASE);
+  } else {
+    BN_GENCB_set(cb, prime_cancel, job);
+  }
+
+  while (!__atomic_load_n(&job->found, __ATOMIC_ACQUIRE)) {
+    if (!BN_priv_rand(start, job->bits, BN_RAND_TOP_ONE, BN_RAND_BOTTOM_ODD) ||
+        (job->safe && !BN_set_bit(start, 1)) ||
+        !prime_sieve(sieve, start, job->safe)) {
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+      __atomic_store_n(&job->found, 1, __ATOMIC_RELEASE);
+      break;
+    }
+
+    for (int i = 0; i < FAHE_PRIME_WINDOW; i++) {
+      if (sieve[i]) {
+        continue;
+      }
+      if (__atomic_load_n(&job->found, __ATOMIC_ACQUIRE)) {
+        break;
+      }
+      if (!BN_copy(c, start) || !BN_add_word(c, step * (BN_ULONG)i)) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&job->found, 1, __ATOMIC_RELEASE);
+        break;
+      }
+      if (BN_num_bits(c) > job->bits) {
+        // Ran past 2**bits; draw a new window
+        break;
+      }
+      if (job->safe &&
+          (!BN_rshift1(q, c) || prime_fermat(c, scratch, ctx) != 1 ||
+           prime_fermat(q, scratch, ctx) != 1 ||
+           prime_check(q, ctx, cb) != 1)) {
+        continue;
+      }
+      if (prime_check(c, ctx, cb) != 1) {
+        continue;
+      }
+      // First finder publishes p; a later one is dropped
+      if (!__atomic_exchange_n(&job->found, 1, __ATOMIC_ACQ_REL)) {
+        if (!BN_copy(job->p, c)) {
+          __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+      }
+      break;
+    }
+  }
+
+  BN_GENCB_free(cb);
+  BN_CTX_end(ctx);
+}
+
+int fahe_prime_generate(BIGNUM *p, int bits, int safe,
+                        fahe_thread_pool *pool) {
+  if (bits < FAHE_PRIME_MIN_BITS) {
+    if (!BN_generate_prime_ex(p, bits, safe, NULL, NULL, NULL)) {
+      log_message(LOG_ERROR, "BN_generate_prime_ex failed\n");
+      return 0;
+    }
+    return 1;
+  }
+  if (!pool) {
+    pool = fahe_thread_pool_shared();
+  }
+  pthread_once(&sieve_once, sieve_init);
+
+  prime_job job;
+  job.p = p;
+  job.bits = bits;
+  job.safe = safe;
+  job.found = 0;
+  job.failed = 0;
+
+  // One item per thread; each searches until some thread finds p
+  fahe_thread_pool_run(pool, pool->num_threads, 1, prime_task, &job);
+
+  if (job.failed) {
+    log_message(LOG_ERROR, "Prime search of %d bits failed\n", bits);
+    return 0;
+  }
+  return 1;
+}
+
+int fahe_pow2_div(BIGNUM *X, int gamma, const BIGNUM *p, BN_CTX *ctx) {
+  BN_zero(X);
+  if (!BN_set_bit(X, gamma) || !BN_div(X, NULL, X, p, ctx)) {
+    log_message(LOG_ERROR, "Computing 2**%d / p failed\n", gamma);
+    return 0;
+  }
+  return 1;
+}
+
+int fahe_keygen_gamma(int rho, int eta) {
+  return (int)(rho / log2(rho) * ((double)(eta - rho) * (eta - rho)));
+}
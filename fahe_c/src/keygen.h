@@ -0,0 +1,108 @@
+/**
+ * @file keygen.h
+ * @brief Header file for keygen.c, the building blocks of FAHE1 and FAHE2
+ * key generation: a parallel prime search and X = floor(2**gamma / p).
+ *
+ * fahe_prime_generate searches for the eta-bit prime p on the threads of a
+ * fahe_thread_pool. Every thread draws its own random window of candidates,
+ * strikes out those with a small factor using a sieve, and runs
+ * Miller-Rabin on the rest. The first thread to find a prime publishes it,
+ * and the others give up at their next candidate or, through the BN_GENCB
+ * callback, between two Miller-Rabin rounds.
+ *
+ * Neither scheme depends on the structure of p - 1: decryption only reduces
+ * modulo p, and security rests on p staying hidden in the approximate
+ * common divisor problem. Safe primes, which the keygen has always drawn,
+ * remain the default; fahe_keygen_opts.safe_prime = 0 draws any prime of
+ * the same size, which takes far fewer candidates.
+ *
+ * This file contains the following structs: fahe_keygen_opts
+ *                and the following methods: fahe_prime_generate,
+ * fahe_pow2_div, fahe_keygen_gamma
+ */
+
+#ifndef KEYGEN_H
+#define KEYGEN_H
+
+#include <openssl/bn.h>
+
+#include "thread_pool.h"
+
+/**
+ * @brief Odd primes the sieve divides candidates by, 3 .. 17881.
+ */
+#define FAHE_PRIME_SIEVE_PRIMES 2048
+
+/**
+ * @brief Candidates per sieve window. A thread draws a new random window
+ * when it has tested every survivor of the last one.
+ */
+#define FAHE_PRIME_WINDOW 4096
+
+/**
+ * @brief Primes shorter than this are left to BN_generate_prime_ex, so that
+ * a candidate can never be one of the sieving primes.
+ */
+#define FAHE_PRIME_MIN_BITS 32
+
+/**
+ * @typedef fahe_keygen_opts
+ * @brief Options of fahe1_keygen_ex and fahe2_keygen_ex.
+ */
+
+/**
+ * @struct fahe_keygen_opts
+ *
+ * @var fahe_keygen_opts: safe_prime (int)
+ * 1 to draw p = 2q + 1 with q prime, as fahe1_keygen does; 0 for any prime.
+ *
+ * @var fahe_keygen_opts: pool (fahe_thread_pool*)
+ * Threads that search for p. NULL uses fahe_thread_pool_shared.
+ */
+typedef struct {
+  int safe_prime;
+  fahe_thread_pool *pool;
+} fahe_keygen_opts;
+
+/**
+ * @brief Options that reproduce fahe1_keygen and fahe2_keygen.
+ */
+#define FAHE_KEYGEN_OPTS_DEFAULT {1, NULL}
+
+/**
+ * @brief Sets p to a random prime of exactly bits bits.
+ *
+ * @param[out] p The prime.
+ * @param[in] bits Bit length of p.
+ * @param[in] safe 1 for a safe prime, (p - 1) / 2 also prime; 0 otherwise.
+ * @param[in] pool Threads to search on. NULL uses the shared pool.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_prime_generate(BIGNUM *p, int bits, int safe,
+                        fahe_thread_pool *pool);
+
+/**
+ * @brief Computes X = floor(2**gamma / p).
+ *
+ * 2**gamma is set as a single bit rather than raised with BN_exp.
+ *
+ * @param[out] X The quotient.
+ * @param[in] gamma The exponent.
+ * @param[in] p The divisor.
+ * @param[in] ctx Scratch for BN_div.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_pow2_div(BIGNUM *X, int gamma, const BIGNUM *p, BN_CTX *ctx);
+
+/**
+ * @brief Returns gamma = rho / log2(rho) * (eta - rho)**2, the bit length
+ * of the ciphertext modulus 2**gamma of both schemes.
+ *
+ * @param[in] rho The noise bit length.
+ * @param[in] eta The bit length of p.
+ */
+int fahe_keygen_gamma(int rho, int eta);
+
+#endif  // KEYGEN_H
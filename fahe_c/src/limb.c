@@ -0,0 +1,191 @@
+/**
+ * @file limb.c
+ * @brief Implementation of native 64-bit limb kernels.
+ *
+ * OpenSSL keeps BIGNUM limbs private, so these kernels work on plain
+ * little-endian uint64_t arrays and convert at the boundary with
+ * limbs_from_bn and limbs_to_bn.
+ *
+ * @note The kernels use the unsigned __int128 extension of GCC and Clang.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ *
+ * @see limb.h for the documentation of the functions implemented here.
+ */
+
+#include "limb.h"
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+
+typedef unsigned __int128 u128;
+
+int limbs_from_bn(const BIGNUM *bn, uint64_t *limbs, size_t num_limbs) {
+  if (BN_bn2lebinpad(bn, (unsigned char *)limbs, (int)(num_limbs * 8)) < 0) {
+    return 0;
+  }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  for (size_t i = 0; i < num_limbs; i++) {
+    limbs[i] = __builtin_bswap64(limbs[i]);
+  }
+#endif
+  return 1;
+}
+
+int limbs_to_bn(const uint64_t *limbs, size_t num_limbs, BIGNUM *bn) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  uint64_t *swapped = OPENSSL_malloc(num_limbs * 8 + 1);
+  if (!swapped) {
+    return 0;
+  }
+  for (size_t i = 0; i < num_limbs; i++) {
+    swapped[i] = __builtin_bswap64(limbs[i]);
+  }
+  int ok = BN_lebin2bn((const unsigned char *)swapped, (int)(num_limbs * 8),
+                       bn) != NULL;
+  OPENSSL_free(swapped);
+  return ok;
+#else
+  return BN_lebin2bn((const unsigned char *)limbs, (int)(num_limbs * 8), bn) !=
+         NULL;
+#endif
+}
+
+int limbs_num_bits(const uint64_t *limbs, size_t num_limbs) {
+  while (num_limbs > 0 && limbs[num_limbs - 1] == 0) {
+    num_limbs--;
+  }
+  if (num_limbs == 0) {
+    return 0;
+  }
+  return (int)(64 * num_limbs) - __builtin_clzll(limbs[num_limbs - 1]);
+}
+
+void limbs_table_mac(const uint64_t *table, size_t k, const uint64_t *c,
+                     size_t begin, size_t end, uint64_t *cols) {
+  for (size_t j = 0; j < k; j++) {
+    u128 sum = ((u128)cols[3 * j + 1] << 64) | cols[3 * j];
+    uint64_t carries = cols[3 * j + 2];
+    const uint64_t *row = table + begin * k + j;
+
+    for (size_t i = begin; i < end; i++, row += k) {
+      u128 prod = (u128)c[i] * *row;
+      sum += prod;
+      carries += sum < prod;
+    }
+
+    cols[3 * j] = (uint64_t)sum;
+    cols[3 * j + 1] = (uint64_t)(sum >> 64);
+    cols[3 * j + 2] = carries;
+  }
+}
+
+// Adds m[from..mn) into out[from..), returns the new length of out.
+static size_t add_tail(uint64_t *out, size_t n, const uint64_t *m, size_t mn,
+                       size_t from) {
+  u128 carry = 0;
+  size_t i = from;
+  for (; i < mn; i++) {
+    carry += (u128)m[i] + (i < n ? out[i] : 0);
+    out[i] = (uint64_t)carry;
+    carry >>= 64;
+  }
+  for (; carry && i < n; i++) {
+    carry += out[i];
+    out[i] = (uint64_t)carry;
+    carry >>= 64;
+  }
+  if (i > n) {
+    n = i;
+  }
+  out[n] = (uint64_t)carry;
+  return n + 1;
+}
+
+// One kernel per multiplier width, fully unrolled so the compiler keeps p and
+// the window of pending output limbs in registers. Row i adds q[i] * p to the
+// window; its lowest limb is then final.
+#define LIMBS_MUL_SMALL_KERNEL(N)                                              \
+  static void mul_small_add_##N(uint64_t *out, const uint64_t *q, size_t qn,   \
+                                const uint64_t *p, const uint64_t *m,          \
+                                size_t mn) {                                   \
+    uint64_t pw[N], w[N];                                                      \
+    _Pragma("GCC unroll 8") for (size_t j = 0; j < N; j++) {                   \
+      pw[j] = p[j];                                                            \
+      w[j] = j < mn ? m[j] : 0;                                                \
+    }                                                                          \
+    for (size_t i = 0; i < qn; i++) {                                          \
+      uint64_t qi = q[i], carry = 0;                                           \
+      _Pragma("GCC unroll 8") for (size_t j = 0; j < N; j++) {                 \
+        u128 t = (u128)qi * pw[j] + w[j] + carry;                              \
+        w[j] = (uint64_t)t;                                                    \
+        carry = (uint64_t)(t >> 64);                                           \
+      }                                                                        \
+      out[i] = w[0];                                                           \
+      _Pragma("GCC unroll 8") for (size_t j = 0; j + 1 < N; j++) {             \
+        w[j] = w[j + 1];                                                       \
+      }                                                                        \
+      w[N - 1] = carry;                                                        \
+    }                                                                          \
+    _Pragma("GCC unroll 8") for (size_t j = 0; j < N; j++) {                   \
+      out[qn + j] = w[j];                                                      \
+    }                                                                          \
+  }
+
+LIMBS_MUL_SMALL_KERNEL(1)
+LIMBS_MUL_SMALL_KERNEL(2)
+LIMBS_MUL_SMALL_KERNEL(3)
+LIMBS_MUL_SMALL_KERNEL(4)
+LIMBS_MUL_SMALL_KERNEL(5)
+LIMBS_MUL_SMALL_KERNEL(6)
+LIMBS_MUL_SMALL_KERNEL(7)
+LIMBS_MUL_SMALL_KERNEL(8)
+
+size_t limbs_mul_small_add(uint64_t *out, const uint64_t *q, size_t qn,
+                           const uint64_t *p, size_t pn, const uint64_t *m,
+                           size_t mn) {
+  switch (pn) {
+    case 1: mul_small_add_1(out, q, qn, p, m, mn); break;
+    case 2: mul_small_add_2(out, q, qn, p, m, mn); break;
+    case 3: mul_small_add_3(out, q, qn, p, m, mn); break;
+    case 4: mul_small_add_4(out, q, qn, p, m, mn); break;
+    case 5: mul_small_add_5(out, q, qn, p, m, mn); break;
+    case 6: mul_small_add_6(out, q, qn, p, m, mn); break;
+    case 7: mul_small_add_7(out, q, qn, p, m, mn); break;
+    case 8: mul_small_add_8(out, q, qn, p, m, mn); break;
+    default:
+      // Wide p: accumulate one row per limb of p, then add all of m
+      for (size_t i = 0; i < qn + pn; i++) {
+        out[i] = 0;
+      }
+      for (size_t j = 0; j < pn; j++) {
+        uint64_t carry = 0;
+        for (size_t i = 0; i < qn; i++) {
+          u128 t = (u128)q[i] * p[j] + out[i + j] + carry;
+          out[i + j] = (uint64_t)t;
+          carry = (uint64_t)(t >> 64);
+        }
+        out[qn + j] = carry;
+      }
+      return add_tail(out, qn + pn, m, mn, 0);
+  }
+  // The window absorbed m[0..pn); carry in the rest
+  return add_tail(out, qn + pn, m, mn, pn);
+}
+
+uint64_t limbs_add(uint64_t *r, size_t rn, const uint64_t *a, size_t an) {
+  u128 carry = 0;
+  size_t i = 0;
+  for (; i < an; i++) {
+    carry += (u128)r[i] + a[i];
+    r[i] = (uint64_t)carry;
+    carry >>= 64;
+  }
+  for (; carry && i < rn; i++) {
+    carry += r[i];
+    r[i] = (uint64_t)carry;
+    carry >>= 64;
+  }
+  return (uint64_t)carry;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file limb.h
+ * @brief Header file for limb.c, native 64-bit limb kernels used on the hot
+ * paths of encryption and decryption.
+ *
+ * Limb arrays are little-endian: limbs[0] holds the least significant 64
+ * bits. This file contains the following methods:
+ *          limbs_from_bn, limbs_to_bn, limbs_num_bits, limbs_table_mac,
+ *          limbs_mul_small_add, limbs_add
+ */
+
+#ifndef LIMB_H
+#define LIMB_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of 64-bit limbs needed to hold bits bits.
+ */
+#define FAHE_LIMBS(bits) (((size_t)(bits) + 63) / 64)
+
+/**
+ * @brief Widest multiplier, in limbs, with an unrolled limbs_mul_small_add
+ * kernel (512 bits). Wider multipliers take a generic row-by-row loop.
+ */
+#define FAHE_LIMB_MUL_MAX_SMALL 8
+
+/**
+ * @brief Exports a non-negative BIGNUM into a zero-padded limb array.
+ *
+ * @param[in] bn The value to export.
+ * @param[out] limbs Destination of num_limbs limbs.
+ * @param[in] num_limbs Size of limbs. Must be >= FAHE_LIMBS(BN_num_bits(bn)).
+ *
+ * @return 1 on success, 0 if bn does not fit.
+ */
+int limbs_from_bn(const BIGNUM *bn, uint64_t *limbs, size_t num_limbs);
+
+/**
+ * @brief Imports a limb array into a BIGNUM.
+ *
+ * @param[in] limbs Source limbs.
+ * @param[in] num_limbs Number of limbs to read.
+ * @param[out] bn Destination. Its storage is reused when large enough.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int limbs_to_bn(const uint64_t *limbs, size_t num_limbs, BIGNUM *bn);
+
+/**
+ * @brief Bits of the value of a limb array without its leading zeros, what
+ * BN_num_bits returns for the same value.
+ *
+ * @param[in] limbs The limbs.
+ * @param[in] num_limbs Number of limbs to read.
+ *
+ * @return The bit length of the value, 0 for zero.
+ */
+int limbs_num_bits(const uint64_t *limbs, size_t num_limbs);
+
+/**
+ * @brief Multiply-accumulates limbs against a table of residues.
+ *
+ * This function computes sum(c[i] * table[i]) for begin <= i < end, where
+ * table[i] is a k-limb residue stored at table + i * k. Column j of the sum
+ * is accumulated in three words, cols[3 * j .. 3 * j + 2] (low, high, carry
+ * count), so no carry ever propagates between columns inside the loop.
+ * Ranges are independent too, so a caller may split [0, n) across threads
+ * and add the column sums.
+ *
+ * @param[in] table Row-major table of k-limb residues.
+ * @param[in] k Limbs per table row.
+ * @param[in] c Limbs of the value being reduced.
+ * @param[in] begin First limb index to process.
+ * @param[in] end One past the last limb index to process.
+ * @param[in,out] cols 3 * k column accumulators. Not cleared.
+ */
+void limbs_table_mac(const uint64_t *table, size_t k, const uint64_t *c,
+                     size_t begin, size_t end, uint64_t *cols);
+
+/**
+ * @brief Computes out = p * q + m in a single pass over q.
+ *
+ * The encryption step of both schemes multiplies the huge random q by the
+ * short prime p and adds the short message term M. For p of at most
+ * FAHE_LIMB_MUL_MAX_SMALL limbs, the limbs of p and a window of pn pending
+ * output limbs stay in registers while q is streamed once, and m seeds the
+ * window instead of being added in a second pass. Nothing is allocated.
+ *
+ * @param[out] out Destination of max(qn + pn, mn) + 1 limbs. May not alias
+ *                 the inputs.
+ * @param[in] q Limbs of the long operand.
+ * @param[in] qn Number of limbs in q.
+ * @param[in] p Limbs of the short operand.
+ * @param[in] pn Number of limbs in p. Must be >= 1.
+ * @param[in] m Limbs of the addend.
+ * @param[in] mn Number of limbs in m. May be 0.
+ *
+ * @return The number of limbs written, max(qn + pn, mn) + 1. The top limb
+ *         holds the final carry and may be zero.
+ */
+size_t limbs_mul_small_add(uint64_t *out, const uint64_t *q, size_t qn,
+                           const uint64_t *p, size_t pn, const uint64_t *m,
+                           size_t mn);
+
+/**
+ * @brief Adds a short limb array into a longer one in place, r += a.
+ *
+ * @param[in,out] r The accumulator of rn limbs.
+ * @param[in] rn Number of limbs in r.
+ * @param[in] a The addend.
+ * @param[in] an Number of limbs in a. Must be <= rn.
+ *
+ * @return The carry out of the top limb of r, 0 or 1.
+ */
+uint64_t limbs_add(uint64_t *r, size_t rn, const uint64_t *a, size_t an);
+
+#endif  // LIMB_H
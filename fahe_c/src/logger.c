@@ -1,8 +1,36 @@
+/**
+ * @file logger.c
+ * @brief Implementation of the record formatting behind log_message and of
+ * the asynchronous log sink.
+ *
+ * The asynchronous sink is a bounded multi-producer, single-consumer ring
+ * in the style of Vyukov's bounded queue: every slot carries a sequence
+ * number that tells producers whether it is free and the writer whether it
+ * is filled. Producers claim a slot with one compare-and-swap on the tail
+ * and never wait; when the ring is full the record is dropped and counted.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ * - pthread.h
+ * - radix.h
+ *
+ * @see logger.h for the documentation of the functions implemented here.
+ */
 
 #include "logger.h"
 
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "radix.h"
 
 // Default log level (can be changed externally)
 LogLevel current_log_level = LOG_FATAL;
@@ -13,36 +41,329 @@ LogLevel current_log_level = LOG_FATAL;
 #define GREEN_COLOR "\033[32m"
 #define BLUE_COLOR "\033[34m"
 
-void log_message(LogLevel level, const char* format, ...) {
-  if (level >= current_log_level) {
-    va_list args;
-    va_start(args, format);
-    switch (level) {
-      case LOG_DEBUG:
-        printf("[DEBUG] ");
-        printf(GREEN_COLOR);
-        break;
-      case LOG_INFO:
-        printf("[INFO] ");
-        printf(BLUE_COLOR);
-        break;
-      case LOG_WARNING:
-        printf("[WARNING] ");
-        printf(YELLOW_COLOR);
-        break;
-      case LOG_ERROR:
-        printf("[ERROR] ");
-        printf(RED_COLOR);
-        break;
-      case LOG_FATAL:
-        printf(RED_COLOR "[FATAL] ");
-        break;
-      default:
+typedef struct {
+  size_t seq;
+  LogLevel level;
+  char text[FAHE_LOG_RECORD_BYTES];
+} log_record;
+
+// State of the asynchronous sink; active is 0 while records go to stdout
+// synchronously
+static struct {
+  int active;
+  int producers;    // log_emit calls inside the active check
+  int colors;
+  FILE *out;
+  log_record *ring;
+  size_t mask;
+  size_t tail;      // next slot producers claim
+  size_t head;      // next slot the writer drains; only the writer writes it
+  uint64_t dropped;
+  int sleeping;
+  int flushing;
+  int stop;
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t drained;
+} sink = {.colors = 1,
+          .lock = PTHREAD_MUTEX_INITIALIZER,
+          .wake = PTHREAD_COND_INITIALIZER,
+          .drained = PTHREAD_COND_INITIALIZER};
+
+// Formats a full line, prefix and newline included, into buf
+static size_t log_format(char *buf, size_t size, LogLevel level, int colors,
+                         const char *text) {
+  const char *prefix;
+  const char *color;
+  switch (level) {
+    case LOG_DEBUG:
+      prefix = "[DEBUG] ";
+      color = GREEN_COLOR;
+      break;
+    case LOG_INFO:
+      prefix = "[INFO] ";
+      color = BLUE_COLOR;
+      break;
+    case LOG_WARNING:
+      prefix = "[WARNING] ";
+      color = YELLOW_COLOR;
+      break;
+    case LOG_ERROR:
+      prefix = "[ERROR] ";
+      color = RED_COLOR;
+      break;
+    case LOG_FATAL:
+      prefix = "[FATAL] ";
+      color = RED_COLOR;
+      break;
+    default:
+      prefix = "";
+      color = "";
+      break;
+  }
+
+  // Add a newline for better readability and reset color
+  int n;
+  if (!colors) {
+    n = snprintf(buf, size, "%s%s\n", prefix, text);
+  } else if (level == LOG_FATAL) {
+    n = snprintf(buf, size, "%s%s%s" RESET_COLOR "\n", color, prefix, text);
+  } else {
+    n = snprintf(buf, size, "%s%s%s" RESET_COLOR "\n", prefix, color, text);
+  }
+  return n < 0 ? 0 : ((size_t)n < size ? (size_t)n : size - 1);
+}
+
+static void *log_writer(void *arg) {
+  (void)arg;
+  char line[FAHE_LOG_RECORD_BYTES + 64];
+
+  for (;;) {
+    size_t head = sink.head;
+    log_record *record = &sink.ring[head & sink.mask];
+    size_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+
+    if (seq == head + 1) {
+      size_t n = log_format(line, sizeof(line), record->level, sink.colors,
+                            record->text);
+      fwrite(line, 1, n, sink.out);
+      // Hand the slot back to producers for the next lap
+      __atomic_store_n(&record->seq, head + sink.mask + 1, __ATOMIC_RELEASE);
+      __atomic_store_n(&sink.head, head + 1, __ATOMIC_RELEASE);
+      // Do not make a flush wait for the ring to run empty under load
+      if (__atomic_load_n(&sink.flushing, __ATOMIC_ACQUIRE)) {
+        fflush(sink.out);
+        pthread_mutex_lock(&sink.lock);
+        pthread_cond_broadcast(&sink.drained);
+        pthread_mutex_unlock(&sink.lock);
+      }
+      continue;
+    }
+
+    // Empty: publish what was written, then sleep until woken or stopped
+    fflush(sink.out);
+    pthread_mutex_lock(&sink.lock);
+    pthread_cond_broadcast(&sink.drained);
+    if (sink.stop &&
+        __atomic_load_n(&sink.tail, __ATOMIC_ACQUIRE) == sink.head) {
+      pthread_mutex_unlock(&sink.lock);
+      break;
+    }
+    __atomic_store_n(&sink.sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sink.tail, __ATOMIC_SEQ_CST) == sink.head &&
+        !sink.stop) {
+      // A producer that misses the sleeping flag is picked up within 10 ms
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += 10 * 1000 * 1000;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&sink.wake, &sink.lock, &deadline);
+    }
+    __atomic_store_n(&sink.sleeping, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&sink.lock);
+  }
+  return NULL;
+}
+
+// Claims a slot and copies the record in; returns 0 if the ring is full
+static int log_enqueue(LogLevel level, const char *text) {
+  size_t tail = __atomic_load_n(&sink.tail, __ATOMIC_RELAXED);
+  log_record *record;
+  for (;;) {
+    record = &sink.ring[tail & sink.mask];
+    size_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+    intptr_t dif = (intptr_t)seq - (intptr_t)tail;
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&sink.tail, &tail, tail + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
         break;
+      }
+    } else if (dif < 0) {
+      return 0;
+    } else {
+      tail = __atomic_load_n(&sink.tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  record->level = level;
+  strncpy(record->text, text, FAHE_LOG_RECORD_BYTES - 1);
+  record->text[FAHE_LOG_RECORD_BYTES - 1] = '\0';
+  __atomic_store_n(&record->seq, tail + 1, __ATOMIC_RELEASE);
+
+  if (__atomic_load_n(&sink.sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_cond_signal(&sink.wake);
+  }
+  return 1;
+}
+
+// Drops the trailing newline; log_format adds its own
+static void log_strip_newline(char *text) {
+  size_t len = strlen(text);
+  if (len > 0 && text[len - 1] == '\n') {
+    text[len - 1] = '\0';
+  }
+}
+
+// Writes a record to stdout in one write, so that lines do not interleave
+static void log_write_sync(LogLevel level, const char *text) {
+  char stack[FAHE_LOG_RECORD_BYTES + 64];
+  char *line = stack;
+  size_t size = strlen(text) + 64;
+  if (size > sizeof(stack) && !(line = malloc(size))) {
+    line = stack;
+    size = sizeof(stack);
+  }
+  size_t n = log_format(line, size, level, 1, text);
+  fwrite(line, 1, n, stdout);
+  if (line != stack) {
+    free(line);
+  }
+}
+
+void log_emit(LogLevel level, const char* format, ...) {
+  char text[FAHE_LOG_RECORD_BYTES];
+  va_list args;
+  va_list again;
+  va_start(args, format);
+  va_copy(again, args);
+  int len = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  log_strip_newline(text);
+
+  // producers keeps log_async_stop from freeing the ring under this record
+  __atomic_fetch_add(&sink.producers, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&sink.active, __ATOMIC_SEQ_CST)) {
+    if (!log_enqueue(level, text)) {
+      __atomic_fetch_add(&sink.dropped, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(&sink.producers, 1, __ATOMIC_RELEASE);
+    va_end(again);
+    return;
+  }
+  __atomic_fetch_sub(&sink.producers, 1, __ATOMIC_RELEASE);
+
+  // Synchronous records are not cut: format again at full length
+  char *full = NULL;
+  if (len >= (int)sizeof(text) && (full = malloc((size_t)len + 1))) {
+    vsnprintf(full, (size_t)len + 1, format, again);
+    log_strip_newline(full);
+  }
+  va_end(again);
+  log_write_sync(level, full ? full : text);
+  free(full);
+}
+
+void log_emit_bignum(LogLevel level, const char *format, const BIGNUM *bn) {
+  char *bn_str = fahe_bn2dec(bn);
+  log_emit(level, format, bn_str ? bn_str : "(fahe_bn2dec failed)");
+  OPENSSL_free(bn_str);
+}
+
+int log_async_start(const char *path, size_t capacity) {
+  if (sink.active) {
+    log_emit(LOG_ERROR, "Asynchronous logging is already running\n");
+    return 0;
+  }
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    log_emit(LOG_ERROR, "Log ring capacity must be a power of two\n");
+    return 0;
+  }
+
+  FILE *out = stdout;
+  if (path) {
+    out = fopen(path, "a");
+    if (!out) {
+      log_emit(LOG_ERROR, "Opening log file %s failed\n", path);
+      return 0;
+    }
+  }
+  log_record *ring = malloc(capacity * sizeof(log_record));
+  if (!ring) {
+    if (path) {
+      fclose(out);
+    }
+    log_emit(LOG_ERROR, "Memory allocation for the log ring failed\n");
+    return 0;
+  }
+  for (size_t i = 0; i < capacity; i++) {
+    ring[i].seq = i;
+  }
+
+  sink.out = out;
+  sink.colors = path == NULL;
+  sink.ring = ring;
+  sink.mask = capacity - 1;
+  sink.tail = 0;
+  sink.head = 0;
+  sink.sleeping = 0;
+  sink.stop = 0;
+  if (pthread_create(&sink.writer, NULL, log_writer, NULL) != 0) {
+    free(ring);
+    if (path) {
+      fclose(out);
     }
-    vprintf(format, args);
-    printf(RESET_COLOR
-           "\n");  // Add a newline for better readability and reset color
-    va_end(args);
+    log_emit(LOG_ERROR, "Starting the log writer failed\n");
+    return 0;
+  }
+  __atomic_store_n(&sink.active, 1, __ATOMIC_RELEASE);
+
+  static int registered = 0;
+  if (!registered) {
+    registered = 1;
+    atexit(log_async_stop);
+  }
+  return 1;
+}
+
+void log_flush(void) {
+  if (!__atomic_load_n(&sink.active, __ATOMIC_ACQUIRE)) {
+    fflush(stdout);
+    return;
+  }
+
+  // Wait for every slot claimed so far; later records may still be queued
+  size_t target = __atomic_load_n(&sink.tail, __ATOMIC_ACQUIRE);
+  __atomic_fetch_add(&sink.flushing, 1, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&sink.lock);
+  while (__atomic_load_n(&sink.head, __ATOMIC_ACQUIRE) - target >
+         (SIZE_MAX >> 1)) {
+    pthread_cond_signal(&sink.wake);
+    pthread_cond_wait(&sink.drained, &sink.lock);
   }
-}
\ No newline at end of file
+  pthread_mutex_unlock(&sink.lock);
+  __atomic_fetch_sub(&sink.flushing, 1, __ATOMIC_RELEASE);
+}
+
+void log_async_stop(void) {
+  if (!__atomic_load_n(&sink.active, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  log_flush();
+
+  // Records from here on go to stdout synchronously. Wait out producers that
+  // saw the sink active; the writer drains their records before exiting.
+  __atomic_store_n(&sink.active, 0, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&sink.producers, __ATOMIC_SEQ_CST) > 0) {
+    sched_yield();
+  }
+  pthread_mutex_lock(&sink.lock);
+  sink.stop = 1;
+  pthread_cond_signal(&sink.wake);
+  pthread_mutex_unlock(&sink.lock);
+  pthread_join(sink.writer, NULL);
+
+  if (sink.out != stdout) {
+    fclose(sink.out);
+  }
+  free(sink.ring);
+  sink.ring = NULL;
+  sink.out = NULL;
+}
+
+uint64_t log_dropped(void) {
+  return __atomic_load_n(&sink.dropped, __ATOMIC_RELAXED);
+}
@@ -1,3 +1,29 @@
+/**
+ * @file logger.h
+ * @brief Header file for logger.c, leveled logging for the FAHE library.
+ *
+ * log_message is a macro: a record below the runtime level
+ * (current_log_level) costs one comparison and its arguments are not
+ * evaluated. Records below FAHE_LOG_MIN_LEVEL are removed at compile time.
+ * BIGNUMs are logged with log_bignum, which only converts the value to
+ * decimal when the record is emitted and frees the string afterwards.
+ *
+ * By default records are written to stdout on the calling thread.
+ * log_async_start moves the writing to a background thread fed through a
+ * bounded lock-free ring, so logging never blocks a worker: when the ring
+ * is full the record is dropped and counted instead.
+ *
+ * This file contains the following methods: log_message, log_bignum,
+ *                log_enabled, log_emit, log_emit_bignum, log_async_start,
+ * log_async_stop, log_flush, log_dropped
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef enum {
     LOG_DEBUG,
@@ -8,6 +34,97 @@ typedef enum {
     NONE
 }LogLevel;
 
+/**
+ * @brief Lowest level compiled into the library, e.g. -DFAHE_LOG_MIN_LEVEL=3
+ * keeps only LOG_ERROR and LOG_FATAL. Must be an integer literal so that the
+ * level check folds to a constant.
+ */
+#ifndef FAHE_LOG_MIN_LEVEL
+#define FAHE_LOG_MIN_LEVEL 0
+#endif
+
+/**
+ * @brief Maximum length of a record in the asynchronous ring; longer
+ * records are cut. Synchronous records have no limit.
+ */
+#define FAHE_LOG_RECORD_BYTES 256
+
+/**
+ * @brief Suggested ring capacity for log_async_start, in records. Memory use
+ * is capacity * (FAHE_LOG_RECORD_BYTES + 16) bytes.
+ */
+#define FAHE_LOG_RING_RECORDS 4096
+
+// Runtime log level, LOG_FATAL by default (can be changed externally)
+extern LogLevel current_log_level;
+
+/**
+ * @brief Whether a record of the given level would be emitted.
+ */
+#define log_enabled(level) \
+  ((int)(level) >= FAHE_LOG_MIN_LEVEL && (level) >= current_log_level)
+
+/**
+ * @brief Logs a printf-style record. The arguments are only evaluated when
+ * the level is enabled.
+ */
+#define log_message(level, ...)        \
+  do {                                 \
+    if (log_enabled(level)) {          \
+      log_emit((level), __VA_ARGS__);  \
+    }                                  \
+  } while (0)
+
+/**
+ * @brief Logs a BIGNUM through a format with a single %s, e.g.
+ * log_bignum(LOG_DEBUG, "q = %s\n", q). The decimal conversion only runs
+ * when the level is enabled.
+ */
+#define log_bignum(level, format, bn)            \
+  do {                                           \
+    if (log_enabled(level)) {                    \
+      log_emit_bignum((level), (format), (bn));  \
+    }                                            \
+  } while (0)
+
+/**
+ * @brief Emits a record unconditionally. Use log_message instead.
+ */
+void log_emit(LogLevel level, const char *format, ...);
+
+/**
+ * @brief Converts bn to decimal, emits it through format and frees the
+ * string. Use log_bignum instead.
+ */
+void log_emit_bignum(LogLevel level, const char *format, const BIGNUM *bn);
+
+/**
+ * @brief Starts the asynchronous sink.
+ *
+ * @param[in] path File to append records to, or NULL for stdout (with
+ *                 colors, as in synchronous mode).
+ * @param[in] capacity Ring size in records. Must be a power of two, e.g.
+ *                     FAHE_LOG_RING_RECORDS.
+ *
+ * @return 1 on success, 0 on failure or if the sink is already running.
+ */
+int log_async_start(const char *path, size_t capacity);
+
+/**
+ * @brief Writes every queued record, stops the writer thread and returns to
+ * synchronous logging. Registered with atexit by log_async_start.
+ */
+void log_async_stop(void);
+
+/**
+ * @brief Blocks until every record logged before the call is written.
+ * Called by fahe1_free and fahe2_free.
+ */
+void log_flush(void);
 
-void log_message(LogLevel level, const char* format,...);
+/**
+ * @brief Returns the number of records dropped because the ring was full.
+ */
+uint64_t log_dropped(void);
 
+#endif  // LOGGER_H
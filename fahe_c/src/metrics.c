@@ -0,0 +1,355 @@
+/**
+ * @file metrics.c
+ * @brief Implementation of the operation metrics and their Prometheus
+ * export.
+ *
+ * Every thread that records gets a fahe_metrics block from a
+ * fahe_thread_blocks registry (@see thread_blocks.h); snapshots sum the
+ * blocks and the totals of exited threads.
+ *
+ * Dependencies:
+ * - unistd.h
+ * - logger.h
+ * - thread_blocks.h
+ *
+ * @see metrics.h for the documentation of the functions implemented here.
+ */
+
+#include "metrics.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "thread_blocks.h"
+
+#define METRICS_SUB_COUNT (1 << FAHE_METRICS_SUB_BITS)
+
+static void metrics_merge(void *into, const void *from);
+
+static int metrics_on = 0;
+
+static fahe_metrics metrics_retired;
+static fahe_thread_blocks metrics_blocks =
+    FAHE_THREAD_BLOCKS_INIT(metrics_retired, metrics_merge);
+static __thread fahe_metrics *current_block = NULL;
+
+static const char *op_names[FAHE_OP_COUNT] = {"keygen", "encrypt", "decrypt",
+                                              "add"};
+
+// Bucket upper edges of the exported histogram, in seconds
+static const double export_bounds[] = {
+    1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3,
+    5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+static const double export_quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static int metrics_bucket(uint64_t ns) {
+  if (ns < METRICS_SUB_COUNT) {
+    return (int)ns;
+  }
+  int e = 63 - __builtin_clzll(ns);
+  if (e >= FAHE_METRICS_MAX_BITS) {
+    return FAHE_METRICS_BUCKETS - 1;
+  }
+  return ((e - FAHE_METRICS_SUB_BITS + 1) << FAHE_METRICS_SUB_BITS) +
+         (int)((ns >> (e - FAHE_METRICS_SUB_BITS)) & (METRICS_SUB_COUNT - 1));
+}
+
+// Exclusive upper edge of bucket b in ns
+static uint64_t metrics_bucket_end(int b) {
+  if (b < METRICS_SUB_COUNT) {
+    return (uint64_t)b + 1;
+  }
+  int k = b >> FAHE_METRICS_SUB_BITS;
+  uint64_t sub = (uint64_t)(b & (METRICS_SUB_COUNT - 1));
+  return (METRICS_SUB_COUNT + sub + 1) << (k - 1);
+}
+
+static void metrics_merge(void *into, const void *from) {
+  const uint64_t *src = (const uint64_t *)from;
+  uint64_t *dst = (uint64_t *)into;
+  // fahe_metrics holds nothing but uint64_t counters
+  for (size_t i = 0; i < sizeof(fahe_metrics) / sizeof(uint64_t); i++) {
+    dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+  }
+}
+
+static fahe_metrics *metrics_thread_block(void) {
+  fahe_metrics *block = current_block;
+  if (!block) {
+    block = current_block = fahe_thread_blocks_get(&metrics_blocks);
+  }
+  return block;
+}
+
+static inline void metrics_add(uint64_t *counter, uint64_t n) {
+  __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+void fahe_metrics_enable(int on) {
+  __atomic_store_n(&metrics_on, on != 0, __ATOMIC_RELAXED);
+}
+
+int fahe_metrics_enabled(void) {
+  return __atomic_load_n(&metrics_on, __ATOMIC_RELAXED);
+}
+
+uint64_t fahe_metrics_start(void) {
+  if (!__atomic_load_n(&metrics_on, __ATOMIC_RELAXED)) {
+    return 0;
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void fahe_metrics_record(fahe_op op, int scheme, uint64_t start,
+                         uint64_t count, uint64_t bytes) {
+  if (!__atomic_load_n(&metrics_on, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  fahe_op_metrics *m = &metrics_thread_block()->ops[op][scheme];
+  metrics_add(&m->count, count);
+  metrics_add(&m->bytes, bytes);
+  if (start) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    uint64_t ns = now > start ? now - start : 0;
+    metrics_add(&m->calls, 1);
+    metrics_add(&m->total_ns, ns);
+    metrics_add(&m->hist[metrics_bucket(ns)], 1);
+  }
+}
+
+void fahe_metrics_fail(fahe_op op, int scheme) {
+  if (!__atomic_load_n(&metrics_on, __ATOMIC_RELAXED)) {
+    return;
+  }
+  metrics_add(&metrics_thread_block()->ops[op][scheme].failures, 1);
+}
+
+void fahe_metrics_snapshot(fahe_metrics *metrics) {
+  memset(metrics, 0, sizeof(*metrics));
+  fahe_thread_blocks_sum(&metrics_blocks, metrics);
+}
+
+void fahe_metrics_reset(void) { fahe_thread_blocks_reset(&metrics_blocks); }
+
+uint64_t fahe_metrics_quantile(const fahe_op_metrics *m, double q) {
+  if (m->calls == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(q * (double)m->calls + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int b = 0; b < FAHE_METRICS_BUCKETS; b++) {
+    seen += m->hist[b];
+    if (seen >= rank) {
+      return metrics_bucket_end(b);
+    }
+  }
+  return metrics_bucket_end(FAHE_METRICS_BUCKETS - 1);
+}
+
+// Addition does not depend on the scheme; everything else is per scheme
+static int metrics_first_scheme(fahe_op op) {
+  return op == FAHE_OP_ADD ? 0 : 1;
+}
+
+static int metrics_last_scheme(fahe_op op) {
+  return op == FAHE_OP_ADD ? 0 : FAHE_METRICS_SCHEMES - 1;
+}
+
+// Writes {op="...",scheme="..." without the closing brace, so that callers
+// can append further labels
+static void metrics_labels(FILE *stream, fahe_op op, int scheme) {
+  fprintf(stream, "{op=\"%s\"", op_names[op]);
+  if (scheme > 0) {
+    fprintf(stream, ",scheme=\"%d\"", scheme);
+  }
+}
+
+static void metrics_write_counter(FILE *stream, const fahe_metrics *metrics,
+                                  const char *name, const char *help,
+                                  fahe_op only, size_t field) {
+  fprintf(stream, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+  for (int op = 0; op < FAHE_OP_COUNT; op++) {
+    if (only != FAHE_OP_COUNT && op != (int)only) {
+      continue;
+    }
+    for (int s = metrics_first_scheme(op); s <= metrics_last_scheme(op);
+         s++) {
+      const uint64_t *value =
+          (const uint64_t *)((const char *)&metrics->ops[op][s] + field);
+      fprintf(stream, "%s", name);
+      metrics_labels(stream, (fahe_op)op, s);
+      fprintf(stream, "} %llu\n", (unsigned long long)*value);
+    }
+  }
+}
+
+static void metrics_write_latency(FILE *stream, const fahe_metrics *metrics) {
+  const char *hist = "fahe_operation_duration_seconds";
+  fprintf(stream,
+          "# HELP %s Latency of a call.\n"
+          "# TYPE %s histogram\n",
+          hist, hist);
+  for (int op = 0; op < FAHE_OP_COUNT; op++) {
+    for (int s = metrics_first_scheme(op); s <= metrics_last_scheme(op);
+         s++) {
+      const fahe_op_metrics *m = &metrics->ops[op][s];
+      // A bucket of the export counts the buckets that end at or below
+      // its bound, so it may undercount by one log-linear bucket
+      int b = 0;
+      uint64_t seen = 0;
+      for (size_t i = 0; i < sizeof(export_bounds) / sizeof(double); i++) {
+        uint64_t bound_ns = (uint64_t)(export_bounds[i] * 1e9 + 0.5);
+        while (b < FAHE_METRICS_BUCKETS && metrics_bucket_end(b) <= bound_ns) {
+          seen += m->hist[b++];
+        }
+        fprintf(stream, "%s_bucket", hist);
+        metrics_labels(stream, (fahe_op)op, s);
+        fprintf(stream, ",le=\"%g\"} %llu\n", export_bounds[i],
+                (unsigned long long)seen);
+      }
+      fprintf(stream, "%s_bucket", hist);
+      metrics_labels(stream, (fahe_op)op, s);
+      fprintf(stream, ",le=\"+Inf\"} %llu\n", (unsigned long long)m->calls);
+      fprintf(stream, "%s_sum", hist);
+      metrics_labels(stream, (fahe_op)op, s);
+      fprintf(stream, "} %.9f\n", m->total_ns / 1e9);
+      fprintf(stream, "%s_count", hist);
+      metrics_labels(stream, (fahe_op)op, s);
+      fprintf(stream, "} %llu\n", (unsigned long long)m->calls);
+    }
+  }
+
+  const char *summary = "fahe_operation_latency_seconds";
+  fprintf(stream,
+          "# HELP %s Latency quantiles of a call, within 12.5%%.\n"
+          "# TYPE %s summary\n",
+          summary, summary);
+  for (int op = 0; op < FAHE_OP_COUNT; op++) {
+    for (int s = metrics_first_scheme(op); s <= metrics_last_scheme(op);
+         s++) {
+      const fahe_op_metrics *m = &metrics->ops[op][s];
+      for (size_t i = 0; i < sizeof(export_quantiles) / sizeof(double); i++) {
+        fprintf(stream, "%s", summary);
+        metrics_labels(stream, (fahe_op)op, s);
+        fprintf(stream, ",quantile=\"%g\"} ", export_quantiles[i]);
+        // Prometheus reports the quantiles of an empty summary as NaN
+        if (m->calls == 0) {
+          fprintf(stream, "NaN\n");
+        } else {
+          fprintf(stream, "%.9f\n",
+                  fahe_metrics_quantile(m, export_quantiles[i]) / 1e9);
+        }
+      }
+      fprintf(stream, "%s_sum", summary);
+      metrics_labels(stream, (fahe_op)op, s);
+      fprintf(stream, "} %.9f\n", m->total_ns / 1e9);
+      fprintf(stream, "%s_count", summary);
+      metrics_labels(stream, (fahe_op)op, s);
+      fprintf(stream, "} %llu\n", (unsigned long long)m->calls);
+    }
+  }
+}
+
+int fahe_metrics_write_prometheus(const fahe_metrics *metrics, FILE *stream) {
+  metrics_write_counter(stream, metrics, "fahe_keygens_total",
+                        "Keys generated.", FAHE_OP_KEYGEN,
+                        offsetof(fahe_op_metrics, count));
+  metrics_write_counter(stream, metrics, "fahe_ciphertexts_encrypted_total",
+                        "Ciphertexts produced by encryption.",
+                        FAHE_OP_ENCRYPT, offsetof(fahe_op_metrics, count));
+  metrics_write_counter(stream, metrics, "fahe_ciphertexts_decrypted_total",
+                        "Ciphertexts decrypted.", FAHE_OP_DECRYPT,
+                        offsetof(fahe_op_metrics, count));
+  metrics_write_counter(stream, metrics, "fahe_ciphertexts_added_total",
+                        "Ciphertexts summed by homomorphic addition.",
+                        FAHE_OP_ADD, offsetof(fahe_op_metrics, count));
+  metrics_write_counter(stream, metrics, "fahe_ciphertext_bytes_total",
+                        "Ciphertext bytes written or read.", FAHE_OP_COUNT,
+                        offsetof(fahe_op_metrics, bytes));
+  metrics_write_counter(stream, metrics, "fahe_failures_total",
+                        "Calls that returned an error.", FAHE_OP_COUNT,
+                        offsetof(fahe_op_metrics, failures));
+  metrics_write_latency(stream, metrics);
+  return fflush(stream) == 0 && !ferror(stream);
+}
+
+// Snapshots on the heap: a fahe_metrics is tens of KiB
+static fahe_metrics *metrics_take(void) {
+  fahe_metrics *metrics = (fahe_metrics *)malloc(sizeof(fahe_metrics));
+  if (!metrics) {
+    log_message(LOG_ERROR, "Memory allocation for the metrics failed\n");
+    return NULL;
+  }
+  fahe_metrics_snapshot(metrics);
+  return metrics;
+}
+
+int fahe_metrics_dump_fd(int fd) {
+  int copy = dup(fd);
+  FILE *stream = copy >= 0 ? fdopen(copy, "w") : NULL;
+  if (!stream) {
+    if (copy >= 0) {
+      close(copy);
+    }
+    log_message(LOG_ERROR, "Cannot open fd %d for the metrics\n", fd);
+    return 0;
+  }
+
+  fahe_metrics *metrics = metrics_take();
+  int ok = metrics && fahe_metrics_write_prometheus(metrics, stream);
+  ok = (fclose(stream) == 0) && ok;
+  free(metrics);
+  return ok;
+}
+
+int fahe_metrics_dump_file(const char *path) {
+  size_t len = strlen(path);
+  char *tmp = (char *)malloc(len + 5);
+  if (!tmp) {
+    log_message(LOG_ERROR, "Memory allocation for the metrics path failed\n");
+    return 0;
+  }
+  memcpy(tmp, path, len);
+  memcpy(tmp + len, ".tmp", 5);
+
+  FILE *stream = fopen(tmp, "w");
+  if (!stream) {
+    log_message(LOG_ERROR, "Cannot open %s for the metrics\n", tmp);
+    free(tmp);
+    return 0;
+  }
+  fahe_metrics *metrics = metrics_take();
+  int ok = metrics && fahe_metrics_write_prometheus(metrics, stream);
+  ok = (fclose(stream) == 0) && ok;
+  free(metrics);
+
+  if (ok && rename(tmp, path) != 0) {
+    log_message(LOG_ERROR, "Cannot rename %s to %s\n", tmp, path);
+    ok = 0;
+  }
+  if (!ok) {
+    remove(tmp);
+  }
+  free(tmp);
+  return ok;
+}
+
+const char *fahe_op_name(fahe_op op) {
+  if ((int)op < 0 || op >= FAHE_OP_COUNT) {
+    return "unknown";
+  }
+  return op_names[op];
+}
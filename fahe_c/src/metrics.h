@@ -0,0 +1,234 @@
+/**
+ * @file metrics.h
+ * @brief Header file for metrics.c, process-wide operation counters and
+ * latency histograms with a Prometheus text export.
+ *
+ * Once switched on with fahe_metrics_enable, keygen, encryption,
+ * decryption and addition count the ciphertexts they handle, the bytes of
+ * ciphertext they write or read and their failures, and add the latency of
+ * each call to a histogram. Everything is kept per operation and per
+ * scheme, in counters owned by the recording thread, as in stats.h.
+ * fahe_metrics_snapshot sums the counters of all threads.
+ *
+ * The histograms are log-linear, in the style of HdrHistogram: samples
+ * below 2**FAHE_METRICS_SUB_BITS ns get a bucket each, and every further
+ * power of two is split into 2**FAHE_METRICS_SUB_BITS equal buckets. Any
+ * quantile read from them is within 1 / 2**FAHE_METRICS_SUB_BITS (12.5%)
+ * of the true value, from 1 ns up to 2**FAHE_METRICS_MAX_BITS ns (18
+ * minutes).
+ *
+ * fahe_metrics_write_prometheus formats a snapshot in the Prometheus text
+ * exposition format; fahe_metrics_dump_fd and fahe_metrics_dump_file take
+ * the snapshot and write it in one call, the latter atomically for a
+ * scraper that reads the file.
+ *
+ * Metrics are off by default. When off, an instrumented call costs one
+ * relaxed load; when on, two clock reads and a few stores to thread-local
+ * counters.
+ *
+ * This file contains the following structs: fahe_op_metrics, fahe_metrics
+ *                and the following methods: fahe_metrics_enable,
+ * fahe_metrics_enabled, fahe_metrics_start, fahe_metrics_record,
+ * fahe_metrics_fail, fahe_metrics_snapshot, fahe_metrics_reset,
+ * fahe_metrics_quantile, fahe_metrics_write_prometheus,
+ * fahe_metrics_dump_fd, fahe_metrics_dump_file, fahe_op_name
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Each power of two of the latency histograms is split into
+ * 2**FAHE_METRICS_SUB_BITS buckets.
+ */
+#define FAHE_METRICS_SUB_BITS 3
+
+/**
+ * @brief Latencies of 2**FAHE_METRICS_MAX_BITS ns and more share the last
+ * bucket.
+ */
+#define FAHE_METRICS_MAX_BITS 40
+
+/**
+ * @brief Buckets per latency histogram.
+ */
+#define FAHE_METRICS_BUCKETS \
+  ((FAHE_METRICS_MAX_BITS - FAHE_METRICS_SUB_BITS + 1) << FAHE_METRICS_SUB_BITS)
+
+/**
+ * @brief Scheme slots: 1 and 2 for FAHE1 and FAHE2, 0 for operations that
+ * do not depend on the scheme, such as addition.
+ */
+#define FAHE_METRICS_SCHEMES 3
+
+/**
+ * @brief Measured operations.
+ *
+ * The count of an operation is the number of keys generated, ciphertexts
+ * encrypted or decrypted, or ciphertexts summed: fahe_add counts 2,
+ * fahe_add_inplace 1 and a sum of a list the length of the list, where
+ * fahe_sum_parallel records one call per block. Bytes are the ciphertext
+ * bytes written by encryption and read by decryption and addition, counted
+ * as the size of each ciphertext value, ceil(bits / 8) as BN_num_bytes
+ * gives it. Limb paths count the same: the zero top limbs of a row or of a
+ * buffer are not ciphertext bytes.
+ */
+typedef enum {
+  FAHE_OP_KEYGEN,
+  FAHE_OP_ENCRYPT,
+  FAHE_OP_DECRYPT,
+  FAHE_OP_ADD,
+  FAHE_OP_COUNT
+} fahe_op;
+
+/**
+ * @typedef fahe_op_metrics
+ * @brief Counters of one operation of one scheme.
+ */
+
+/**
+ * @struct fahe_op_metrics
+ *
+ * @var fahe_op_metrics: count, bytes, failures (uint64_t)
+ * Items handled, ciphertext bytes handled and failed calls.
+ *
+ * @var fahe_op_metrics: calls, total_ns (uint64_t)
+ * Number and total latency of the timed calls.
+ *
+ * @var fahe_op_metrics: hist (uint64_t[FAHE_METRICS_BUCKETS])
+ * Timed calls per log-linear latency bucket.
+ */
+typedef struct {
+  uint64_t count;
+  uint64_t bytes;
+  uint64_t failures;
+  uint64_t calls;
+  uint64_t total_ns;
+  uint64_t hist[FAHE_METRICS_BUCKETS];
+} fahe_op_metrics;
+
+/**
+ * @typedef fahe_metrics
+ * @brief A snapshot of all operations.
+ */
+
+/**
+ * @struct fahe_metrics
+ *
+ * @var fahe_metrics: ops (fahe_op_metrics[FAHE_OP_COUNT][3])
+ * The counters, indexed by fahe_op and scheme slot.
+ */
+typedef struct {
+  fahe_op_metrics ops[FAHE_OP_COUNT][FAHE_METRICS_SCHEMES];
+} fahe_metrics;
+
+/**
+ * @brief Switches recording on (1) or off (0) for all threads.
+ */
+void fahe_metrics_enable(int on);
+
+/**
+ * @brief Returns 1 if recording is on, 0 otherwise.
+ */
+int fahe_metrics_enabled(void);
+
+/**
+ * @brief Starts timing a call.
+ *
+ * @return The current time in ns, or 0 if recording is off.
+ */
+uint64_t fahe_metrics_start(void);
+
+/**
+ * @brief Records a successful call on the current thread.
+ *
+ * Does nothing if recording is off. A start of 0, from a call that began
+ * while recording was off, counts the call without a latency sample.
+ *
+ * @param[in] op The operation.
+ * @param[in] scheme The scheme slot, @see FAHE_METRICS_SCHEMES.
+ * @param[in] start What fahe_metrics_start returned at the top of the call.
+ * @param[in] count Items handled by the call.
+ * @param[in] bytes Ciphertext bytes handled by the call, @see fahe_op.
+ */
+void fahe_metrics_record(fahe_op op, int scheme, uint64_t start,
+                         uint64_t count, uint64_t bytes);
+
+/**
+ * @brief Records a failed call on the current thread. Does nothing if
+ * recording is off.
+ */
+void fahe_metrics_fail(fahe_op op, int scheme);
+
+/**
+ * @brief Sums the counters of all threads, including threads that have
+ * exited.
+ *
+ * @param[out] metrics Where to store the snapshot.
+ */
+void fahe_metrics_snapshot(fahe_metrics *metrics);
+
+/**
+ * @brief Zeroes the counters of all threads.
+ *
+ * @note As with fahe_stats_reset, calls recorded while the reset runs may
+ * survive it.
+ */
+void fahe_metrics_reset(void);
+
+/**
+ * @brief Returns a quantile of the latency of an operation.
+ *
+ * @param[in] m Counters of the operation from a snapshot.
+ * @param[in] q The quantile, in [0, 1].
+ *
+ * @return The upper edge in ns of the bucket holding the quantile, 0 if no
+ *         call was timed.
+ */
+uint64_t fahe_metrics_quantile(const fahe_op_metrics *m, double q);
+
+/**
+ * @brief Writes a snapshot in the Prometheus text exposition format.
+ *
+ * Counters are fahe_keygens_total, fahe_ciphertexts_encrypted_total,
+ * fahe_ciphertexts_decrypted_total, fahe_ciphertexts_added_total,
+ * fahe_ciphertext_bytes_total and fahe_failures_total. Latencies are the
+ * histogram fahe_operation_duration_seconds, with buckets from 1 us to
+ * 10 s, and the summary fahe_operation_latency_seconds with the 0.5, 0.9,
+ * 0.99 and 0.999 quantiles read from the full histogram. Series carry the
+ * labels op and, except for addition, scheme.
+ *
+ * @param[in] metrics A snapshot.
+ * @param[in] stream Where to write.
+ *
+ * @return 1 on success, 0 if writing failed.
+ */
+int fahe_metrics_write_prometheus(const fahe_metrics *metrics, FILE *stream);
+
+/**
+ * @brief Takes a snapshot and writes it to a file descriptor, which stays
+ * open.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_metrics_dump_fd(int fd);
+
+/**
+ * @brief Takes a snapshot and replaces the file at path with it.
+ *
+ * The snapshot is written to path.tmp and renamed over path, so a scraper
+ * never reads a partial file.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_metrics_dump_file(const char *path);
+
+/**
+ * @brief Returns the name of an operation, e.g. "encrypt".
+ */
+const char *fahe_op_name(fahe_op op);
+
+#endif  // METRICS_H
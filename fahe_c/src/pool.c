@@ -0,0 +1,211 @@
+/**
+ * @file pool.c
+ * @brief Implementation of the background-filled pool of p * q values.
+ *
+ * The pool is a ring of fixed-size limb rows. A single worker thread writes
+ * the free slot after the newest value without holding the lock, because
+ * consumers only read the occupied slots, and then publishes it by
+ * incrementing count under the lock.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ * - openssl/crypto.h
+ * - pthread.h
+ * - limb.h
+ * - logger.h
+ * - rng.h
+ *
+ * @see pool.h for the documentation of the functions implemented here.
+ */
+
+#include "pool.h"
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "limb.h"
+#include "logger.h"
+#include "rng.h"
+
+static void *pool_worker(void *arg) {
+  fahe_pool *pool = (fahe_pool *)arg;
+
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->stop) {
+    // Sleep until consumers drain the pool to the low watermark
+    while (!pool->stop && pool->count > pool->low_watermark) {
+      pthread_cond_wait(&pool->wake_worker, &pool->lock);
+    }
+
+    // Refill to depth
+    while (!pool->stop && pool->count < pool->depth) {
+      uint64_t *slot =
+          pool->slots +
+          ((pool->head + pool->count) % pool->depth) * pool->n_limbs;
+      pthread_mutex_unlock(&pool->lock);
+
+      // slot = p * q with q < X + 1
+      int ok = fahe_rng_limbs_below(pool->rng, pool->q_buf, pool->bound_buf,
+                                    pool->q_limbs);
+      if (ok) {
+        limbs_mul_small_add(slot, pool->q_buf, pool->q_limbs, pool->p_buf,
+                            pool->p_limbs, NULL, 0);
+      }
+
+      pthread_mutex_lock(&pool->lock);
+      if (!ok) {
+        log_message(LOG_ERROR, "Pool worker failed to draw q, stopping\n");
+        pool->stop = 1;
+        break;
+      }
+      pool->count++;
+      pool->produced++;
+      pthread_cond_broadcast(&pool->filled);
+    }
+  }
+  pthread_cond_broadcast(&pool->filled);
+  pthread_mutex_unlock(&pool->lock);
+
+  OPENSSL_cleanse(pool->q_buf, pool->q_limbs * sizeof(uint64_t));
+  return NULL;
+}
+
+fahe_pool *fahe_pool_new(const BIGNUM *p, const BIGNUM *X, size_t depth,
+                         size_t low_watermark) {
+  if (!p || !X || BN_is_zero(p)) {
+    log_message(LOG_FATAL, "Pool key is NULL or incomplete\n");
+    exit(EXIT_FAILURE);
+  }
+  if (depth == 0 || low_watermark >= depth) {
+    log_message(LOG_FATAL, "Pool needs 0 <= low_watermark < depth\n");
+    exit(EXIT_FAILURE);
+  }
+
+  fahe_pool *pool = (fahe_pool *)malloc(sizeof(fahe_pool));
+  if (!pool) {
+    log_message(LOG_FATAL, "Memory allocation for fahe_pool failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  BIGNUM *X_plus_one = BN_dup(X);
+  if (!X_plus_one || !BN_add_word(X_plus_one, 1)) {
+    log_message(LOG_FATAL, "Computing X + 1 failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pool->depth = depth;
+  pool->low_watermark = low_watermark;
+  pool->p_limbs = FAHE_LIMBS(BN_num_bits(p));
+  pool->q_limbs = FAHE_LIMBS(BN_num_bits(X_plus_one));
+  // limbs_mul_small_add writes a final carry limb, which is zero here
+  pool->n_limbs = pool->p_limbs + pool->q_limbs + 1;
+  pool->p_buf = malloc(pool->p_limbs * sizeof(uint64_t));
+  pool->bound_buf = malloc(pool->q_limbs * sizeof(uint64_t));
+  pool->q_buf = malloc(pool->q_limbs * sizeof(uint64_t));
+  pool->slots = malloc(depth * pool->n_limbs * sizeof(uint64_t));
+  if (!pool->p_buf || !pool->bound_buf || !pool->q_buf || !pool->slots) {
+    log_message(LOG_FATAL, "Memory allocation for pool slots failed\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!limbs_from_bn(p, pool->p_buf, pool->p_limbs) ||
+      !limbs_from_bn(X_plus_one, pool->bound_buf, pool->q_limbs)) {
+    log_message(LOG_FATAL, "Exporting key limbs failed\n");
+    exit(EXIT_FAILURE);
+  }
+  BN_free(X_plus_one);
+
+  pool->head = 0;
+  pool->count = 0;
+  pool->hits = 0;
+  pool->misses = 0;
+  pool->produced = 0;
+  pool->stop = 0;
+  pool->rng = fahe_rng_new(FAHE_RNG_DEFAULT);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake_worker, NULL);
+  pthread_cond_init(&pool->filled, NULL);
+  if (pthread_create(&pool->worker, NULL, pool_worker, pool) != 0) {
+    log_message(LOG_FATAL, "Starting the pool worker failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  log_message(LOG_DEBUG, "fahe_pool of %zu x %zu limbs started\n", depth,
+              pool->n_limbs);
+  return pool;
+}
+
+void fahe_pool_free(fahe_pool *pool) {
+  if (!pool) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_signal(&pool->wake_worker);
+  pthread_mutex_unlock(&pool->lock);
+  pthread_join(pool->worker, NULL);
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->wake_worker);
+  pthread_cond_destroy(&pool->filled);
+  fahe_rng_free(pool->rng);
+  OPENSSL_cleanse(pool->slots,
+                  pool->depth * pool->n_limbs * sizeof(uint64_t));
+  free(pool->slots);
+  free(pool->p_buf);
+  free(pool->bound_buf);
+  free(pool->q_buf);
+  free(pool);
+}
+
+void fahe_pool_prefill(fahe_pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->stop && pool->count < pool->depth) {
+    pthread_cond_wait(&pool->filled, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+int fahe_pool_take(fahe_pool *pool, uint64_t *out, size_t out_limbs) {
+  if (out_limbs < pool->n_limbs) {
+    log_message(LOG_ERROR, "Pool output holds %zu limbs, need %zu\n",
+                out_limbs, pool->n_limbs);
+    return 0;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->count == 0) {
+    pool->misses++;
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+  }
+
+  // Copy and wipe under the lock: once head moves, the worker may refill
+  // this slot, and until then the mask must not stay in memory
+  uint64_t *slot = pool->slots + pool->head * pool->n_limbs;
+  memcpy(out, slot, pool->n_limbs * sizeof(uint64_t));
+  OPENSSL_cleanse(slot, pool->n_limbs * sizeof(uint64_t));
+  pool->head = (pool->head + 1) % pool->depth;
+  pool->count--;
+  pool->hits++;
+  if (pool->count <= pool->low_watermark) {
+    pthread_cond_signal(&pool->wake_worker);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = pool->n_limbs; i < out_limbs; i++) {
+    out[i] = 0;
+  }
+  return 1;
+}
+
+void fahe_pool_get_stats(fahe_pool *pool, fahe_pool_stats *stats) {
+  pthread_mutex_lock(&pool->lock);
+  stats->hits = pool->hits;
+  stats->misses = pool->misses;
+  stats->produced = pool->produced;
+  stats->available = pool->count;
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,178 @@
+/**
+ * @file pool.h
+ * @brief Header file for pool.c, a background-filled pool of p * q values
+ * for offline/online encryption.
+ *
+ * This file contains the following structs: fahe_pool, fahe_pool_stats
+ *                and the following methods: fahe_pool_new, fahe_pool_free,
+ * fahe_pool_prefill, fahe_pool_take, fahe_pool_get_stats
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <openssl/bn.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rng.h"
+
+/**
+ * @typedef fahe_pool_stats
+ * @brief Counters of a fahe_pool. @see fahe_pool_get_stats
+ */
+
+/**
+ * @struct fahe_pool_stats
+ *
+ * @var fahe_pool_stats: hits (uint64_t)
+ * fahe_pool_take calls served from the pool.
+ *
+ * @var fahe_pool_stats: misses (uint64_t)
+ * fahe_pool_take calls that found the pool empty.
+ *
+ * @var fahe_pool_stats: produced (uint64_t)
+ * Values generated by the background worker.
+ *
+ * @var fahe_pool_stats: available (size_t)
+ * Values currently in the pool.
+ */
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t produced;
+  size_t available;
+} fahe_pool_stats;
+
+/**
+ * @typedef fahe_pool
+ * @brief A bounded pool of fresh p * q values for one key.
+ *
+ * Only M depends on the message in c = p * q + M, while drawing the
+ * gamma-bit q and multiplying it by p is almost all of the encryption cost.
+ * A pool moves that work to a background thread: it keeps up to depth
+ * values of p * q, sleeps while more than low_watermark remain and refills
+ * to depth once consumers drain it to low_watermark. Online encryption then
+ * only copies one value out and adds M (@see fahe1_encrypt_pooled_limbs).
+ *
+ * Every value is handed out exactly once. An empty pool is a miss, and the
+ * caller computes p * q itself.
+ *
+ * @note fahe_pool_take is thread-safe; any number of threads may share one
+ * pool.
+ * @note Memory use is depth * (gamma / 8) bytes.
+ */
+
+/**
+ * @struct fahe_pool
+ *
+ * @var fahe_pool: depth, low_watermark (size_t)
+ * Capacity of the pool and the fill level at which the worker wakes up.
+ *
+ * @var fahe_pool: p_limbs, q_limbs (size_t)
+ * Limb counts of p and of the bound X + 1.
+ *
+ * @var fahe_pool: n_limbs (size_t)
+ * Limbs per pooled value, p_limbs + q_limbs + 1. This matches the c_limbs of
+ * an encryption context for the same key.
+ *
+ * @var fahe_pool: p_buf, bound_buf, q_buf (uint64_t*)
+ * Limbs of p, of X + 1 and the worker's scratch for q.
+ *
+ * @var fahe_pool: slots (uint64_t*)
+ * Ring of depth values of n_limbs limbs each.
+ *
+ * @var fahe_pool: head, count (size_t)
+ * Index of the oldest value and the number of values in the ring.
+ *
+ * @var fahe_pool: rng (fahe_rng*)
+ * The worker's random number engine.
+ *
+ * @var fahe_pool: hits, misses, produced (uint64_t)
+ * @see fahe_pool_stats struct
+ *
+ * @var fahe_pool: lock, wake_worker, filled (pthread_mutex_t, pthread_cond_t)
+ * Protect the ring and the counters; wake the worker at the low watermark;
+ * signal fahe_pool_prefill when a value is added.
+ *
+ * @var fahe_pool: worker, stop (pthread_t, int)
+ * The background thread and its shutdown flag.
+ */
+typedef struct {
+  size_t depth;
+  size_t low_watermark;
+  size_t p_limbs;
+  size_t q_limbs;
+  size_t n_limbs;
+  uint64_t *p_buf;
+  uint64_t *bound_buf;
+  uint64_t *q_buf;
+  uint64_t *slots;
+  size_t head;
+  size_t count;
+  fahe_rng *rng;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t produced;
+  pthread_mutex_t lock;
+  pthread_cond_t wake_worker;
+  pthread_cond_t filled;
+  pthread_t worker;
+  int stop;
+} fahe_pool;
+
+/**
+ * @brief Creates a pool for a key and starts its background worker.
+ *
+ * The worker starts filling the pool immediately.
+ *
+ * @param[in] p The key's prime p.
+ * @param[in] X The key's X; q is drawn uniformly below X + 1.
+ * @param[in] depth Maximum number of pooled values. Must be >= 1.
+ * @param[in] low_watermark Fill level at or below which the worker refills
+ *                          the pool to depth. Must be < depth.
+ *
+ * @return The initialized pool. Free with fahe_pool_free.
+ */
+fahe_pool *fahe_pool_new(const BIGNUM *p, const BIGNUM *X, size_t depth,
+                         size_t low_watermark);
+
+/**
+ * @brief Stops the worker and frees a pool. Pooled values are cleansed.
+ *
+ * @param[in] pool The pool to free. NULL is ignored.
+ */
+void fahe_pool_free(fahe_pool *pool);
+
+/**
+ * @brief Blocks until the pool holds depth values.
+ *
+ * @param[in] pool The pool to wait for.
+ */
+void fahe_pool_prefill(fahe_pool *pool);
+
+/**
+ * @brief Removes one p * q value from the pool.
+ *
+ * On a hit, the value is copied to out[0 .. n_limbs), its slot is
+ * cleansed and the limbs of out from n_limbs up to out_limbs are cleared.
+ * On a miss, out is untouched.
+ *
+ * @param[in] pool The pool to take from.
+ * @param[out] out Destination limbs.
+ * @param[in] out_limbs Size of out. Must be >= pool->n_limbs.
+ *
+ * @return 1 on a hit, 0 on a miss.
+ */
+int fahe_pool_take(fahe_pool *pool, uint64_t *out, size_t out_limbs);
+
+/**
+ * @brief Reads the pool's counters.
+ *
+ * @param[in] pool The pool to read.
+ * @param[out] stats The counters. @see fahe_pool_stats struct
+ */
+void fahe_pool_get_stats(fahe_pool *pool, fahe_pool_stats *stats);
+
+#endif  // POOL_H
@@ -0,0 +1,75 @@
+/**
+ * @file probes.h
+ * @brief USDT static tracepoints of the fahe library.
+ *
+ * Keygen, encryption, decryption and the list functions of both schemes
+ * fire an entry and a return probe of provider "fahe". A tracer attaches to
+ * them in a running process without a rebuild, e.g.
+ *
+ *   bpftrace -e 'usdt:./app:fahe:encrypt_entry { @s[tid] = nsecs; }
+ *     usdt:./app:fahe:encrypt_return /@s[tid]/ {
+ *       @ns[arg0] = hist(nsecs - @s[tid]); delete(@s[tid]); }'
+ *
+ * The probes come from <sys/sdt.h> (systemtap-sdt-dev), which is
+ * header-only: an unattached probe is a single nop and an ELF note, with no
+ * library to link. STAP arguments are evaluated whether or not a tracer is
+ * attached, so every argument is an integer the function already holds:
+ * a field of its key or context, a count it loops over, or a size it also
+ * reports to the metrics. The only exception is the gamma of
+ * encrypt_entry in fahe1_encrypt and fahe2_encrypt, which allocate several
+ * BIGNUMs on every call anyway. Without <sys/sdt.h>, or with
+ * -DFAHE_NO_PROBES, the macros expand to nothing.
+ *
+ * Probes and arguments; scheme is 1 or 2, sizes are in bits:
+ * - keygen_entry(scheme, lambda, m_max, alpha)
+ * - keygen_return(scheme, lambda, eta, gamma)
+ * - encrypt_entry(scheme, alpha, gamma), encrypt_return(scheme, alpha,
+ *   ciphertext size)
+ * - decrypt_entry(scheme, m_max, ciphertext size), decrypt_return(scheme,
+ *   m_max, ciphertext size)
+ * - encrypt_list_entry, encrypt_list_return, decrypt_list_entry,
+ *   decrypt_list_return(scheme, list length, threads)
+ *
+ * The encrypt and decrypt probes fire for every message, also inside the
+ * list functions. On every path, BIGNUM or limbs, the ciphertext size is
+ * the bit length of the ciphertext value, which the metrics count in bytes
+ * (@see fahe_op). It is at most gamma, or up to alpha bits more for a sum
+ * of ciphertexts.
+ *
+ * This file contains the following macros: FAHE_PROBES_ENABLED, FAHE_PROBE3,
+ * FAHE_PROBE4
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(FAHE_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define FAHE_PROBES_ENABLED 1
+#endif
+#endif
+
+/**
+ * @brief 1 if the probes are compiled in, 0 otherwise.
+ */
+#ifndef FAHE_PROBES_ENABLED
+#define FAHE_PROBES_ENABLED 0
+#endif
+
+/**
+ * @brief Fire probe fahe:name with three or four integer arguments.
+ */
+#if FAHE_PROBES_ENABLED
+#define FAHE_PROBE3(name, a, b, c) STAP_PROBE3(fahe, name, a, b, c)
+#define FAHE_PROBE4(name, a, b, c, d) STAP_PROBE4(fahe, name, a, b, c, d)
+#else
+#define FAHE_PROBE3(name, a, b, c) \
+  do {                             \
+  } while (0)
+#define FAHE_PROBE4(name, a, b, c, d) \
+  do {                                \
+  } while (0)
+#endif
+
+#endif  // PROBES_H
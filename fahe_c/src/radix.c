@@ -0,0 +1,534 @@
+/**
+ * @file radix.c
+ * @brief Implementation of the divide-and-conquer decimal conversion and of
+ * the linear hexadecimal conversion.
+ *
+ * Level j of the tree is the power P[j] = 10**(FAHE_RADIX_LEAF_DIGITS *
+ * 2**j) with b[j] bits, and its Barrett reciprocal mu[j] = 2**(2 b[j]) /
+ * P[j], rounded down. A node at level j of fahe_bn2dec is below P[j + 1] =
+ * P[j]**2 and is split into quotient and remainder by P[j]; a node of
+ * fahe_dec2bn joins two neighbours of level j - 1 as high * P[j] + low.
+ * Nodes are numbered from the least significant leaf, so node i of a
+ * level of stride 2**(j + 1) joins or splits into nodes i and i + 2**j.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ * - openssl/crypto.h
+ * - pthread.h
+ * - logger.h
+ * - thread_pool.h
+ *
+ * @see radix.h for the documentation of the functions implemented here.
+ */
+
+#include "radix.h"
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "thread_pool.h"
+
+#define RADIX_WORD_DIGITS 19
+#define RADIX_WORD_BASE 10000000000000000000ULL  // 10**RADIX_WORD_DIGITS
+#define RADIX_MAX_FIXUPS 64
+
+static BIGNUM *radix_pow[FAHE_RADIX_LEVELS];
+static BIGNUM *radix_mu[FAHE_RADIX_LEVELS];
+static int radix_bits[FAHE_RADIX_LEVELS];
+static int radix_levels;
+static pthread_mutex_t radix_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+  const char *digits;
+  size_t len;
+  char *out;
+  BIGNUM **nodes;
+  size_t num_nodes;
+  int level;
+  int failed;
+} radix_job;
+
+static int radix_is_digit(char c) { return c >= '0' && c <= '9'; }
+
+static int radix_hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Corrects mu to 2**(2b) / p rounded down, when it is a few units off
+static int radix_mu_fix(BIGNUM *mu, const BIGNUM *p, int b, BN_CTX *ctx) {
+  BN_CTX_start(ctx);
+  BIGNUM *r = BN_CTX_get(ctx);
+  BIGNUM *t = BN_CTX_get(ctx);
+  int ok = t && BN_mul(t, p, mu, ctx) &&
+           BN_lshift(r, BN_value_one(), 2 * b) && BN_sub(r, r, t);
+  int fixups = 0;
+  while (ok && BN_is_negative(r) && fixups++ < RADIX_MAX_FIXUPS) {
+    ok = BN_sub_word(mu, 1) && BN_add(r, r, p);
+  }
+  while (ok && BN_cmp(r, p) >= 0 && fixups++ < RADIX_MAX_FIXUPS) {
+    ok = BN_add_word(mu, 1) && BN_sub(r, r, p);
+  }
+  BN_CTX_end(ctx);
+  return ok && fixups <= RADIX_MAX_FIXUPS;
+}
+
+// Sets mu[j] from mu[j - 1]: as P[j] = P[j - 1]**2, mu[j - 1]**2 shifted to
+// 2 b[j] bits is within a factor 1 + 2**(1 - b[j - 1]) of mu[j], and one
+// Newton step x += x * (2**(2 b) - P x) / 2**(2 b) squares that error
+static int radix_mu_newton(int j, BN_CTX *ctx) {
+  int b = radix_bits[j];
+  int shift = 2 * b - 4 * radix_bits[j - 1];
+  BIGNUM *x = radix_mu[j];
+
+  BN_CTX_start(ctx);
+  BIGNUM *e = BN_CTX_get(ctx);
+  BIGNUM *t = BN_CTX_get(ctx);
+  int ok = t && BN_sqr(x, radix_mu[j - 1], ctx) &&
+           (shift >= 0 ? BN_lshift(x, x, shift) : BN_rshift(x, x, -shift)) &&
+           BN_mul(t, radix_pow[j], x, ctx) &&
+           BN_lshift(e, BN_value_one(), 2 * b) && BN_sub(e, e, t) &&
+           BN_mul(t, x, e, ctx) && BN_rshift(t, t, 2 * b) && BN_add(x, x, t);
+  BN_CTX_end(ctx);
+  return ok && radix_mu_fix(x, radix_pow[j], b, ctx);
+}
+
+// Makes sure levels [0, levels) of the power tree exist
+static int radix_ensure(int levels, BN_CTX *ctx) {
+  if (levels > FAHE_RADIX_LEVELS) {
+    log_message(LOG_ERROR, "Number too large for %d radix levels\n",
+                FAHE_RADIX_LEVELS);
+    return 0;
+  }
+  if (__atomic_load_n(&radix_levels, __ATOMIC_ACQUIRE) >= levels) {
+    return 1;
+  }
+  pthread_mutex_lock(&radix_lock);
+  int ok = 1;
+  while (ok && radix_levels < levels) {
+    int j = radix_levels;
+    BIGNUM *p = BN_new();
+    BIGNUM *mu = BN_new();
+    ok = p && mu;
+    if (ok && j == 0) {
+      BIGNUM *e = BN_new();
+      ok = e && BN_set_word(p, RADIX_WORD_BASE) &&
+           BN_set_word(e, FAHE_RADIX_LEAF_DIGITS / RADIX_WORD_DIGITS) &&
+           BN_exp(p, p, e, ctx);
+      BN_free(e);
+      radix_bits[j] = BN_num_bits(p);
+      ok = ok && BN_set_bit(mu, 2 * radix_bits[j]) &&
+           BN_div(mu, NULL, mu, p, ctx);
+      radix_pow[j] = p;
+      radix_mu[j] = mu;
+    } else if (ok) {
+      ok = BN_sqr(p, radix_pow[j - 1], ctx);
+      radix_bits[j] = BN_num_bits(p);
+      radix_pow[j] = p;
+      radix_mu[j] = mu;
+      ok = ok && radix_mu_newton(j, ctx);
+    }
+    if (!ok) {
+      BN_free(p);
+      BN_free(mu);
+      radix_pow[j] = NULL;
+      radix_mu[j] = NULL;
+      log_message(LOG_ERROR, "Computing radix level %d failed\n", j);
+      break;
+    }
+    __atomic_store_n(&radix_levels, j + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&radix_lock);
+  return ok;
+}
+
+// Sets q and r to the quotient and remainder of m < P[j]**2 by P[j]
+static int radix_divmod(BIGNUM *q, BIGNUM *r, const BIGNUM *m, int j,
+                        BN_CTX *ctx) {
+  int b = radix_bits[j];
+  BN_CTX_start(ctx);
+  BIGNUM *t = BN_CTX_get(ctx);
+  int ok = t && BN_rshift(t, m, b - 1) && BN_mul(t, t, radix_mu[j], ctx) &&
+           BN_rshift(q, t, b + 1) && BN_mul(t, q, radix_pow[j], ctx) &&
+           BN_sub(r, m, t);
+  // Barrett's estimate is at most 2 below the quotient
+  while (ok && BN_cmp(r, radix_pow[j]) >= 0) {
+    ok = BN_sub(r, r, radix_pow[j]) && BN_add_word(q, 1);
+  }
+  BN_CTX_end(ctx);
+  return ok;
+}
+
+// Sets bn to the len decimal digits at s, RADIX_WORD_DIGITS at a time
+static int radix_leaf_parse(BIGNUM *bn, const char *s, size_t len) {
+  size_t n = len % RADIX_WORD_DIGITS;
+  if (n == 0) {
+    n = RADIX_WORD_DIGITS;
+  }
+  BN_zero(bn);
+  for (size_t i = 0; i < len; i += n, n = RADIX_WORD_DIGITS) {
+    BN_ULONG word = 0;
+    for (size_t k = 0; k < n; k++) {
+      word = word * 10 + (BN_ULONG)(s[i + k] - '0');
+    }
+    if ((i > 0 && !BN_mul_word(bn, (BN_ULONG)RADIX_WORD_BASE)) ||
+        !BN_add_word(bn, word)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Writes v < 10**width as exactly width digits at out. v is consumed.
+static int radix_leaf_print(BIGNUM *v, char *out, size_t width) {
+  size_t pos = width;
+  while (pos > 0) {
+    BN_ULONG word = 0;
+    if (!BN_is_zero(v)) {
+      word = BN_div_word(v, (BN_ULONG)RADIX_WORD_BASE);
+      if (word == (BN_ULONG)-1) {
+        return 0;
+      }
+    }
+    for (size_t k = 0; k < RADIX_WORD_DIGITS && pos > 0; k++) {
+      out[--pos] = (char)('0' + word % 10);
+      word /= 10;
+    }
+  }
+  return 1;
+}
+
+static void radix_parse_task(void *arg, size_t begin, size_t end,
+                             fahe_worker *worker) {
+  (void)worker;
+  radix_job *job = (radix_job *)arg;
+  for (size_t k = begin; k < end; k++) {
+    // Leaf k holds the digits [len - (k + 1) * leaf, len - k * leaf)
+    size_t stop = job->len - k * FAHE_RADIX_LEAF_DIGITS;
+    size_t start =
+        stop > FAHE_RADIX_LEAF_DIGITS ? stop - FAHE_RADIX_LEAF_DIGITS : 0;
+    if (!radix_leaf_parse(job->nodes[k], job->digits + start, stop - start)) {
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static void radix_join_task(void *arg, size_t begin, size_t end,
+                            fahe_worker *worker) {
+  radix_job *job = (radix_job *)arg;
+  size_t half = (size_t)1 << job->level;
+  BN_CTX *ctx = worker->bn_ctx;
+  BN_CTX_start(ctx);
+  BIGNUM *t = BN_CTX_get(ctx);
+  for (size_t item = begin; item < end; item++) {
+    size_t i = item * 2 * half;
+    if (i + half >= job->num_nodes) {
+      continue;
+    }
+    if (!t || !BN_mul(t, job->nodes[i + half], radix_pow[job->level], ctx) ||
+        !BN_add(job->nodes[i], job->nodes[i], t)) {
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+  }
+  BN_CTX_end(ctx);
+}
+
+static void radix_split_task(void *arg, size_t begin, size_t end,
+                             fahe_worker *worker) {
+  radix_job *job = (radix_job *)arg;
+  size_t half = (size_t)1 << job->level;
+  BN_CTX *ctx = worker->bn_ctx;
+  BN_CTX_start(ctx);
+  BIGNUM *r = BN_CTX_get(ctx);
+  for (size_t item = begin; item < end; item++) {
+    size_t i = item * 2 * half;
+    if (!r ||
+        !radix_divmod(job->nodes[i + half], r, job->nodes[i], job->level,
+                      ctx) ||
+        !BN_copy(job->nodes[i], r)) {
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+  }
+  BN_CTX_end(ctx);
+}
+
+static void radix_print_task(void *arg, size_t begin, size_t end,
+                             fahe_worker *worker) {
+  (void)worker;
+  radix_job *job = (radix_job *)arg;
+  for (size_t k = begin; k < end; k++) {
+    char *out = job->out + (job->num_nodes - 1 - k) * FAHE_RADIX_LEAF_DIGITS;
+    if (!radix_leaf_print(job->nodes[k], out, FAHE_RADIX_LEAF_DIGITS)) {
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+// Runs fn over [0, num_items) on pool, or on the calling thread if NULL
+static void radix_run(fahe_thread_pool *pool, fahe_worker *self,
+                      size_t num_items, fahe_task_fn fn, radix_job *job) {
+  if (pool && num_items > 1) {
+    fahe_thread_pool_run(pool, num_items, 0, fn, job);
+  } else {
+    fn(job, 0, num_items, self);
+  }
+}
+
+static BIGNUM **radix_nodes_new(size_t num_nodes) {
+  BIGNUM **nodes = calloc(num_nodes, sizeof(BIGNUM *));
+  if (!nodes) {
+    log_message(LOG_FATAL, "Memory allocation for radix nodes failed\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < num_nodes; i++) {
+    nodes[i] = BN_new();
+    if (!nodes[i]) {
+      log_message(LOG_FATAL, "BN_new failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return nodes;
+}
+
+static void radix_nodes_free(BIGNUM **nodes, size_t num_nodes) {
+  for (size_t i = 0; i < num_nodes; i++) {
+    BN_clear_free(nodes[i]);
+  }
+  free(nodes);
+}
+
+static int radix_dec2bn(BIGNUM *bn, const char *s, size_t len,
+                        fahe_thread_pool *pool) {
+  int neg = len > 0 && s[0] == '-';
+  s += neg;
+  len -= neg;
+  if (len == 0) {
+    return 0;
+  }
+  for (size_t i = 0; i < len; i++) {
+    if (!radix_is_digit(s[i])) {
+      return 0;
+    }
+  }
+
+  if (len <= FAHE_RADIX_LEAF_DIGITS) {
+    if (!radix_leaf_parse(bn, s, len)) {
+      return 0;
+    }
+    BN_set_negative(bn, neg);
+    return 1;
+  }
+
+  size_t num_leaves = (len + FAHE_RADIX_LEAF_DIGITS - 1) /
+                      FAHE_RADIX_LEAF_DIGITS;
+  int levels = 0;
+  while (((size_t)1 << levels) < num_leaves) {
+    levels++;
+  }
+  BN_CTX *ctx = BN_CTX_new();
+  if (!ctx || !radix_ensure(levels, ctx)) {
+    BN_CTX_free(ctx);
+    return 0;
+  }
+
+  radix_job job;
+  job.digits = s;
+  job.len = len;
+  job.out = NULL;
+  job.nodes = radix_nodes_new(num_leaves);
+  job.num_nodes = num_leaves;
+  job.level = 0;
+  job.failed = 0;
+  fahe_worker self;
+  self.index = 0;
+  self.bn_ctx = ctx;
+  self.rng = NULL;
+
+  radix_run(pool, &self, num_leaves, radix_parse_task, &job);
+  for (int j = 0; j < levels && !job.failed; j++) {
+    size_t stride = (size_t)2 << j;
+    job.level = j;
+    radix_run(pool, &self, (num_leaves + stride - 1) / stride,
+              radix_join_task, &job);
+  }
+
+  int ok = !job.failed && BN_copy(bn, job.nodes[0]) != NULL;
+  if (ok) {
+    BN_set_negative(bn, neg);
+  }
+  radix_nodes_free(job.nodes, num_leaves);
+  BN_CTX_free(ctx);
+  return ok;
+}
+
+static char *radix_bn2dec(const BIGNUM *bn, fahe_thread_pool *pool) {
+  int neg = BN_is_negative(bn);
+  // Digits of |bn| are at most bits * log10(2) + 1, and log10(2) < 0.30103
+  size_t digits = (size_t)BN_num_bits(bn) * 30103 / 100000 + 1;
+
+  size_t num_leaves = 1;
+  int levels = 0;
+  size_t width = (digits + RADIX_WORD_DIGITS - 1) / RADIX_WORD_DIGITS *
+                 RADIX_WORD_DIGITS;
+  if (digits > FAHE_RADIX_LEAF_DIGITS) {
+    while (num_leaves * FAHE_RADIX_LEAF_DIGITS < digits) {
+      num_leaves *= 2;
+      levels++;
+    }
+    width = num_leaves * FAHE_RADIX_LEAF_DIGITS;
+  }
+
+  char *out = OPENSSL_malloc(width + 2);
+  BN_CTX *ctx = BN_CTX_new();
+  if (!out || !ctx) {
+    OPENSSL_free(out);
+    BN_CTX_free(ctx);
+    return NULL;
+  }
+
+  radix_job job;
+  job.digits = NULL;
+  job.len = 0;
+  job.out = out + 1;
+  job.nodes = radix_nodes_new(num_leaves);
+  job.num_nodes = num_leaves;
+  job.level = 0;
+  job.failed = !BN_copy(job.nodes[0], bn);
+  BN_set_negative(job.nodes[0], 0);
+  fahe_worker self;
+  self.index = 0;
+  self.bn_ctx = ctx;
+  self.rng = NULL;
+
+  if (num_leaves == 1) {
+    job.failed = job.failed || !radix_leaf_print(job.nodes[0], out + 1, width);
+  } else if (!job.failed && radix_ensure(levels, ctx)) {
+    for (int j = levels - 1; j >= 0 && !job.failed; j--) {
+      job.level = j;
+      radix_run(pool, &self, num_leaves >> (j + 1), radix_split_task, &job);
+    }
+    if (!job.failed) {
+      radix_run(pool, &self, num_leaves, radix_print_task, &job);
+    }
+  } else {
+    job.failed = 1;
+  }
+  radix_nodes_free(job.nodes, num_leaves);
+  BN_CTX_free(ctx);
+  if (job.failed) {
+    OPENSSL_free(out);
+    return NULL;
+  }
+
+  // Drop the zero padding, keeping one digit for zero
+  size_t skip = 0;
+  while (skip + 1 < width && out[1 + skip] == '0') {
+    skip++;
+  }
+  if (neg) {
+    out[0] = '-';
+    memmove(out + 1, out + 1 + skip, width - skip);
+    out[1 + width - skip] = '\0';
+  } else {
+    memmove(out, out + 1 + skip, width - skip);
+    out[width - skip] = '\0';
+  }
+  return out;
+}
+
+char *fahe_bn2dec(const BIGNUM *bn) { return radix_bn2dec(bn, NULL); }
+
+char *fahe_bn2dec_parallel(const BIGNUM *bn, fahe_thread_pool *pool) {
+  if (!pool) {
+    pool = fahe_thread_pool_shared();
+  }
+  return radix_bn2dec(bn, pool);
+}
+
+int fahe_dec2bn(BIGNUM *bn, const char *s, size_t len) {
+  return radix_dec2bn(bn, s, len, NULL);
+}
+
+int fahe_dec2bn_parallel(BIGNUM *bn, const char *s, size_t len,
+                         fahe_thread_pool *pool) {
+  if (!pool) {
+    pool = fahe_thread_pool_shared();
+  }
+  return radix_dec2bn(bn, s, len, pool);
+}
+
+char *fahe_bn2hex(const BIGNUM *bn) {
+  static const char hex[] = "0123456789ABCDEF";
+  int neg = BN_is_negative(bn);
+  size_t num_bytes = (size_t)BN_num_bytes(bn);
+  unsigned char *bytes = OPENSSL_malloc(num_bytes > 0 ? num_bytes : 1);
+  char *out = OPENSSL_malloc(2 * num_bytes + 3);
+  if (!bytes || !out) {
+    OPENSSL_free(bytes);
+    OPENSSL_free(out);
+    return NULL;
+  }
+  BN_bn2bin(bn, bytes);
+
+  char *p = out;
+  if (neg) {
+    *p++ = '-';
+  }
+  for (size_t i = 0; i < num_bytes; i++) {
+    // The top byte has no leading zero nibble
+    if (i > 0 || bytes[i] >> 4) {
+      *p++ = hex[bytes[i] >> 4];
+    }
+    *p++ = hex[bytes[i] & 15];
+  }
+  if (num_bytes == 0) {
+    *p++ = '0';
+  }
+  *p = '\0';
+  OPENSSL_free(bytes);
+  return out;
+}
+
+int fahe_hex2bn(BIGNUM *bn, const char *s, size_t len) {
+  int neg = len > 0 && s[0] == '-';
+  s += neg;
+  len -= neg;
+  if (len == 0) {
+    return 0;
+  }
+
+  // Pack nibbles from the least significant end into big-endian bytes
+  size_t num_bytes = (len + 1) / 2;
+  unsigned char *bytes = OPENSSL_malloc(num_bytes);
+  if (!bytes) {
+    return 0;
+  }
+  for (size_t i = 0; i < len; i++) {
+    int v = radix_hex_value(s[len - 1 - i]);
+    if (v < 0) {
+      OPENSSL_free(bytes);
+      return 0;
+    }
+    unsigned char *byte = &bytes[num_bytes - 1 - i / 2];
+    *byte = (unsigned char)(i % 2 ? *byte | (v << 4) : v);
+  }
+  int ok = BN_bin2bn(bytes, (int)num_bytes, bn) != NULL;
+  OPENSSL_free(bytes);
+  if (ok) {
+    BN_set_negative(bn, neg);
+  }
+  return ok;
+}
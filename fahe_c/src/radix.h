@@ -0,0 +1,115 @@
+/**
+ * @file radix.h
+ * @brief Header file for radix.c, decimal and hexadecimal conversion of
+ * BIGNUMs for text files, logs and prints.
+ *
+ * BN_bn2dec and BN_dec2bn convert 19 digits at a time with a word
+ * multiplication or division over the whole number, which is quadratic: at
+ * gamma = 300K bits they cost more than an encryption. The decimal
+ * routines here split the number instead, on a tree of powers
+ * 10**(FAHE_RADIX_LEAF_DIGITS * 2**j):
+ *
+ * - fahe_dec2bn parses the digits in leaves of FAHE_RADIX_LEAF_DIGITS and
+ *   joins neighbours level by level as high * 10**k + low;
+ * - fahe_bn2dec divides by the powers from the top level down, with
+ *   Barrett reduction, until the parts are leaves that are printed with
+ *   word divisions.
+ *
+ * Every level is a multiplication or a Barrett division of the size of the
+ * level, so a conversion costs O(M(n) log n) for an n-digit number, with
+ * M(n) the cost of BN_mul. The powers and their Barrett reciprocals are
+ * computed on first use, each reciprocal by one Newton step from the one a
+ * level below, and kept for the life of the process.
+ *
+ * The nodes of a level are independent, so the _parallel variants run them
+ * on the threads of a fahe_thread_pool.
+ *
+ * Hexadecimal needs no tree: fahe_bn2hex and fahe_hex2bn are linear and
+ * take a length, like fahe_dec2bn, so that records of a larger buffer can
+ * be converted in place.
+ *
+ * This file contains the following methods: fahe_bn2dec,
+ * fahe_bn2dec_parallel, fahe_dec2bn, fahe_dec2bn_parallel, fahe_bn2hex,
+ * fahe_hex2bn
+ */
+
+#ifndef RADIX_H
+#define RADIX_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+
+#include "thread_pool.h"
+
+/**
+ * @brief Decimal digits of a leaf of the tree, 16 words of 19 digits.
+ * Numbers of at most this many digits are converted with word operations
+ * alone.
+ */
+#define FAHE_RADIX_LEAF_DIGITS (19 * 16)
+
+/**
+ * @brief Levels of the power tree. The top power has
+ * FAHE_RADIX_LEAF_DIGITS * 2**(FAHE_RADIX_LEVELS - 1) digits.
+ */
+#define FAHE_RADIX_LEVELS 24
+
+/**
+ * @brief Converts a BIGNUM to decimal, like BN_bn2dec.
+ *
+ * @param[in] bn The value.
+ *
+ * @return A NUL-terminated string with a leading '-' if bn is negative, or
+ *         NULL on failure. Free with OPENSSL_free.
+ */
+char *fahe_bn2dec(const BIGNUM *bn);
+
+/**
+ * @brief fahe_bn2dec with the nodes of each level run on a pool.
+ *
+ * @param[in] bn The value.
+ * @param[in] pool The pool to run on. NULL uses fahe_thread_pool_shared.
+ */
+char *fahe_bn2dec_parallel(const BIGNUM *bn, fahe_thread_pool *pool);
+
+/**
+ * @brief Parses decimal digits, like BN_dec2bn but with a length.
+ *
+ * @param[out] bn Where to store the value.
+ * @param[in] s An optional '-' followed by at least one digit. Need not be
+ *              NUL-terminated.
+ * @param[in] len Length of s.
+ *
+ * @return 1 on success, 0 if s holds anything else or on failure.
+ */
+int fahe_dec2bn(BIGNUM *bn, const char *s, size_t len);
+
+/**
+ * @brief fahe_dec2bn with the nodes of each level run on a pool.
+ *
+ * @param[in] pool The pool to run on. NULL uses fahe_thread_pool_shared.
+ */
+int fahe_dec2bn_parallel(BIGNUM *bn, const char *s, size_t len,
+                         fahe_thread_pool *pool);
+
+/**
+ * @brief Converts a BIGNUM to upper-case hexadecimal, like BN_bn2hex but
+ * without zero padding to whole bytes.
+ *
+ * @return A NUL-terminated string, NULL on failure. Free with OPENSSL_free.
+ */
+char *fahe_bn2hex(const BIGNUM *bn);
+
+/**
+ * @brief Parses hexadecimal digits of either case, like BN_hex2bn but with
+ * a length.
+ *
+ * @param[out] bn Where to store the value.
+ * @param[in] s An optional '-' followed by at least one digit.
+ * @param[in] len Length of s.
+ *
+ * @return 1 on success, 0 if s holds anything else or on failure.
+ */
+int fahe_hex2bn(BIGNUM *bn, const char *s, size_t len);
+
+#endif  // RADIX_H
@@ -0,0 +1,274 @@
+/**
+ * @file reduce.c
+ * @brief Implementation of precomputed modular reduction by p.
+ *
+ * This file contains the folding reducer used by the decryption contexts of
+ * FAHE1 and FAHE2. Decryption only ever reduces by the key's prime p, so the
+ * reduction data for p is computed once and reused for every ciphertext.
+ *
+ * @note OpenSSL's own precomputed reductions do not fit this shape:
+ * BN_RECP_CTX recomputes its reciprocal whenever the dividend width changes,
+ * and BN_MONT_CTX only accepts inputs below p * R.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ * - helper.h
+ * - limb.h
+ * - logger.h
+ *
+ * @see reduce.h for the documentation of the functions implemented here.
+ */
+
+#include "reduce.h"
+
+#include <openssl/bn.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helper.h"
+#include "limb.h"
+#include "logger.h"
+
+// Extends the limb table and the export buffer to cover num_limbs limb
+// positions. Row i of the table is 2^(64 * i) mod p.
+static int reducer_grow_table(fahe_reducer *reducer, size_t num_limbs) {
+  if (reducer->limb_table && num_limbs <= reducer->table_len) {
+    return 1;
+  }
+  if (num_limbs < reducer->reserve_limbs) {
+    num_limbs = reducer->reserve_limbs;
+  }
+  if (num_limbs == 0) {
+    num_limbs = 1;
+  }
+
+  size_t k = reducer->p_limbs;
+  uint64_t *table =
+      realloc(reducer->limb_table, num_limbs * k * sizeof(uint64_t));
+  if (!table) {
+    return 0;
+  }
+  reducer->limb_table = table;
+  uint64_t *buf = realloc(reducer->limb_buf, num_limbs * sizeof(uint64_t));
+  if (!buf) {
+    return 0;
+  }
+  reducer->limb_buf = buf;
+
+  BN_CTX_start(reducer->bn_ctx);
+  BIGNUM *row = BN_CTX_get(reducer->bn_ctx);
+  size_t i = reducer->table_len;
+  int ok = row != NULL;
+
+  // Resume from the last row already in the table, or from 2^0 = 1
+  if (ok) {
+    ok = (i == 0) ? BN_one(row)
+                  : limbs_to_bn(table + (i - 1) * k, k, row) &&
+                        BN_lshift(row, row, 64) &&
+                        BN_mod(row, row, reducer->p, reducer->bn_ctx);
+  }
+  for (; ok && i < num_limbs; i++) {
+    ok = limbs_from_bn(row, table + i * k, k) && BN_lshift(row, row, 64) &&
+         BN_mod(row, row, reducer->p, reducer->bn_ctx);
+  }
+  BN_CTX_end(reducer->bn_ctx);
+  if (!ok) {
+    return 0;
+  }
+
+  reducer->table_len = num_limbs;
+  log_message(LOG_DEBUG, "Reducer limb table covers %zu limbs\n", num_limbs);
+  return 1;
+}
+
+fahe_reducer *fahe_reducer_new(BIGNUM *p, int reserve_bits) {
+  return fahe_reducer_new_ctx(p, reserve_bits, NULL);
+}
+
+fahe_reducer *fahe_reducer_new_ctx(BIGNUM *p, int reserve_bits,
+                                   BN_CTX *bn_ctx) {
+  if (!p || BN_is_zero(p) || BN_is_negative(p)) {
+    log_message(LOG_FATAL, "Reducer modulus must be positive\n");
+    exit(EXIT_FAILURE);
+  }
+
+  fahe_reducer *reducer = (fahe_reducer *)malloc(sizeof(fahe_reducer));
+  if (!reducer) {
+    log_message(LOG_FATAL, "Memory allocation for fahe_reducer failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  reducer->p = p;
+  reducer->p_bits = BN_num_bits(p);
+  reducer->method = FAHE_REDUCE_FOLD;
+  reducer->p_limbs = FAHE_LIMBS(reducer->p_bits);
+  reducer->reserve_limbs = reserve_bits > 0 ? FAHE_LIMBS(reserve_bits) : 0;
+  reducer->table_len = 0;
+  reducer->limb_table = NULL;
+  reducer->limb_buf = NULL;
+  reducer->owns_bn_ctx = bn_ctx == NULL;
+  reducer->bn_ctx = bn_ctx ? bn_ctx : BN_CTX_new();
+  reducer->acc = BN_new();
+  reducer->hi = BN_new();
+  reducer->lo = BN_new();
+  if (!reducer->bn_ctx || !reducer->acc || !reducer->hi || !reducer->lo) {
+    log_message(LOG_FATAL, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Folding by W bits only shrinks the value when W > p_bits + 1
+  reducer->min_fold = 0;
+  while (reducer->min_fold < FAHE_REDUCE_NUM_FOLDS &&
+         (64L << reducer->min_fold) <= reducer->p_bits + 1) {
+    reducer->min_fold++;
+  }
+
+  // fold_mod[0] = 2^64 mod p, fold_mod[i + 1] = fold_mod[i]^2 mod p
+  for (int i = 0; i < FAHE_REDUCE_NUM_FOLDS; i++) {
+    reducer->fold_mod[i] = BN_new();
+    if (!reducer->fold_mod[i]) {
+      log_message(LOG_FATAL, "BN_new failed\n");
+      exit(EXIT_FAILURE);
+    }
+    int ok = (i == 0)
+                 ? BN_set_bit(reducer->fold_mod[0], 64) &&
+                       BN_mod(reducer->fold_mod[0], reducer->fold_mod[0], p,
+                              reducer->bn_ctx)
+                 : BN_mod_sqr(reducer->fold_mod[i], reducer->fold_mod[i - 1],
+                              p, reducer->bn_ctx);
+    if (!ok) {
+      log_message(LOG_FATAL, "Computing folding constant %d failed\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Reserve scratch storage up front so reducing never grows a buffer
+  if (!bn_reserve_bits(reducer->acc, reserve_bits) ||
+      !bn_reserve_bits(reducer->hi, reserve_bits) ||
+      !bn_reserve_bits(reducer->lo, reserve_bits)) {
+    log_message(LOG_FATAL, "bn_reserve_bits failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return reducer;
+}
+
+void fahe_reducer_free(fahe_reducer *reducer) {
+  if (!reducer) {
+    return;
+  }
+  for (int i = 0; i < FAHE_REDUCE_NUM_FOLDS; i++) {
+    BN_free(reducer->fold_mod[i]);
+  }
+  BN_free(reducer->acc);
+  BN_free(reducer->hi);
+  BN_free(reducer->lo);
+  if (reducer->owns_bn_ctx) {
+    BN_CTX_free(reducer->bn_ctx);
+  }
+  free(reducer->limb_table);
+  free(reducer->limb_buf);
+  free(reducer);
+}
+
+void fahe_reducer_set_method(fahe_reducer *reducer, fahe_reduce_method method) {
+  if (method == FAHE_REDUCE_LIMB_TABLE) {
+    if (reducer->p_limbs > FAHE_REDUCE_MAX_P_LIMBS) {
+      log_message(LOG_ERROR, "p is too wide for the limb table, folding\n");
+      return;
+    }
+    if (!reducer_grow_table(reducer, 1)) {
+      log_message(LOG_FATAL, "Building the reducer limb table failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  reducer->method = method;
+}
+
+int fahe_reduce(fahe_reducer *reducer, BIGNUM *r, const BIGNUM *c) {
+  if (reducer->method == FAHE_REDUCE_LIMB_TABLE) {
+    size_t num_limbs = FAHE_LIMBS(BN_num_bits(c));
+    if (num_limbs == 0) {
+      BN_zero(r);
+      return 1;
+    }
+    if (!reducer_grow_table(reducer, num_limbs) ||
+        !limbs_from_bn(c, reducer->limb_buf, num_limbs)) {
+      log_message(LOG_ERROR, "Exporting ciphertext limbs failed\n");
+      return 0;
+    }
+    return fahe_reduce_limbs(reducer, r, reducer->limb_buf, num_limbs);
+  }
+
+  const BIGNUM *src = c;
+  int src_bits = BN_num_bits(src);
+
+  while (src_bits > 2 * reducer->p_bits + 64) {
+    // Pick the widest fold that leaves a non-empty high part
+    int i = reducer->min_fold;
+    while (i + 1 < FAHE_REDUCE_NUM_FOLDS && (64L << (i + 1)) < src_bits - 1) {
+      i++;
+    }
+    int width = 64 << i;
+    if (width >= src_bits - 1) {
+      break;
+    }
+
+    // src = hi * 2^width + lo  =>  src = hi * fold_mod[i] + lo (mod p)
+    if (!BN_rshift(reducer->hi, src, width) || !BN_copy(reducer->lo, src) ||
+        !BN_mask_bits(reducer->lo, width) ||
+        !BN_mul(reducer->acc, reducer->hi, reducer->fold_mod[i],
+                reducer->bn_ctx) ||
+        !BN_add(reducer->acc, reducer->acc, reducer->lo)) {
+      log_message(LOG_ERROR, "Folding by 2^%d failed\n", width);
+      return 0;
+    }
+    src = reducer->acc;
+    src_bits = BN_num_bits(src);
+  }
+
+  // At most 2 * eta + 64 bits remain; a short division finishes the job
+  if (!BN_mod(r, src, reducer->p, reducer->bn_ctx)) {
+    log_message(LOG_ERROR, "BN_mod failed\n");
+    return 0;
+  }
+  return 1;
+}
+
+int fahe_reduce_limbs(fahe_reducer *reducer, BIGNUM *r, const uint64_t *c,
+                      size_t num_limbs) {
+  size_t k = reducer->p_limbs;
+  if (k > FAHE_REDUCE_MAX_P_LIMBS) {
+    return limbs_to_bn(c, num_limbs, reducer->acc) &&
+           fahe_reduce(reducer, r, reducer->acc);
+  }
+  if (!reducer_grow_table(reducer, num_limbs)) {
+    log_message(LOG_ERROR, "Growing the reducer limb table failed\n");
+    return 0;
+  }
+
+  // cols[3j .. 3j + 2] = sum_i c[i] * table[i][j]
+  uint64_t cols[3 * FAHE_REDUCE_MAX_P_LIMBS] = {0};
+  limbs_table_mac(reducer->limb_table, k, c, 0, num_limbs, cols);
+
+  // sum = sum_j cols_j * 2^(64j). Each column is below 2^192, so the sum
+  // fits in k + 2 limbs; one more absorbs the carries while adding.
+  uint64_t sum[FAHE_REDUCE_MAX_P_LIMBS + 3] = {0};
+  for (size_t j = 0; j < k; j++) {
+    unsigned __int128 carry = 0;
+    for (size_t w = j; w < k + 3; w++) {
+      uint64_t add = (w < j + 3) ? cols[3 * j + (w - j)] : 0;
+      carry += (unsigned __int128)sum[w] + add;
+      sum[w] = (uint64_t)carry;
+      carry >>= 64;
+    }
+  }
+
+  // The single small reduction of at most eta + 192 bits
+  if (!limbs_to_bn(sum, k + 3, reducer->acc) ||
+      !BN_mod(r, reducer->acc, reducer->p, reducer->bn_ctx)) {
+    log_message(LOG_ERROR, "Final limb-table reduction failed\n");
+    return 0;
+  }
+  return 1;
+}
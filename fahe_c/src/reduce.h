@@ -0,0 +1,203 @@
+/**
+ * @file reduce.h
+ * @brief Header file for reduce.c, precomputed reduction of huge ciphertexts
+ * modulo the small secret prime p.
+ *
+ * This file contains the following structs: fahe_reducer
+ *                and the following methods: fahe_reducer_new,
+ * fahe_reducer_new_ctx, fahe_reducer_free, fahe_reducer_set_method,
+ * fahe_reduce, fahe_reduce_limbs
+ */
+
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of precomputed folding constants. fold_mod[i] covers a fold
+ * width of 64 * 2**i bits, so 26 entries handle ciphertexts up to 2**31 bits.
+ */
+#define FAHE_REDUCE_NUM_FOLDS 26
+
+/**
+ * @brief Largest p, in 64-bit limbs, supported by FAHE_REDUCE_LIMB_TABLE
+ * (1024 bits). Larger moduli always use FAHE_REDUCE_FOLD.
+ */
+#define FAHE_REDUCE_MAX_P_LIMBS 16
+
+/**
+ * @brief Reduction strategies of a fahe_reducer.
+ *
+ * FAHE_REDUCE_FOLD folds the BIGNUM with 2**(64 * 2**i) mod p constants.
+ * FAHE_REDUCE_LIMB_TABLE multiply-accumulates every 64-bit limb of the value
+ * against a table of 2**(64 * i) mod p and reduces the short sum once. It
+ * works on native limbs, so it pays off most when the ciphertext is already
+ * a limb array (@see fahe_reduce_limbs); BIGNUM inputs are exported first.
+ */
+typedef enum { FAHE_REDUCE_FOLD, FAHE_REDUCE_LIMB_TABLE } fahe_reduce_method;
+
+/**
+ * @typedef fahe_reducer
+ * @brief Precomputed data for reducing gamma-bit values modulo an eta-bit p.
+ *
+ * Ciphertexts are gamma bits (tens to hundreds of thousands) while p is only
+ * eta bits (a few hundred). Instead of a generic long division, the reducer
+ * folds the value: with c = hi * 2**W + lo and R = 2**W mod p,
+ * c = hi * R + lo (mod p), which shrinks c by about W - eta bits using one
+ * short multiplication. The fold constants and the scratch BIGNUMs are
+ * created once per key, so reducing does not allocate.
+ *
+ * @note A reducer is not thread-safe. Use one reducer per thread.
+ * @note The reducer borrows p; p must outlive the reducer.
+ */
+
+/**
+ * @struct fahe_reducer
+ *
+ * @var fahe_reducer: p (BIGNUM*)
+ * The modulus. Borrowed from the key.
+ *
+ * @var fahe_reducer: p_bits (int)
+ * Bit length of p (eta).
+ *
+ * @var fahe_reducer: min_fold (int)
+ * Index of the smallest fold width 64 * 2**min_fold that is larger than
+ * p_bits + 1. Narrower folds would not shrink the value.
+ *
+ * @var fahe_reducer: fold_mod (BIGNUM*[])
+ * fold_mod[i] = 2**(64 * 2**i) mod p.
+ *
+ * @var fahe_reducer: bn_ctx (BN_CTX*)
+ * Context reused by every BIGNUM operation of this reducer.
+ *
+ * @var fahe_reducer: owns_bn_ctx (int)
+ * 1 if bn_ctx was created by the reducer and is freed with it.
+ *
+ * @var fahe_reducer: acc, hi, lo (BIGNUM*)
+ * Scratch values for the running fold, its high and its low part.
+ *
+ * @var fahe_reducer: method (fahe_reduce_method)
+ * Strategy used by fahe_reduce. Defaults to FAHE_REDUCE_FOLD.
+ *
+ * @var fahe_reducer: p_limbs (size_t)
+ * Limbs per residue in limb_table, FAHE_LIMBS(p_bits).
+ *
+ * @var fahe_reducer: reserve_limbs (size_t)
+ * Limb positions the table is first built for, from reserve_bits.
+ *
+ * @var fahe_reducer: table_len (size_t)
+ * Number of limb positions covered by limb_table and limb_buf.
+ *
+ * @var fahe_reducer: limb_table (uint64_t*)
+ * Row i holds 2**(64 * i) mod p in p_limbs limbs. NULL until the
+ * FAHE_REDUCE_LIMB_TABLE method is selected or fahe_reduce_limbs is used.
+ *
+ * @var fahe_reducer: limb_buf (uint64_t*)
+ * Scratch limbs for exporting BIGNUM inputs to the limb-table kernel.
+ */
+typedef struct {
+  BIGNUM *p;
+  int p_bits;
+  int min_fold;
+  BIGNUM *fold_mod[FAHE_REDUCE_NUM_FOLDS];
+  BN_CTX *bn_ctx;
+  int owns_bn_ctx;
+  BIGNUM *acc;
+  BIGNUM *hi;
+  BIGNUM *lo;
+  fahe_reduce_method method;
+  size_t p_limbs;
+  size_t reserve_limbs;
+  size_t table_len;
+  uint64_t *limb_table;
+  uint64_t *limb_buf;
+} fahe_reducer;
+
+/**
+ * @brief Creates a reducer for the modulus p.
+ *
+ * This function computes the folding constants 2**(64 * 2**i) mod p by
+ * repeated squaring, creates a BN_CTX and reserves the scratch BIGNUMs for
+ * reserve_bits bits.
+ *
+ * @param[in] p The modulus. Must be positive.
+ * @param[in] reserve_bits The largest input size expected, in bits. Inputs
+ *                         larger than this still reduce correctly but grow
+ *                         the scratch buffers once. 0 reserves nothing.
+ *
+ * @return The initialized reducer. Free with fahe_reducer_free.
+ */
+fahe_reducer *fahe_reducer_new(BIGNUM *p, int reserve_bits);
+
+/**
+ * @brief Creates a reducer that uses a borrowed BN_CTX, e.g. the bn_ctx of
+ * a fahe_worker, instead of creating its own. @see fahe_reducer_new
+ *
+ * @param[in] p The modulus. Must be positive.
+ * @param[in] reserve_bits As for fahe_reducer_new.
+ * @param[in] bn_ctx Context for every BIGNUM operation. It must outlive the
+ *                   reducer and only be used by one thread at a time.
+ *
+ * @return The initialized reducer. Free with fahe_reducer_free.
+ */
+fahe_reducer *fahe_reducer_new_ctx(BIGNUM *p, int reserve_bits,
+                                   BN_CTX *bn_ctx);
+
+/**
+ * @brief Frees a reducer created by fahe_reducer_new.
+ *
+ * @param[in] reducer The reducer to free. NULL is ignored.
+ */
+void fahe_reducer_free(fahe_reducer *reducer);
+
+/**
+ * @brief Selects the strategy used by fahe_reduce.
+ *
+ * Selecting FAHE_REDUCE_LIMB_TABLE builds the limb table for the reserved
+ * size if it does not exist yet. It is ignored, with an error logged, when p
+ * is wider than FAHE_REDUCE_MAX_P_LIMBS limbs.
+ *
+ * @param[in] reducer The reducer to configure.
+ * @param[in] method @see fahe_reduce_method
+ */
+void fahe_reducer_set_method(fahe_reducer *reducer, fahe_reduce_method method);
+
+/**
+ * @brief Computes r = c mod p.
+ *
+ * With FAHE_REDUCE_FOLD, this function folds c with the largest precomputed
+ * width that still shrinks it until c is at most 2 * eta + 64 bits, then
+ * finishes with a single short BN_mod. With FAHE_REDUCE_LIMB_TABLE, it
+ * exports c to limbs and calls fahe_reduce_limbs.
+ *
+ * @param[in] reducer A reducer for p. @see fahe_reducer struct
+ * @param[out] r The result. May not alias reducer scratch values.
+ * @param[in] c The non-negative value to reduce. May alias r.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_reduce(fahe_reducer *reducer, BIGNUM *r, const BIGNUM *c);
+
+/**
+ * @brief Computes r = c mod p for a value given as little-endian limbs.
+ *
+ * This function computes sum(c[i] * (2**(64 * i) mod p)) with
+ * limbs_table_mac, which fits in p_limbs + 3 limbs, and reduces that short
+ * sum with a single BN_mod. The table grows once if c is longer than any
+ * value seen before. When p is wider than FAHE_REDUCE_MAX_P_LIMBS limbs, c
+ * is imported and folded instead.
+ *
+ * @param[in] reducer A reducer for p. @see fahe_reducer struct
+ * @param[out] r The result.
+ * @param[in] c The limbs of the value to reduce.
+ * @param[in] num_limbs The number of limbs in c.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_reduce_limbs(fahe_reducer *reducer, BIGNUM *r, const uint64_t *c,
+                      size_t num_limbs);
+
+#endif  // REDUCE_H
@@ -0,0 +1,259 @@
+/**
+ * @file rng.c
+ * @brief Implementation of the bulk random number engine.
+ *
+ * The engines produce randomness by encrypting zero bytes in place with a
+ * stream cipher keyed from OpenSSL's private DRBG, which makes the keystream
+ * land directly in the caller's buffer.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ * - openssl/evp.h
+ * - openssl/rand.h
+ * - pthread.h
+ * - limb.h
+ * - logger.h
+ *
+ * @see rng.h for the documentation of the functions implemented here.
+ */
+
+#include "rng.h"
+
+#include <limits.h>
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "limb.h"
+#include "logger.h"
+
+// Bumped in the child after fork(); engines keyed in an older generation
+// rekey before producing more output.
+static volatile unsigned int fork_generation = 0;
+static pthread_once_t rng_once = PTHREAD_ONCE_INIT;
+static pthread_key_t rng_thread_key;
+
+static void rng_after_fork_child(void) { fork_generation++; }
+
+static void rng_thread_destroy(void *rng) { fahe_rng_free((fahe_rng *)rng); }
+
+static void rng_init_once(void) {
+  pthread_atfork(NULL, NULL, rng_after_fork_child);
+  pthread_key_create(&rng_thread_key, rng_thread_destroy);
+}
+
+static int rng_rekey(fahe_rng *rng) {
+  rng->bytes_since_seed = 0;
+  rng->fork_generation = fork_generation;
+  if (rng->engine == FAHE_RNG_SYSTEM) {
+    return 1;
+  }
+
+  unsigned char key[32];
+  unsigned char iv[16];
+  if (RAND_priv_bytes(key, sizeof(key)) != 1 ||
+      RAND_priv_bytes(iv, sizeof(iv)) != 1) {
+    return 0;
+  }
+
+  const EVP_CIPHER *cipher;
+  if (rng->engine == FAHE_RNG_CHACHA20) {
+    // The first 4 bytes are the block counter; start it at 0
+    memset(iv, 0, 4);
+    cipher = EVP_chacha20();
+  } else {
+    cipher = EVP_aes_256_ctr();
+  }
+  int ok = EVP_EncryptInit_ex(rng->cipher, cipher, NULL, key, iv);
+  OPENSSL_cleanse(key, sizeof(key));
+  return ok;
+}
+
+// Grows the BIGNUM sampling buffer to num_limbs limbs
+static int rng_reserve_scratch(fahe_rng *rng, size_t num_limbs) {
+  if (num_limbs <= rng->scratch_len) {
+    return 1;
+  }
+  uint64_t *scratch = realloc(rng->scratch, num_limbs * sizeof(uint64_t));
+  if (!scratch) {
+    return 0;
+  }
+  rng->scratch = scratch;
+  rng->scratch_len = num_limbs;
+  return 1;
+}
+
+fahe_rng *fahe_rng_new(fahe_rng_engine engine) {
+  pthread_once(&rng_once, rng_init_once);
+
+  fahe_rng *rng = (fahe_rng *)malloc(sizeof(fahe_rng));
+  if (!rng) {
+    log_message(LOG_FATAL, "Memory allocation for fahe_rng failed\n");
+    exit(EXIT_FAILURE);
+  }
+  rng->engine = engine;
+  rng->cipher = EVP_CIPHER_CTX_new();
+  rng->top = BN_new();
+  rng->scratch = NULL;
+  rng->scratch_len = 0;
+  if (!rng->cipher || !rng->top) {
+    log_message(LOG_FATAL, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!rng_rekey(rng)) {
+    log_message(LOG_FATAL, "Keying the random number engine failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return rng;
+}
+
+void fahe_rng_free(fahe_rng *rng) {
+  if (!rng) {
+    return;
+  }
+  // EVP_CIPHER_CTX_free cleanses the key schedule
+  EVP_CIPHER_CTX_free(rng->cipher);
+  BN_free(rng->top);
+  free(rng->scratch);
+  free(rng);
+}
+
+void fahe_rng_set_engine(fahe_rng *rng, fahe_rng_engine engine) {
+  rng->engine = engine;
+  if (!rng_rekey(rng)) {
+    log_message(LOG_FATAL, "Keying the random number engine failed\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+fahe_rng *fahe_rng_thread(void) {
+  pthread_once(&rng_once, rng_init_once);
+  fahe_rng *rng = pthread_getspecific(rng_thread_key);
+  if (!rng) {
+    rng = fahe_rng_new(FAHE_RNG_DEFAULT);
+    pthread_setspecific(rng_thread_key, rng);
+  }
+  return rng;
+}
+
+int fahe_rng_bytes(fahe_rng *rng, unsigned char *out, size_t len) {
+  while (len > 0) {
+    int chunk = len > INT_MAX / 2 ? INT_MAX / 2 : (int)len;
+
+    if (rng->engine == FAHE_RNG_SYSTEM) {
+      if (RAND_bytes(out, chunk) != 1) {
+        return 0;
+      }
+    } else {
+      if ((rng->fork_generation != fork_generation ||
+           rng->bytes_since_seed + (uint64_t)chunk > FAHE_RNG_RESEED_BYTES) &&
+          !rng_rekey(rng)) {
+        return 0;
+      }
+      // The keystream is the encryption of zeros
+      int out_len;
+      memset(out, 0, chunk);
+      if (!EVP_EncryptUpdate(rng->cipher, out, &out_len, out, chunk)) {
+        return 0;
+      }
+      rng->bytes_since_seed += (uint64_t)chunk;
+    }
+
+    out += chunk;
+    len -= chunk;
+  }
+  return 1;
+}
+
+int fahe_rng_limbs_below(fahe_rng *rng, uint64_t *out, const uint64_t *bound,
+                         size_t num_limbs) {
+  if (num_limbs == 0 || bound[num_limbs - 1] == 0) {
+    return 0;
+  }
+  size_t top = num_limbs - 1;
+  uint64_t top_bound = bound[top];
+  uint64_t top_mask = ~(uint64_t)0 >> __builtin_clzll(top_bound);
+
+  for (;;) {
+    if (!fahe_rng_bytes(rng, (unsigned char *)out, num_limbs * 8)) {
+      return 0;
+    }
+    // Redraw only the top limb while it is out of range
+    out[top] &= top_mask;
+    while (out[top] > top_bound) {
+      if (!fahe_rng_bytes(rng, (unsigned char *)(out + top), 8)) {
+        return 0;
+      }
+      out[top] &= top_mask;
+    }
+    if (out[top] < top_bound) {
+      return 1;
+    }
+
+    // Equal top limbs: the low limbs decide, and a loss restarts the draw
+    size_t i = top;
+    while (i > 0 && out[i - 1] == bound[i - 1]) {
+      i--;
+    }
+    if (i > 0 && out[i - 1] < bound[i - 1]) {
+      return 1;
+    }
+  }
+}
+
+int fahe_rng_bn_below(fahe_rng *rng, BIGNUM *r, const BIGNUM *bound) {
+  int bound_bits = BN_num_bits(bound);
+  if (bound_bits == 0 || BN_is_negative(bound)) {
+    return 0;
+  }
+  size_t num_limbs = FAHE_LIMBS(bound_bits);
+  size_t top = num_limbs - 1;
+  if (!rng_reserve_scratch(rng, num_limbs) ||
+      !BN_rshift(rng->top, bound, (int)(64 * top))) {
+    return 0;
+  }
+  uint64_t top_bound = (uint64_t)BN_get_word(rng->top);
+  uint64_t top_mask = ~(uint64_t)0 >> __builtin_clzll(top_bound);
+  uint64_t *limbs = rng->scratch;
+
+  for (;;) {
+    if (!fahe_rng_bytes(rng, (unsigned char *)limbs, num_limbs * 8)) {
+      return 0;
+    }
+    limbs[top] &= top_mask;
+    while (limbs[top] > top_bound) {
+      if (!fahe_rng_bytes(rng, (unsigned char *)(limbs + top), 8)) {
+        return 0;
+      }
+      limbs[top] &= top_mask;
+    }
+    if (!limbs_to_bn(limbs, num_limbs, r)) {
+      return 0;
+    }
+    // Equal top limbs are rare; compare the whole value only then
+    if (limbs[top] < top_bound || BN_cmp(r, bound) < 0) {
+      return 1;
+    }
+  }
+}
+
+int fahe_rng_bn_bits(fahe_rng *rng, BIGNUM *r, int bits) {
+  if (bits <= 0) {
+    BN_zero(r);
+    return 1;
+  }
+  size_t num_limbs = FAHE_LIMBS(bits);
+  if (!rng_reserve_scratch(rng, num_limbs) ||
+      !fahe_rng_bytes(rng, (unsigned char *)rng->scratch, num_limbs * 8)) {
+    return 0;
+  }
+  if (bits % 64) {
+    rng->scratch[num_limbs - 1] &= ~(uint64_t)0 >> (64 - bits % 64);
+  }
+  return limbs_to_bn(rng->scratch, num_limbs, r);
+}
@@ -0,0 +1,183 @@
+/**
+ * @file rng.h
+ * @brief Header file for rng.c, the bulk random number engine used to draw q
+ * and the noise terms during encryption.
+ *
+ * This file contains the following structs: fahe_rng
+ *                and the following methods: fahe_rng_new, fahe_rng_free,
+ * fahe_rng_set_engine, fahe_rng_thread, fahe_rng_bytes, fahe_rng_limbs_below,
+ * fahe_rng_bn_below, fahe_rng_bn_bits
+ */
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <openssl/bn.h>
+#include <openssl/evp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Bytes an engine produces before it is rekeyed from the OpenSSL
+ * private DRBG.
+ */
+#define FAHE_RNG_RESEED_BYTES ((uint64_t)1 << 32)
+
+/**
+ * @brief Keystream generators of a fahe_rng.
+ *
+ * FAHE_RNG_AES_CTR is AES-256 in counter mode, which runs on AES-NI where
+ * available. FAHE_RNG_CHACHA20 is the faster choice on CPUs without AES
+ * instructions. Both are keyed from RAND_priv_bytes. FAHE_RNG_SYSTEM calls
+ * RAND_bytes directly, which is slower for small requests because of its
+ * per-call locking.
+ */
+typedef enum {
+  FAHE_RNG_AES_CTR,
+  FAHE_RNG_CHACHA20,
+  FAHE_RNG_SYSTEM
+} fahe_rng_engine;
+
+/**
+ * @brief Engine selected by fahe_rng_thread and the encryption contexts.
+ */
+#define FAHE_RNG_DEFAULT FAHE_RNG_AES_CTR
+
+/**
+ * @typedef fahe_rng
+ * @brief A keyed stream cipher used as a bulk CSPRNG.
+ *
+ * Encryption draws a gamma-bit q and a few noise terms per message.
+ * BN_rand_range pays for RAND_bytes locking and an intermediate buffer on
+ * every call; a fahe_rng instead encrypts zeros in place with a stream
+ * cipher, straight into the caller's limbs.
+ *
+ * The engine is rekeyed after FAHE_RNG_RESEED_BYTES bytes and in the child
+ * after fork(), so parent and child never share a keystream.
+ *
+ * @note A fahe_rng is not thread-safe. Use one per thread, e.g. through
+ * fahe_rng_thread.
+ */
+
+/**
+ * @struct fahe_rng
+ *
+ * @var fahe_rng: engine (fahe_rng_engine)
+ * The keystream generator. @see fahe_rng_engine
+ *
+ * @var fahe_rng: cipher (EVP_CIPHER_CTX*)
+ * Cipher state of the keystream. Unused by FAHE_RNG_SYSTEM.
+ *
+ * @var fahe_rng: bytes_since_seed (uint64_t)
+ * Keystream bytes produced with the current key.
+ *
+ * @var fahe_rng: fork_generation (unsigned int)
+ * Process fork count when the current key was drawn.
+ *
+ * @var fahe_rng: top (BIGNUM*)
+ * Scratch value for the top limb of a BIGNUM bound.
+ *
+ * @var fahe_rng: scratch, scratch_len (uint64_t*, size_t)
+ * Limb buffer for the BIGNUM sampling functions, grown on demand.
+ */
+typedef struct {
+  fahe_rng_engine engine;
+  EVP_CIPHER_CTX *cipher;
+  uint64_t bytes_since_seed;
+  unsigned int fork_generation;
+  BIGNUM *top;
+  uint64_t *scratch;
+  size_t scratch_len;
+} fahe_rng;
+
+/**
+ * @brief Creates and keys a random number engine.
+ *
+ * @param[in] engine The keystream generator. @see fahe_rng_engine
+ *
+ * @return The initialized engine. Free with fahe_rng_free.
+ */
+fahe_rng *fahe_rng_new(fahe_rng_engine engine);
+
+/**
+ * @brief Frees an engine created by fahe_rng_new. The key is cleansed.
+ *
+ * @param[in] rng The engine to free. NULL is ignored.
+ */
+void fahe_rng_free(fahe_rng *rng);
+
+/**
+ * @brief Switches an engine to another keystream generator with a fresh key.
+ *
+ * @param[in] rng The engine to rekey.
+ * @param[in] engine The new keystream generator. @see fahe_rng_engine
+ */
+void fahe_rng_set_engine(fahe_rng *rng, fahe_rng_engine engine);
+
+/**
+ * @brief Returns the calling thread's FAHE_RNG_DEFAULT engine.
+ *
+ * The engine is created on first use and freed when the thread exits. It is
+ * what the one-shot helpers rand_bignum_below and rand_bits_below draw from.
+ *
+ * @return The calling thread's engine.
+ */
+fahe_rng *fahe_rng_thread(void);
+
+/**
+ * @brief Fills a buffer with random bytes.
+ *
+ * @param[in] rng The engine to draw from.
+ * @param[out] out Destination buffer.
+ * @param[in] len Number of bytes to write.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_rng_bytes(fahe_rng *rng, unsigned char *out, size_t len);
+
+/**
+ * @brief Draws a uniformly random value below a bound directly into limbs.
+ *
+ * The low num_limbs - 1 limbs are drawn once. The top limb is masked to the
+ * bit length of the bound's top limb and redrawn alone while it exceeds it,
+ * which is at most half of the draws. Only when it equals the bound's top
+ * limb are the low limbs compared, and a low part that is too large restarts
+ * the whole draw. The result is exactly uniform on [0, bound).
+ *
+ * @param[in] rng The engine to draw from.
+ * @param[out] out Destination of num_limbs limbs.
+ * @param[in] bound Exclusive upper bound. Its top limb must be non-zero.
+ * @param[in] num_limbs Number of limbs in bound and out.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_rng_limbs_below(fahe_rng *rng, uint64_t *out, const uint64_t *bound,
+                         size_t num_limbs);
+
+/**
+ * @brief Draws a uniformly random BIGNUM below a bound.
+ *
+ * This function applies the fahe_rng_limbs_below strategy to a BIGNUM bound
+ * without exporting it: only its top limb is extracted, and the full
+ * comparison runs only when the top limbs are equal.
+ *
+ * @param[in] rng The engine to draw from.
+ * @param[out] r The result.
+ * @param[in] bound Exclusive upper bound. Must be positive.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_rng_bn_below(fahe_rng *rng, BIGNUM *r, const BIGNUM *bound);
+
+/**
+ * @brief Draws a uniformly random BIGNUM of at most bits bits.
+ *
+ * @param[in] rng The engine to draw from.
+ * @param[out] r The result. 0 when bits <= 0.
+ * @param[in] bits Bit length bound.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_rng_bn_bits(fahe_rng *rng, BIGNUM *r, int bits);
+
+#endif  // RNG_H
@@ -0,0 +1,140 @@
+/**
+ * @file stats.c
+ * @brief Implementation of the per-thread stage counters.
+ *
+ * Every thread that records a sample gets a block of counters from a
+ * fahe_thread_blocks registry (@see thread_blocks.h). Only the owning thread
+ * writes its block, with relaxed atomic stores, so that a concurrent
+ * snapshot never reads a torn value. When the thread exits, its block is
+ * folded into the retired totals and freed.
+ *
+ * Dependencies:
+ * - pthread.h
+ * - thread_blocks.h
+ *
+ * @see stats.h for the documentation of the functions implemented here.
+ */
+
+#include "stats.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "thread_blocks.h"
+
+static void stats_merge(void *into, const void *from);
+
+static fahe_stage_stats stats_retired[FAHE_STAGE_COUNT];
+static fahe_thread_blocks stats_blocks =
+    FAHE_THREAD_BLOCKS_INIT(stats_retired, stats_merge);
+static __thread fahe_stage_stats *current_block = NULL;
+
+static const char *stage_names[FAHE_STAGE_COUNT] = {
+    "encrypt", "decrypt", "encrypt_list", "decrypt_list",
+    "rng",     "encode",  "mul",          "add",
+    "reduce",  "decode",  "convert",      "alloc"};
+
+static void stats_merge(void *into_block, const void *from_block) {
+  fahe_stage_stats *into = (fahe_stage_stats *)into_block;
+  const fahe_stage_stats *from = (const fahe_stage_stats *)from_block;
+  for (int s = 0; s < FAHE_STAGE_COUNT; s++) {
+    into[s].count += __atomic_load_n(&from[s].count, __ATOMIC_RELAXED);
+    into[s].total_ticks +=
+        __atomic_load_n(&from[s].total_ticks, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&from[s].max_ticks, __ATOMIC_RELAXED);
+    if (max > into[s].max_ticks) {
+      into[s].max_ticks = max;
+    }
+    for (int b = 0; b < FAHE_STATS_BUCKETS; b++) {
+      into[s].hist[b] += __atomic_load_n(&from[s].hist[b], __ATOMIC_RELAXED);
+    }
+  }
+}
+
+void fahe_stats_record(fahe_stage stage, uint64_t ticks) {
+  fahe_stage_stats *block = current_block;
+  if (!block) {
+    block = current_block = fahe_thread_blocks_get(&stats_blocks);
+  }
+
+  // Only this thread writes the block, so load and store need no RMW
+  fahe_stage_stats *s = &block[stage];
+  int b = ticks ? 64 - __builtin_clzll(ticks) : 0;
+  if (b >= FAHE_STATS_BUCKETS) {
+    b = FAHE_STATS_BUCKETS - 1;
+  }
+  __atomic_store_n(&s->count, s->count + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->total_ticks, s->total_ticks + ticks, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->hist[b], s->hist[b] + 1, __ATOMIC_RELAXED);
+  if (ticks > s->max_ticks) {
+    __atomic_store_n(&s->max_ticks, ticks, __ATOMIC_RELAXED);
+  }
+}
+
+#if defined(FAHE_STATS_RDTSC) && defined(__x86_64__)
+static pthread_once_t tick_once = PTHREAD_ONCE_INIT;
+static double tick_ns = 1.0;
+
+// Measures the period of the time-stamp counter over 10 ms
+static void stats_calibrate(void) {
+  struct timespec start, end, pause = {0, 10 * 1000 * 1000};
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  uint64_t t0 = __rdtsc();
+  nanosleep(&pause, NULL);
+  uint64_t t1 = __rdtsc();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  if (t1 > t0) {
+    tick_ns = ns / (double)(t1 - t0);
+  }
+}
+#endif
+
+void fahe_stats_snapshot(fahe_stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->ns_per_tick = 1.0;
+#if defined(FAHE_STATS_RDTSC) && defined(__x86_64__)
+  pthread_once(&tick_once, stats_calibrate);
+  stats->ns_per_tick = tick_ns;
+#endif
+
+  stats->threads = fahe_thread_blocks_sum(&stats_blocks, stats->stages);
+}
+
+void fahe_stats_reset(void) { fahe_thread_blocks_reset(&stats_blocks); }
+
+// Upper edge of the bucket holding the median sample, in ticks
+static uint64_t stats_median(const fahe_stage_stats *s) {
+  uint64_t seen = 0;
+  for (int b = 0; b < FAHE_STATS_BUCKETS; b++) {
+    seen += s->hist[b];
+    if (2 * seen >= s->count) {
+      return b ? (uint64_t)1 << b : 0;
+    }
+  }
+  return s->max_ticks;
+}
+
+void fahe_stats_print(const fahe_stats *stats, FILE *stream) {
+  fprintf(stream, "%-14s %12s %12s %12s %12s %12s\n", "stage", "count",
+          "total/ms", "mean/ns", "p50<=/ns", "max/ns");
+  for (int i = 0; i < FAHE_STAGE_COUNT; i++) {
+    const fahe_stage_stats *s = &stats->stages[i];
+    if (s->count == 0) {
+      continue;
+    }
+    double ns = stats->ns_per_tick;
+    fprintf(stream, "%-14s %12llu %12.3f %12.1f %12.0f %12.0f\n",
+            stage_names[i], (unsigned long long)s->count,
+            s->total_ticks * ns / 1e6, s->total_ticks * ns / s->count,
+            stats_median(s) * ns, s->max_ticks * ns);
+  }
+}
+
+const char *fahe_stage_name(fahe_stage stage) {
+  if ((int)stage < 0 || stage >= FAHE_STAGE_COUNT) {
+    return "unknown";
+  }
+  return stage_names[stage];
+}
@@ -0,0 +1,190 @@
+/**
+ * @file stats.h
+ * @brief Header file for stats.c, opt-in timing of the stages of encryption
+ * and decryption.
+ *
+ * The encrypt, decrypt and list functions time their stages (drawing
+ * randomness, multiplying, reducing, ...) with FAHE_STATS_START and
+ * FAHE_STATS_STOP. Each thread adds its samples to its own counters, so
+ * timing does not make the threads of a batch share cache lines.
+ * fahe_stats_snapshot sums the counters of all threads.
+ *
+ * Timing is compiled in with -DFAHE_STATS, e.g.
+ * make OPTFLAGS="-O2 -DFAHE_STATS". Without it the macros expand to nothing
+ * and fahe_stats_snapshot reports zeros. On x86-64, -DFAHE_STATS_RDTSC
+ * replaces clock_gettime with the cheaper time-stamp counter.
+ *
+ * This file contains the following structs: fahe_stage_stats, fahe_stats
+ *                and the following methods: fahe_stats_now,
+ * fahe_stats_record, fahe_stats_snapshot, fahe_stats_reset,
+ * fahe_stats_print, fahe_stage_name
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(FAHE_STATS_RDTSC) && defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * @brief 1 if the library was built with -DFAHE_STATS, 0 otherwise.
+ */
+#ifdef FAHE_STATS
+#define FAHE_STATS_ENABLED 1
+#else
+#define FAHE_STATS_ENABLED 0
+#endif
+
+/**
+ * @brief Histogram buckets per stage. Bucket 0 counts samples of 0 ticks and
+ * bucket b > 0 samples of [2**(b - 1), 2**b) ticks; the last bucket also
+ * takes everything longer.
+ */
+#define FAHE_STATS_BUCKETS 40
+
+/**
+ * @brief Timed stages.
+ *
+ * FAHE_STAGE_ENCRYPT and FAHE_STAGE_DECRYPT time a whole message and
+ * overlap the other per-message stages; the list stages time a whole list.
+ * - RNG: drawing q and the noise terms.
+ * - ENCODE: building M from the message and the noise.
+ * - MUL: p * q, including the addition of M where the two are fused.
+ * - ADD: adding M to a separately computed p * q.
+ * - REDUCE: ciphertext mod p.
+ * - DECODE: shifting and masking the message out of the remainder.
+ * - CONVERT: copying limbs into a BIGNUM.
+ * - ALLOC: allocating BIGNUMs and contexts inside an operation.
+ */
+typedef enum {
+  FAHE_STAGE_ENCRYPT,
+  FAHE_STAGE_DECRYPT,
+  FAHE_STAGE_ENCRYPT_LIST,
+  FAHE_STAGE_DECRYPT_LIST,
+  FAHE_STAGE_RNG,
+  FAHE_STAGE_ENCODE,
+  FAHE_STAGE_MUL,
+  FAHE_STAGE_ADD,
+  FAHE_STAGE_REDUCE,
+  FAHE_STAGE_DECODE,
+  FAHE_STAGE_CONVERT,
+  FAHE_STAGE_ALLOC,
+  FAHE_STAGE_COUNT
+} fahe_stage;
+
+/**
+ * @typedef fahe_stage_stats
+ * @brief Samples of one stage.
+ */
+
+/**
+ * @struct fahe_stage_stats
+ *
+ * @var fahe_stage_stats: count (uint64_t)
+ * Number of samples.
+ *
+ * @var fahe_stage_stats: total_ticks, max_ticks (uint64_t)
+ * Sum and maximum of the samples.
+ *
+ * @var fahe_stage_stats: hist (uint64_t[FAHE_STATS_BUCKETS])
+ * Samples per power-of-two bucket of ticks.
+ */
+typedef struct {
+  uint64_t count;
+  uint64_t total_ticks;
+  uint64_t max_ticks;
+  uint64_t hist[FAHE_STATS_BUCKETS];
+} fahe_stage_stats;
+
+/**
+ * @typedef fahe_stats
+ * @brief A snapshot of all stages.
+ */
+
+/**
+ * @struct fahe_stats
+ *
+ * @var fahe_stats: ns_per_tick (double)
+ * Length of a tick: 1 with clock_gettime, the measured period of the
+ * time-stamp counter with FAHE_STATS_RDTSC.
+ *
+ * @var fahe_stats: threads (int)
+ * Threads that recorded samples and are still running.
+ *
+ * @var fahe_stats: stages (fahe_stage_stats[FAHE_STAGE_COUNT])
+ * The stages, indexed by fahe_stage.
+ */
+typedef struct {
+  double ns_per_tick;
+  int threads;
+  fahe_stage_stats stages[FAHE_STAGE_COUNT];
+} fahe_stats;
+
+/**
+ * @brief Returns the current time in ticks.
+ */
+static inline uint64_t fahe_stats_now(void) {
+#if defined(FAHE_STATS_RDTSC) && defined(__x86_64__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Adds a sample to the current thread's counters. Use
+ * FAHE_STATS_STOP instead.
+ */
+void fahe_stats_record(fahe_stage stage, uint64_t ticks);
+
+/**
+ * @brief FAHE_STATS_START(t) declares a timer t; FAHE_STATS_STOP(stage, t)
+ * records the time since then as a sample of stage. Both expand to nothing
+ * without FAHE_STATS.
+ */
+#ifdef FAHE_STATS
+#define FAHE_STATS_START(t) uint64_t t = fahe_stats_now()
+#define FAHE_STATS_STOP(stage, t) \
+  fahe_stats_record((stage), fahe_stats_now() - (t))
+#else
+#define FAHE_STATS_START(t) ((void)0)
+#define FAHE_STATS_STOP(stage, t) ((void)0)
+#endif
+
+/**
+ * @brief Sums the counters of all threads, including threads that have
+ * exited.
+ *
+ * @param[out] stats Where to store the snapshot.
+ */
+void fahe_stats_snapshot(fahe_stats *stats);
+
+/**
+ * @brief Zeroes the counters of all threads.
+ *
+ * @note Samples recorded while the reset runs may survive it. Reset between
+ * batches, not during one.
+ */
+void fahe_stats_reset(void);
+
+/**
+ * @brief Prints count, total, mean, median and maximum per stage.
+ *
+ * @param[in] stats A snapshot.
+ * @param[in] stream Where to print.
+ */
+void fahe_stats_print(const fahe_stats *stats, FILE *stream);
+
+/**
+ * @brief Returns the name of a stage, e.g. "rng".
+ */
+const char *fahe_stage_name(fahe_stage stage);
+
+#endif  // STATS_H
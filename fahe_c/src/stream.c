@@ -0,0 +1,485 @@
+/**
+ * @file stream.c
+ * @brief Implementation of encryption and decryption of ciphertexts as
+ * byte streams.
+ *
+ * Bytes are gathered into a block of FAHE_STREAM_BLOCK_LIMBS limbs. A full
+ * block is folded into the residue with one fahe_reduce_limbs: for the most
+ * significant byte first, over the block with the residue above it; for the
+ * least significant byte first, over the block alone, before it is scaled
+ * by the running power of 2**64 mod p. Chunks that cover a whole block are
+ * folded in place without a copy. The partial block left at the end is
+ * folded by fahe_decrypt_stream_final with BIGNUM operations, as its width
+ * is only known then.
+ *
+ * An encryption stream emits c = p * q + M a block of q at a time. With
+ * the window V of pending limbs below 2**(64 * p_limbs) and n limbs Q of q,
+ * V + Q * p is one limbs_mul_small_add with V as the addend; it fits in
+ * n + p_limbs limbs, its low n limbs are final and the rest is the next
+ * window. After the last block the window holds the top limbs of c.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ * - openssl/crypto.h
+ * - errno.h
+ * - unistd.h
+ * - limb.h
+ * - logger.h
+ * - reduce.h
+ * - rng.h
+ *
+ * @see stream.h for the documentation of the functions implemented here.
+ */
+
+#include "stream.h"
+
+#include <errno.h>
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "limb.h"
+#include "logger.h"
+#include "reduce.h"
+#include "rng.h"
+
+#define STREAM_BLOCK_BYTES (8 * FAHE_STREAM_BLOCK_LIMBS)
+#define STREAM_READ_BYTES 16384
+
+fahe_decrypt_stream *fahe_decrypt_stream_new(BIGNUM *p, int shift, int m_max,
+                                             fahe_stream_order order) {
+  fahe_decrypt_stream *stream =
+      (fahe_decrypt_stream *)malloc(sizeof(fahe_decrypt_stream));
+  if (!stream) {
+    log_message(LOG_FATAL,
+                "Memory allocation for fahe_decrypt_stream failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // A fold reduces a block with the residue above it
+  size_t p_limbs = FAHE_LIMBS(BN_num_bits(p));
+  stream->reducer =
+      fahe_reducer_new(p, 64 * (FAHE_STREAM_BLOCK_LIMBS + (int)p_limbs));
+  stream->order = order;
+  stream->shift = shift;
+  stream->m_max = m_max;
+  stream->block = malloc(STREAM_BLOCK_BYTES);
+  stream->limbs = calloc(FAHE_STREAM_BLOCK_LIMBS + p_limbs, sizeof(uint64_t));
+  stream->residue = BN_new();
+  stream->power = BN_new();
+  stream->block_power = BN_new();
+  stream->t = BN_new();
+  if (!stream->block || !stream->limbs || !stream->residue ||
+      !stream->power || !stream->block_power || !stream->t ||
+      !BN_set_bit(stream->block_power, 64 * FAHE_STREAM_BLOCK_LIMBS) ||
+      !BN_mod(stream->block_power, stream->block_power, p,
+              stream->reducer->bn_ctx)) {
+    log_message(LOG_FATAL, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  fahe_decrypt_stream_reset(stream);
+  return stream;
+}
+
+void fahe_decrypt_stream_free(fahe_decrypt_stream *stream) {
+  if (!stream) {
+    return;
+  }
+  fahe_reducer_free(stream->reducer);
+  OPENSSL_cleanse(stream->block, STREAM_BLOCK_BYTES);
+  free(stream->block);
+  free(stream->limbs);
+  BN_clear_free(stream->residue);
+  BN_clear_free(stream->power);
+  BN_free(stream->block_power);
+  BN_clear_free(stream->t);
+  free(stream);
+}
+
+void fahe_decrypt_stream_reset(fahe_decrypt_stream *stream) {
+  stream->block_bytes = 0;
+  stream->total_bytes = 0;
+  BN_zero(stream->residue);
+  BN_one(stream->power);
+}
+
+static uint64_t stream_load_be64(const unsigned char *buf) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) {
+    v = (v << 8) | buf[i];
+  }
+  return v;
+}
+
+static uint64_t stream_load_le64(const unsigned char *buf) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) {
+    v = (v << 8) | buf[i];
+  }
+  return v;
+}
+
+// residue * 2**(8 * n) + the n bytes of block, mod p
+static int stream_fold_msb(fahe_decrypt_stream *stream,
+                           const unsigned char *block, size_t n) {
+  return BN_lshift(stream->residue, stream->residue, 8 * (int)n) &&
+         BN_bin2bn(block, (int)n, stream->t) &&
+         BN_add(stream->residue, stream->residue, stream->t) &&
+         fahe_reduce(stream->reducer, stream->residue, stream->residue);
+}
+
+// residue + (the n bytes of block mod p) * power, mod p
+static int stream_fold_lsb(fahe_decrypt_stream *stream,
+                           const unsigned char *block, size_t n) {
+  BN_CTX *ctx = stream->reducer->bn_ctx;
+  BIGNUM *p = stream->reducer->p;
+  return BN_lebin2bn(block, (int)n, stream->t) &&
+         fahe_reduce(stream->reducer, stream->t, stream->t) &&
+         BN_mod_mul(stream->t, stream->t, stream->power, p, ctx) &&
+         BN_mod_add(stream->residue, stream->residue, stream->t, p, ctx);
+}
+
+// Folds a full block of STREAM_BLOCK_BYTES bytes into the residue
+static int stream_fold_block(fahe_decrypt_stream *stream,
+                             const unsigned char *block) {
+  fahe_reducer *reducer = stream->reducer;
+  uint64_t *limbs = stream->limbs;
+  size_t n = FAHE_STREAM_BLOCK_LIMBS;
+
+  if (stream->order == FAHE_STREAM_MSB_FIRST) {
+    // The block below the residue: residue * 2**(64 n) + block
+    for (size_t j = 0; j < n; j++) {
+      limbs[j] = stream_load_be64(block + 8 * (n - 1 - j));
+    }
+    return limbs_from_bn(stream->residue, limbs + n, reducer->p_limbs) &&
+           fahe_reduce_limbs(reducer, stream->residue, limbs,
+                             n + reducer->p_limbs);
+  }
+
+  for (size_t j = 0; j < n; j++) {
+    limbs[j] = stream_load_le64(block + 8 * j);
+  }
+  BN_CTX *ctx = reducer->bn_ctx;
+  return fahe_reduce_limbs(reducer, stream->t, limbs, n) &&
+         BN_mod_mul(stream->t, stream->t, stream->power, reducer->p, ctx) &&
+         BN_mod_add(stream->residue, stream->residue, stream->t, reducer->p,
+                    ctx) &&
+         BN_mod_mul(stream->power, stream->power, stream->block_power,
+                    reducer->p, ctx);
+}
+
+int fahe_decrypt_stream_update(fahe_decrypt_stream *stream, const void *data,
+                               size_t len) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  stream->total_bytes += len;
+  while (len > 0) {
+    const unsigned char *block = bytes;
+    size_t take = STREAM_BLOCK_BYTES;
+    if (stream->block_bytes > 0 || len < STREAM_BLOCK_BYTES) {
+      // Complete the block in the buffer
+      take = STREAM_BLOCK_BYTES - stream->block_bytes;
+      if (take > len) {
+        take = len;
+      }
+      memcpy(stream->block + stream->block_bytes, bytes, take);
+      stream->block_bytes += take;
+      block = stream->block;
+    }
+    bytes += take;
+    len -= take;
+
+    if (block != stream->block || stream->block_bytes == STREAM_BLOCK_BYTES) {
+      if (!stream_fold_block(stream, block)) {
+        log_message(LOG_ERROR, "Folding a ciphertext block failed\n");
+        return 0;
+      }
+      stream->block_bytes = 0;
+    }
+  }
+  return 1;
+}
+
+BIGNUM *fahe_decrypt_stream_final(fahe_decrypt_stream *stream,
+                                  BIGNUM *message) {
+  size_t n = stream->block_bytes;
+  int ok = n == 0 || (stream->order == FAHE_STREAM_MSB_FIRST
+                          ? stream_fold_msb(stream, stream->block, n)
+                          : stream_fold_lsb(stream, stream->block, n));
+  if (!ok) {
+    log_message(LOG_ERROR, "Folding the last ciphertext block failed\n");
+    fahe_decrypt_stream_reset(stream);
+    return NULL;
+  }
+
+  BIGNUM *m = message ? message : BN_new();
+  if (!m) {
+    log_message(LOG_FATAL, "Memory allocation for message failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // m = (c mod p) >> shift, masked to m_max bits as in fahe1_decrypt
+  ok = BN_rshift(m, stream->residue, stream->shift) &&
+       (BN_num_bits(m) <= stream->m_max || BN_mask_bits(m, stream->m_max));
+  fahe_decrypt_stream_reset(stream);
+  if (!ok) {
+    log_message(LOG_ERROR, "Decoding the message failed\n");
+    if (!message) {
+      BN_free(m);
+    }
+    return NULL;
+  }
+  return m;
+}
+
+BIGNUM *fahe_decrypt_stream_fd(fahe_decrypt_stream *stream, int fd,
+                               BIGNUM *message) {
+  unsigned char buf[STREAM_READ_BYTES];
+  for (;;) {
+    ssize_t got = read(fd, buf, sizeof(buf));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0) {
+      log_message(LOG_ERROR, "Reading the ciphertext failed\n");
+      fahe_decrypt_stream_reset(stream);
+      return NULL;
+    }
+    if (got == 0) {
+      break;
+    }
+    if (!fahe_decrypt_stream_update(stream, buf, (size_t)got)) {
+      fahe_decrypt_stream_reset(stream);
+      return NULL;
+    }
+  }
+  return fahe_decrypt_stream_final(stream, message);
+}
+
+fahe_encrypt_stream *fahe_encrypt_stream_new(const uint64_t *p,
+                                             size_t p_limbs,
+                                             const uint64_t *bound,
+                                             size_t q_limbs) {
+  if (p_limbs == 0 || q_limbs == 0 || bound[q_limbs - 1] == 0) {
+    log_message(LOG_FATAL, "Encryption stream needs non-zero p and bound\n");
+    exit(EXIT_FAILURE);
+  }
+
+  fahe_encrypt_stream *stream =
+      (fahe_encrypt_stream *)malloc(sizeof(fahe_encrypt_stream));
+  if (!stream) {
+    log_message(LOG_FATAL,
+                "Memory allocation for fahe_encrypt_stream failed\n");
+    exit(EXIT_FAILURE);
+  }
+  stream->p = p;
+  stream->bound = bound;
+  stream->p_limbs = p_limbs;
+  stream->q_limbs = q_limbs;
+  stream->c_limbs = p_limbs + q_limbs + 1;
+  stream->rng = fahe_rng_new(FAHE_RNG_DEFAULT);
+  stream->window = calloc(p_limbs, sizeof(uint64_t));
+  stream->q = malloc(FAHE_STREAM_BLOCK_LIMBS * sizeof(uint64_t));
+  stream->block =
+      malloc((FAHE_STREAM_BLOCK_LIMBS + p_limbs + 1) * sizeof(uint64_t));
+  if (!stream->window || !stream->q || !stream->block) {
+    log_message(LOG_FATAL, "Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Nothing to read until fahe_encrypt_stream_begin
+  stream->next_limb = stream->c_limbs;
+  stream->block_next = 0;
+  stream->block_bytes = 0;
+  stream->failed = 0;
+  return stream;
+}
+
+void fahe_encrypt_stream_free(fahe_encrypt_stream *stream) {
+  if (!stream) {
+    return;
+  }
+  fahe_rng_free(stream->rng);
+  OPENSSL_cleanse(stream->window, stream->p_limbs * sizeof(uint64_t));
+  OPENSSL_cleanse(stream->q, FAHE_STREAM_BLOCK_LIMBS * sizeof(uint64_t));
+  size_t block_limbs = FAHE_STREAM_BLOCK_LIMBS + stream->p_limbs + 1;
+  OPENSSL_cleanse(stream->block, block_limbs * sizeof(uint64_t));
+  free(stream->window);
+  free(stream->q);
+  free(stream->block);
+  free(stream);
+}
+
+static int stream_random_limb(fahe_encrypt_stream *stream, uint64_t *limb) {
+  return fahe_rng_bytes(stream->rng, (unsigned char *)limb, sizeof(*limb));
+}
+
+// Draws the limbs of q that decide q < bound, from the top, exactly as
+// fahe_rng_limbs_below decides them: the top limb is masked and redrawn
+// while too large, and a tie with the bound is broken by the limbs below,
+// restarting the draw on a loss. The limbs below the first one under the
+// bound are then uniform and free, and are drawn as they are emitted.
+static int stream_draw_top(fahe_encrypt_stream *stream) {
+  const uint64_t *bound = stream->bound;
+  size_t top = stream->q_limbs - 1;
+  uint64_t top_mask = ~(uint64_t)0 >> __builtin_clzll(bound[top]);
+
+  for (;;) {
+    uint64_t limb;
+    do {
+      if (!stream_random_limb(stream, &limb)) {
+        return 0;
+      }
+      limb &= top_mask;
+    } while (limb > bound[top]);
+
+    size_t i = top;
+    while (limb == bound[i] && i > 0) {
+      i--;
+      if (!stream_random_limb(stream, &limb)) {
+        return 0;
+      }
+    }
+    if (limb < bound[i]) {
+      stream->free_top = i;
+      stream->free_top_limb = limb;
+      return 1;
+    }
+  }
+}
+
+int fahe_encrypt_stream_begin(fahe_encrypt_stream *stream, const uint64_t *M,
+                              size_t m_limbs) {
+  // Nothing to read until the new ciphertext is ready
+  stream->block_next = 0;
+  stream->block_bytes = 0;
+  stream->next_limb = stream->c_limbs;
+  stream->failed = 1;
+  if (m_limbs > stream->p_limbs) {
+    log_message(LOG_ERROR, "Message is too large to encrypt\n");
+    return 0;
+  }
+  // The window starts as M, below 2**(64 * p_limbs)
+  memcpy(stream->window, M, m_limbs * sizeof(uint64_t));
+  memset(stream->window + m_limbs, 0,
+         (stream->p_limbs - m_limbs) * sizeof(uint64_t));
+  if (!stream_draw_top(stream)) {
+    log_message(LOG_ERROR, "Drawing q failed\n");
+    return 0;
+  }
+  stream->next_limb = 0;
+  stream->failed = 0;
+  return 1;
+}
+
+// Fills q with its limbs [begin, begin + n)
+static int stream_q_block(fahe_encrypt_stream *stream, size_t begin,
+                          size_t n) {
+  uint64_t *q = stream->q;
+  size_t free_top = stream->free_top;
+  size_t random = free_top < begin ? 0 : free_top - begin;
+  if (random > n) {
+    random = n;
+  }
+  if (random > 0 &&
+      !fahe_rng_bytes(stream->rng, (unsigned char *)q, 8 * random)) {
+    return 0;
+  }
+  for (size_t j = random; j < n; j++) {
+    q[j] = begin + j == free_top ? stream->free_top_limb
+                                 : stream->bound[begin + j];
+  }
+  return 1;
+}
+
+// Produces the next limbs of the ciphertext into block
+static int stream_next_block(fahe_encrypt_stream *stream) {
+  size_t k = stream->p_limbs;
+  uint64_t *limbs = stream->block;
+  size_t n;
+  if (stream->next_limb < stream->q_limbs) {
+    // V + Q * p: the low n limbs are final, the next k are the new window
+    n = stream->q_limbs - stream->next_limb;
+    if (n > FAHE_STREAM_BLOCK_LIMBS) {
+      n = FAHE_STREAM_BLOCK_LIMBS;
+    }
+    if (!stream_q_block(stream, stream->next_limb, n)) {
+      return 0;
+    }
+    limbs_mul_small_add(limbs, stream->q, n, stream->p, k, stream->window,
+                        k);
+    memcpy(stream->window, limbs + n, k * sizeof(uint64_t));
+  } else {
+    // The window, then the top limb, which p * q + M < 2**(64 (k + qn))
+    // leaves zero
+    n = k + 1;
+    memcpy(limbs, stream->window, k * sizeof(uint64_t));
+    limbs[k] = 0;
+  }
+
+  stream->next_limb += n;
+  stream->block_next = 0;
+  stream->block_bytes = 8 * n;
+  return 1;
+}
+
+size_t fahe_encrypt_stream_read(fahe_encrypt_stream *stream, void *out,
+                                size_t len) {
+  unsigned char *bytes = (unsigned char *)out;
+  size_t done = 0;
+  if (stream->failed) {
+    return (size_t)-1;
+  }
+  while (done < len) {
+    if (stream->block_next == stream->block_bytes) {
+      if (stream->next_limb == stream->c_limbs) {
+        break;
+      }
+      if (!stream_next_block(stream)) {
+        log_message(LOG_ERROR, "Drawing q failed\n");
+        // The bytes written so far are returned, the failure is reported
+        // by the next read
+        stream->next_limb = stream->c_limbs;
+        stream->block_next = 0;
+        stream->block_bytes = 0;
+        stream->failed = 1;
+        return done > 0 ? done : (size_t)-1;
+      }
+    }
+    size_t n = stream->block_bytes - stream->block_next;
+    if (n > len - done) {
+      n = len - done;
+    }
+    memcpy(bytes + done, (unsigned char *)stream->block + stream->block_next,
+           n);
+    stream->block_next += n;
+    done += n;
+  }
+  return done;
+}
+
+int fahe_encrypt_stream_fd(fahe_encrypt_stream *stream, int fd) {
+  unsigned char buf[STREAM_READ_BYTES];
+  for (;;) {
+    size_t got = fahe_encrypt_stream_read(stream, buf, sizeof(buf));
+    if (got == (size_t)-1) {
+      return 0;
+    }
+    if (got == 0) {
+      return 1;
+    }
+    for (size_t off = 0; off < got;) {
+      ssize_t put = write(fd, buf + off, got - off);
+      if (put < 0 && errno == EINTR) {
+        continue;
+      }
+      if (put <= 0) {
+        log_message(LOG_ERROR, "Writing the ciphertext failed\n");
+        return 0;
+      }
+      off += (size_t)put;
+    }
+  }
+}
@@ -0,0 +1,339 @@
+/**
+ * @file stream.h
+ * @brief Header file for stream.c, encryption and decryption of ciphertexts
+ * as byte streams, to and from read(), write(), an mmap window or a socket,
+ * without building them.
+ *
+ * Decryption only needs c mod p, and p is eta bits while c is gamma. A
+ * fahe_decrypt_stream keeps c mod p of the bytes seen so far and folds
+ * every FAHE_STREAM_BLOCK_LIMBS limbs into it as they arrive:
+ *
+ * - most significant byte first (BN_bn2bin, network order), Horner-style:
+ *   r = (r * 2**(64 * B) + block) mod p;
+ * - least significant byte first (the limbs of a fahe_ct_batch row or of a
+ *   FAHE file record), with the running power w = 2**(64 * B * i) mod p of
+ *   block i: r = (r + (block mod p) * w) mod p.
+ *
+ * Each fold is one limb-table reduction of the block (@see fahe_reduce_limbs)
+ * on a table of B + p_limbs rows. So a stream holds a block and a few
+ * eta-bit values whatever the size of the ciphertext, and the reduction of a
+ * ciphertext is done when its last byte is. At gamma = 320K bits that takes
+ * about a third longer than fahe1_decrypt_ctx on the whole BIGNUM.
+ *
+ * Encryption runs the other way. c = p * q + M is produced least
+ * significant limb first, FAHE_STREAM_BLOCK_LIMBS limbs of q at a time:
+ * each block of q is drawn when it is needed and multiplied by p into a
+ * window of p_limbs pending limbs that M seeds, and the limbs below the
+ * window are emitted. Only the limbs of q that decide q < X + 1 are drawn
+ * up front, from the top, so q has the distribution of
+ * fahe_rng_limbs_below. A fahe_encrypt_stream holds the window and a block
+ * of q and of output, and borrows p and X + 1 from an encryption context.
+ *
+ * This file contains the following structs: fahe_decrypt_stream,
+ *                fahe_encrypt_stream and the following methods:
+ * fahe_decrypt_stream_new, fahe_decrypt_stream_free,
+ * fahe_decrypt_stream_reset, fahe_decrypt_stream_update,
+ * fahe_decrypt_stream_final, fahe_decrypt_stream_fd,
+ * fahe_encrypt_stream_new, fahe_encrypt_stream_free,
+ * fahe_encrypt_stream_begin, fahe_encrypt_stream_read,
+ * fahe_encrypt_stream_fd
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "reduce.h"
+#include "rng.h"
+
+/**
+ * @brief Limbs folded into the residue at once. Every fold ends in a short
+ * BN_mod, which blocks of 1 KiB make a small part of its cost.
+ */
+#define FAHE_STREAM_BLOCK_LIMBS 128
+
+/**
+ * @brief Byte orders of a ciphertext stream.
+ *
+ * FAHE_STREAM_MSB_FIRST is big-endian, as written by BN_bn2bin and
+ * BN_bn2binpad. FAHE_STREAM_LSB_FIRST is little-endian, which is the
+ * 64-bit limbs of fahe_ct_batch rows and FAHE files read as bytes.
+ */
+typedef enum {
+  FAHE_STREAM_MSB_FIRST,
+  FAHE_STREAM_LSB_FIRST
+} fahe_stream_order;
+
+/**
+ * @typedef fahe_decrypt_stream
+ * @brief Decryption state of one ciphertext received in chunks.
+ *
+ * @note A stream is not thread-safe. Use one stream per connection.
+ */
+
+/**
+ * @struct fahe_decrypt_stream
+ *
+ * @var fahe_decrypt_stream: reducer (fahe_reducer*)
+ * Reduction modulo p, with a limb table of FAHE_STREAM_BLOCK_LIMBS +
+ * p_limbs rows.
+ *
+ * @var fahe_decrypt_stream: order (fahe_stream_order)
+ * Byte order of the ciphertexts.
+ *
+ * @var fahe_decrypt_stream: shift (int)
+ * Noise shift, rho + alpha for fahe1 and pos + alpha for fahe2.
+ *
+ * @var fahe_decrypt_stream: m_max (int)
+ * Bits of the message kept after the shift.
+ *
+ * @var fahe_decrypt_stream: block (unsigned char*)
+ * Bytes of the block being filled, in arrival order.
+ *
+ * @var fahe_decrypt_stream: block_bytes (size_t)
+ * Bytes in block.
+ *
+ * @var fahe_decrypt_stream: limbs (uint64_t*)
+ * A full block as little-endian limbs, followed, for FAHE_STREAM_MSB_FIRST,
+ * by the p_limbs limbs of the residue it is folded with.
+ *
+ * @var fahe_decrypt_stream: total_bytes (uint64_t)
+ * Bytes of the current ciphertext received so far.
+ *
+ * @var fahe_decrypt_stream: residue (BIGNUM*)
+ * The value of the bytes received so far, folded blocks only, mod p.
+ *
+ * @var fahe_decrypt_stream: power (BIGNUM*)
+ * For FAHE_STREAM_LSB_FIRST, 2**(8 * folded bytes) mod p.
+ *
+ * @var fahe_decrypt_stream: block_power (BIGNUM*)
+ * 2**(64 * FAHE_STREAM_BLOCK_LIMBS) mod p.
+ *
+ * @var fahe_decrypt_stream: t (BIGNUM*)
+ * Scratch value.
+ */
+typedef struct {
+  fahe_reducer *reducer;
+  fahe_stream_order order;
+  int shift;
+  int m_max;
+  unsigned char *block;
+  size_t block_bytes;
+  uint64_t *limbs;
+  uint64_t total_bytes;
+  BIGNUM *residue;
+  BIGNUM *power;
+  BIGNUM *block_power;
+  BIGNUM *t;
+} fahe_decrypt_stream;
+
+/**
+ * @brief Creates a decryption stream. @see fahe1_decrypt_stream_new and
+ * fahe2_decrypt_stream_new, which take the parameters from a key.
+ *
+ * @param[in] p The secret prime. Borrowed; it must outlive the stream.
+ * @param[in] shift The noise shift, rho + alpha or pos + alpha.
+ * @param[in] m_max Bits of the message.
+ * @param[in] order Byte order of the ciphertexts.
+ *
+ * @return The stream, ready for a ciphertext. Free with
+ *         fahe_decrypt_stream_free.
+ */
+fahe_decrypt_stream *fahe_decrypt_stream_new(BIGNUM *p, int shift, int m_max,
+                                             fahe_stream_order order);
+
+/**
+ * @brief Frees a stream created by fahe_decrypt_stream_new.
+ *
+ * @param[in] stream The stream to free. NULL is ignored.
+ */
+void fahe_decrypt_stream_free(fahe_decrypt_stream *stream);
+
+/**
+ * @brief Drops the bytes received so far, to start a new ciphertext.
+ */
+void fahe_decrypt_stream_reset(fahe_decrypt_stream *stream);
+
+/**
+ * @brief Feeds the next bytes of the ciphertext.
+ *
+ * Chunks may be of any size, including 0, and split limbs anywhere.
+ *
+ * @param[in] stream The stream.
+ * @param[in] data The bytes, in the order of the stream.
+ * @param[in] len Number of bytes.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_decrypt_stream_update(fahe_decrypt_stream *stream, const void *data,
+                               size_t len);
+
+/**
+ * @brief Finishes the ciphertext and decodes its message.
+ *
+ * The message is the one fahe1_decrypt or fahe2_decrypt return for the
+ * ciphertext: ((c mod p) >> shift) masked to m_max bits. The stream is then
+ * reset for the next ciphertext.
+ *
+ * @param[in] stream The stream.
+ * @param[out] message Where to store the result. If NULL, a new BIGNUM is
+ *                     allocated.
+ *
+ * @return message or the new BIGNUM, NULL on failure.
+ */
+BIGNUM *fahe_decrypt_stream_final(fahe_decrypt_stream *stream,
+                                  BIGNUM *message);
+
+/**
+ * @brief Feeds everything read from fd until end of file, then finishes.
+ *
+ * @param[in] stream The stream. Bytes fed before are kept.
+ * @param[in] fd A file, pipe or socket, read with read().
+ * @param[out] message Where to store the result, as for
+ *                     fahe_decrypt_stream_final.
+ *
+ * @return message or the new BIGNUM, NULL if reading failed.
+ */
+BIGNUM *fahe_decrypt_stream_fd(fahe_decrypt_stream *stream, int fd,
+                               BIGNUM *message);
+
+/**
+ * @typedef fahe_encrypt_stream
+ * @brief Encryption state of one ciphertext produced in chunks.
+ *
+ * The ciphertext is the c_limbs little-endian limbs of
+ * fahe1_encrypt_ctx_limbs or fahe2_encrypt_ctx_limbs, read as bytes, so it
+ * can be stored as a fahe_ct_batch row or FAHE file record, or decrypted by
+ * a FAHE_STREAM_LSB_FIRST fahe_decrypt_stream.
+ *
+ * @note A stream is not thread-safe, but streams that borrow the same limbs
+ * of p and X + 1 may run on different threads.
+ */
+
+/**
+ * @struct fahe_encrypt_stream
+ *
+ * @var fahe_encrypt_stream: p, bound (const uint64_t*)
+ * Limbs of p and of the exclusive bound X + 1 of q. Borrowed.
+ *
+ * @var fahe_encrypt_stream: p_limbs, q_limbs, c_limbs (size_t)
+ * Limbs of p, of X + 1 and of a ciphertext, p_limbs + q_limbs + 1.
+ *
+ * @var fahe_encrypt_stream: rng (fahe_rng*)
+ * Owned FAHE_RNG_DEFAULT engine for q.
+ *
+ * @var fahe_encrypt_stream: window (uint64_t*)
+ * The p_limbs limbs of the ciphertext that still take carries.
+ *
+ * @var fahe_encrypt_stream: free_top, free_top_limb (size_t, uint64_t)
+ * q is free_top random limbs, then free_top_limb, then the limbs of X + 1
+ * above it.
+ *
+ * @var fahe_encrypt_stream: q (uint64_t*)
+ * A block of FAHE_STREAM_BLOCK_LIMBS limbs of q.
+ *
+ * @var fahe_encrypt_stream: block (uint64_t*)
+ * The last limbs produced, read as bytes in the order of a FAHE file record.
+ * Room for FAHE_STREAM_BLOCK_LIMBS + p_limbs + 1 limbs.
+ *
+ * @var fahe_encrypt_stream: block_next, block_bytes (size_t)
+ * The next byte of block to read and the number produced.
+ *
+ * @var fahe_encrypt_stream: next_limb (size_t)
+ * Index of the next ciphertext limb to produce.
+ *
+ * @var fahe_encrypt_stream: failed (int)
+ * 1 once drawing q has failed, until the next fahe_encrypt_stream_begin.
+ */
+typedef struct {
+  const uint64_t *p;
+  const uint64_t *bound;
+  size_t p_limbs;
+  size_t q_limbs;
+  size_t c_limbs;
+  fahe_rng *rng;
+  uint64_t *window;
+  size_t free_top;
+  uint64_t free_top_limb;
+  uint64_t *q;
+  uint64_t *block;
+  size_t block_next;
+  size_t block_bytes;
+  size_t next_limb;
+  int failed;
+} fahe_encrypt_stream;
+
+/**
+ * @brief Creates an encryption stream. @see fahe1_encrypt_stream_new and
+ * fahe2_encrypt_stream_new, which borrow the limbs of an encryption
+ * context.
+ *
+ * @param[in] p Limbs of p. Borrowed; they must outlive the stream.
+ * @param[in] p_limbs Number of limbs of p.
+ * @param[in] bound Limbs of X + 1. Borrowed. Its top limb must be non-zero.
+ * @param[in] q_limbs Number of limbs of bound.
+ *
+ * @return The stream. Free with fahe_encrypt_stream_free.
+ */
+fahe_encrypt_stream *fahe_encrypt_stream_new(const uint64_t *p,
+                                             size_t p_limbs,
+                                             const uint64_t *bound,
+                                             size_t q_limbs);
+
+/**
+ * @brief Frees a stream created by fahe_encrypt_stream_new.
+ *
+ * @param[in] stream The stream to free. NULL is ignored.
+ */
+void fahe_encrypt_stream_free(fahe_encrypt_stream *stream);
+
+/**
+ * @brief Starts the ciphertext of an encoded message, dropping what is left
+ * of the previous one, and clears a failure. @see fahe1_encrypt_stream_begin
+ * and fahe2_encrypt_stream_begin, which encode the message.
+ *
+ * On failure the stream has nothing to read and its reads fail until it is
+ * begun again.
+ *
+ * @param[in] stream The stream.
+ * @param[in] M Limbs of the encoded message M, copied.
+ * @param[in] m_limbs Number of limbs of M. At most p_limbs.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_encrypt_stream_begin(fahe_encrypt_stream *stream, const uint64_t *M,
+                              size_t m_limbs);
+
+/**
+ * @brief Produces the next bytes of the ciphertext.
+ *
+ * Reads may be of any size; the ciphertext is 8 * c_limbs bytes in all.
+ * As with read(), a failure after some bytes were written returns those
+ * bytes, and is reported by the next read. A failed stream drops the rest
+ * of the ciphertext and fails every read until fahe_encrypt_stream_begin.
+ *
+ * @param[in] stream The stream.
+ * @param[out] out Destination, e.g. a buffer or an mmap region.
+ * @param[in] len Room in out.
+ *
+ * @return The bytes written, less than len only at the end of the
+ *         ciphertext or on a failure, and 0 after the end. (size_t)-1 on a
+ *         read of a failed stream.
+ */
+size_t fahe_encrypt_stream_read(fahe_encrypt_stream *stream, void *out,
+                                size_t len);
+
+/**
+ * @brief Writes the rest of the ciphertext to fd.
+ *
+ * @param[in] stream The stream.
+ * @param[in] fd A file, pipe or socket, written with write().
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_encrypt_stream_fd(fahe_encrypt_stream *stream, int fd);
+
+#endif  // STREAM_H
@@ -0,0 +1,276 @@
+/**
+ * @file textio.c
+ * @brief Implementation of the streaming decimal text reader.
+ *
+ * Every fill of the window is cut after its last separator. The text
+ * before the cut holds only complete records; it is split into pieces of
+ * at least TEXT_MIN_PIECE bytes, each moved forward to the next separator
+ * so that no record straddles two pieces, and the pieces are parsed in
+ * parallel into per-piece lists of BIGNUMs that are reused from one fill
+ * to the next. The text after the cut is moved to the front of the window
+ * and completed by the next fill.
+ *
+ * Dependencies:
+ * - fcntl.h
+ * - openssl/bn.h
+ * - openssl/crypto.h
+ * - batch.h
+ * - logger.h
+ * - radix.h
+ * - thread_pool.h
+ *
+ * @see textio.h for the documentation of the functions implemented here.
+ */
+
+#include "textio.h"
+
+#include <fcntl.h>
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "logger.h"
+#include "radix.h"
+#include "thread_pool.h"
+
+#define TEXT_PIECES_PER_THREAD 4
+#define TEXT_MIN_PIECE 4096
+
+typedef struct {
+  size_t begin;
+  size_t end;
+  BIGNUM **values;
+  size_t num_values;
+  size_t cap_values;
+  size_t error;
+  int failed;
+} text_piece;
+
+typedef struct {
+  const char *buf;
+  text_piece *pieces;
+} text_job;
+
+static int text_is_digit(char c) { return c >= '0' && c <= '9'; }
+
+static int text_is_separator(char c) {
+  return c == ',' || c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Makes room for one more value in a piece
+static int text_piece_reserve(text_piece *piece) {
+  if (piece->num_values < piece->cap_values) {
+    return 1;
+  }
+  size_t cap = piece->cap_values ? 2 * piece->cap_values : 16;
+  BIGNUM **values = realloc(piece->values, cap * sizeof(BIGNUM *));
+  if (!values) {
+    return 0;
+  }
+  piece->values = values;
+  for (; piece->cap_values < cap; piece->cap_values++) {
+    values[piece->cap_values] = BN_new();
+    if (!values[piece->cap_values]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Parses the records of a piece, up to the first invalid byte
+static void text_parse_piece(const char *buf, text_piece *piece) {
+  piece->num_values = 0;
+  piece->error = SIZE_MAX;
+  piece->failed = 0;
+
+  size_t i = piece->begin;
+  while (i < piece->end) {
+    if (text_is_separator(buf[i])) {
+      i++;
+      continue;
+    }
+    size_t j = i;
+    while (j < piece->end && text_is_digit(buf[j])) {
+      j++;
+    }
+    if (j == i || (j < piece->end && !text_is_separator(buf[j]))) {
+      piece->error = j;
+      return;
+    }
+    if (!text_piece_reserve(piece) ||
+        !fahe_dec2bn(piece->values[piece->num_values], buf + i, j - i)) {
+      piece->failed = 1;
+      return;
+    }
+    piece->num_values++;
+    i = j;
+  }
+}
+
+static void text_parse_task(void *arg, size_t begin, size_t end,
+                            fahe_worker *worker) {
+  (void)worker;
+  text_job *job = (text_job *)arg;
+  for (size_t k = begin; k < end; k++) {
+    text_parse_piece(job->buf, &job->pieces[k]);
+  }
+}
+
+// Splits len bytes of complete records into pieces. Returns their number.
+static size_t text_split(const char *buf, size_t len, text_piece *pieces,
+                         size_t max_pieces) {
+  size_t num = len / TEXT_MIN_PIECE;
+  if (num > max_pieces) {
+    num = max_pieces;
+  }
+  if (num == 0) {
+    num = 1;
+  }
+
+  size_t begin = 0;
+  for (size_t k = 0; k < num; k++) {
+    size_t end = k + 1 == num ? len : len / num * (k + 1);
+    if (end < begin) {
+      end = begin;
+    }
+    while (end < len && text_is_digit(buf[end])) {
+      end++;
+    }
+    pieces[k].begin = begin;
+    pieces[k].end = end;
+    begin = end;
+  }
+  return num;
+}
+
+int fahe_text_read(FILE *stream, const fahe_text_opts *opts,
+                   fahe_text_record_fn fn, void *arg, size_t *count) {
+  fahe_text_opts defaults = FAHE_TEXT_OPTS_DEFAULT;
+  if (!opts) {
+    opts = &defaults;
+  }
+  size_t window = opts->window_bytes;
+  if (window < FAHE_TEXT_MIN_WINDOW) {
+    window = FAHE_TEXT_MIN_WINDOW;
+  }
+  fahe_thread_pool *pool = opts->pool;
+  if (!pool) {
+    pool = fahe_thread_pool_shared();
+  }
+
+  size_t max_pieces = (size_t)pool->num_threads * TEXT_PIECES_PER_THREAD;
+  char *buf = malloc(window);
+  text_piece *pieces = calloc(max_pieces, sizeof(text_piece));
+  if (!buf || !pieces) {
+    log_message(LOG_FATAL, "Memory allocation for the text window failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t used = 0;
+  size_t records = 0;
+  uint64_t base = 0;
+  int eof = 0;
+  int ok = 1;
+  while (ok && !eof) {
+    used += fread(buf + used, 1, window - used, stream);
+    if (used < window) {
+      if (ferror(stream)) {
+        log_message(LOG_ERROR, "Reading the text stream failed\n");
+        ok = 0;
+        break;
+      }
+      eof = 1;
+    }
+
+    // Cut after the last separator; the record after it may go on in the
+    // next fill
+    size_t cut = used;
+    if (!eof) {
+      while (cut > 0 && text_is_digit(buf[cut - 1])) {
+        cut--;
+      }
+      if (cut == 0) {
+        log_message(LOG_ERROR,
+                    "Record at byte %llu is longer than the %zu byte "
+                    "window\n",
+                    (unsigned long long)base, window);
+        ok = 0;
+        break;
+      }
+    }
+
+    size_t num_pieces = text_split(buf, cut, pieces, max_pieces);
+    text_job job;
+    job.buf = buf;
+    job.pieces = pieces;
+    fahe_thread_pool_run(pool, num_pieces, 1, text_parse_task, &job);
+
+    // Hand the values over in file order, up to the first error
+    for (size_t k = 0; k < num_pieces && ok; k++) {
+      text_piece *piece = &pieces[k];
+      for (size_t v = 0; v < piece->num_values && ok; v++) {
+        if (!fn(arg, records, piece->values[v])) {
+          log_message(LOG_ERROR, "Reading stopped at record %zu\n", records);
+          ok = 0;
+        } else {
+          records++;
+        }
+      }
+      if (ok && piece->failed) {
+        log_message(LOG_ERROR, "Parsing record %zu failed\n", records);
+        ok = 0;
+      } else if (ok && piece->error != SIZE_MAX) {
+        log_message(LOG_ERROR, "Invalid character at byte %llu\n",
+                    (unsigned long long)(base + piece->error));
+        ok = 0;
+      }
+    }
+
+    memmove(buf, buf + cut, used - cut);
+    base += cut;
+    used -= cut;
+  }
+
+  for (size_t k = 0; k < max_pieces; k++) {
+    for (size_t v = 0; v < pieces[k].cap_values; v++) {
+      BN_clear_free(pieces[k].values[v]);
+    }
+    free(pieces[k].values);
+  }
+  free(pieces);
+  OPENSSL_cleanse(buf, window);
+  free(buf);
+
+  if (count) {
+    *count = records;
+  }
+  return ok;
+}
+
+int fahe_text_read_file(const char *path, const fahe_text_opts *opts,
+                        fahe_text_record_fn fn, void *arg, size_t *count) {
+  FILE *stream = fopen(path, "rb");
+  if (!stream) {
+    log_message(LOG_ERROR, "Could not open %s\n", path);
+    return 0;
+  }
+  // The file is read once, front to back
+  posix_fadvise(fileno(stream), 0, 0, POSIX_FADV_SEQUENTIAL);
+  int ok = fahe_text_read(stream, opts, fn, arg, count);
+  fclose(stream);
+  return ok;
+}
+
+static int text_batch_record(void *arg, size_t index, const BIGNUM *value) {
+  (void)index;
+  fahe_ct_batch *batch = (fahe_ct_batch *)arg;
+  return fahe_ct_batch_set(batch, batch->count, value);
+}
+
+int fahe_text_read_batch(FILE *stream, const fahe_text_opts *opts,
+                         fahe_ct_batch *batch) {
+  return fahe_text_read(stream, opts, text_batch_record, batch, NULL);
+}
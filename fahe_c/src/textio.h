@@ -0,0 +1,118 @@
+/**
+ * @file textio.h
+ * @brief Header file for textio.c, a streaming reader for decimal text
+ * files of ciphertexts or messages, such as those of
+ * write_messages_to_file.
+ *
+ * A file is a sequence of records, each a run of decimal digits, separated
+ * by commas and/or whitespace. The reader holds at most a window of the
+ * file at once: it fills a fixed buffer, parses every record that ends in
+ * it and carries the partial record at its end over to the next fill. So a
+ * file of any size is read in bounded memory, and a record may be as long
+ * as the window.
+ *
+ * The complete records of a window are split into pieces at separators
+ * and parsed on the threads of a fahe_thread_pool, while the values are
+ * handed to the caller one at a time, in file order, on the calling
+ * thread.
+ *
+ * This file contains the following structs: fahe_text_opts
+ *                and the following methods: fahe_text_read,
+ * fahe_text_read_file, fahe_text_read_batch
+ */
+
+#ifndef TEXTIO_H
+#define TEXTIO_H
+
+#include <openssl/bn.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "batch.h"
+#include "thread_pool.h"
+
+/**
+ * @brief Default bytes of text held at once.
+ */
+#define FAHE_TEXT_WINDOW_BYTES ((size_t)16 << 20)
+
+/**
+ * @brief Smallest window accepted; smaller ones are raised to it.
+ */
+#define FAHE_TEXT_MIN_WINDOW 4096
+
+/**
+ * @brief Receives the records of a file in order.
+ *
+ * @param[in] arg The arg passed to the reader.
+ * @param[in] index The position of the record in the file, from 0.
+ * @param[in] value The record. It is only valid during the call.
+ *
+ * @return 1 to go on, 0 to stop reading, which makes the reader fail.
+ */
+typedef int (*fahe_text_record_fn)(void *arg, size_t index,
+                                   const BIGNUM *value);
+
+/**
+ * @typedef fahe_text_opts
+ * @brief Options of fahe_text_read.
+ */
+
+/**
+ * @struct fahe_text_opts
+ *
+ * @var fahe_text_opts: window_bytes (size_t)
+ * Bytes of text held at once. Records may be up to this long. Besides the
+ * window, the reader only holds the values parsed from it, which take
+ * less than half as many bytes.
+ *
+ * @var fahe_text_opts: pool (fahe_thread_pool*)
+ * Threads that parse. NULL uses fahe_thread_pool_shared.
+ */
+typedef struct {
+  size_t window_bytes;
+  fahe_thread_pool *pool;
+} fahe_text_opts;
+
+/**
+ * @brief Options with the default window on the shared pool.
+ */
+#define FAHE_TEXT_OPTS_DEFAULT {FAHE_TEXT_WINDOW_BYTES, NULL}
+
+/**
+ * @brief Parses the records of a stream and hands each to fn.
+ *
+ * @param[in] stream An open stream, read to its end.
+ * @param[in] opts Window and pool. NULL uses FAHE_TEXT_OPTS_DEFAULT.
+ * @param[in] fn Called for every record, in file order.
+ * @param[in] arg Passed to fn.
+ * @param[out] count Where to store the number of records handed to fn.
+ *                   May be NULL.
+ *
+ * @return 1 on success, 0 if reading failed, the text holds anything but
+ *         digits, commas and whitespace, a record is longer than the
+ *         window or fn stopped the read.
+ */
+int fahe_text_read(FILE *stream, const fahe_text_opts *opts,
+                   fahe_text_record_fn fn, void *arg, size_t *count);
+
+/**
+ * @brief Opens path and reads it with fahe_text_read.
+ */
+int fahe_text_read_file(const char *path, const fahe_text_opts *opts,
+                        fahe_text_record_fn fn, void *arg, size_t *count);
+
+/**
+ * @brief Appends the records of a stream to the rows of a batch.
+ *
+ * @param[in] stream An open stream, read to its end.
+ * @param[in] opts Window and pool. NULL uses FAHE_TEXT_OPTS_DEFAULT.
+ * @param[in,out] batch The batch. Records are stored from row count on and
+ *                      must fit in its capacity and row_limbs.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+int fahe_text_read_batch(FILE *stream, const fahe_text_opts *opts,
+                         fahe_ct_batch *batch);
+
+#endif  // TEXTIO_H
@@ -0,0 +1,93 @@
+/**
+ * @file thread_blocks.c
+ * @brief Implementation of the registry of per-thread counter blocks.
+ *
+ * A block is allocated behind a list node the first time its thread asks
+ * for it, and set as the thread's value of the registry's key. The key's
+ * destructor runs when the thread exits: it merges the block into the
+ * retired total under the lock, unlinks it and frees it.
+ *
+ * Dependencies:
+ * - pthread.h
+ * - logger.h
+ *
+ * @see thread_blocks.h for the documentation of the functions implemented
+ * here.
+ */
+
+#include "thread_blocks.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+
+// Folds the block of an exiting thread into the retired total
+static void thread_blocks_retire(void *arg) {
+  fahe_thread_block_node *node = (fahe_thread_block_node *)arg;
+  fahe_thread_blocks *blocks = node->blocks;
+  pthread_mutex_lock(&blocks->lock);
+  blocks->merge(blocks->retired, node->counters);
+  if (node->prev) {
+    node->prev->next = node->next;
+  } else {
+    blocks->head = node->next;
+  }
+  if (node->next) {
+    node->next->prev = node->prev;
+  }
+  pthread_mutex_unlock(&blocks->lock);
+  free(node);
+}
+
+void *fahe_thread_blocks_get(fahe_thread_blocks *blocks) {
+  fahe_thread_block_node *node = (fahe_thread_block_node *)calloc(
+      1, sizeof(fahe_thread_block_node) + blocks->size);
+  if (!node) {
+    log_message(LOG_FATAL, "Memory allocation for a thread block failed\n");
+    exit(EXIT_FAILURE);
+  }
+  node->blocks = blocks;
+
+  pthread_mutex_lock(&blocks->lock);
+  if (!blocks->key_ready) {
+    if (pthread_key_create(&blocks->key, thread_blocks_retire) != 0) {
+      log_message(LOG_FATAL, "pthread_key_create for thread blocks failed\n");
+      exit(EXIT_FAILURE);
+    }
+    blocks->key_ready = 1;
+  }
+  node->next = blocks->head;
+  if (blocks->head) {
+    blocks->head->prev = node;
+  }
+  blocks->head = node;
+  pthread_mutex_unlock(&blocks->lock);
+  pthread_setspecific(blocks->key, node);
+  return node->counters;
+}
+
+int fahe_thread_blocks_sum(fahe_thread_blocks *blocks, void *into) {
+  int threads = 0;
+  pthread_mutex_lock(&blocks->lock);
+  blocks->merge(into, blocks->retired);
+  for (fahe_thread_block_node *node = blocks->head; node; node = node->next) {
+    blocks->merge(into, node->counters);
+    threads++;
+  }
+  pthread_mutex_unlock(&blocks->lock);
+  return threads;
+}
+
+void fahe_thread_blocks_reset(fahe_thread_blocks *blocks) {
+  size_t n = blocks->size / sizeof(uint64_t);
+  pthread_mutex_lock(&blocks->lock);
+  memset(blocks->retired, 0, blocks->size);
+  for (fahe_thread_block_node *node = blocks->head; node; node = node->next) {
+    for (size_t i = 0; i < n; i++) {
+      __atomic_store_n(&node->counters[i], 0, __ATOMIC_RELAXED);
+    }
+  }
+  pthread_mutex_unlock(&blocks->lock);
+}
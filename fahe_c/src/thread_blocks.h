@@ -0,0 +1,134 @@
+/**
+ * @file thread_blocks.h
+ * @brief Header file for thread_blocks.c, per-thread blocks of counters
+ * that are summed on demand.
+ *
+ * The stage timers of stats.c and the operation metrics of metrics.c keep
+ * their counters per thread, so that recording never shares a cache line
+ * between threads. A fahe_thread_blocks registry hands every thread its own
+ * zeroed block, keeps the blocks on a list for snapshots and folds the
+ * block of an exiting thread into a retired total.
+ *
+ * Blocks hold nothing but uint64_t counters. Only the owning thread writes
+ * its block, with relaxed atomic stores; the merge callback reads it with
+ * relaxed atomic loads, so a concurrent snapshot never reads a torn value.
+ *
+ * This file contains the following structs: fahe_thread_block_node,
+ *                fahe_thread_blocks and the following methods:
+ * fahe_thread_blocks_get, fahe_thread_blocks_sum, fahe_thread_blocks_reset
+ */
+
+#ifndef THREAD_BLOCKS_H
+#define THREAD_BLOCKS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Adds the counters of the block from to the block into.
+ */
+typedef void (*fahe_blocks_merge_fn)(void *into, const void *from);
+
+struct fahe_thread_blocks;
+
+/**
+ * @typedef fahe_thread_block_node
+ * @brief A block of one thread and its place on the list of its registry.
+ */
+
+/**
+ * @struct fahe_thread_block_node
+ *
+ * @var fahe_thread_block_node: next, prev (fahe_thread_block_node*)
+ * Neighbours on the list of live blocks.
+ *
+ * @var fahe_thread_block_node: blocks (struct fahe_thread_blocks*)
+ * The registry, for the retire callback of the thread.
+ *
+ * @var fahe_thread_block_node: counters (uint64_t[])
+ * The block handed out by fahe_thread_blocks_get.
+ */
+typedef struct fahe_thread_block_node {
+  struct fahe_thread_block_node *next;
+  struct fahe_thread_block_node *prev;
+  struct fahe_thread_blocks *blocks;
+  uint64_t counters[];
+} fahe_thread_block_node;
+
+/**
+ * @typedef fahe_thread_blocks
+ * @brief A registry of per-thread blocks. Define one statically with
+ * FAHE_THREAD_BLOCKS_INIT.
+ */
+
+/**
+ * @struct fahe_thread_blocks
+ *
+ * @var fahe_thread_blocks: size (size_t)
+ * Bytes of a block, a multiple of sizeof(uint64_t).
+ *
+ * @var fahe_thread_blocks: merge (fahe_blocks_merge_fn)
+ * Adds one block to another.
+ *
+ * @var fahe_thread_blocks: retired (void*)
+ * Sum of the blocks of the threads that have exited.
+ *
+ * @var fahe_thread_blocks: head (fahe_thread_block_node*)
+ * List of the blocks of live threads.
+ *
+ * @var fahe_thread_blocks: lock (pthread_mutex_t)
+ * Guards head, retired and key_ready.
+ *
+ * @var fahe_thread_blocks: key, key_ready (pthread_key_t, int)
+ * Key whose destructor retires the block of an exiting thread.
+ */
+typedef struct fahe_thread_blocks {
+  size_t size;
+  fahe_blocks_merge_fn merge;
+  void *retired;
+  fahe_thread_block_node *head;
+  pthread_mutex_t lock;
+  pthread_key_t key;
+  int key_ready;
+} fahe_thread_blocks;
+
+/**
+ * @brief Static initializer of a registry whose blocks have the type and
+ * size of total, the static variable that keeps the retired total, e.g.
+ * static fahe_thread_blocks blocks = FAHE_THREAD_BLOCKS_INIT(total, merge);
+ */
+#define FAHE_THREAD_BLOCKS_INIT(total, merge_fn)                    \
+  {.size = sizeof(total), .merge = (merge_fn), .retired = &(total), \
+   .lock = PTHREAD_MUTEX_INITIALIZER}
+
+/**
+ * @brief Creates and registers the block of the calling thread. Callers
+ * keep the result in a __thread pointer and only call this when it is NULL.
+ *
+ * @param[in] blocks The registry.
+ *
+ * @return The zeroed block of the calling thread. Exits on allocation
+ *         failure.
+ */
+void *fahe_thread_blocks_get(fahe_thread_blocks *blocks);
+
+/**
+ * @brief Merges the retired total and the blocks of all live threads into
+ * into.
+ *
+ * @param[in] blocks The registry.
+ * @param[in,out] into A block to add to, usually zeroed by the caller.
+ *
+ * @return The number of live threads with a block.
+ */
+int fahe_thread_blocks_sum(fahe_thread_blocks *blocks, void *into);
+
+/**
+ * @brief Zeroes the retired total and the blocks of all live threads.
+ *
+ * @param[in] blocks The registry.
+ */
+void fahe_thread_blocks_reset(fahe_thread_blocks *blocks);
+
+#endif  // THREAD_BLOCKS_H
@@ -0,0 +1,225 @@
+/**
+ * @file thread_pool.c
+ * @brief Implementation of the persistent worker pool.
+ *
+ * Dependencies:
+ * - openssl/bn.h
+ * - pthread.h
+ * - logger.h
+ * - rng.h
+ *
+ * @see thread_pool.h for the documentation of the functions implemented here.
+ */
+
+#include "thread_pool.h"
+
+#include <openssl/bn.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "rng.h"
+
+// The worker the current thread is running a batch as, NULL outside a batch
+static __thread fahe_worker *current_worker = NULL;
+
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+static fahe_thread_pool *shared_pool = NULL;
+
+typedef struct {
+  fahe_thread_pool *pool;
+  fahe_worker *worker;
+} pool_thread_arg;
+
+// Claims chunks of the current batch until none are left
+static void pool_work(fahe_thread_pool *pool, fahe_worker *worker) {
+  fahe_worker *outer = current_worker;
+  current_worker = worker;
+  for (;;) {
+    size_t begin = __atomic_fetch_add(&pool->next, pool->chunk,
+                                      __ATOMIC_RELAXED);
+    if (begin >= pool->num_items) {
+      break;
+    }
+    size_t end = begin + pool->chunk < pool->num_items
+                     ? begin + pool->chunk
+                     : pool->num_items;
+    pool->fn(pool->arg, begin, end, worker);
+  }
+  current_worker = outer;
+}
+
+static void *pool_thread(void *arg) {
+  fahe_thread_pool *pool = ((pool_thread_arg *)arg)->pool;
+  fahe_worker *worker = ((pool_thread_arg *)arg)->worker;
+  free(arg);
+
+  // Batches are numbered from 1, so a thread that starts after the first
+  // batch was posted still joins it
+  uint64_t seen = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stop && pool->generation == seen) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->stop) {
+      break;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_work(pool, worker);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+fahe_thread_pool *fahe_thread_pool_new(int num_threads) {
+  if (num_threads <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = cpus > 0 ? (int)cpus : 1;
+  }
+
+  fahe_thread_pool *pool =
+      (fahe_thread_pool *)malloc(sizeof(fahe_thread_pool));
+  if (!pool) {
+    log_message(LOG_FATAL, "Memory allocation for fahe_thread_pool failed\n");
+    exit(EXIT_FAILURE);
+  }
+  pool->num_threads = num_threads;
+  pool->threads = malloc(num_threads * sizeof(pthread_t));
+  pool->workers = malloc(num_threads * sizeof(fahe_worker));
+  if (!pool->threads || !pool->workers) {
+    log_message(LOG_FATAL, "Memory allocation for pool threads failed\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    pool->workers[i].index = i;
+    pool->workers[i].bn_ctx = BN_CTX_new();
+    pool->workers[i].rng = fahe_rng_new(FAHE_RNG_DEFAULT);
+    if (!pool->workers[i].bn_ctx) {
+      log_message(LOG_FATAL, "BN_CTX_new failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  pool->generation = 0;
+  pool->busy = 0;
+  pool->stop = 0;
+  pool->fn = NULL;
+  pool->arg = NULL;
+  pool->num_items = 0;
+  pool->chunk = 1;
+  pool->next = 0;
+  pthread_mutex_init(&pool->run_lock, NULL);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  // workers[0] is the caller of fahe_thread_pool_run
+  for (int i = 1; i < num_threads; i++) {
+    pool_thread_arg *arg = malloc(sizeof(pool_thread_arg));
+    if (!arg) {
+      log_message(LOG_FATAL, "Memory allocation failed\n");
+      exit(EXIT_FAILURE);
+    }
+    arg->pool = pool;
+    arg->worker = &pool->workers[i];
+    if (pthread_create(&pool->threads[i], NULL, pool_thread, arg) != 0) {
+      log_message(LOG_FATAL, "Starting a pool thread failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  log_message(LOG_DEBUG, "fahe_thread_pool of %d threads started\n",
+              num_threads);
+  return pool;
+}
+
+void fahe_thread_pool_free(fahe_thread_pool *pool) {
+  if (!pool) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 1; i < pool->num_threads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  for (int i = 0; i < pool->num_threads; i++) {
+    BN_CTX_free(pool->workers[i].bn_ctx);
+    fahe_rng_free(pool->workers[i].rng);
+  }
+  pthread_mutex_destroy(&pool->run_lock);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  free(pool->threads);
+  free(pool->workers);
+  free(pool);
+}
+
+static void shared_pool_init(void) { shared_pool = fahe_thread_pool_new(0); }
+
+fahe_thread_pool *fahe_thread_pool_shared(void) {
+  pthread_once(&shared_once, shared_pool_init);
+  return shared_pool;
+}
+
+void fahe_thread_pool_run(fahe_thread_pool *pool, size_t num_items,
+                          size_t chunk, fahe_task_fn fn, void *arg) {
+  if (num_items == 0) {
+    return;
+  }
+  if (chunk == 0) {
+    chunk = num_items /
+            ((size_t)pool->num_threads * FAHE_POOL_CHUNKS_PER_THREAD);
+    chunk = chunk > 0 ? chunk : 1;
+  }
+
+  // A batch started by a task of the same pool runs on that task's thread
+  if (current_worker >= pool->workers &&
+      current_worker < pool->workers + pool->num_threads) {
+    fn(arg, 0, num_items, current_worker);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->run_lock);
+  if (pool->num_threads == 1 || chunk >= num_items) {
+    fahe_worker *outer = current_worker;
+    current_worker = &pool->workers[0];
+    fn(arg, 0, num_items, current_worker);
+    current_worker = outer;
+    pthread_mutex_unlock(&pool->run_lock);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->num_items = num_items;
+  pool->chunk = chunk;
+  pool->next = 0;
+  pool->busy = pool->num_threads - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  pool_work(pool, &pool->workers[0]);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  pthread_mutex_unlock(&pool->run_lock);
+}
@@ -0,0 +1,164 @@
+/**
+ * @file thread_pool.h
+ * @brief Header file for thread_pool.c, a persistent worker pool for batch
+ * encryption, decryption and summation.
+ *
+ * This file contains the following structs: fahe_worker, fahe_thread_pool
+ *                and the following methods: fahe_thread_pool_new,
+ * fahe_thread_pool_free, fahe_thread_pool_shared, fahe_thread_pool_run
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <openssl/bn.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rng.h"
+
+/**
+ * @brief Chunks per thread that fahe_thread_pool_run aims for when the caller
+ * passes chunk = 0. More chunks balance uneven items better; fewer chunks
+ * touch the shared counter less.
+ */
+#define FAHE_POOL_CHUNKS_PER_THREAD 8
+
+/**
+ * @typedef fahe_worker
+ * @brief State owned by one thread of a fahe_thread_pool.
+ *
+ * Tasks receive the worker running them and may use its BN_CTX and RNG
+ * without locking. Index 0 is the thread that called fahe_thread_pool_run.
+ */
+
+/**
+ * @struct fahe_worker
+ *
+ * @var fahe_worker: index (int)
+ * Position of the worker in the pool, 0 .. num_threads - 1.
+ *
+ * @var fahe_worker: bn_ctx (BN_CTX*)
+ * Scratch for BIGNUM arithmetic.
+ *
+ * @var fahe_worker: rng (fahe_rng*)
+ * Random number engine of the worker. @see rng.h
+ */
+typedef struct {
+  int index;
+  BN_CTX *bn_ctx;
+  fahe_rng *rng;
+} fahe_worker;
+
+/**
+ * @brief A task run by fahe_thread_pool_run on the items [begin, end).
+ */
+typedef void (*fahe_task_fn)(void *arg, size_t begin, size_t end,
+                             fahe_worker *worker);
+
+/**
+ * @typedef fahe_thread_pool
+ * @brief A fixed set of threads that stay alive between batches.
+ *
+ * fahe_thread_pool_run splits a batch of items into chunks. The calling
+ * thread and the pool's threads claim chunks from a shared counter until
+ * none are left, so a thread that draws cheap items simply takes more
+ * chunks. Threads sleep on a condition variable between batches.
+ *
+ * @note Batches from different threads on the same pool run one at a time.
+ * @note A task that calls fahe_thread_pool_run on its own pool runs the
+ * inner batch on its own thread.
+ * @note Pool threads do not survive fork(). Create pools after forking.
+ */
+
+/**
+ * @struct fahe_thread_pool
+ *
+ * @var fahe_thread_pool: num_threads (int)
+ * Threads working on a batch, including the caller of fahe_thread_pool_run.
+ *
+ * @var fahe_thread_pool: threads (pthread_t*)
+ * The num_threads - 1 background threads.
+ *
+ * @var fahe_thread_pool: workers (fahe_worker*)
+ * num_threads worker states; workers[0] belongs to the caller.
+ *
+ * @var fahe_thread_pool: run_lock (pthread_mutex_t)
+ * Serializes batches.
+ *
+ * @var fahe_thread_pool: lock, start, done (pthread_mutex_t, pthread_cond_t)
+ * Protect the batch fields; wake the threads for a batch; signal the caller
+ * when the last background thread has finished.
+ *
+ * @var fahe_thread_pool: generation (uint64_t)
+ * Batch number; a thread starts working when it changes.
+ *
+ * @var fahe_thread_pool: busy, stop (int)
+ * Background threads still working on the batch and the shutdown flag.
+ *
+ * @var fahe_thread_pool: fn, arg (fahe_task_fn, void*)
+ * The task of the current batch and its argument.
+ *
+ * @var fahe_thread_pool: num_items, chunk, next (size_t)
+ * Items in the batch, items per chunk and the first unclaimed item.
+ */
+typedef struct {
+  int num_threads;
+  pthread_t *threads;
+  fahe_worker *workers;
+  pthread_mutex_t run_lock;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  uint64_t generation;
+  int busy;
+  int stop;
+  fahe_task_fn fn;
+  void *arg;
+  size_t num_items;
+  size_t chunk;
+  size_t next;
+} fahe_thread_pool;
+
+/**
+ * @brief Creates a pool and starts its threads.
+ *
+ * @param[in] num_threads Threads to work on a batch, including the caller.
+ *                        <= 0 uses one per online CPU.
+ *
+ * @return The initialized pool. Free with fahe_thread_pool_free.
+ */
+fahe_thread_pool *fahe_thread_pool_new(int num_threads);
+
+/**
+ * @brief Stops the threads and frees a pool.
+ *
+ * @param[in] pool The pool to free. NULL is ignored. Must not be the pool
+ *                 returned by fahe_thread_pool_shared.
+ */
+void fahe_thread_pool_free(fahe_thread_pool *pool);
+
+/**
+ * @brief Returns the process-wide pool with one thread per online CPU.
+ *
+ * The pool is created on first use and lives until the process exits.
+ *
+ * @return The shared pool.
+ */
+fahe_thread_pool *fahe_thread_pool_shared(void);
+
+/**
+ * @brief Runs fn over the items [0, num_items) and waits for it to finish.
+ *
+ * @param[in] pool The pool to run on.
+ * @param[in] num_items Number of items.
+ * @param[in] chunk Items per call of fn. 0 picks a chunk that gives each
+ *                  thread about FAHE_POOL_CHUNKS_PER_THREAD chunks.
+ * @param[in] fn The task. Called with disjoint ranges that cover all items.
+ * @param[in] arg Passed to fn.
+ */
+void fahe_thread_pool_run(fahe_thread_pool *pool, size_t num_items,
+                          size_t chunk, fahe_task_fn fn, void *arg);
+
+#endif  // THREAD_POOL_H
@@ -1,11 +1,23 @@
 #include <criterion/criterion.h>
 #include <math.h>
+#include <openssl/opensslv.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
+#include "add.h"
+#include "alloc_track.h"
 #include "fahe1.h"
+#include "fahefile.h"
 #include "helper.h"
+#include "limb.h"
 #include "logger.h"
+#include "metrics.h"
+#include "radix.h"
+#include "stats.h"
+#include "textio.h"
 
 Test(fahe1, fahe1_analysis_fahe1_full) {
   // Number of trials
@@ -82,3 +94,1429 @@ Test(fahe1, fahe1_analysis_fahe1_full) {
   }
   free(msg_list);
 }
+
+Test(fahe1, fahe1_encrypt_ctx_roundtrip) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(&fahe1_instance->key);
+  cr_assert_not_null(enc_ctx, "fahe1_enc_ctx_new failed");
+
+  // Reuse one ciphertext BIGNUM across messages, as a steady-state caller would
+  BIGNUM *ciphertext = BN_new();
+  for (int i = 0; i < 32; i++) {
+    BIGNUM *message = generate_big_message(fahe1_instance->msg_size);
+    cr_assert_eq(fahe1_encrypt_ctx(enc_ctx, message, ciphertext), ciphertext);
+
+    BIGNUM *decrypted =
+        fahe1_decrypt(fahe1_instance->key.p, fahe1_instance->key.m_max,
+                      fahe1_instance->key.rho, fahe1_instance->key.alpha,
+                      ciphertext);
+    cr_assert(BN_cmp(message, decrypted) == 0, "Decryption failed for %d", i);
+    BN_free(message);
+    BN_free(decrypted);
+  }
+
+  BN_free(ciphertext);
+  fahe1_enc_ctx_free(enc_ctx);
+  fahe1_free(fahe1_instance);
+}
+
+// BN_check_prime is OpenSSL 3.0+, as in prime_check of keygen.c
+static int test_is_prime(const BIGNUM *c, BN_CTX *ctx) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  return BN_check_prime(c, ctx, NULL);
+#else
+  return BN_is_prime_fasttest_ex(c, BN_prime_checks, ctx, 0, NULL);
+#endif
+}
+
+Test(fahe1, fahe1_keygen_ex_primes) {
+  // Four searchers even on one CPU, so that the losers are cancelled
+  fahe_thread_pool *pool = fahe_thread_pool_new(4);
+  BN_CTX *ctx = BN_CTX_new();
+  BIGNUM *q = BN_new();
+  BIGNUM *bound = BN_new();
+  int lambda = 128, m_max = 32, alpha = 6;
+  int eta = lambda + 2 * alpha + m_max;
+  int gamma = (int)(lambda / log2(lambda) * ((eta - lambda) * (eta - lambda)));
+
+  for (int safe = 0; safe <= 1; safe++) {
+    fahe_keygen_opts opts = {safe, pool};
+    fahe1_key key = fahe1_keygen_ex(lambda, m_max, alpha, &opts);
+    cr_assert_eq(BN_num_bits(key.p), eta);
+    cr_assert_eq(test_is_prime(key.p, ctx), 1);
+    if (safe) {
+      BN_rshift1(q, key.p);
+      cr_assert_eq(test_is_prime(q, ctx), 1);
+    }
+
+    // X * p <= 2**gamma < (X + 1) * p
+    BN_mul(bound, key.X, key.p, ctx);
+    cr_assert(BN_num_bits(bound) <= gamma);
+    BN_add(bound, bound, key.p);
+    cr_assert(BN_num_bits(bound) > gamma);
+
+    BIGNUM *message = generate_big_message(m_max);
+    BIGNUM *c = fahe1_encrypt(key.p, key.X, key.rho, alpha, message);
+    BIGNUM *m = fahe1_decrypt(key.p, m_max, key.rho, alpha, c);
+    cr_assert(BN_cmp(message, m) == 0);
+    BN_free(message);
+    BN_free(c);
+    BN_free(m);
+    BN_free(key.p);
+    BN_free(key.X);
+  }
+
+  BN_free(q);
+  BN_free(bound);
+  BN_CTX_free(ctx);
+  fahe_thread_pool_free(pool);
+}
+
+Test(fahe1, fahe1_decrypt_ctx_matches_bn_mod) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(&fahe1_instance->key);
+  fahe1_dec_ctx *dec_ctx = fahe1_dec_ctx_new(&fahe1_instance->key);
+
+  // Sums of ciphertexts are wider than gamma and exercise every fold width
+  BIGNUM *sum = BN_new();
+  BIGNUM *ciphertext = BN_new();
+  BIGNUM *decrypted = BN_new();
+  BN_zero(sum);
+  for (int i = 0; i < 32; i++) {
+    BIGNUM *message = generate_big_message(fahe1_instance->msg_size);
+    fahe1_encrypt_ctx(enc_ctx, message, ciphertext);
+    BN_add(sum, sum, ciphertext);
+
+    BIGNUM *expected =
+        fahe1_decrypt(fahe1_instance->key.p, fahe1_instance->key.m_max,
+                      fahe1_instance->key.rho, fahe1_instance->key.alpha, sum);
+    fahe1_decrypt_ctx(dec_ctx, sum, decrypted);
+    cr_assert(BN_cmp(expected, decrypted) == 0, "Mismatch after %d sums", i);
+    BN_free(expected);
+    BN_free(message);
+  }
+
+  BN_free(sum);
+  BN_free(ciphertext);
+  BN_free(decrypted);
+  fahe1_enc_ctx_free(enc_ctx);
+  fahe1_dec_ctx_free(dec_ctx);
+  fahe1_free(fahe1_instance);
+}
+
+Test(fahe1, fahe1_limb_table_matches_bn_mod) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_dec_ctx *dec_ctx = fahe1_dec_ctx_new(&fahe1_instance->key);
+  fahe_reducer_set_method(dec_ctx->reducer, FAHE_REDUCE_LIMB_TABLE);
+  BN_CTX *ctx = BN_CTX_new();
+
+  // Random values from one limb up to well past gamma, which grows the table
+  BIGNUM *value = BN_new();
+  BIGNUM *expected = BN_new();
+  BIGNUM *reduced = BN_new();
+  for (int bits = 1; bits < 80000; bits += 997) {
+    BN_rand(value, bits, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY);
+    BN_mod(expected, value, fahe1_instance->key.p, ctx);
+    cr_assert(fahe_reduce(dec_ctx->reducer, reduced, value));
+    cr_assert(BN_cmp(expected, reduced) == 0, "Mismatch at %d bits", bits);
+  }
+
+  // All-ones limbs maximize every column accumulator
+  BN_zero(value);
+  BN_set_bit(value, 64 * 1000);
+  BN_sub_word(value, 1);
+  BN_mod(expected, value, fahe1_instance->key.p, ctx);
+  cr_assert(fahe_reduce(dec_ctx->reducer, reduced, value));
+  cr_assert(BN_cmp(expected, reduced) == 0);
+
+  BN_free(value);
+  BN_free(expected);
+  BN_free(reduced);
+  BN_CTX_free(ctx);
+  fahe1_dec_ctx_free(dec_ctx);
+  fahe1_free(fahe1_instance);
+}
+
+Test(fahe1, fahe1_mul_small_add_matches_bn) {
+  BN_CTX *ctx = BN_CTX_new();
+  BIGNUM *p = BN_new();
+  BIGNUM *q = BN_new();
+  BIGNUM *m = BN_new();
+  BIGNUM *expected = BN_new();
+  BIGNUM *result = BN_new();
+  uint64_t p_buf[12], q_buf[40], m_buf[60], out[64];
+
+  // Unrolled widths 1-8, the generic loop above them, and M both shorter and
+  // longer than p * q
+  for (int p_bits = 1; p_bits <= 12 * 64; p_bits += 37) {
+    for (int trial = 0; trial < 20; trial++) {
+      int q_bits = 1 + rand() % (40 * 64);
+      int m_bits = 1 + rand() % (60 * 64);
+      BN_rand(p, p_bits, BN_RAND_TOP_ONE, BN_RAND_BOTTOM_ANY);
+      BN_rand(q, q_bits, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY);
+      BN_rand(m, m_bits, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY);
+      size_t pn = FAHE_LIMBS(p_bits), qn = FAHE_LIMBS(q_bits);
+      size_t mn = FAHE_LIMBS(m_bits);
+      cr_assert(limbs_from_bn(p, p_buf, pn) && limbs_from_bn(q, q_buf, qn) &&
+                limbs_from_bn(m, m_buf, mn));
+
+      size_t n = limbs_mul_small_add(out, q_buf, qn, p_buf, pn, m_buf, mn);
+      cr_assert(n == (qn + pn > mn ? qn + pn : mn) + 1);
+      cr_assert(limbs_to_bn(out, n, result));
+      BN_mul(expected, p, q, ctx);
+      BN_add(expected, expected, m);
+      cr_assert(BN_cmp(expected, result) == 0, "Mismatch at %d-bit p",
+                p_bits);
+    }
+  }
+
+  // All-ones operands carry through every limb
+  uint64_t ones[8] = {~0ULL, ~0ULL, ~0ULL, ~0ULL, ~0ULL, ~0ULL, ~0ULL, ~0ULL};
+  size_t n = limbs_mul_small_add(out, ones, 8, ones, 4, ones, 8);
+  cr_assert(limbs_to_bn(out, n, result));
+  limbs_to_bn(ones, 8, q);
+  limbs_to_bn(ones, 4, p);
+  BN_mul(expected, p, q, ctx);
+  BN_add(expected, expected, q);
+  cr_assert(BN_cmp(expected, result) == 0);
+
+  BN_free(p);
+  BN_free(q);
+  BN_free(m);
+  BN_free(expected);
+  BN_free(result);
+  BN_CTX_free(ctx);
+}
+
+Test(fahe1, fahe1_rng_below_bound) {
+  fahe_rng_engine engines[] = {FAHE_RNG_AES_CTR, FAHE_RNG_CHACHA20,
+                               FAHE_RNG_SYSTEM};
+  fahe_rng *rng = fahe_rng_new(FAHE_RNG_DEFAULT);
+  BIGNUM *bound = BN_new();
+  BIGNUM *r = BN_new();
+  uint64_t bound_buf[3], out[3];
+
+  for (int e = 0; e < 3; e++) {
+    fahe_rng_set_engine(rng, engines[e]);
+
+    // A top limb of 1 makes equal top limbs, and restarts, common
+    bound_buf[0] = 12345;
+    bound_buf[1] = 0;
+    bound_buf[2] = 1;
+    int top_set = 0;
+    for (int i = 0; i < 2000; i++) {
+      cr_assert(fahe_rng_limbs_below(rng, out, bound_buf, 3));
+      cr_assert(out[2] < 1 || (out[1] == 0 && out[0] < 12345));
+      top_set += out[2] == 1;
+    }
+    // Only 12345 of the 2**129 values below the bound have a top limb of 1
+    cr_assert(top_set == 0, "Top limb was set %d times", top_set);
+
+    // Fifty-fifty split between values below and above 2**128
+    bound_buf[0] = 0;
+    bound_buf[2] = 2;
+    top_set = 0;
+    for (int i = 0; i < 2000; i++) {
+      cr_assert(fahe_rng_limbs_below(rng, out, bound_buf, 3));
+      cr_assert(out[2] < 2);
+      top_set += out[2] == 1;
+    }
+    cr_assert(top_set > 850 && top_set < 1150, "Skewed top limb: %d",
+              top_set);
+
+    // BIGNUM bounds from one bit up to several limbs
+    for (int bits = 1; bits < 700; bits += 13) {
+      BN_rand(bound, bits, BN_RAND_TOP_ONE, BN_RAND_BOTTOM_ODD);
+      for (int i = 0; i < 20; i++) {
+        cr_assert(fahe_rng_bn_below(rng, r, bound));
+        cr_assert(BN_cmp(r, bound) < 0);
+      }
+      cr_assert(fahe_rng_bn_bits(rng, r, bits));
+      cr_assert(BN_num_bits(r) <= bits);
+    }
+  }
+
+  BN_free(bound);
+  BN_free(r);
+  fahe_rng_free(rng);
+}
+
+Test(fahe1, fahe1_encrypt_pooled_roundtrip) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(&fahe1_instance->key);
+  fahe1_dec_ctx *dec_ctx = fahe1_dec_ctx_new(&fahe1_instance->key);
+  fahe_pool *pool =
+      fahe_pool_new(fahe1_instance->key.p, fahe1_instance->key.X, 8, 2);
+  fahe_pool_prefill(pool);
+
+  // A taken mask does not stay in its slot. With 7 of 8 left, above the
+  // low watermark, the worker does not refill it yet.
+  uint64_t *mask = malloc(pool->n_limbs * sizeof(uint64_t));
+  cr_assert(fahe_pool_take(pool, mask, pool->n_limbs));
+  pthread_mutex_lock(&pool->lock);
+  const uint64_t *taken =
+      pool->slots + (pool->head + pool->depth - 1) % pool->depth *
+                        pool->n_limbs;
+  for (size_t i = 0; i < pool->n_limbs; i++) {
+    cr_assert_eq(taken[i], 0);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  free(mask);
+
+  // A burst larger than the pool mixes hits with possible misses
+  BIGNUM *ciphertext = BN_new();
+  BIGNUM *sum = BN_new();
+  BIGNUM *expected = BN_new();
+  BN_zero(sum);
+  BN_zero(expected);
+  for (int i = 0; i < 32; i++) {
+    BIGNUM *message = generate_big_message(fahe1_instance->msg_size);
+    cr_assert_eq(fahe1_encrypt_pooled(enc_ctx, pool, message, ciphertext),
+                 ciphertext);
+    BIGNUM *decrypted = fahe1_decrypt_ctx(dec_ctx, ciphertext, NULL);
+    cr_assert(BN_cmp(message, decrypted) == 0, "Decryption failed for %d", i);
+
+    // Pooled ciphertexts still add homomorphically
+    if (i < 4) {
+      BN_add(sum, sum, ciphertext);
+      BN_add(expected, expected, message);
+    }
+    BN_free(message);
+    BN_free(decrypted);
+  }
+  // Decryption keeps the low m_max bits of the sum
+  BIGNUM *decrypted_sum = fahe1_decrypt_ctx(dec_ctx, sum, NULL);
+  BN_mask_bits(expected, fahe1_instance->key.m_max);
+  cr_assert(BN_cmp(expected, decrypted_sum) == 0);
+
+  fahe_pool_stats stats;
+  fahe_pool_get_stats(pool, &stats);
+  cr_assert_eq(stats.hits + stats.misses, 33);
+  cr_assert(stats.hits >= 8, "Only %lu pool hits", (unsigned long)stats.hits);
+  cr_assert_eq(stats.produced, stats.hits + stats.available);
+
+  BN_free(ciphertext);
+  BN_free(sum);
+  BN_free(expected);
+  BN_free(decrypted_sum);
+  fahe_pool_free(pool);
+  fahe1_enc_ctx_free(enc_ctx);
+  fahe1_dec_ctx_free(dec_ctx);
+  fahe1_free(fahe1_instance);
+}
+
+Test(fahe1, fahe1_add_and_sum) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(&fahe1_instance->key);
+  fahe1_dec_ctx *dec_ctx = fahe1_dec_ctx_new(&fahe1_instance->key);
+  // num_additions is 2**(alpha - 1)
+  int num_additions = (int)BN_get_word(fahe1_instance->num_additions);
+
+  BIGNUM **ciphertexts = malloc(num_additions * sizeof(BIGNUM *));
+  BIGNUM *expected = BN_new();
+  BN_zero(expected);
+  fahe_acc *acc = fahe_acc_new(enc_ctx->gamma_bits,
+                               fahe1_instance->num_additions);
+  for (int i = 0; i < num_additions; i++) {
+    BIGNUM *message = generate_big_message(fahe1_instance->msg_size);
+    ciphertexts[i] = fahe1_encrypt_ctx(enc_ctx, message, NULL);
+    cr_assert(fahe_add_inplace(acc, ciphertexts[i]));
+    BN_add(expected, expected, message);
+    BN_free(message);
+  }
+  cr_assert_eq(acc->count, (uint64_t)num_additions);
+  cr_assert(BN_num_bits(acc->sum) <= acc->reserve_bits);
+
+  // One addition past num_additions is refused and leaves the sum unchanged
+  BIGNUM *before = BN_dup(acc->sum);
+  cr_assert(!fahe_add_inplace(acc, ciphertexts[0]));
+  cr_assert(BN_cmp(before, acc->sum) == 0);
+
+  // The accumulator, fahe_sum and chained fahe_add agree and decrypt
+  BN_mask_bits(expected, fahe1_instance->key.m_max);
+  BIGNUM *sum = fahe_sum(ciphertexts, num_additions);
+  BIGNUM *chained = fahe_add(NULL, ciphertexts[0], ciphertexts[1]);
+  for (int i = 2; i < num_additions; i++) {
+    fahe_add(chained, chained, ciphertexts[i]);
+  }
+  cr_assert(BN_cmp(sum, acc->sum) == 0);
+  cr_assert(BN_cmp(chained, acc->sum) == 0);
+  BIGNUM *decrypted = fahe1_decrypt_ctx(dec_ctx, acc->sum, NULL);
+  cr_assert(BN_cmp(expected, decrypted) == 0);
+
+  fahe_acc_reset(acc);
+  cr_assert(fahe_add_inplace(acc, ciphertexts[0]));
+  cr_assert(BN_cmp(acc->sum, ciphertexts[0]) == 0);
+
+  for (int i = 0; i < num_additions; i++) {
+    BN_free(ciphertexts[i]);
+  }
+  free(ciphertexts);
+  BN_free(expected);
+  BN_free(before);
+  BN_free(sum);
+  BN_free(chained);
+  BN_free(decrypted);
+  fahe_acc_free(acc);
+  fahe1_enc_ctx_free(enc_ctx);
+  fahe1_dec_ctx_free(dec_ctx);
+  fahe1_free(fahe1_instance);
+}
+
+Test(fahe1, fahe1_sum_parallel_matches_fahe_sum) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(&fahe1_instance->key);
+  int num_additions = (int)BN_get_word(fahe1_instance->num_additions);
+
+  // Ciphertexts as BIGNUMs and as limb rows with padding between rows
+  size_t row_limbs = enc_ctx->c_limbs;
+  size_t row_stride = row_limbs + 3;
+  uint64_t *rows = calloc(num_additions * row_stride, sizeof(uint64_t));
+  BIGNUM **ciphertexts = malloc(num_additions * sizeof(BIGNUM *));
+  for (int i = 0; i < num_additions; i++) {
+    BIGNUM *message = generate_big_message(fahe1_instance->msg_size);
+    ciphertexts[i] = fahe1_encrypt_ctx(enc_ctx, message, NULL);
+    cr_assert(limbs_from_bn(ciphertexts[i], rows + i * row_stride, row_limbs));
+    rows[i * row_stride + row_limbs] = ~(uint64_t)0;
+    BN_free(message);
+  }
+  BIGNUM *expected = fahe_sum(ciphertexts, num_additions);
+
+  int thread_counts[] = {1, 2, 3, 7, 0};
+  size_t out_limbs = row_limbs + 4;
+  uint64_t *out = malloc(out_limbs * sizeof(uint64_t));
+  BIGNUM *limb_sum = BN_new();
+  for (size_t t = 0; t < sizeof(thread_counts) / sizeof(int); t++) {
+    BIGNUM *sum = fahe_sum_parallel(ciphertexts, num_additions,
+                                    thread_counts[t]);
+    cr_assert(BN_cmp(sum, expected) == 0);
+    BN_free(sum);
+
+    memset(out, 0xff, out_limbs * sizeof(uint64_t));
+    cr_assert(fahe_sum_limbs_parallel(rows, num_additions, row_limbs,
+                                      row_stride, out, out_limbs,
+                                      thread_counts[t]));
+    cr_assert(limbs_to_bn(out, out_limbs, limb_sum));
+    cr_assert(BN_cmp(limb_sum, expected) == 0);
+  }
+
+  // Carries across every column: rows of all ones
+  for (int i = 0; i < num_additions; i++) {
+    memset(rows + i * row_stride, 0xff, row_limbs * sizeof(uint64_t));
+  }
+  BIGNUM *ones = BN_new();
+  BN_set_bit(ones, 64 * row_limbs);
+  BN_sub_word(ones, 1);
+  BN_mul_word(ones, num_additions);
+  cr_assert(fahe_sum_limbs_parallel(rows, num_additions, row_limbs,
+                                    row_stride, out, out_limbs, 3));
+  cr_assert(limbs_to_bn(out, out_limbs, limb_sum));
+  cr_assert(BN_cmp(limb_sum, ones) == 0);
+
+  // Too small an output is refused
+  cr_assert(!fahe_sum_limbs_parallel(rows, num_additions, row_limbs,
+                                     row_stride, out, row_limbs + 1, 2));
+
+  for (int i = 0; i < num_additions; i++) {
+    BN_free(ciphertexts[i]);
+  }
+  free(ciphertexts);
+  free(rows);
+  free(out);
+  BN_free(expected);
+  BN_free(limb_sum);
+  BN_free(ones);
+  fahe1_enc_ctx_free(enc_ctx);
+  fahe1_free(fahe1_instance);
+}
+
+Test(fahe1, fahe1_list_parallel_roundtrip) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  size_t list_size = 100;
+
+  BIGNUM **messages = malloc(list_size * sizeof(BIGNUM *));
+  for (size_t i = 0; i < list_size; i++) {
+    messages[i] = generate_big_message(fahe1_instance->msg_size);
+  }
+
+  // A private pool with more threads than this machine may have, then the
+  // shared pool
+  fahe_thread_pool *pool = fahe_thread_pool_new(3);
+  fahe_thread_pool *pools[] = {pool, NULL};
+  for (int k = 0; k < 2; k++) {
+    BIGNUM **ciphertexts = fahe1_encrypt_list_parallel(
+        &fahe1_instance->key, messages, list_size, pools[k]);
+    BIGNUM **decrypted = fahe1_decrypt_list_parallel(
+        &fahe1_instance->key, ciphertexts, list_size, pools[k]);
+    for (size_t i = 0; i < list_size; i++) {
+      cr_assert(BN_cmp(messages[i], decrypted[i]) == 0,
+                "Decryption failed for %zu", i);
+      BN_free(ciphertexts[i]);
+      BN_free(decrypted[i]);
+    }
+    free(ciphertexts);
+    free(decrypted);
+  }
+
+  for (size_t i = 0; i < list_size; i++) {
+    BN_free(messages[i]);
+  }
+  free(messages);
+  fahe_thread_pool_free(pool);
+  fahe1_free(fahe1_instance);
+}
+
+Test(fahe1, fahe1_batch_roundtrip) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(&fahe1_instance->key);
+  fahe1_dec_ctx *dec_ctx = fahe1_dec_ctx_new(&fahe1_instance->key);
+  size_t list_size = (size_t)BN_get_word(fahe1_instance->num_additions);
+
+  BIGNUM **messages = malloc(list_size * sizeof(BIGNUM *));
+  BIGNUM *expected = BN_new();
+  BN_zero(expected);
+  for (size_t i = 0; i < list_size; i++) {
+    messages[i] = generate_big_message(fahe1_instance->msg_size);
+    BN_add(expected, expected, messages[i]);
+  }
+  BN_mask_bits(expected, fahe1_instance->key.m_max);
+
+  int flags[] = {0, FAHE_CT_BATCH_HUGEPAGES};
+  for (int f = 0; f < 2; f++) {
+    fahe_ct_batch *batch =
+        fahe_ct_batch_new(enc_ctx->c_limbs, list_size, flags[f]);
+    cr_assert_eq((uintptr_t)batch->limbs % FAHE_CT_BATCH_ALIGN, 0);
+    cr_assert_eq(batch->row_stride * sizeof(uint64_t) % FAHE_CT_BATCH_ALIGN,
+                 0);
+    cr_assert(fahe1_encrypt_batch(&fahe1_instance->key, messages, list_size,
+                                  batch, NULL));
+    cr_assert_eq(batch->count, list_size);
+
+    // Rows decrypt in place and through a BIGNUM copy
+    BIGNUM **decrypted = fahe1_decrypt_batch(&fahe1_instance->key, batch,
+                                             NULL);
+    BIGNUM *row = BN_new();
+    for (size_t i = 0; i < list_size; i++) {
+      cr_assert(BN_cmp(messages[i], decrypted[i]) == 0,
+                "Decryption failed for %zu", i);
+      cr_assert(fahe_ct_batch_get(batch, i, row));
+      BIGNUM *m = fahe1_decrypt_ctx(dec_ctx, row, NULL);
+      cr_assert(BN_cmp(messages[i], m) == 0);
+      BN_free(m);
+      BN_free(decrypted[i]);
+    }
+    free(decrypted);
+
+    // The sum of the rows decrypts to the sum of the messages
+    BIGNUM *sum = fahe_ct_batch_sum(batch, 0);
+    BIGNUM *decrypted_sum = fahe1_decrypt_ctx(dec_ctx, sum, NULL);
+    cr_assert(BN_cmp(expected, decrypted_sum) == 0);
+
+    // Write and read back through a temporary file
+    FILE *stream = tmpfile();
+    cr_assert_not_null(stream);
+    cr_assert(fahe_ct_batch_write(batch, stream));
+    rewind(stream);
+    fahe_ct_batch *copy = fahe_ct_batch_read(stream, 0);
+    fclose(stream);
+    cr_assert_not_null(copy);
+    cr_assert_eq(copy->count, list_size);
+    cr_assert_eq(copy->row_limbs, batch->row_limbs);
+    for (size_t i = 0; i < list_size; i++) {
+      cr_assert(memcmp(fahe_ct_batch_row(copy, i),
+                       fahe_ct_batch_row(batch, i),
+                       batch->row_limbs * sizeof(uint64_t)) == 0);
+    }
+
+    // Headers that claim more than the stream holds are refused: a row
+    // size that wraps the allocation, and a count too large to allocate
+    uint64_t bad[][2] = {{((uint64_t)1 << 60) + 8, 2}, {1, (uint64_t)1 << 62}};
+    for (int b = 0; b < 2; b++) {
+      stream = tmpfile();
+      cr_assert_not_null(stream);
+      cr_assert(fwrite("FAHECTB1", 1, 8, stream) == 8 &&
+                fwrite(bad[b], sizeof(uint64_t), 2, stream) == 2);
+      for (int k = 0; k < 64; k++) {
+        cr_assert(fwrite(fahe_ct_batch_row(batch, 0), sizeof(uint64_t),
+                         batch->row_limbs, stream) == batch->row_limbs);
+      }
+      rewind(stream);
+      cr_assert_null(fahe_ct_batch_read(stream, 0));
+      fclose(stream);
+    }
+
+    // A row set from a BIGNUM reads back unchanged
+    cr_assert(fahe_ct_batch_set(copy, 1, row));
+    BIGNUM *again = BN_new();
+    cr_assert(fahe_ct_batch_get(copy, 1, again));
+    cr_assert(BN_cmp(again, row) == 0);
+
+    BN_free(row);
+    BN_free(sum);
+    BN_free(decrypted_sum);
+    BN_free(again);
+    fahe_ct_batch_free(copy);
+    fahe_ct_batch_free(batch);
+  }
+
+  for (size_t i = 0; i < list_size; i++) {
+    BN_free(messages[i]);
+  }
+  free(messages);
+  BN_free(expected);
+  fahe1_enc_ctx_free(enc_ctx);
+  fahe1_dec_ctx_free(dec_ctx);
+  fahe1_free(fahe1_instance);
+}
+
+static int log_argument_evaluations = 0;
+
+static int count_log_argument(void) { return ++log_argument_evaluations; }
+
+Test(fahe1, fahe1_logging_is_lazy) {
+  LogLevel saved_level = current_log_level;
+  BIGNUM *value = BN_new();
+  BN_set_word(value, 42);
+
+  // Disabled records do not evaluate their arguments
+  current_log_level = LOG_FATAL;
+  log_message(LOG_DEBUG, "Debug: %d\n", count_log_argument());
+  log_bignum(LOG_DEBUG, "Debug: value = %s\n", value);
+  cr_assert_eq(log_argument_evaluations, 0);
+  cr_assert(!log_enabled(LOG_ERROR));
+  cr_assert(log_enabled(LOG_FATAL));
+
+  current_log_level = LOG_DEBUG;
+  log_message(LOG_DEBUG, "Debug: %d\n", count_log_argument());
+  log_bignum(LOG_DEBUG, "Debug: value = %s\n", value);
+  cr_assert_eq(log_argument_evaluations, 1);
+
+  // Synchronous records are not cut to FAHE_LOG_RECORD_BYTES
+  char path[] = "/tmp/fahe_sync_logXXXXXX";
+  int fd = mkstemp(path);
+  cr_assert(fd >= 0);
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  dup2(fd, STDOUT_FILENO);
+  BN_lshift(value, value, 4000);
+  log_bignum(LOG_DEBUG, "Debug: value = %s\n", value);
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+
+  char *expected = fahe_bn2dec(value);
+  size_t size = strlen(expected) + 64;
+  char *line = calloc(1, size);
+  cr_assert(pread(fd, line, size - 1, 0) > 0);
+  cr_assert_not_null(strstr(line, expected), "Record was cut: %s", line);
+  close(fd);
+  unlink(path);
+  free(line);
+  OPENSSL_free(expected);
+
+  current_log_level = saved_level;
+  BN_free(value);
+}
+
+#define ASYNC_LOG_THREADS 4
+#define ASYNC_LOG_RECORDS 500
+
+static void *emit_async_records(void *arg) {
+  int id = *(int *)arg;
+  for (int i = 0; i < ASYNC_LOG_RECORDS; i++) {
+    log_message(LOG_DEBUG, "thread %d record %d\n", id, i);
+  }
+  return NULL;
+}
+
+Test(fahe1, fahe1_async_log_sink) {
+  LogLevel saved_level = current_log_level;
+  char path[] = "/tmp/fahe_async_logXXXXXX";
+  int fd = mkstemp(path);
+  cr_assert(fd >= 0);
+  close(fd);
+
+  // A small ring overflows under four producers; nothing may block or tear
+  cr_assert(!log_async_start(path, 6));
+  cr_assert(log_async_start(path, 8));
+  uint64_t dropped_before = log_dropped();
+  current_log_level = LOG_DEBUG;
+  pthread_t threads[ASYNC_LOG_THREADS];
+  int ids[ASYNC_LOG_THREADS];
+  for (int t = 0; t < ASYNC_LOG_THREADS; t++) {
+    ids[t] = t;
+    pthread_create(&threads[t], NULL, emit_async_records, &ids[t]);
+  }
+  for (int t = 0; t < ASYNC_LOG_THREADS; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  log_flush();
+  current_log_level = saved_level;
+  uint64_t dropped = log_dropped() - dropped_before;
+
+  FILE *file = fopen(path, "r");
+  cr_assert(file != NULL);
+  char line[FAHE_LOG_RECORD_BYTES];
+  uint64_t lines = 0;
+  int id, record;
+  while (fgets(line, sizeof(line), file)) {
+    cr_assert_eq(sscanf(line, "[DEBUG] thread %d record %d\n", &id, &record),
+                 2, "Torn log line: %s", line);
+    lines++;
+  }
+  fclose(file);
+  cr_assert_eq(lines + dropped, ASYNC_LOG_THREADS * ASYNC_LOG_RECORDS);
+
+  log_async_stop();
+  remove(path);
+}
+
+Test(fahe1, fahe1_stats_snapshot) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(&fahe1_instance->key);
+  fahe1_dec_ctx *dec_ctx = fahe1_dec_ctx_new(&fahe1_instance->key);
+  BIGNUM *ciphertext = BN_new();
+  BIGNUM *decrypted = BN_new();
+  int n = 16;
+
+  fahe_stats_reset();
+  for (int i = 0; i < n; i++) {
+    BIGNUM *message = generate_big_message(fahe1_instance->msg_size);
+    fahe1_encrypt_ctx(enc_ctx, message, ciphertext);
+    fahe1_decrypt_ctx(dec_ctx, ciphertext, decrypted);
+    cr_assert(BN_cmp(message, decrypted) == 0);
+    BN_free(message);
+  }
+
+  fahe_stats stats;
+  fahe_stats_snapshot(&stats);
+  if (!FAHE_STATS_ENABLED) {
+    // Compiled out: nothing is recorded
+    for (int s = 0; s < FAHE_STAGE_COUNT; s++) {
+      cr_assert_eq(stats.stages[s].count, 0);
+    }
+  } else {
+    fahe_stage_stats *encrypt = &stats.stages[FAHE_STAGE_ENCRYPT];
+    cr_assert_eq(encrypt->count, n);
+    cr_assert_eq(stats.stages[FAHE_STAGE_DECRYPT].count, n);
+    cr_assert_eq(stats.stages[FAHE_STAGE_REDUCE].count, n);
+    cr_assert_eq(stats.stages[FAHE_STAGE_MUL].count, n);
+    // One draw for the noise and one for q per message
+    cr_assert_eq(stats.stages[FAHE_STAGE_RNG].count, 2 * n);
+    cr_assert(encrypt->total_ticks >= stats.stages[FAHE_STAGE_MUL].total_ticks);
+    uint64_t samples = 0;
+    for (int b = 0; b < FAHE_STATS_BUCKETS; b++) {
+      samples += encrypt->hist[b];
+    }
+    cr_assert_eq(samples, n);
+    fahe_stats_print(&stats, stdout);
+  }
+
+  fahe_stats_reset();
+  fahe_stats_snapshot(&stats);
+  cr_assert_eq(stats.stages[FAHE_STAGE_ENCRYPT].count, 0);
+
+  BN_free(ciphertext);
+  BN_free(decrypted);
+  fahe1_dec_ctx_free(dec_ctx);
+  fahe1_enc_ctx_free(enc_ctx);
+  fahe1_free(fahe1_instance);
+}
+
+Test(fahe1, fahe1_steady_state_allocations) {
+  // OpenSSL accepts the counting allocator only before its first allocation,
+  // which holds in the forked process of a test
+  if (!fahe_alloc_track_install()) {
+    cr_skip_test("OpenSSL allocated before the tracker was installed\n");
+  }
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(&fahe1_instance->key);
+  fahe1_dec_ctx *dec_ctx = fahe1_dec_ctx_new(&fahe1_instance->key);
+  fahe_acc *acc = fahe_acc_new(enc_ctx->gamma_bits,
+                               fahe1_instance->num_additions);
+  BIGNUM *ciphertext = BN_new();
+  BIGNUM *decrypted = BN_new();
+  BIGNUM *sum = BN_new();
+  int n = 16;
+  BIGNUM *messages[16];
+  for (int i = 0; i < n; i++) {
+    messages[i] = generate_big_message(fahe1_instance->msg_size);
+  }
+
+  // The first rounds size the scratch values; after them nothing allocates
+  fahe_alloc_stats before, after, diff;
+  const char *labels[3] = {"encrypt", "decrypt", "add"};
+  for (int round = 0; round < 3; round++) {
+    for (int op = 0; op < 3; op++) {
+      fahe_alloc_snapshot(&before);
+      for (int i = 0; i < n; i++) {
+        if (op == 0) {
+          fahe1_encrypt_ctx(enc_ctx, messages[i], ciphertext);
+        } else if (op == 1) {
+          fahe1_decrypt_ctx(dec_ctx, ciphertext, decrypted);
+        } else {
+          fahe_acc_reset(acc);
+          cr_assert(fahe_add_inplace(acc, ciphertext));
+          cr_assert(fahe_add_inplace(acc, ciphertext));
+          fahe_add(sum, ciphertext, acc->sum);
+        }
+      }
+      fahe_alloc_snapshot(&after);
+      fahe_alloc_diff(&diff, &before, &after);
+      if (round == 2) {
+        fahe_alloc_print(labels[op], &diff, n, stdout);
+        cr_assert_eq(fahe_alloc_count(&diff), 0,
+                     "%s allocated in steady state\n", labels[op]);
+      }
+    }
+    cr_assert(BN_cmp(messages[n - 1], decrypted) == 0);
+  }
+
+  // The allocating API frees everything it allocates. Round 0 creates the
+  // calling thread's random engine, which lives until the thread exits.
+  for (int i = -1; i < n; i++) {
+    if (i == 0) {
+      fahe_alloc_snapshot(&before);
+    }
+    fahe1_key *key = &fahe1_instance->key;
+    BIGNUM *message = messages[i < 0 ? 0 : i];
+    BIGNUM *c = fahe1_encrypt(key->p, key->X, key->rho, key->alpha, message);
+    BIGNUM *m = fahe1_decrypt(key->p, key->m_max, key->rho, key->alpha, c);
+    cr_assert(BN_cmp(message, m) == 0);
+    BN_free(c);
+    BN_free(m);
+  }
+  fahe_alloc_snapshot(&after);
+  fahe_alloc_diff(&diff, &before, &after);
+  fahe_alloc_print("legacy", &diff, n, stdout);
+  for (int s = 0; s < FAHE_ALLOC_SOURCE_COUNT; s++) {
+    cr_assert_eq(diff.sources[s].allocs, diff.sources[s].frees);
+    cr_assert_eq(diff.sources[s].bytes, diff.sources[s].freed_bytes);
+  }
+
+  for (int i = 0; i < n; i++) {
+    BN_free(messages[i]);
+  }
+  BN_free(ciphertext);
+  BN_free(decrypted);
+  BN_free(sum);
+  fahe_acc_free(acc);
+  fahe1_dec_ctx_free(dec_ctx);
+  fahe1_enc_ctx_free(enc_ctx);
+  fahe1_free(fahe1_instance);
+}
+
+Test(fahe1, fahe1_metrics_prometheus) {
+  fahe_metrics_enable(1);
+  fahe_metrics_reset();
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(&fahe1_instance->key);
+  fahe1_dec_ctx *dec_ctx = fahe1_dec_ctx_new(&fahe1_instance->key);
+  fahe_acc *acc = fahe_acc_new(enc_ctx->gamma_bits,
+                               fahe1_instance->num_additions);
+  BIGNUM *ciphertext = BN_new();
+  BIGNUM *decrypted = BN_new();
+  int n = 16;
+  uint64_t bytes = 0;
+
+  for (int i = 0; i < n; i++) {
+    BIGNUM *message = generate_big_message(fahe1_instance->msg_size);
+    fahe1_encrypt_ctx(enc_ctx, message, ciphertext);
+    fahe1_decrypt_ctx(dec_ctx, ciphertext, decrypted);
+    cr_assert(BN_cmp(message, decrypted) == 0);
+    cr_assert(fahe_add_inplace(acc, ciphertext));
+    bytes += BN_num_bytes(ciphertext);
+    BN_free(message);
+  }
+  // A buffer that is too small fails without encrypting
+  uint64_t limb;
+  cr_assert_eq(fahe1_encrypt_ctx_limbs(enc_ctx, decrypted, &limb, 1), 0);
+  // So does an RNG that fails, here a cipher that was never keyed
+  uint64_t *out = malloc(enc_ctx->c_limbs * sizeof(uint64_t));
+  EVP_CIPHER_CTX *cipher = enc_ctx->rng->cipher;
+  enc_ctx->rng->cipher = EVP_CIPHER_CTX_new();
+  cr_assert_eq(
+      fahe1_encrypt_ctx_limbs(enc_ctx, decrypted, out, enc_ctx->c_limbs), 0);
+  EVP_CIPHER_CTX_free(enc_ctx->rng->cipher);
+  enc_ctx->rng->cipher = cipher;
+  free(out);
+
+  fahe_metrics *metrics = malloc(sizeof(fahe_metrics));
+  fahe_metrics_snapshot(metrics);
+  fahe_op_metrics *encrypt = &metrics->ops[FAHE_OP_ENCRYPT][1];
+  cr_assert_eq(metrics->ops[FAHE_OP_KEYGEN][1].count, 1);
+  cr_assert_eq(encrypt->count, n);
+  cr_assert_eq(encrypt->calls, n);
+  cr_assert_eq(encrypt->bytes, bytes);
+  cr_assert_eq(encrypt->failures, 2);
+  cr_assert_eq(metrics->ops[FAHE_OP_DECRYPT][1].count, n);
+  cr_assert_eq(metrics->ops[FAHE_OP_DECRYPT][1].bytes, bytes);
+  cr_assert_eq(metrics->ops[FAHE_OP_ADD][0].count, n);
+  cr_assert_eq(metrics->ops[FAHE_OP_ADD][0].bytes, bytes);
+  cr_assert_eq(metrics->ops[FAHE_OP_ENCRYPT][2].count, 0);
+  uint64_t samples = 0;
+  for (int b = 0; b < FAHE_METRICS_BUCKETS; b++) {
+    samples += encrypt->hist[b];
+  }
+  cr_assert_eq(samples, n);
+  uint64_t p50 = fahe_metrics_quantile(encrypt, 0.5);
+  cr_assert(p50 > 0);
+  cr_assert(p50 <= fahe_metrics_quantile(encrypt, 0.99));
+  cr_assert(fahe_metrics_quantile(encrypt, 1) * n >= encrypt->total_ns);
+
+  // The dumped file is complete and replaces the previous one
+  char path[] = "/tmp/fahe_metrics_XXXXXX";
+  int fd = mkstemp(path);
+  cr_assert(fd >= 0);
+  cr_assert(fahe_metrics_dump_fd(fd));
+  cr_assert(lseek(fd, 0, SEEK_END) > 0);
+  close(fd);
+  cr_assert(fahe_metrics_dump_file(path));
+  FILE *file = fopen(path, "r");
+  cr_assert(file);
+  char line[256];
+  int found = 0;
+  while (fgets(line, sizeof(line), file)) {
+    found += strcmp(line, "fahe_ciphertexts_encrypted_total"
+                          "{op=\"encrypt\",scheme=\"1\"} 16\n") == 0;
+    found += strcmp(line, "fahe_failures_total"
+                          "{op=\"encrypt\",scheme=\"1\"} 2\n") == 0;
+    found += strcmp(line, "fahe_operation_duration_seconds_bucket"
+                          "{op=\"encrypt\",scheme=\"1\",le=\"+Inf\"} 16\n") ==
+             0;
+    found += strcmp(line, "fahe_ciphertexts_added_total{op=\"add\"} 16\n") == 0;
+  }
+  fclose(file);
+  remove(path);
+  cr_assert_eq(found, 4);
+
+  // Nothing is recorded while metrics are off
+  fahe_metrics_enable(0);
+  fahe1_encrypt_ctx(enc_ctx, decrypted, ciphertext);
+  fahe_metrics_snapshot(metrics);
+  cr_assert_eq(metrics->ops[FAHE_OP_ENCRYPT][1].count, n);
+
+  fahe_metrics_reset();
+  free(metrics);
+  BN_free(ciphertext);
+  BN_free(decrypted);
+  fahe_acc_free(acc);
+  fahe1_dec_ctx_free(dec_ctx);
+  fahe1_enc_ctx_free(enc_ctx);
+  fahe1_free(fahe1_instance);
+}
+
+Test(fahe1, fahe1_file_mmap_roundtrip) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_key *key = &fahe1_instance->key;
+  size_t list_size = (size_t)BN_get_word(fahe1_instance->num_additions);
+
+  BIGNUM **messages = malloc(list_size * sizeof(BIGNUM *));
+  for (size_t i = 0; i < list_size; i++) {
+    messages[i] = generate_big_message(fahe1_instance->msg_size);
+  }
+
+  // The header carries the key and sizes the rows as an encryption context
+  fahe_file_header header;
+  cr_assert(fahe1_file_header(key, FAHE_FILE_CIPHERTEXTS, &header));
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(key);
+  cr_assert_eq(header.row_limbs, enc_ctx->c_limbs);
+  cr_assert_eq(header.scheme, 1);
+  int eta = key->rho + 2 * key->alpha + key->m_max;
+  cr_assert_eq(header.gamma, (uint64_t)fahe_keygen_gamma(key->rho, eta));
+  fahe1_enc_ctx_free(enc_ctx);
+
+  fahe_ct_batch *batch = fahe_ct_batch_new(header.row_limbs, list_size, 0);
+  cr_assert(fahe1_encrypt_batch(key, messages, list_size, batch, NULL));
+
+  char path[] = "/tmp/fahe1_fileXXXXXX";
+  int fd = mkstemp(path);
+  cr_assert(fd >= 0);
+  FILE *stream = fdopen(fd, "wb");
+  cr_assert(fahe_file_write_batch(&header, batch, stream));
+  cr_assert_eq(fclose(stream), 0);
+
+  // The mapped records decrypt in place
+  fahe_file *file = fahe_file_open(path);
+  cr_assert_not_null(file);
+  cr_assert_eq(file->header.version, FAHE_FILE_VERSION);
+  cr_assert_eq(file->header.kind, FAHE_FILE_CIPHERTEXTS);
+  cr_assert_eq(file->header.count, list_size);
+  cr_assert_eq(file->header.lambda, key->lambda);
+  cr_assert(memcmp(file->header.fingerprint, header.fingerprint,
+                   FAHE_FILE_FINGERPRINT_BYTES) == 0);
+  cr_assert_eq((const void *)fahe_file_row(file, 0),
+               (const void *)((char *)file->map + FAHE_FILE_HEADER_BYTES));
+  BIGNUM **decrypted = fahe1_decrypt_batch(key, fahe_file_batch(file), NULL);
+  BIGNUM *row = BN_new();
+  BIGNUM *expected = BN_new();
+  for (size_t i = 0; i < list_size; i++) {
+    cr_assert(BN_cmp(messages[i], decrypted[i]) == 0,
+              "Decryption failed for %zu", i);
+    cr_assert(fahe_file_get(file, i, row));
+    cr_assert(fahe_ct_batch_get(batch, i, expected));
+    cr_assert(BN_cmp(row, expected) == 0);
+    BN_free(decrypted[i]);
+  }
+  free(decrypted);
+  cr_assert(!fahe_file_get(file, list_size, row));
+  fahe_file_close(file);
+
+  // Another key has another fingerprint
+  fahe1_key other = fahe1_keygen(key->lambda, key->m_max, key->alpha);
+  fahe_file_header other_header;
+  cr_assert(fahe1_file_header(&other, FAHE_FILE_CIPHERTEXTS, &other_header));
+  cr_assert(memcmp(other_header.fingerprint, header.fingerprint,
+                   FAHE_FILE_FINGERPRINT_BYTES) != 0);
+  BN_free(other.p);
+  BN_free(other.X);
+
+  // Messages go through a stream and back into a batch
+  cr_assert(fahe1_file_header(key, FAHE_FILE_MESSAGES, &header));
+  stream = tmpfile();
+  cr_assert(fahe_file_write_list(&header, messages, list_size, stream));
+  rewind(stream);
+  fahe_ct_batch *copy = fahe_ct_batch_read(stream, 0);
+  fclose(stream);
+  cr_assert_not_null(copy);
+  cr_assert_eq(copy->row_limbs, FAHE_LIMBS(key->m_max));
+  for (size_t i = 0; i < list_size; i++) {
+    cr_assert(fahe_ct_batch_get(copy, i, row));
+    cr_assert(BN_cmp(row, messages[i]) == 0);
+  }
+  fahe_ct_batch_free(copy);
+
+  // A FAHECTB1 stream still maps, as version 0
+  uint64_t legacy[4] = {2, 1, 7, 9};
+  stream = fopen(path, "wb");
+  cr_assert(fwrite("FAHECTB1", 1, 8, stream) == 8 &&
+            fwrite(legacy, sizeof(uint64_t), 4, stream) == 4);
+  cr_assert_eq(fclose(stream), 0);
+  file = fahe_file_open(path);
+  cr_assert_not_null(file);
+  cr_assert_eq(file->header.version, 0);
+  cr_assert_eq(file->header.row_limbs, 2);
+  cr_assert_eq(fahe_file_row(file, 0)[1], 9);
+  fahe_file_close(file);
+
+  // A truncated file is refused, mapped or read as a stream
+  cr_assert_eq(truncate(path, 8 + 16 + 8), 0);
+  cr_assert_null(fahe_file_open(path));
+  fahe_file_header truncated;
+  stream = fopen(path, "rb");
+  cr_assert_not_null(stream);
+  cr_assert(!fahe_file_header_read(stream, &truncated));
+  fclose(stream);
+  unlink(path);
+
+  for (size_t i = 0; i < list_size; i++) {
+    BN_free(messages[i]);
+  }
+  free(messages);
+  BN_free(row);
+  BN_free(expected);
+  fahe_ct_batch_free(batch);
+  fahe1_free(fahe1_instance);
+}
+
+typedef struct {
+  BIGNUM **expected;
+  size_t num;
+} text_check;
+
+static int text_check_record(void *arg, size_t index, const BIGNUM *value) {
+  text_check *check = (text_check *)arg;
+  return index < check->num && BN_cmp(check->expected[index], value) == 0;
+}
+
+Test(fahe1, fahe1_text_stream_read) {
+  size_t n = 300;
+  BIGNUM **values = malloc(n * sizeof(BIGNUM *));
+  const char *separators[] = {",", ",\n", " , ", "\r\n"};
+  char path[] = "/tmp/fahe1_textXXXXXX";
+  int fd = mkstemp(path);
+  cr_assert(fd >= 0);
+  FILE *stream = fdopen(fd, "w");
+  for (size_t i = 0; i < n; i++) {
+    values[i] = generate_big_message(1 + (unsigned int)(i * 37 % 3000));
+    char *dec = BN_bn2dec(values[i]);
+    fprintf(stream, "%s%s", dec, i + 1 < n ? separators[i % 4] : "\n");
+    OPENSSL_free(dec);
+  }
+  cr_assert_eq(fclose(stream), 0);
+
+  // Records come back in order whatever the window and however many
+  // pieces a window is parsed in
+  fahe_thread_pool *pool = fahe_thread_pool_new(3);
+  text_check check = {values, n};
+  size_t windows[] = {FAHE_TEXT_MIN_WINDOW, 65536, FAHE_TEXT_WINDOW_BYTES};
+  for (int w = 0; w < 3; w++) {
+    fahe_text_opts opts = {windows[w], pool};
+    size_t count = 0;
+    cr_assert(fahe_text_read_file(path, &opts, text_check_record, &check,
+                                  &count));
+    cr_assert_eq(count, n, "window %zu read %zu records", windows[w], count);
+  }
+
+  int list_size = 0;
+  BIGNUM **list = read_bignum_list_from_file(path, &list_size);
+  cr_assert_not_null(list);
+  cr_assert_eq(list_size, (int)n);
+  for (size_t i = 0; i < n; i++) {
+    cr_assert(BN_cmp(list[i], values[i]) == 0);
+    BN_free(list[i]);
+  }
+  free(list);
+
+  // Into a batch, which must have room for every record
+  fahe_text_opts opts = {FAHE_TEXT_MIN_WINDOW, pool};
+  fahe_ct_batch *batch = fahe_ct_batch_new(FAHE_LIMBS(3000), n, 0);
+  stream = fopen(path, "r");
+  cr_assert(fahe_text_read_batch(stream, &opts, batch));
+  fclose(stream);
+  cr_assert_eq(batch->count, n);
+  BIGNUM *row = BN_new();
+  cr_assert(fahe_ct_batch_get(batch, n - 1, row));
+  cr_assert(BN_cmp(row, values[n - 1]) == 0);
+  fahe_ct_batch_free(batch);
+  batch = fahe_ct_batch_new(FAHE_LIMBS(3000), n - 1, 0);
+  stream = fopen(path, "r");
+  cr_assert(!fahe_text_read_batch(stream, &opts, batch));
+  fclose(stream);
+  fahe_ct_batch_free(batch);
+
+  // Records before an invalid byte are delivered, then the read fails
+  size_t count = 0;
+  stream = fopen(path, "w");
+  fputs("12,3x4,5", stream);
+  fclose(stream);
+  cr_assert(!fahe_text_read_file(path, &opts, text_check_record, &check,
+                                 &count));
+  cr_assert_eq(count, 0);
+
+  // A record longer than the window fails
+  stream = fopen(path, "w");
+  for (int i = 0; i < FAHE_TEXT_MIN_WINDOW + 10; i++) {
+    fputc('7', stream);
+  }
+  fputs(",1", stream);
+  fclose(stream);
+  cr_assert(!fahe_text_read_file(path, &opts, text_check_record, &check,
+                                 &count));
+  unlink(path);
+
+  for (size_t i = 0; i < n; i++) {
+    BN_free(values[i]);
+  }
+  free(values);
+  BN_free(row);
+  fahe_thread_pool_free(pool);
+}
+
+Test(fahe1, fahe1_radix_matches_bn) {
+  // Around the leaf and word sizes, and deep enough for several levels
+  int sizes[] = {0, 1, 63, 64, 1009, 1010, 1011, 2020, 4100, 40000, 300000};
+  fahe_thread_pool *pool = fahe_thread_pool_new(3);
+  BN_CTX *ctx = BN_CTX_new();
+  BIGNUM *x = BN_new();
+  BIGNUM *y = BN_new();
+  BIGNUM *ten = BN_new();
+  BN_set_word(ten, 10);
+
+  for (int s = 0; s < 11; s++) {
+    for (int form = 0; form < 3; form++) {
+      if (form == 0) {
+        cr_assert(BN_rand(x, sizes[s], BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY));
+      } else {
+        // 10**k - 1 fills every digit and 10**k is one digit longer
+        BIGNUM *k = BN_new();
+        BN_set_word(k, (BN_ULONG)sizes[s] * 30103 / 100000);
+        cr_assert(BN_exp(x, ten, k, ctx));
+        if (form == 1) {
+          cr_assert(BN_sub_word(x, 1));
+        }
+        BN_free(k);
+      }
+      BN_set_negative(x, s % 2);
+
+      char *expected = BN_bn2dec(x);
+      char *dec = fahe_bn2dec(x);
+      cr_assert_str_eq(dec, expected, "%d bits, form %d", sizes[s], form);
+      OPENSSL_free(dec);
+      dec = fahe_bn2dec_parallel(x, pool);
+      cr_assert_str_eq(dec, expected, "%d bits, form %d", sizes[s], form);
+      OPENSSL_free(dec);
+
+      cr_assert(fahe_dec2bn(y, expected, strlen(expected)));
+      cr_assert(BN_cmp(x, y) == 0, "%d bits, form %d", sizes[s], form);
+      BN_zero(y);
+      cr_assert(fahe_dec2bn_parallel(y, expected, strlen(expected), pool));
+      cr_assert(BN_cmp(x, y) == 0, "%d bits, form %d", sizes[s], form);
+      OPENSSL_free(expected);
+
+      char *hex = fahe_bn2hex(x);
+      cr_assert(BN_hex2bn(&y, hex) > 0);
+      cr_assert(BN_cmp(x, y) == 0);
+      cr_assert(hex[BN_is_negative(x)] != '0' || BN_is_zero(x));
+      OPENSSL_free(hex);
+      hex = BN_bn2hex(x);
+      cr_assert(fahe_hex2bn(y, hex, strlen(hex)));
+      cr_assert(BN_cmp(x, y) == 0);
+      OPENSSL_free(hex);
+    }
+  }
+
+  // Lengths bound the input, which need not be NUL-terminated
+  cr_assert(fahe_dec2bn(y, "12345", 3));
+  cr_assert(BN_is_word(y, 123));
+  cr_assert(fahe_hex2bn(y, "fFx", 2));
+  cr_assert(BN_is_word(y, 255));
+  cr_assert(!fahe_dec2bn(y, "", 0));
+  cr_assert(!fahe_dec2bn(y, "-", 1));
+  cr_assert(!fahe_dec2bn(y, "12a4", 4));
+  cr_assert(!fahe_dec2bn(y, "+1", 2));
+  cr_assert(!fahe_hex2bn(y, "1g", 2));
+
+  BN_free(x);
+  BN_free(y);
+  BN_free(ten);
+  BN_CTX_free(ctx);
+  fahe_thread_pool_free(pool);
+}
+
+Test(fahe1, fahe1_decrypt_stream_matches_decrypt) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_key *key = &fahe1_instance->key;
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(key);
+  fahe_decrypt_stream *msb =
+      fahe1_decrypt_stream_new(key, FAHE_STREAM_MSB_FIRST);
+  fahe_decrypt_stream *lsb =
+      fahe1_decrypt_stream_new(key, FAHE_STREAM_LSB_FIRST);
+
+  // Chunks split limbs and blocks anywhere, and may be empty
+  size_t chunks[] = {1, 7, 64, 255, 256, 257, 1000, 100000};
+  BIGNUM *sum = BN_new();
+  BIGNUM *ciphertext = BN_new();
+  BIGNUM *decrypted = BN_new();
+  BN_zero(sum);
+  for (int i = 0; i < 16; i++) {
+    BIGNUM *message = generate_big_message(fahe1_instance->msg_size);
+    fahe1_encrypt_ctx(enc_ctx, message, ciphertext);
+    BN_add(sum, sum, ciphertext);
+    BIGNUM *expected = fahe1_decrypt(key->p, key->m_max, key->rho,
+                                     key->alpha, sum);
+
+    // Big-endian bytes, and little-endian ones padded with zero limbs as in
+    // a batch row
+    int len = BN_num_bytes(sum);
+    int padded = 8 * (FAHE_LIMBS(BN_num_bits(sum)) + 2);
+    unsigned char *be = malloc(len);
+    unsigned char *le = malloc(padded);
+    BN_bn2bin(sum, be);
+    BN_bn2lebinpad(sum, le, padded);
+
+    size_t chunk = chunks[i % 8];
+    for (int order = 0; order < 2; order++) {
+      fahe_decrypt_stream *stream = order ? lsb : msb;
+      unsigned char *bytes = order ? le : be;
+      size_t total = order ? (size_t)padded : (size_t)len;
+      for (size_t off = 0; off < total;) {
+        size_t n = chunk < total - off ? chunk : total - off;
+        cr_assert(fahe_decrypt_stream_update(stream, bytes + off, 0));
+        cr_assert(fahe_decrypt_stream_update(stream, bytes + off, n));
+        off += n;
+      }
+      cr_assert_eq(stream->total_bytes, total);
+      cr_assert_eq(fahe_decrypt_stream_final(stream, decrypted), decrypted);
+      cr_assert(BN_cmp(expected, decrypted) == 0,
+                "Mismatch after %d sums, order %d, chunk %zu", i, order, chunk);
+    }
+    free(be);
+    free(le);
+    BN_free(expected);
+    BN_free(message);
+  }
+
+  // From a file descriptor, after a reset drops a partial ciphertext
+  char path[] = "/tmp/fahe1_streamXXXXXX";
+  int fd = mkstemp(path);
+  cr_assert(fd >= 0);
+  int len = BN_num_bytes(sum);
+  unsigned char *be = malloc(len);
+  BN_bn2bin(sum, be);
+  cr_assert_eq(write(fd, be, len), len);
+  cr_assert_eq(lseek(fd, 0, SEEK_SET), 0);
+  cr_assert(fahe_decrypt_stream_update(msb, be, 100));
+  fahe_decrypt_stream_reset(msb);
+  BIGNUM *m = fahe_decrypt_stream_fd(msb, fd, NULL);
+  cr_assert_not_null(m);
+  BIGNUM *expected = fahe1_decrypt(key->p, key->m_max, key->rho, key->alpha,
+                                   sum);
+  cr_assert(BN_cmp(expected, m) == 0);
+  close(fd);
+  unlink(path);
+
+  free(be);
+  BN_free(m);
+  BN_free(expected);
+  BN_free(sum);
+  BN_free(ciphertext);
+  BN_free(decrypted);
+  fahe_decrypt_stream_free(msb);
+  fahe_decrypt_stream_free(lsb);
+  fahe1_enc_ctx_free(enc_ctx);
+  fahe1_free(fahe1_instance);
+}
+
+// Draws q < bound through an encryption stream with p = 3 and M = 0
+static void stream_draw_q(fahe_encrypt_stream *stream, BIGNUM *q) {
+  uint64_t zero = 0;
+  size_t len = 8 * stream->c_limbs;
+  unsigned char *bytes = malloc(len);
+  cr_assert(fahe_encrypt_stream_begin(stream, &zero, 1));
+  cr_assert_eq(fahe_encrypt_stream_read(stream, bytes, len), len);
+  cr_assert(BN_lebin2bn(bytes, (int)len, q));
+  BN_div_word(q, 3);
+  free(bytes);
+}
+
+Test(fahe1, fahe1_encrypt_stream_roundtrip) {
+  fahe_params params = {128, 32, 6, 32};
+  fahe1 *fahe1_instance = fahe1_init(&params);
+  fahe1_key *key = &fahe1_instance->key;
+  fahe1_enc_ctx *enc_ctx = fahe1_enc_ctx_new(key);
+  fahe_encrypt_stream *stream = fahe1_encrypt_stream_new(enc_ctx);
+  fahe_decrypt_stream *lsb =
+      fahe1_decrypt_stream_new(key, FAHE_STREAM_LSB_FIRST);
+
+  // Reads split limbs anywhere; the bytes are a row of c_limbs limbs
+  size_t len = 8 * enc_ctx->c_limbs;
+  unsigned char *bytes = malloc(len + 1);
+  size_t chunks[] = {1, 3, 8, 13, 1024, 100000};
+  BIGNUM *c = BN_new();
+  BIGNUM *m = BN_new();
+  for (int i = 0; i < 12; i++) {
+    BIGNUM *message = generate_big_message(fahe1_instance->msg_size);
+    cr_assert(fahe1_encrypt_stream_begin(enc_ctx, stream, message));
+    size_t done = 0;
+    for (size_t got; (got = fahe_encrypt_stream_read(
+                          stream, bytes + done, chunks[i % 6])) > 0;) {
+      cr_assert_neq(got, (size_t)-1);
+      done += got;
+      cr_assert(done <= len);
+    }
+    cr_assert_eq(done, len);
+    cr_assert_eq(fahe_encrypt_stream_read(stream, bytes, 1), 0);
+
+    cr_assert(BN_lebin2bn(bytes, (int)len, c));
+    cr_assert(BN_num_bits(c) <= enc_ctx->gamma_bits);
+    BIGNUM *decrypted = fahe1_decrypt(key->p, key->m_max, key->rho,
+                                      key->alpha, c);
+    cr_assert(BN_cmp(message, decrypted) == 0, "Decryption failed for %d", i);
+    cr_assert(fahe_decrypt_stream_update(lsb, bytes, len));
+    cr_assert_not_null(fahe_decrypt_stream_final(lsb, m));
+    cr_assert(BN_cmp(message, m) == 0);
+    BN_free(decrypted);
+    BN_free(message);
+  }
+
+  // Straight to a file descriptor
+  char path[] = "/tmp/fahe1_encstreamXXXXXX";
+  int fd = mkstemp(path);
+  cr_assert(fd >= 0);
+  BIGNUM *message = generate_big_message(fahe1_instance->msg_size);
+  cr_assert(fahe1_encrypt_stream_begin(enc_ctx, stream, message));
+  cr_assert(fahe_encrypt_stream_fd(stream, fd));
+  cr_assert_eq(lseek(fd, 0, SEEK_SET), 0);
+  cr_assert_eq(fahe_decrypt_stream_fd(lsb, fd, m), m);
+  cr_assert(BN_cmp(message, m) == 0);
+  cr_assert_eq(lseek(fd, 0, SEEK_END), (off_t)len);
+  close(fd);
+  unlink(path);
+  BN_free(message);
+
+  // An RNG that fails, here a cipher that was never keyed: the read that
+  // fails returns the rest of the first block of q, and the stream fails
+  // every read until it is begun again
+  message = generate_big_message(fahe1_instance->msg_size);
+  cr_assert(fahe1_encrypt_stream_begin(enc_ctx, stream, message));
+  cr_assert_eq(fahe_encrypt_stream_read(stream, bytes, 10), 10);
+  EVP_CIPHER_CTX *cipher = stream->rng->cipher;
+  stream->rng->cipher = EVP_CIPHER_CTX_new();
+  cr_assert_eq(fahe_encrypt_stream_read(stream, bytes + 10, len - 10),
+               8 * FAHE_STREAM_BLOCK_LIMBS - 10);
+  cr_assert_eq(fahe_encrypt_stream_read(stream, bytes, len), (size_t)-1);
+  cr_assert_eq(fahe_encrypt_stream_read(stream, bytes, len), (size_t)-1);
+  cr_assert_not(fahe1_encrypt_stream_begin(enc_ctx, stream, message));
+  cr_assert_eq(fahe_encrypt_stream_read(stream, bytes, len), (size_t)-1);
+  EVP_CIPHER_CTX_free(stream->rng->cipher);
+  stream->rng->cipher = cipher;
+  cr_assert(fahe1_encrypt_stream_begin(enc_ctx, stream, message));
+  cr_assert_eq(fahe_encrypt_stream_read(stream, bytes, len + 1), len);
+  cr_assert(BN_lebin2bn(bytes, (int)len, c));
+  BIGNUM *decrypted =
+      fahe1_decrypt(key->p, key->m_max, key->rho, key->alpha, c);
+  cr_assert(BN_cmp(message, decrypted) == 0);
+  BN_free(decrypted);
+  BN_free(message);
+
+  // The top limbs of q: uniform below a one-limb bound, never at or above
+  // a bound whose low limbs are zero, and half of the draws tie the top
+  // limb of 2**64 + 2**64 - 1
+  uint64_t p3 = 3;
+  uint64_t ten = 10;
+  uint64_t low_zero[2] = {0, 1};
+  uint64_t low_max[2] = {~(uint64_t)0, 1};
+  BIGNUM *q = BN_new();
+  int counts[10] = {0};
+  fahe_encrypt_stream *small = fahe_encrypt_stream_new(&p3, 1, &ten, 1);
+  for (int i = 0; i < 5000; i++) {
+    stream_draw_q(small, q);
+    cr_assert(BN_get_word(q) < 10);
+    counts[BN_get_word(q)]++;
+  }
+  for (int v = 0; v < 10; v++) {
+    cr_assert(counts[v] > 350 && counts[v] < 650, "%d drawn %d times", v,
+              counts[v]);
+  }
+  fahe_encrypt_stream_free(small);
+
+  small = fahe_encrypt_stream_new(&p3, 1, low_zero, 2);
+  for (int i = 0; i < 200; i++) {
+    stream_draw_q(small, q);
+    cr_assert(BN_num_bits(q) <= 64);
+  }
+  fahe_encrypt_stream_free(small);
+
+  int ties = 0;
+  small = fahe_encrypt_stream_new(&p3, 1, low_max, 2);
+  for (int i = 0; i < 1000; i++) {
+    stream_draw_q(small, q);
+    cr_assert(BN_num_bits(q) <= 65);
+    ties += BN_num_bits(q) == 65;
+  }
+  cr_assert(ties > 400 && ties < 600, "%d ties", ties);
+  fahe_encrypt_stream_free(small);
+
+  free(bytes);
+  BN_free(q);
+  BN_free(c);
+  BN_free(m);
+  fahe_decrypt_stream_free(lsb);
+  fahe_encrypt_stream_free(stream);
+  fahe1_enc_ctx_free(enc_ctx);
+  fahe1_free(fahe1_instance);
+}
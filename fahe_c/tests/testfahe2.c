@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <time.h>
 
+#include "alloc_track.h"
 #include "fahe2.h"
 #include "helper.h"
 #include "logger.h"
@@ -55,8 +56,7 @@ Test(fahe2, fahe2_analysis_fahe2full) {
     // TIMED ENCRYPTION
     clock_t fahe2_encryption_start_time = clock();
     BIGNUM **ciphertext_list =
-        fahe2_encrypt_list(fahe2_instance->key, msg_list,
-                           BN_get_word(fahe2_instance->num_additions), ctx);
+        fahe2_encrypt_list(fahe2_instance->key, msg_list, list_size, ctx);
     clock_t fahe2_encryption_end_time = clock();
 
     if (!ciphertext_list) {
@@ -117,4 +117,345 @@ Test(fahe2, fahe2_analysis_fahe2full) {
   }
   free(msg_list);
   BN_CTX_free(ctx);
-}
\ No newline at end of file
+}
+
+Test(fahe2, fahe2_encrypt_ctx_roundtrip) {
+  fahe_params params = {128, 32, 10, 32};
+  fahe2 *fahe2_instance = fahe2_init(&params);
+  fahe2_enc_ctx *enc_ctx = fahe2_enc_ctx_new(&fahe2_instance->key);
+  cr_assert_not_null(enc_ctx, "fahe2_enc_ctx_new failed");
+  fahe2_dec_ctx *dec_ctx = fahe2_dec_ctx_new(&fahe2_instance->key);
+  cr_assert_not_null(dec_ctx, "fahe2_dec_ctx_new failed");
+
+  // Reuse one ciphertext BIGNUM across messages, as a steady-state caller would
+  BIGNUM *ciphertext = BN_new();
+  for (int i = 0; i < 32; i++) {
+    BIGNUM *message = generate_big_message(fahe2_instance->msg_size);
+    cr_assert_eq(fahe2_encrypt_ctx(enc_ctx, message, ciphertext), ciphertext);
+
+    BIGNUM *decrypted = fahe2_decrypt_ctx(dec_ctx, ciphertext, NULL);
+    cr_assert(BN_cmp(message, decrypted) == 0, "Decryption failed for %d", i);
+    BN_free(message);
+    BN_free(decrypted);
+  }
+
+  BN_free(ciphertext);
+  fahe2_enc_ctx_free(enc_ctx);
+  fahe2_dec_ctx_free(dec_ctx);
+  fahe2_free(fahe2_instance);
+}
+
+Test(fahe2, fahe2_decrypt_ctx_matches_bn_mod) {
+  fahe_params params = {128, 32, 10, 32};
+  fahe2 *fahe2_instance = fahe2_init(&params);
+  fahe2_enc_ctx *enc_ctx = fahe2_enc_ctx_new(&fahe2_instance->key);
+  fahe2_dec_ctx *dec_ctx = fahe2_dec_ctx_new(&fahe2_instance->key);
+  BN_CTX *ctx = BN_CTX_new();
+
+  // Sums of ciphertexts are wider than gamma and exercise every fold width
+  BIGNUM *sum = BN_new();
+  BIGNUM *ciphertext = BN_new();
+  BIGNUM *decrypted = BN_new();
+  BN_zero(sum);
+  for (int i = 0; i < 64; i++) {
+    BIGNUM *message = generate_big_message(fahe2_instance->msg_size);
+    fahe2_encrypt_ctx(enc_ctx, message, ciphertext);
+    BN_add(sum, sum, ciphertext);
+
+    BIGNUM *expected = fahe2_decrypt(fahe2_instance->key, sum, ctx);
+    fahe_reducer_set_method(dec_ctx->reducer, FAHE_REDUCE_FOLD);
+    fahe2_decrypt_ctx(dec_ctx, sum, decrypted);
+    cr_assert(BN_cmp(expected, decrypted) == 0, "Mismatch after %d sums", i);
+    fahe_reducer_set_method(dec_ctx->reducer, FAHE_REDUCE_LIMB_TABLE);
+    fahe2_decrypt_ctx(dec_ctx, sum, decrypted);
+    cr_assert(BN_cmp(expected, decrypted) == 0, "Mismatch after %d sums", i);
+    BN_free(expected);
+    BN_free(message);
+  }
+
+  BN_free(sum);
+  BN_free(ciphertext);
+  BN_free(decrypted);
+  BN_CTX_free(ctx);
+  fahe2_enc_ctx_free(enc_ctx);
+  fahe2_dec_ctx_free(dec_ctx);
+  fahe2_free(fahe2_instance);
+}
+
+Test(fahe2, fahe2_encrypt_pooled_roundtrip) {
+  fahe_params params = {128, 32, 10, 32};
+  fahe2 *fahe2_instance = fahe2_init(&params);
+  fahe2_enc_ctx *enc_ctx = fahe2_enc_ctx_new(&fahe2_instance->key);
+  fahe2_dec_ctx *dec_ctx = fahe2_dec_ctx_new(&fahe2_instance->key);
+  fahe_pool *pool =
+      fahe_pool_new(fahe2_instance->key.p, fahe2_instance->key.X, 4, 1);
+  fahe_pool_prefill(pool);
+
+  BIGNUM *ciphertext = BN_new();
+  for (int i = 0; i < 16; i++) {
+    BIGNUM *message = generate_big_message(fahe2_instance->msg_size);
+    cr_assert_eq(fahe2_encrypt_pooled(enc_ctx, pool, message, ciphertext),
+                 ciphertext);
+    BIGNUM *decrypted = fahe2_decrypt_ctx(dec_ctx, ciphertext, NULL);
+    cr_assert(BN_cmp(message, decrypted) == 0, "Decryption failed for %d", i);
+    BN_free(message);
+    BN_free(decrypted);
+  }
+
+  fahe_pool_stats stats;
+  fahe_pool_get_stats(pool, &stats);
+  cr_assert_eq(stats.hits + stats.misses, 16);
+  cr_assert(stats.hits >= 4);
+
+  BN_free(ciphertext);
+  fahe_pool_free(pool);
+  fahe2_enc_ctx_free(enc_ctx);
+  fahe2_dec_ctx_free(dec_ctx);
+  fahe2_free(fahe2_instance);
+}
+
+Test(fahe2, fahe2_list_parallel_roundtrip) {
+  fahe_params params = {128, 32, 10, 32};
+  fahe2 *fahe2_instance = fahe2_init(&params);
+  size_t list_size = 100;
+
+  BIGNUM **messages = malloc(list_size * sizeof(BIGNUM *));
+  for (size_t i = 0; i < list_size; i++) {
+    messages[i] = generate_big_message(fahe2_instance->msg_size);
+  }
+
+  // A private pool with more threads than this machine may have, then the
+  // shared pool
+  fahe_thread_pool *pool = fahe_thread_pool_new(3);
+  fahe_thread_pool *pools[] = {pool, NULL};
+  for (int k = 0; k < 2; k++) {
+    BIGNUM **ciphertexts = fahe2_encrypt_list_parallel(
+        &fahe2_instance->key, messages, list_size, pools[k]);
+    BIGNUM **decrypted = fahe2_decrypt_list_parallel(
+        &fahe2_instance->key, ciphertexts, list_size, pools[k]);
+    for (size_t i = 0; i < list_size; i++) {
+      cr_assert(BN_cmp(messages[i], decrypted[i]) == 0,
+                "Decryption failed for %zu", i);
+      BN_free(ciphertexts[i]);
+      BN_free(decrypted[i]);
+    }
+    free(ciphertexts);
+    free(decrypted);
+  }
+
+  for (size_t i = 0; i < list_size; i++) {
+    BN_free(messages[i]);
+  }
+  free(messages);
+  fahe_thread_pool_free(pool);
+  fahe2_free(fahe2_instance);
+}
+
+Test(fahe2, fahe2_batch_roundtrip) {
+  fahe_params params = {128, 32, 10, 32};
+  fahe2 *fahe2_instance = fahe2_init(&params);
+  fahe2_enc_ctx *enc_ctx = fahe2_enc_ctx_new(&fahe2_instance->key);
+  size_t list_size = 64;
+
+  BIGNUM **messages = malloc(list_size * sizeof(BIGNUM *));
+  for (size_t i = 0; i < list_size; i++) {
+    messages[i] = generate_big_message(fahe2_instance->msg_size);
+  }
+
+  fahe_ct_batch *batch = fahe_ct_batch_new(enc_ctx->c_limbs, list_size, 0);
+  cr_assert(fahe2_encrypt_batch(&fahe2_instance->key, messages, list_size,
+                                batch, NULL));
+  BIGNUM **decrypted =
+      fahe2_decrypt_batch(&fahe2_instance->key, batch, NULL);
+  for (size_t i = 0; i < list_size; i++) {
+    cr_assert(BN_cmp(messages[i], decrypted[i]) == 0,
+              "Decryption failed for %zu", i);
+  }
+
+  // Rows narrower than a ciphertext are refused
+  fahe_ct_batch *narrow = fahe_ct_batch_new(1, list_size, 0);
+  cr_assert(!fahe2_encrypt_batch(&fahe2_instance->key, messages, list_size,
+                                 narrow, NULL));
+  cr_assert_eq(narrow->count, 0);
+
+  for (size_t i = 0; i < list_size; i++) {
+    BN_free(messages[i]);
+    BN_free(decrypted[i]);
+  }
+
+  free(messages);
+  free(decrypted);
+  fahe_ct_batch_free(batch);
+  fahe_ct_batch_free(narrow);
+  fahe2_enc_ctx_free(enc_ctx);
+  fahe2_free(fahe2_instance);
+}
+
+Test(fahe2, fahe2_decrypt_stream_matches_decrypt) {
+  fahe_params params = {128, 32, 10, 32};
+  fahe2 *fahe2_instance = fahe2_init(&params);
+  fahe2_enc_ctx *enc_ctx = fahe2_enc_ctx_new(&fahe2_instance->key);
+  fahe_decrypt_stream *stream =
+      fahe2_decrypt_stream_new(&fahe2_instance->key, FAHE_STREAM_MSB_FIRST);
+  BN_CTX *ctx = BN_CTX_new();
+
+  // The shift by pos + alpha, on sums fed in chunks of odd sizes
+  BIGNUM *sum = BN_new();
+  BIGNUM *ciphertext = BN_new();
+  BIGNUM *decrypted = BN_new();
+  BN_zero(sum);
+  for (int i = 0; i < 8; i++) {
+    BIGNUM *message = generate_big_message(fahe2_instance->msg_size);
+    fahe2_encrypt_ctx(enc_ctx, message, ciphertext);
+    BN_add(sum, sum, ciphertext);
+    BIGNUM *expected = fahe2_decrypt(fahe2_instance->key, sum, ctx);
+
+    int len = BN_num_bytes(sum);
+    unsigned char *bytes = malloc(len);
+    BN_bn2bin(sum, bytes);
+    size_t chunk = 1 + 333 * i;
+    for (size_t off = 0; off < (size_t)len; off += chunk) {
+      size_t n = chunk < len - off ? chunk : len - off;
+      cr_assert(fahe_decrypt_stream_update(stream, bytes + off, n));
+    }
+    cr_assert_not_null(fahe_decrypt_stream_final(stream, decrypted));
+    cr_assert(BN_cmp(expected, decrypted) == 0, "Mismatch after %d sums", i);
+    free(bytes);
+    BN_free(expected);
+    BN_free(message);
+  }
+
+  BN_free(sum);
+  BN_free(ciphertext);
+  BN_free(decrypted);
+  BN_CTX_free(ctx);
+  fahe_decrypt_stream_free(stream);
+  fahe2_enc_ctx_free(enc_ctx);
+  fahe2_free(fahe2_instance);
+}
+
+Test(fahe2, fahe2_encrypt_stream_roundtrip) {
+  fahe_params params = {128, 32, 10, 32};
+  fahe2 *fahe2_instance = fahe2_init(&params);
+  fahe2_enc_ctx *enc_ctx = fahe2_enc_ctx_new(&fahe2_instance->key);
+  fahe_encrypt_stream *stream = fahe2_encrypt_stream_new(enc_ctx);
+  BN_CTX *ctx = BN_CTX_new();
+
+  // Rows read in chunks of odd sizes decrypt like fahe2_encrypt_ctx output
+  size_t len = 8 * enc_ctx->c_limbs;
+  unsigned char *bytes = malloc(len);
+  BIGNUM *ciphertext = BN_new();
+  for (int i = 0; i < 8; i++) {
+    BIGNUM *message = generate_big_message(fahe2_instance->msg_size);
+    cr_assert(fahe2_encrypt_stream_begin(enc_ctx, stream, message));
+    size_t chunk = 1 + 333 * i;
+    size_t done = 0;
+    for (size_t got; (got = fahe_encrypt_stream_read(stream, bytes + done,
+                                                      chunk)) > 0;) {
+      cr_assert_neq(got, (size_t)-1);
+      done += got;
+    }
+    cr_assert_eq(done, len);
+    cr_assert(BN_lebin2bn(bytes, (int)len, ciphertext));
+    BIGNUM *decrypted = fahe2_decrypt(fahe2_instance->key, ciphertext, ctx);
+    cr_assert(BN_cmp(message, decrypted) == 0, "Decryption failed for %d", i);
+    BN_free(decrypted);
+    BN_free(message);
+  }
+
+  free(bytes);
+  BN_free(ciphertext);
+  BN_CTX_free(ctx);
+  fahe_encrypt_stream_free(stream);
+  fahe2_enc_ctx_free(enc_ctx);
+  fahe2_free(fahe2_instance);
+}
+
+Test(fahe2, fahe2_steady_state_allocations) {
+  // OpenSSL accepts the counting allocator only before its first allocation,
+  // which holds in the forked process of a test
+  if (!fahe_alloc_track_install()) {
+    cr_skip_test("OpenSSL allocated before the tracker was installed\n");
+  }
+  fahe_params params = {128, 32, 10, 32};
+  fahe2 *fahe2_instance = fahe2_init(&params);
+  fahe2_enc_ctx *enc_ctx = fahe2_enc_ctx_new(&fahe2_instance->key);
+  fahe2_dec_ctx *dec_ctx = fahe2_dec_ctx_new(&fahe2_instance->key);
+  BIGNUM *ciphertext = BN_new();
+  BIGNUM *decrypted = BN_new();
+  int n = 16;
+  BIGNUM *messages[16];
+  for (int i = 0; i < n; i++) {
+    messages[i] = generate_big_message(fahe2_instance->msg_size);
+  }
+
+  // The first rounds size the scratch values; after them nothing allocates
+  fahe_alloc_stats before, after, diff;
+  const char *labels[2] = {"encrypt", "decrypt"};
+  for (int round = 0; round < 3; round++) {
+    for (int op = 0; op < 2; op++) {
+      fahe_alloc_snapshot(&before);
+      for (int i = 0; i < n; i++) {
+        if (op == 0) {
+          fahe2_encrypt_ctx(enc_ctx, messages[i], ciphertext);
+        } else {
+          fahe2_decrypt_ctx(dec_ctx, ciphertext, decrypted);
+        }
+      }
+      fahe_alloc_snapshot(&after);
+      fahe_alloc_diff(&diff, &before, &after);
+      if (round == 2) {
+        fahe_alloc_print(labels[op], &diff, n, stdout);
+        cr_assert_eq(fahe_alloc_count(&diff), 0,
+                     "%s allocated in steady state\n", labels[op]);
+      }
+    }
+    cr_assert(BN_cmp(messages[n - 1], decrypted) == 0);
+  }
+
+  // The allocating API, fahe2_encrypt's rand_bits_below temporary included,
+  // frees everything it allocates. Round 0 creates the calling thread's
+  // random engine, which lives until the thread exits.
+  fahe2_key key = fahe2_instance->key;
+  BN_CTX *ctx = BN_CTX_new();
+  for (int i = -1; i < n; i++) {
+    if (i == 0) {
+      fahe_alloc_snapshot(&before);
+    }
+    BIGNUM *message = messages[i < 0 ? 0 : i];
+    BIGNUM *c = fahe2_encrypt(key, message, ctx);
+    BIGNUM *m = fahe2_decrypt(key, c, ctx);
+    cr_assert(BN_cmp(message, m) == 0);
+    BN_free(c);
+    BN_free(m);
+  }
+  BIGNUM **ciphertexts = fahe2_encrypt_list(key, messages, n, ctx);
+  BIGNUM *bn_n = BN_new();
+  BN_set_word(bn_n, n);
+  BIGNUM **decrypted_list = fahe2_decrypt_list(key, ciphertexts, bn_n, ctx);
+  for (int i = 0; i < n; i++) {
+    cr_assert(BN_cmp(messages[i], decrypted_list[i]) == 0);
+    BN_free(ciphertexts[i]);
+    BN_free(decrypted_list[i]);
+  }
+  free(ciphertexts);
+  free(decrypted_list);
+  BN_free(bn_n);
+  fahe_alloc_snapshot(&after);
+  fahe_alloc_diff(&diff, &before, &after);
+  fahe_alloc_print("legacy", &diff, n, stdout);
+  for (int s = 0; s < FAHE_ALLOC_SOURCE_COUNT; s++) {
+    cr_assert_eq(diff.sources[s].allocs, diff.sources[s].frees);
+    cr_assert_eq(diff.sources[s].bytes, diff.sources[s].freed_bytes);
+  }
+
+  for (int i = 0; i < n; i++) {
+    BN_free(messages[i]);
+  }
+  BN_CTX_free(ctx);
+  BN_free(ciphertext);
+  BN_free(decrypted);
+  fahe2_dec_ctx_free(dec_ctx);
+  fahe2_enc_ctx_free(enc_ctx);
+  fahe2_free(fahe2_instance);
+}
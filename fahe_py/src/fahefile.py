@@ -0,0 +1,93 @@
+"""Reader for the FAHE binary file format written by fahe_c (src/fahefile.h).
+
+A file is a header followed by count fixed-width records of row_limbs
+little-endian 64-bit limbs. FaheFile maps the file and decodes records only
+when they are asked for; row_view returns a record without copying it.
+"""
+
+import mmap
+import struct
+
+FILE_MAGIC = b"FAHEFILE"
+LEGACY_MAGIC = b"FAHECTB1"
+FILE_VERSION = 1
+CIPHERTEXTS = 0
+MESSAGES = 1
+
+# magic, version, header_bytes, kind, scheme, lambda, m_max, alpha,
+# reserved, gamma, count, row_limbs, fingerprint
+_HEADER = struct.Struct("<8sIIIIiiiIQQQ32s")
+_LEGACY_HEADER = struct.Struct("<8sQQ")
+
+
+class FaheFile:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        try:
+            self._read_header()
+        except ValueError:
+            self._map.close()
+            raise
+
+    def _read_header(self):
+        magic = self._map[:8]
+        if magic == FILE_MAGIC and len(self._map) >= 128:
+            (_, self.version, self.header_bytes, self.kind, self.scheme,
+             self.lambda_param, self.m_max, self.alpha, _, self.gamma,
+             self.count, self.row_limbs,
+             self.fingerprint) = _HEADER.unpack_from(self._map)
+            if not 1 <= self.version <= FILE_VERSION:
+                raise ValueError(f"unsupported version {self.version}")
+            if self.header_bytes < 128 or self.header_bytes % 8:
+                raise ValueError(f"invalid header size {self.header_bytes}")
+            if self.kind not in (CIPHERTEXTS, MESSAGES):
+                raise ValueError("invalid header")
+        elif magic == LEGACY_MAGIC and len(self._map) >= 24:
+            _, self.row_limbs, self.count = _LEGACY_HEADER.unpack_from(
+                self._map)
+            self.version = 0
+            self.header_bytes = 24
+            self.kind = CIPHERTEXTS
+            self.scheme = self.lambda_param = self.m_max = self.alpha = 0
+            self.gamma = 0
+            self.fingerprint = bytes(32)
+        else:
+            raise ValueError("not a FAHE file")
+
+        if self.row_limbs == 0:
+            raise ValueError("records need at least one limb")
+        if len(self._map) < self.header_bytes + self.count * self.row_bytes:
+            raise ValueError(f"file is shorter than its {self.count} records")
+
+    @property
+    def row_bytes(self):
+        return 8 * self.row_limbs
+
+    def row_view(self, i):
+        if not 0 <= i < self.count:
+            raise IndexError(i)
+        start = self.header_bytes + i * self.row_bytes
+        return memoryview(self._map)[start:start + self.row_bytes]
+
+    def __len__(self):
+        return self.count
+
+    def __getitem__(self, i):
+        if i < 0:
+            i += self.count
+        with self.row_view(i) as row:
+            return int.from_bytes(row, "little")
+
+    def __iter__(self):
+        for i in range(self.count):
+            yield self[i]
+
+    def close(self):
+        self._map.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
@@ -0,0 +1,37 @@
+import shutil
+import struct
+from pathlib import Path
+
+import pytest
+from fahefile import MESSAGES, FaheFile
+
+# Written by fahe_c with fahe_file_write_list: a messages file of the values
+# below under a FAHE1 (128, 32, 6) header, records as wide as the largest.
+C_MESSAGES = Path(__file__).parent / "data" / "messages.fahe"
+C_VALUES = [0, 1, 2**64 - 1, 2**64, 2**100 + 12345]
+
+
+def test_reads_c_written_file():
+    with FaheFile(C_MESSAGES) as f:
+        assert f.version == 1
+        assert f.header_bytes == 128
+        assert f.kind == MESSAGES
+        assert (f.scheme, f.lambda_param, f.m_max, f.alpha) == (1, 128, 32, 6)
+        assert f.row_limbs == 2
+        assert len(f) == len(C_VALUES)
+        assert list(f) == C_VALUES
+        assert f[-1] == C_VALUES[-1]
+        with f.row_view(2) as row:
+            assert bytes(row) == (2**64 - 1).to_bytes(16, "little")
+        with pytest.raises(IndexError):
+            f.row_view(len(C_VALUES))
+
+
+def test_rejects_unaligned_header(tmp_path):
+    path = tmp_path / "unaligned.fahe"
+    shutil.copy(C_MESSAGES, path)
+    with open(path, "r+b") as f:
+        f.seek(12)
+        f.write(struct.pack("<I", 132))
+    with pytest.raises(ValueError, match="header size"):
+        FaheFile(path)